@@ -0,0 +1,91 @@
+/*
+ * bench_conflicts.c
+ *
+ * Times finding the overlapping events in a month with conflicts.c,
+ * against comparing every pair of events as a baseline.
+ *
+ * Usage: bench_conflicts [events per day] [runs]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "drivers/conflicts.h"
+#include "common.h"
+
+size_t count_pairs(struct events* events);
+
+int main(int argc, char* argv[]) {
+    int per_day = argc > 1 ? atoi(argv[1]) : 20;
+    int runs = argc > 2 ? atoi(argv[2]) : 100;
+
+    // A busy month: meetings between 8:00 and 18:00 on the quarter hour,
+    // from 15 minutes to 2 hours long
+    struct events events;
+    init_events(&events);
+    srand(42);
+
+    for (int day = 1; day <= 31; day++) {
+        for (int i = 0; i < per_day; i++) {
+            struct event event = {0};
+            event.year = 2026;
+            event.month = 3;
+            event.day = day;
+            event.hour = 8 + rand() % 10;
+            event.min = rand() % 4 * 15;
+            event.duration = (1 + rand() % 8) * 15;
+            event.summary = strdup("Meeting");
+            append_event(&events, event);
+        }
+    }
+
+    double best_ms = 1e9;
+    size_t num_conflicts = 0;
+    for (int i = 0; i < runs; i++) {
+        double start = now_ms();
+        struct conflict* conflicts;
+        num_conflicts = find_conflicts(&events, &conflicts);
+        double elapsed = now_ms() - start;
+
+        free(conflicts);
+        if (elapsed < best_ms) best_ms = elapsed;
+    }
+
+    double start = now_ms();
+    size_t num_pairs = count_pairs(&events);
+    double pairs_ms = now_ms() - start;
+
+    printf("%zu events in a month, %zu conflicts\n", events.length, num_conflicts);
+    printf("%-28s %10.3f ms (best of %d)\n", "find_conflicts", best_ms, runs);
+    printf("%-28s %10.3f ms\n", "every pair (baseline)", pairs_ms);
+
+    if (num_pairs != num_conflicts) {
+        printf("mismatch: the baseline found %zu conflicts\n", num_pairs);
+        return 1;
+    }
+
+    free_events(events);
+    return 0;
+}
+
+/*
+ * Counts the overlapping pairs the slow way. Every event is on the same
+ * month, so the day is enough to place it.
+ */
+size_t count_pairs(struct events* events) {
+    size_t count = 0;
+
+    for (size_t i = 0; i < events->length; i++) {
+        struct event* a = &events->events[i];
+        long a_start = a->day * 1440 + a->hour * 60 + a->min;
+
+        for (size_t j = i + 1; j < events->length; j++) {
+            struct event* b = &events->events[j];
+            long b_start = b->day * 1440 + b->hour * 60 + b->min;
+
+            if (a_start < b_start + b->duration && b_start < a_start + a->duration) count++;
+        }
+    }
+
+    return count;
+}
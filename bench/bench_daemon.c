@@ -0,0 +1,153 @@
+/*
+ * bench_daemon.c
+ *
+ * Times reading days from a calendar.txt directly against reading them
+ * through calenterd, forked here on a temporary home. A cold read opens
+ * the calendar, reads a day and closes it, which is what every command or
+ * status bar script pays; warm reads are random days from a calendar
+ * that stays open, as the TUI makes. Both ways have to find the same
+ * events.
+ *
+ * Usage: bench_daemon [years] [events per day] [runs]
+ */
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "drivers/daemon.h"
+#include "drivers/storage.h"
+#include "drivers/skeleton.h"
+#include "common.h"
+
+#define FIRST_YEAR 2010
+#define LOOKUPS 20000
+
+int open_calendar(struct storage* storage, bool through_daemon, const char* path);
+long read_random_days(struct storage* storage, long first_day, long num_days);
+
+int main(int argc, char* argv[]) {
+    int years = argc > 1 ? atoi(argv[1]) : 20;
+    int events_per_day = argc > 2 ? atoi(argv[2]) : 4;
+    int runs = argc > 3 ? atoi(argv[3]) : 50;
+
+    if (years < 1 || events_per_day < 0 || runs < 1) {
+        printf("Usage: %s [years] [events per day] [runs]\n", argv[0]);
+        return 1;
+    }
+
+    char home[] = "/tmp/calenter-bench-XXXXXX";
+    if (make_bench_home(home) != 0) return 1;
+
+    char path[256];
+    snprintf(path, sizeof(path), "%s/.calendar/calendar.txt", home);
+
+    long first_day = days_from_date_key(DATE_KEY(FIRST_YEAR, 1, 1));
+    long num_days = days_from_date_key(DATE_KEY(FIRST_YEAR + years - 1, 12, 31)) - first_day + 1;
+
+    struct day_update* updates = make_bench_days(first_day, num_days, events_per_day);
+    int written = write_bench_days(path, &calendartxt_driver, updates, num_days);
+    free_bench_days(updates, num_days);
+
+    if (written != 0) {
+        printf("Failed to write %s\n", path);
+        return 1;
+    }
+
+    char* socket_path = get_daemon_socket_path();
+    pid_t daemon = fork();
+    if (daemon == 0) {
+        fclose(stdout);
+        _exit(run_daemon(socket_path) == 0 ? 0 : 1);
+    }
+
+    // Wait for the daemon to listen
+    struct storage storage;
+    for (int i = 0; i < 200 && open_daemon_storage(&storage, &calendartxt_driver, path) != 0; i++) {
+        usleep(10000);
+    }
+    if (!is_daemon_connected()) {
+        printf("The daemon didn't start\n");
+        kill(daemon, SIGTERM);
+        return 1;
+    }
+    close_storage(&storage);
+
+    int today = DATE_KEY(FIRST_YEAR + years / 2, 6, 15);
+
+    const char* names[2] = {"direct", "daemon"};
+    double cold_ms[2], warm_ms[2];
+    long found[2];
+
+    for (int pass = 0; pass < 2; pass++) {
+        cold_ms[pass] = 1e9;
+
+        for (int i = 0; i < runs; i++) {
+            double start = now_ms();
+            if (open_calendar(&storage, pass == 1, path) != 0) return 1;
+
+            struct events events = storage.driver->get_day(storage.handle, today / 10000, today / 100 % 100, today % 100);
+            free_events(events);
+            close_storage(&storage);
+
+            double elapsed = now_ms() - start;
+            if (elapsed < cold_ms[pass]) cold_ms[pass] = elapsed;
+        }
+
+        if (open_calendar(&storage, pass == 1, path) != 0) return 1;
+
+        // The first read builds the offset index or loads the daemon's copy
+        found[pass] = read_random_days(&storage, first_day, 1);
+
+        double start = now_ms();
+        found[pass] = read_random_days(&storage, first_day, num_days);
+        warm_ms[pass] = now_ms() - start;
+
+        close_storage(&storage);
+    }
+
+    kill(daemon, SIGTERM);
+    waitpid(daemon, NULL, 0);
+
+    printf("%d years, %d events/day\n", years, events_per_day);
+    printf("%-8s %12s %16s\n", "", "cold (ms)", "get_day (us/op)");
+    for (int pass = 0; pass < 2; pass++) {
+        printf("%-8s %12.3f %16.2f\n", names[pass], cold_ms[pass], warm_ms[pass] * 1000 / LOOKUPS);
+    }
+
+    remove_bench_dir(home);
+    free(socket_path);
+
+    if (found[0] != found[1]) {
+        printf("mismatch: %ld events directly, %ld through the daemon\n", found[0], found[1]);
+        return 1;
+    }
+
+    return 0;
+}
+
+int open_calendar(struct storage* storage, bool through_daemon, const char* path) {
+    if (through_daemon) return open_daemon_storage(storage, &calendartxt_driver, path);
+
+    return open_storage(storage, &calendartxt_driver, path);
+}
+
+/*
+ * Reads LOOKUPS days picked the same way for both passes and returns how
+ * many events they had.
+ */
+long read_random_days(struct storage* storage, long first_day, long num_days) {
+    srand(42);
+
+    long found = 0;
+    for (int i = 0; i < LOOKUPS; i++) {
+        int key = date_key_from_days(first_day + rand() % num_days);
+        struct events events = storage->driver->get_day(storage->handle, key / 10000, key / 100 % 100, key % 100);
+        found += events.length;
+        free_events(events);
+    }
+
+    return found;
+}
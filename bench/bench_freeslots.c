@@ -0,0 +1,141 @@
+/*
+ * bench_freeslots.c
+ *
+ * Times finding free slots over a long horizon with the minute bitmaps in
+ * freeslots.c, against a baseline that keeps one byte per minute and
+ * tests every minute. The events are made up in memory so only the search
+ * is timed, not reading the calendars.
+ *
+ * Usage: bench_freeslots [days] [calendars] [runs]
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "drivers/freeslots.h"
+#include "drivers/skeleton.h"
+#include "common.h"
+
+#define FIRST_KEY 20260101
+#define SLOT_LENGTH 45
+
+size_t find_slots_bytes(struct events* events, int num_days, struct free_slot* slots);
+
+int main(int argc, char* argv[]) {
+    int num_days = argc > 1 ? atoi(argv[1]) : 365;
+    int num_calendars = argc > 2 ? atoi(argv[2]) : 3;
+    int runs = argc > 3 ? atoi(argv[3]) : 20;
+
+    // Busy calendars: half hour and hour meetings on the half hour from
+    // 8:00 to 18:00, so a 45 minute gap inside 9:00-17:00 is rare
+    struct events events;
+    init_events(&events);
+    srand(42);
+
+    long first_day = days_from_date_key(FIRST_KEY);
+    for (int day = 0; day < num_days; day++) {
+        int key = date_key_from_days(first_day + day);
+
+        for (int calendar = 0; calendar < num_calendars; calendar++) {
+            for (int slot = 16; slot < 36; slot++) {
+                if (rand() % 3 != 0) continue;
+
+                struct event event = {0};
+                event.year = key / 10000;
+                event.month = key / 100 % 100;
+                event.day = key % 100;
+                event.hour = slot / 2;
+                event.min = slot % 2 * 30;
+                event.duration = (1 + rand() % 2) * 30;
+                event.source = calendar;
+                event.summary = strdup("Meeting");
+                append_event(&events, event);
+            }
+        }
+    }
+
+    struct day_bitmap window = {0};
+    mark_minutes(&window, DEFAULT_WORK_START, DEFAULT_WORK_END);
+    struct day_bitmap* busy = malloc(num_days * sizeof(struct day_bitmap));
+
+    // Asks for more slots than there are so the whole horizon is searched
+    size_t max_slots = (size_t)num_days * MINUTES_PER_DAY;
+    struct free_slot* slots = malloc(max_slots * sizeof(struct free_slot));
+    struct free_slot* baseline_slots = malloc(max_slots * sizeof(struct free_slot));
+
+    double best_ms = 1e9;
+    size_t num_slots = 0;
+    for (int i = 0; i < runs; i++) {
+        double start = now_ms();
+        memset(busy, 0, num_days * sizeof(struct day_bitmap));
+        mark_events(busy, FIRST_KEY, num_days, &events);
+        num_slots = scan_free_slots(busy, &window, FIRST_KEY, num_days, SLOT_LENGTH, slots, max_slots);
+        double elapsed = now_ms() - start;
+
+        if (elapsed < best_ms) best_ms = elapsed;
+    }
+
+    double start = now_ms();
+    size_t num_baseline = find_slots_bytes(&events, num_days, baseline_slots);
+    double baseline_ms = now_ms() - start;
+
+    printf("%zu events over %d days in %d calendars, %zu gaps of %d minutes\n",
+        events.length, num_days, num_calendars, num_slots, SLOT_LENGTH);
+    printf("%-28s %10.3f ms (best of %d)\n", "minute bitmaps", best_ms, runs);
+    printf("%-28s %10.3f ms\n", "minute by minute (baseline)", baseline_ms);
+
+    int status = 0;
+    if (num_baseline != num_slots || memcmp(slots, baseline_slots, num_slots * sizeof(struct free_slot)) != 0) {
+        printf("mismatch: the baseline found %zu gaps\n", num_baseline);
+        status = 1;
+    }
+
+    free(slots);
+    free(baseline_slots);
+    free(busy);
+    free_events(events);
+
+    return status;
+}
+
+/*
+ * Finds the gaps the slow way, with a byte for every minute of the
+ * horizon.
+ */
+size_t find_slots_bytes(struct events* events, int num_days, struct free_slot* slots) {
+    long first_day = days_from_date_key(FIRST_KEY);
+    long total = (long)num_days * MINUTES_PER_DAY;
+    char* taken = calloc(total, 1);
+
+    for (size_t i = 0; i < events->length; i++) {
+        struct event* event = &events->events[i];
+        long day = days_from_date_key(DATE_KEY(event->year, event->month, event->day)) - first_day;
+        long start = day * MINUTES_PER_DAY + event->hour * 60 + event->min;
+
+        for (long minute = start; minute < start + event->duration && minute < total; minute++) {
+            taken[minute] = 1;
+        }
+    }
+
+    size_t num_slots = 0;
+    int key = FIRST_KEY;
+    for (int day = 0; day < num_days; day++) {
+        int run_start = -1;
+
+        for (int minute = DEFAULT_WORK_START; minute <= DEFAULT_WORK_END; minute++) {
+            bool is_free = minute < DEFAULT_WORK_END && !taken[(long)day * MINUTES_PER_DAY + minute];
+
+            if (is_free && run_start < 0) run_start = minute;
+            if (!is_free && run_start >= 0) {
+                if (minute - run_start >= SLOT_LENGTH) slots[num_slots++] = (struct free_slot){key, run_start, minute};
+                run_start = -1;
+            }
+        }
+
+        key = next_date_key(key);
+    }
+
+    free(taken);
+    return num_slots;
+}
@@ -0,0 +1,148 @@
+/*
+ * bench_ics.c
+ *
+ * Times parsing a generated ICS feed in one pass with parse_ics_file and
+ * on 1 to MAX_PARSE_THREADS threads with parse_ics_file_parallel. The
+ * callback only checksums the events, so the time is the parsing itself,
+ * and every run has to see the same events in the same order as the
+ * single pass.
+ *
+ * Usage: bench_ics [events] [runs]
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "drivers/calendartxt.h"
+#include "drivers/ics.h"
+#include "common.h"
+
+/*
+ * What the callback has seen so far.
+ */
+struct checksum {
+    long events;
+    uint64_t hash;
+};
+
+void write_feed(FILE* feed, long num_events);
+int checksum_event(struct ics_event* event, void* data);
+uint64_t hash_text(uint64_t hash, const char* text);
+
+int main(int argc, char* argv[]) {
+    long num_events = argc > 1 ? atol(argv[1]) : 100000;
+    int runs = argc > 2 ? atoi(argv[2]) : 5;
+
+    char path[] = "/tmp/bench_ics_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        perror("mkstemp");
+        return 1;
+    }
+
+    FILE* feed = fdopen(fd, "w");
+    write_feed(feed, num_events);
+    long size = ftell(feed);
+    fclose(feed);
+
+    printf("%ld events, %.1f MB, %ld cores online\n", num_events, size / 1e6, sysconf(_SC_NPROCESSORS_ONLN));
+
+    struct checksum expected = {0};
+    double best_ms = 1e9;
+    for (int i = 0; i < runs; i++) {
+        expected = (struct checksum){0};
+        double start = now_ms();
+        parse_ics_file(path, checksum_event, &expected);
+        double elapsed = now_ms() - start;
+        if (elapsed < best_ms) best_ms = elapsed;
+    }
+
+    double single_ms = best_ms;
+    printf("%-12s %10.2f ms %8.1f MB/s\n", "one pass", single_ms, size / 1e3 / single_ms);
+
+    int status = 0;
+    for (int threads = 1; threads <= MAX_PARSE_THREADS; threads *= 2) {
+        struct checksum seen = {0};
+        best_ms = 1e9;
+
+        for (int i = 0; i < runs; i++) {
+            seen = (struct checksum){0};
+            double start = now_ms();
+            parse_ics_file_parallel(path, threads, checksum_event, &seen);
+            double elapsed = now_ms() - start;
+            if (elapsed < best_ms) best_ms = elapsed;
+        }
+
+        char label[32];
+        snprintf(label, sizeof(label), "%d thread%s", threads, threads == 1 ? "" : "s");
+        printf("%-12s %10.2f ms %8.1f MB/s %6.2fx\n", label, best_ms, size / 1e3 / best_ms, single_ms / best_ms);
+
+        if (seen.events != expected.events || seen.hash != expected.hash) {
+            printf("mismatch: %ld events instead of %ld, or in a different order\n", seen.events, expected.events);
+            status = 1;
+        }
+    }
+
+    unlink(path);
+    return status;
+}
+
+/*
+ * Writes a feed shaped like an exported Google calendar: a time zone
+ * definition, then events with long folded descriptions, alarms and the
+ * odd repeat rule.
+ */
+void write_feed(FILE* feed, long num_events) {
+    fprintf(feed, "BEGIN:VCALENDAR\r\nVERSION:2.0\r\nPRODID:-//bench//calenter//EN\r\n");
+    fprintf(feed, "BEGIN:VTIMEZONE\r\nTZID:Europe/Paris\r\nBEGIN:STANDARD\r\nDTSTART:19701025T030000\r\n");
+    fprintf(feed, "TZOFFSETFROM:+0200\r\nTZOFFSETTO:+0100\r\nEND:STANDARD\r\nEND:VTIMEZONE\r\n");
+
+    srand(42);
+    for (long i = 0; i < num_events; i++) {
+        int year = 2010 + i % 17;
+        int month = 1 + rand() % 12;
+        int day = 1 + rand() % 28;
+        int hour = 7 + rand() % 12;
+
+        fprintf(feed, "BEGIN:VEVENT\r\n");
+        fprintf(feed, "DTSTART;TZID=Europe/Paris:%04d%02d%02dT%02d%02d00\r\n", year, month, day, hour, rand() % 2 * 30);
+        fprintf(feed, "DTEND;TZID=Europe/Paris:%04d%02d%02dT%02d%02d00\r\n", year, month, day, hour + 1, rand() % 2 * 30);
+        fprintf(feed, "UID:%ld-%d@bench.calenter\r\n", i, rand());
+        fprintf(feed, "SUMMARY:Meeting %ld about the quarterly planning\\, budget and the roa\r\n dmap for next year\r\n", i);
+        fprintf(feed, "DESCRIPTION:Agenda: review of last quarter\\, open questions from the team\\, \r\n");
+        fprintf(feed, " hiring plans and anything else that comes up. Dial in details are in th\r\n");
+        fprintf(feed, " e invitation.\\nNotes will be shared afterwards.\r\n");
+        if (i % 10 == 0) fprintf(feed, "RRULE:FREQ=WEEKLY;INTERVAL=2;BYDAY=MO,WE;COUNT=20\r\n");
+        fprintf(feed, "BEGIN:VALARM\r\nACTION:DISPLAY\r\nSUMMARY:Reminder\r\nTRIGGER:-PT10M\r\nEND:VALARM\r\n");
+        fprintf(feed, "END:VEVENT\r\n");
+    }
+
+    fprintf(feed, "END:VCALENDAR\r\n");
+}
+
+/*
+ * An ics_event_callback that folds the event into an order dependent hash.
+ */
+int checksum_event(struct ics_event* event, void* data) {
+    struct checksum* checksum = data;
+
+    checksum->events++;
+    checksum->hash = hash_text(checksum->hash, event->uid);
+    checksum->hash = hash_text(checksum->hash, event->summary);
+    checksum->hash = hash_text(checksum->hash, event->rrule);
+    checksum->hash = checksum->hash * 31 + event->start.year * 10000 + event->start.month * 100 + event->start.day;
+    checksum->hash = checksum->hash * 31 + event->end.hour * 60 + event->end.min;
+
+    return 0;
+}
+
+/*
+ * Folds text into hash, with a missing property changing it as well.
+ */
+uint64_t hash_text(uint64_t hash, const char* text) {
+    if (text == NULL) return hash * 31;
+
+    return hash_bytes(hash, text, strlen(text));
+}
@@ -0,0 +1,192 @@
+/*
+ * bench_reminders.c
+ *
+ * Runs the reminder engine on a generated calendar in a temporary home,
+ * with a stub reminder_command that appends its arguments to a file. It
+ * times reading the window into the heap from scratch against taking in
+ * one added event, checks both reminders are sent, and then counts the
+ * wakeups and CPU time spent idle.
+ *
+ * Usage: bench_reminders [events per day] [idle seconds]
+ */
+
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "drivers/reminders.h"
+#include "drivers/skeleton.h"
+#include "drivers/sources.h"
+#include "drivers/storage.h"
+#include "common.h"
+
+#define LEAD_MINUTES 5
+#define WINDOW_DAYS 30
+
+double cpu_ms();
+int write_calendar(const char* path, int events_per_day, struct tm* soon);
+int wait_for_sent(const char* path, int count);
+
+int main(int argc, char* argv[]) {
+    int events_per_day = argc > 1 ? atoi(argv[1]) : 200;
+    int idle_seconds = argc > 2 ? atoi(argv[2]) : 5;
+
+    if (events_per_day < 1 || idle_seconds < 0) {
+        printf("Usage: %s [events per day] [idle seconds]\n", argv[0]);
+        return 1;
+    }
+
+    char home[] = "/tmp/calenter-bench-XXXXXX";
+    if (make_bench_home(home) != 0) return 1;
+
+    char path[256], sent_path[256];
+    snprintf(sent_path, sizeof(sent_path), "%s/sent", home);
+
+    snprintf(path, sizeof(path), "%s/stub", home);
+    FILE* stub = fopen(path, "w");
+    fprintf(stub, "#!/bin/sh\necho \"$1 at $2\" >> %s\n", sent_path);
+    fclose(stub);
+    chmod(path, 0700);
+
+    char config_path[256];
+    snprintf(config_path, sizeof(config_path), "%s/.config", home);
+    mkdir(config_path, 0700);
+    snprintf(config_path, sizeof(config_path), "%s/.config/calenter", home);
+    mkdir(config_path, 0700);
+    snprintf(config_path, sizeof(config_path), "%s/.config/calenter/config", home);
+
+    FILE* config = fopen(config_path, "w");
+    fprintf(config, "reminders=true\nreminder_minutes=%d\nreminder_command=%s\n", LEAD_MINUTES, path);
+    fclose(config);
+
+    snprintf(path, sizeof(path), "%s/.calendar/calendar.txt", home);
+
+    // An event starting at the next minute, so its reminder is already due
+    time_t soon_time = time(NULL) / 60 * 60 + 60;
+    struct tm soon;
+    localtime_r(&soon_time, &soon);
+
+    if (write_calendar(path, events_per_day, &soon) != 0) {
+        printf("Failed to write %s\n", path);
+        return 1;
+    }
+
+    double start = now_ms();
+    int reminder_fd = start_reminders();
+    double build_ms = now_ms() - start;
+
+    if (reminder_fd < 0 || wait_for_sent(sent_path, 1) != 0) {
+        printf("The reminder for the first event wasn't sent\n");
+        return 1;
+    }
+
+    struct event event = {0};
+    event.hour = soon.tm_hour;
+    event.min = soon.tm_min;
+    event.summary = "Added while running";
+    event.source = get_default_source();
+    add_event(event, soon.tm_year + 1900, soon.tm_mon + 1, soon.tm_mday);
+
+    struct pollfd fd = {.fd = reminder_fd, .events = POLLIN};
+    if (poll(&fd, 1, 2000) != 1) {
+        printf("The added event didn't wake the engine\n");
+        return 1;
+    }
+
+    start = now_ms();
+    handle_reminders();
+    double update_ms = now_ms() - start;
+
+    if (wait_for_sent(sent_path, 2) != 0) {
+        printf("The reminder for the added event wasn't sent\n");
+        return 1;
+    }
+
+    // The calendar write wakes it once more, which changes nothing
+    while (poll(&fd, 1, 100) == 1) {
+        handle_reminders();
+    }
+
+    int wakeups = 0;
+    double cpu_start = cpu_ms();
+    double idle_end = now_ms() + idle_seconds * 1000.0;
+
+    for (double left = idle_end - now_ms(); left > 0; left = idle_end - now_ms()) {
+        if (poll(&fd, 1, left) == 1) {
+            wakeups++;
+            handle_reminders();
+        }
+    }
+    double idle_cpu_ms = cpu_ms() - cpu_start;
+
+    stop_reminders();
+
+    printf("%d events/day, reminders %d minutes ahead\n", events_per_day, LEAD_MINUTES);
+    printf("%-28s %10.3f ms\n", "read window into heap", build_ms);
+    printf("%-28s %10.3f ms\n", "take in an added event", update_ms);
+    printf("%-28s %10d wakeups, %.3f ms CPU in %d s\n", "idle", wakeups, idle_cpu_ms, idle_seconds);
+
+    remove_bench_dir(home);
+
+    return 0;
+}
+
+/*
+ * Writes WINDOW_DAYS days from today, each with events_per_day events
+ * spread over it, plus one event at soon.
+ */
+int write_calendar(const char* path, int events_per_day, struct tm* soon) {
+    time_t raw_time = time(NULL);
+    struct tm today;
+    localtime_r(&raw_time, &today);
+
+    long first_day = days_from_date_key(DATE_KEY(today.tm_year + 1900, today.tm_mon + 1, today.tm_mday));
+    long soon_day = days_from_date_key(DATE_KEY(soon->tm_year + 1900, soon->tm_mon + 1, soon->tm_mday));
+
+    struct day_update* updates = make_bench_days(first_day, WINDOW_DAYS, events_per_day);
+
+    struct event event = {0};
+    event.hour = soon->tm_hour;
+    event.min = soon->tm_min;
+    event.summary = strdup("Starting soon");
+    append_event(&updates[soon_day - first_day].events, event);
+
+    int result = write_bench_days(path, &calendartxt_driver, updates, WINDOW_DAYS);
+    free_bench_days(updates, WINDOW_DAYS);
+
+    return result;
+}
+
+/*
+ * Waits up to two seconds for the stub to have run count times, since the
+ * command isn't waited for. Returns 0 once it has, -1 if it hasn't.
+ */
+int wait_for_sent(const char* path, int count) {
+    for (int attempt = 0; attempt < 200; attempt++) {
+        FILE* sent = fopen(path, "r");
+        int lines = 0;
+
+        if (sent != NULL) {
+            for (int c = fgetc(sent); c != EOF; c = fgetc(sent)) {
+                if (c == '\n') lines++;
+            }
+            fclose(sent);
+        }
+
+        if (lines >= count) return 0;
+        usleep(10000);
+    }
+
+    return -1;
+}
+
+double cpu_ms() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1e3 + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e3;
+}
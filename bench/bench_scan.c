@@ -0,0 +1,125 @@
+/*
+ * bench_scan.c
+ *
+ * Times a full pass over a generated calendar.txt that finds every date
+ * line and its offset, the way refresh_day_offsets builds its cache: once
+ * with the getline and sscanf loop the driver used to make, and once with
+ * scan_date_lines. Both have to find the same lines.
+ *
+ * Usage: bench_scan [years] [events] [runs]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "drivers/scanner.h"
+#include "drivers/skeleton.h"
+#include "common.h"
+
+#define FIRST_YEAR 2007
+
+/*
+ * What a pass found: the number of date lines and a sum of their dates
+ * and offsets to compare the passes by.
+ */
+struct scan_result {
+    long lines;
+    unsigned long long checksum;
+};
+
+void scan_getline(const char* path, struct scan_result* result);
+void scan_block(const char* path, struct scan_result* result);
+int add_line(struct date_line* line, void* data);
+void add_result(struct scan_result* result, int date_key, long offset);
+
+int main(int argc, char* argv[]) {
+    int years = argc > 1 ? atoi(argv[1]) : 20;
+    long num_events = argc > 2 ? atol(argv[2]) : 100000;
+    int runs = argc > 3 ? atoi(argv[3]) : 20;
+
+    char path[] = "/tmp/bench_scan_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        perror("mkstemp");
+        return 1;
+    }
+
+    FILE* out = fdopen(fd, "w");
+    write_bench_calendar(out, FIRST_YEAR, years, num_events);
+    long size = ftell(out);
+    fclose(out);
+
+    printf("%d years, %ld events, %.1f MB\n", years, num_events, size / 1e6);
+
+    void (*passes[2])(const char*, struct scan_result*) = {scan_getline, scan_block};
+    const char* names[2] = {"getline", "scanner"};
+    struct scan_result results[2];
+    double best_ms[2];
+
+    for (int pass = 0; pass < 2; pass++) {
+        best_ms[pass] = 1e9;
+
+        for (int i = 0; i < runs; i++) {
+            memset(&results[pass], 0, sizeof(struct scan_result));
+            double start = now_ms();
+            passes[pass](path, &results[pass]);
+            double elapsed = now_ms() - start;
+            if (elapsed < best_ms[pass]) best_ms[pass] = elapsed;
+        }
+
+        printf("%-8s %10.2f ms %8.2f GB/s %6.2fx %8ld lines\n", names[pass], best_ms[pass], size / 1e6 / best_ms[pass],
+            best_ms[0] / best_ms[pass], results[pass].lines);
+    }
+
+    unlink(path);
+
+    if (results[0].lines != results[1].lines || results[0].checksum != results[1].checksum) {
+        printf("mismatch: the passes found different lines\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * The loop refresh_day_offsets used before the scanner.
+ */
+void scan_getline(const char* path, struct scan_result* result) {
+    FILE* calendar_file = fopen(path, "r");
+    if (calendar_file == NULL) return;
+
+    char* line = NULL;
+    size_t len = 0;
+    int read;
+    long offset = 0;
+
+    while ((read = getline(&line, &len, calendar_file)) > 0) {
+        int year, month, day;
+        if (read >= 10 && sscanf(line, "%4d-%2d-%2d", &year, &month, &day) == 3) {
+            add_result(result, DATE_KEY(year, month, day), offset);
+        }
+        offset += read;
+    }
+
+    free(line);
+    fclose(calendar_file);
+}
+
+void scan_block(const char* path, struct scan_result* result) {
+    struct file_block block;
+    if (open_file_block(path, &block) != 0) return;
+
+    scan_date_lines(&block, 0, add_line, result);
+    close_file_block(&block);
+}
+
+int add_line(struct date_line* line, void* data) {
+    add_result(data, line->date_key, line->offset);
+    return 0;
+}
+
+void add_result(struct scan_result* result, int date_key, long offset) {
+    result->lines++;
+    result->checksum = result->checksum * 31 + date_key + offset;
+}
@@ -0,0 +1,80 @@
+/*
+ * bench_stats.c
+ *
+ * Times collect_file_stats on a generated calendar.txt with 1 to
+ * MAX_STATS_THREADS threads. Every run has to count exactly what the
+ * single thread run counted.
+ *
+ * Usage: bench_stats [years] [events] [runs]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "drivers/skeleton.h"
+#include "drivers/stats.h"
+#include "common.h"
+
+#define FIRST_YEAR 2007
+
+int main(int argc, char* argv[]) {
+    int years = argc > 1 ? atoi(argv[1]) : 20;
+    long num_events = argc > 2 ? atol(argv[2]) : 100000;
+    int runs = argc > 3 ? atoi(argv[3]) : 5;
+
+    char path[] = "/tmp/bench_stats_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        perror("mkstemp");
+        return 1;
+    }
+
+    FILE* out = fdopen(fd, "w");
+    write_bench_calendar(out, FIRST_YEAR, years, num_events);
+    long size = ftell(out);
+    fclose(out);
+
+    printf("%d years, %ld events, %.1f MB, %ld cores online\n", years, num_events, size / 1e6, sysconf(_SC_NPROCESSORS_ONLN));
+
+    struct calendar_stats* expected = calloc(1, sizeof(struct calendar_stats));
+    struct calendar_stats* seen = calloc(1, sizeof(struct calendar_stats));
+    double single_ms = 0;
+    int status = 0;
+
+    for (int threads = 1; threads <= MAX_STATS_THREADS; threads *= 2) {
+        double best_ms = 1e9;
+
+        for (int i = 0; i < runs; i++) {
+            memset(seen, 0, sizeof(struct calendar_stats));
+            double start = now_ms();
+            collect_file_stats(path, threads, seen);
+            double elapsed = now_ms() - start;
+            if (elapsed < best_ms) best_ms = elapsed;
+        }
+
+        if (threads == 1) {
+            memcpy(expected, seen, sizeof(struct calendar_stats));
+            single_ms = best_ms;
+        }
+
+        char label[32];
+        snprintf(label, sizeof(label), "%d thread%s", threads, threads == 1 ? "" : "s");
+        printf("%-12s %10.2f ms %8.1f MB/s %6.2fx\n", label, best_ms, size / 1e3 / best_ms, single_ms / best_ms);
+
+        if (memcmp(seen, expected, sizeof(struct calendar_stats)) != 0) {
+            printf("mismatch: %ld events instead of %ld, or different counts\n", seen->events, expected->events);
+            status = 1;
+        }
+    }
+
+    if (expected->events != num_events) {
+        printf("counted %ld events instead of %ld\n", expected->events, num_events);
+        status = 1;
+    }
+
+    free(expected);
+    free(seen);
+    unlink(path);
+    return status;
+}
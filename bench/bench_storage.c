@@ -0,0 +1,118 @@
+/*
+ * bench_storage.c
+ *
+ * Times the storage backends against the same synthetic calendar.
+ *
+ * Usage: bench_storage <txt|binary> [years] [events per day]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "drivers/storage.h"
+#include "drivers/skeleton.h"
+#include "common.h"
+
+#define FIRST_YEAR 2010
+#define LOOKUPS 20000
+#define EDITS 200
+
+int count_events(int year, int month, int day, struct events* events, void* data);
+int random_date_key(long first_day, long num_days);
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        printf("Usage: %s <txt|binary> [years] [events per day]\n", argv[0]);
+        return 1;
+    }
+
+    const struct storage_driver* driver = get_storage_driver(argv[1]);
+    int years = argc > 2 ? atoi(argv[2]) : 20;
+    int events_per_day = argc > 3 ? atoi(argv[3]) : 4;
+
+    if (driver == NULL || years < 1 || events_per_day < 0) {
+        printf("Usage: %s <txt|binary> [years] [events per day]\n", argv[0]);
+        return 1;
+    }
+
+    char dir[] = "/tmp/calenter-bench-XXXXXX";
+    if (make_bench_dir(dir) != 0) return 1;
+
+    char path[256];
+    snprintf(path, sizeof(path), "%s/calendar.%s", dir, driver == &binary_driver ? "bin" : "txt");
+
+    int first_key = DATE_KEY(FIRST_YEAR, 1, 1);
+    int last_key = DATE_KEY(FIRST_YEAR + years - 1, 12, 31);
+    long first_day = days_from_date_key(first_key);
+    long num_days = days_from_date_key(last_key) - first_day + 1;
+
+    // Build every day in memory first so only the batch write is timed
+    struct day_update* updates = make_bench_days(first_day, num_days, events_per_day);
+
+    struct storage storage;
+    if (open_storage(&storage, driver, path) != 0) {
+        printf("Failed to open %s\n", path);
+        return 1;
+    }
+
+    srand(42);
+
+    double start = now_ms();
+    driver->batch(storage.handle, updates, num_days);
+    double batch_ms = now_ms() - start;
+
+    start = now_ms();
+    long found = 0;
+    for (int i = 0; i < LOOKUPS; i++) {
+        int key = random_date_key(first_day, num_days);
+        struct events events = driver->get_day(storage.handle, key / 10000, key / 100 % 100, key % 100);
+        found += events.length;
+        free_events(events);
+    }
+    double lookup_ms = now_ms() - start;
+
+    start = now_ms();
+    long range_events = 0;
+    driver->get_range(storage.handle, first_key, last_key, count_events, &range_events);
+    double range_ms = now_ms() - start;
+
+    start = now_ms();
+    for (int i = 0; i < EDITS; i++) {
+        int key = random_date_key(first_day, num_days);
+
+        struct event event = {0};
+        event.year = key / 10000;
+        event.month = key / 100 % 100;
+        event.day = key % 100;
+        event.hour = 23;
+        event.min = 59;
+        event.summary = "Benchmark edit";
+
+        driver->add(storage.handle, event);
+        driver->delete(storage.handle, event);
+    }
+    double edit_ms = now_ms() - start;
+
+    close_storage(&storage);
+
+    printf("backend: %s, %d years, %d events/day\n", driver->name, years, events_per_day);
+    printf("%-28s %10.2f ms\n", "batch write (all days)", batch_ms);
+    printf("%-28s %10.2f us/op (%ld events)\n", "get_day (random)", lookup_ms * 1000 / LOOKUPS, found);
+    printf("%-28s %10.2f ms (%ld events)\n", "get_range (everything)", range_ms, range_events);
+    printf("%-28s %10.2f us/op\n", "add + delete (random)", edit_ms * 1000 / EDITS);
+
+    free_bench_days(updates, num_days);
+    remove_bench_dir(dir);
+
+    return 0;
+}
+
+int count_events(int year, int month, int day, struct events* events, void* data) {
+    *(long*)data += events->length;
+    return 0;
+}
+
+int random_date_key(long first_day, long num_days) {
+    return date_key_from_days(first_day + rand() % num_days);
+}
@@ -0,0 +1,91 @@
+/*
+ * bench_tz.c
+ *
+ * Times converting event times between zones with tz.c, against the C
+ * library's localtime_r as a baseline.
+ *
+ * Usage: bench_tz [zone] [count]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "drivers/tz.h"
+#include "common.h"
+
+int int64_cmp(const void* a, const void* b);
+
+int main(int argc, char* argv[]) {
+    const char* name = argc > 1 ? argv[1] : "America/New_York";
+    long count = argc > 2 ? atol(argv[2]) : 100000;
+
+    double start = now_ms();
+    struct time_zone zone;
+    if (load_time_zone(&zone, name) != 0) {
+        printf("Failed to load %s\n", name);
+        return 1;
+    }
+    double load_ms = now_ms() - start;
+
+    // Event times spread over 2020-2040, like a long synced calendar
+    int64_t first = civil_to_seconds(2020, 1, 1, 0, 0, 0);
+    int64_t last = civil_to_seconds(2040, 12, 31, 0, 0, 0);
+
+    int64_t* utc = malloc(count * sizeof(int64_t));
+    int64_t* local = malloc(count * sizeof(int64_t));
+    srand(42);
+    for (long i = 0; i < count; i++) {
+        utc[i] = first + (int64_t)((double)rand() / RAND_MAX * (last - first));
+    }
+
+    start = now_ms();
+    utc_to_local_times(&zone, utc, local, count);
+    double random_ms = now_ms() - start;
+
+    qsort(utc, count, sizeof(int64_t), int64_cmp);
+    start = now_ms();
+    utc_to_local_times(&zone, utc, local, count);
+    double sorted_ms = now_ms() - start;
+
+    start = now_ms();
+    int64_t checksum = 0;
+    for (long i = 0; i < count; i++) {
+        checksum += local_to_utc(&zone, local[i]) - utc[i];
+    }
+    double reverse_ms = now_ms() - start;
+
+    char tz[256];
+    snprintf(tz, sizeof(tz), "TZ=%s", name);
+    putenv(tz);
+    tzset();
+
+    start = now_ms();
+    long mismatches = 0;
+    for (long i = 0; i < count; i++) {
+        time_t t = utc[i];
+        struct tm tm;
+        localtime_r(&t, &tm);
+        if (tm.tm_gmtoff != local[i] - utc[i]) mismatches++;
+    }
+    double libc_ms = now_ms() - start;
+
+    printf("zone: %s (%zu transitions), %ld times\n", name, zone.num_transitions, count);
+    printf("%-34s %10.3f ms\n", "load TZif", load_ms);
+    printf("%-34s %10.3f ms\n", "utc_to_local_times (random order)", random_ms);
+    printf("%-34s %10.3f ms\n", "utc_to_local_times (sorted)", sorted_ms);
+    printf("%-34s %10.3f ms\n", "local_to_utc", reverse_ms);
+    printf("%-34s %10.3f ms\n", "localtime_r (baseline)", libc_ms);
+    printf("offset mismatches against libc: %ld, round trip drift from repeated hours: %lld s\n", mismatches, (long long)checksum);
+
+    free(utc);
+    free(local);
+    free_time_zone(&zone);
+
+    return 0;
+}
+
+int int64_cmp(const void* a, const void* b) {
+    int64_t first = *(const int64_t*)a;
+    int64_t second = *(const int64_t*)b;
+    return (first > second) - (first < second);
+}
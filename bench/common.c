@@ -0,0 +1,124 @@
+/*
+ * common.c
+ *
+ * Fixtures shared by the benchmarks: the clock, temporary directories
+ * and generated calendars.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include "common.h"
+#include "drivers/skeleton.h"
+
+double now_ms() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e3 + now.tv_nsec / 1e6;
+}
+
+int make_bench_dir(char* template) {
+    return mkdtemp(template) == NULL ? -1 : 0;
+}
+
+int make_bench_home(char* template) {
+    if (make_bench_dir(template) != 0) return -1;
+    setenv("HOME", template, 1);
+
+    char path[256];
+    snprintf(path, sizeof(path), "%s/.calendar", template);
+    return mkdir(path, 0700);
+}
+
+void remove_bench_dir(const char* dir) {
+    char command[512];
+    snprintf(command, sizeof(command), "rm -rf %s", dir);
+    system(command);
+}
+
+struct day_update* make_bench_days(long first_day, long num_days, int events_per_day) {
+    struct day_update* updates = malloc(num_days * sizeof(struct day_update));
+
+    for (long i = 0; i < num_days; i++) {
+        int key = date_key_from_days(first_day + i);
+        updates[i].year = key / 10000;
+        updates[i].month = key / 100 % 100;
+        updates[i].day = key % 100;
+        updates[i].base = NULL;
+        init_events(&updates[i].events);
+
+        for (int j = 0; j < events_per_day; j++) {
+            int minute = j * 1440 / events_per_day;
+
+            struct event event = {0};
+            event.hour = minute / 60;
+            event.min = minute % 60;
+            event.duration = 30;
+            event.summary = strdup("Synthetic benchmark event with a realistic summary");
+            append_event(&updates[i].events, event);
+        }
+    }
+
+    return updates;
+}
+
+void free_bench_days(struct day_update* updates, long num_days) {
+    for (long i = 0; i < num_days; i++) {
+        free_events(updates[i].events);
+    }
+    free(updates);
+}
+
+int write_bench_days(const char* path, const struct storage_driver* driver, struct day_update* updates, long num_days) {
+    struct storage storage;
+    if (open_storage(&storage, driver, path) != 0) return -1;
+
+    int result = driver->batch(storage.handle, updates, num_days);
+    close_storage(&storage);
+
+    return result;
+}
+
+void write_bench_calendar(FILE* out, int first_year, int years, long num_events) {
+    int first_key = DATE_KEY(first_year, 1, 1);
+    int last_key = DATE_KEY(first_year + years - 1, 12, 31);
+    long num_days = days_from_date_key(last_key) - days_from_date_key(first_key) + 1;
+
+    int* per_day = calloc(num_days, sizeof(int));
+    srand(42);
+    for (long i = 0; i < num_events; i++) {
+        per_day[rand() % num_days]++;
+    }
+
+    char* skeleton = NULL;
+    size_t skeleton_length = 0;
+    FILE* lines = open_memstream(&skeleton, &skeleton_length);
+    write_skeleton(lines, first_key, last_key);
+    fclose(lines);
+
+    char* line = skeleton;
+    for (long day = 0; day < num_days; day++) {
+        char* newline = strchr(line, '\n');
+        fwrite(line, 1, newline - line, out);
+        line = newline + 1;
+
+        for (int i = 0; i < per_day[day]; i++) {
+            int hour = 7 + rand() % 12;
+            int min = rand() % 4 * 15;
+
+            fputs(i == 0 ? "  " : ",", out);
+            if (rand() % 20 == 0) {
+                fprintf(out, "ALL DAY - Offsite %ld", day);
+            } else if (rand() % 5 == 0) {
+                fprintf(out, "%02d:%02d - Reminder %d for the team", hour, min, i);
+            } else {
+                fprintf(out, "%02d:%02d-%02d:%02d - Meeting %d about the roadmap", hour, min, hour + 1, min, i);
+            }
+        }
+        fputc('\n', out);
+    }
+
+    free(skeleton);
+    free(per_day);
+}
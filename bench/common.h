@@ -0,0 +1,48 @@
+#ifndef BENCH_COMMON_H
+#define BENCH_COMMON_H
+
+#include <stdio.h>
+#include "drivers/storage.h"
+
+/*
+ * Milliseconds on the monotonic clock.
+ */
+double now_ms();
+
+/*
+ * Makes a temporary directory from template, which ends in XXXXXX and is
+ * overwritten with its path. Returns 0 on success, -1 on failure.
+ */
+int make_bench_dir(char* template);
+
+/*
+ * The same, and points HOME at it with an empty ~/.calendar in it.
+ */
+int make_bench_home(char* template);
+
+/*
+ * Deletes a temporary directory and everything in it.
+ */
+void remove_bench_dir(const char* dir);
+
+/*
+ * Makes an update for each of num_days days from first_day (days since
+ * 1970-01-01), with events_per_day half hour events spread over the day.
+ */
+struct day_update* make_bench_days(long first_day, long num_days, int events_per_day);
+void free_bench_days(struct day_update* updates, long num_days);
+
+/*
+ * Writes the days to the calendar at path with driver. Returns 0 on
+ * success, -1 on failure.
+ */
+int write_bench_days(const char* path, const struct storage_driver* driver, struct day_update* updates, long num_days);
+
+/*
+ * Writes a calendar.txt line for every day of the years from first_year
+ * with num_events events spread over them at random: mostly meetings with
+ * an end time, some without one and the odd all day event.
+ */
+void write_bench_calendar(FILE* out, int first_year, int years, long num_events);
+
+#endif
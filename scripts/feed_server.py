@@ -0,0 +1,101 @@
+#!/usr/bin/python3
+"""
+Serves an .ics file over plain HTTP the way a calendar provider would, for
+trying out `calenter sync` locally:
+
+    python3 scripts/feed_server.py feed.ics --port 8080 --fail 2 --chunked
+    build/calenter sync http://localhost:8080/feed.ics
+
+Responses carry an ETag and Last-Modified and conditional requests are
+answered with 304 while the file is unchanged. --fail N answers the first N
+requests with 503 to exercise the retries, and --chunked sends the body with
+chunked encoding in small pieces. Every request is logged to stderr.
+"""
+
+import argparse
+import hashlib
+import os
+import sys
+from email.utils import formatdate, parsedate_to_datetime
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+
+def parse_args():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("path", help="the .ics file to serve at every url")
+    parser.add_argument("--port", type=int, default=8080)
+    parser.add_argument("--fail", type=int, default=0, help="answer the first N requests with 503")
+    parser.add_argument("--chunked", action="store_true", help="use chunked transfer encoding")
+    return parser.parse_args()
+
+
+ARGS = parse_args()
+failures_left = ARGS.fail
+
+
+class FeedHandler(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+
+    def do_GET(self):
+        global failures_left
+
+        if failures_left > 0:
+            failures_left -= 1
+            self.send_response(503)
+            self.send_header("Content-Length", "0")
+            self.end_headers()
+            return
+
+        with open(ARGS.path, "rb") as feed:
+            body = feed.read()
+
+        mtime = int(os.stat(ARGS.path).st_mtime)
+        etag = '"' + hashlib.sha1(body).hexdigest()[:16] + '"'
+        last_modified = formatdate(mtime, usegmt=True)
+
+        if self.not_modified(etag, mtime):
+            self.send_response(304)
+            self.send_header("ETag", etag)
+            self.end_headers()
+            return
+
+        self.send_response(200)
+        self.send_header("Content-Type", "text/calendar")
+        self.send_header("ETag", etag)
+        self.send_header("Last-Modified", last_modified)
+
+        if ARGS.chunked:
+            self.send_header("Transfer-Encoding", "chunked")
+            self.end_headers()
+            for start in range(0, len(body), 1000):
+                chunk = body[start:start + 1000]
+                self.wfile.write(b"%x\r\n%s\r\n" % (len(chunk), chunk))
+            self.wfile.write(b"0\r\n\r\n")
+        else:
+            self.send_header("Content-Length", str(len(body)))
+            self.end_headers()
+            self.wfile.write(body)
+
+    def not_modified(self, etag, mtime):
+        """
+        If-None-Match takes precedence over If-Modified-Since (RFC 9110).
+        """
+        if_none_match = self.headers.get("If-None-Match")
+        if if_none_match is not None:
+            return etag in [tag.strip() for tag in if_none_match.split(",")]
+
+        if_modified_since = self.headers.get("If-Modified-Since")
+        if if_modified_since is not None:
+            try:
+                return mtime <= parsedate_to_datetime(if_modified_since).timestamp()
+            except (TypeError, ValueError):
+                return False
+
+        return False
+
+    def log_message(self, format, *args):
+        sys.stderr.write("%s\n" % (format % args))
+
+
+if __name__ == "__main__":
+    ThreadingHTTPServer(("", ARGS.port), FeedHandler).serve_forever()
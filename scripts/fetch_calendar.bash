@@ -1,22 +1,29 @@
 #!/bin/bash
 
+# calenter fetches plain http feeds itself; this is only used for the
+# rest (https), which it can't
+
 CALENDAR_DIR=$HOME/.calendar
+ETAG_FILE=$CALENDAR_DIR/sync_etag
 
 start=$(date +%s)
 timeout=10
+delay=1
 
 mkdir $CALENDAR_DIR/downloads
 
 result=1
 duration=$(($(date +%s) - $start))
 while [ $duration -le $timeout ]; do
-    curl -o $CALENDAR_DIR/downloads/gcal.ics $1
+    curl -sfL --etag-compare $ETAG_FILE --etag-save $CALENDAR_DIR/downloads/etag \
+        -o $CALENDAR_DIR/downloads/gcal.ics $1
     if [ $? -eq 0 ]; then
         result=0
         break
     fi
 
-    sleep 5
+    sleep $delay
+    delay=$((delay * 2))
     duration=$(($(date +%s) - $start))
 done
 
@@ -28,7 +35,19 @@ if [[ $result != 0 ]]; then
     exit $return
 fi
 
-python3 $CALENDAR_DIR/scripts/write_events.py $CALENDAR_DIR/downloads/gcal.ics > /dev/null
+# A 304 leaves nothing to import
+if [[ ! -s $CALENDAR_DIR/downloads/gcal.ics ]]; then
+    rm -rf $CALENDAR_DIR/downloads
+    exit 0
+fi
+
+# calenter converts times to the zone in its config file natively; the
+# python writer is only a fallback for when it isn't on the PATH
+if command -v calenter > /dev/null; then
+    calenter import $CALENDAR_DIR/downloads/gcal.ics 2> /dev/null
+else
+    python3 $CALENDAR_DIR/scripts/write_events.py $CALENDAR_DIR/downloads/gcal.ics > /dev/null
+fi
 
 if [[ $? != 0 ]]; then
     return=$?
@@ -38,6 +57,9 @@ if [[ $? != 0 ]]; then
     exit $return
 fi
 
+# The ETag is only kept once the feed has been imported, so a failed
+# import is fetched in full next time
+mv $CALENDAR_DIR/downloads/etag $ETAG_FILE 2> /dev/null
 rm -rf $CALENDAR_DIR/downloads
 
 notify-send --urgency=normal "calendar.txt" "Google Calendar sync successful"
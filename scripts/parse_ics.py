@@ -4,7 +4,7 @@ Parses data from an ics file to be written to
 calendar.txt
 
 Reads the provided file (must be in ics format) and outputs a
-dictionary containing the start time, summary, and repeat rule.
+dictionary containing the start and end times, summary, and repeat rule.
 '''
 
 import sys
@@ -52,6 +52,7 @@ def parse_ics(ics_file_path):
 
         id = properties.get("UID")
         start = properties.get("DTSTART")
+        end = properties.get("DTEND")
         summary = properties.get("SUMMARY")
         repeat_rule = properties.get("RRULE")
 
@@ -65,6 +66,7 @@ def parse_ics(ics_file_path):
 
         event = {
             "DTSTART": start[0],
+            "DTEND": end[0] if end is not None else None,
             "SUMMARY": summary[0],
             "RRULE": repeat_rule[2] if repeat_rule is not None else None
         }
@@ -3,10 +3,11 @@
 Writes events parsed from a .ics file to calendar.txt
 """
 
+import fcntl
 import os
 import re
 import sys
-from datetime import date, datetime, timezone
+from datetime import date, datetime, timedelta, timezone
 from zoneinfo import ZoneInfo
 
 from parse_ics import parse_ics
@@ -14,144 +15,205 @@ from parse_ics import parse_ics
 HOME_DIR = os.environ["HOME"]
 CALENDAR_PATH = f"{HOME_DIR}/.calendar/calendar.txt"
 
+# calenter takes the same flock on this while it writes calendar.txt
+LOCK_PATH = f"{CALENDAR_PATH}.lock"
+
+# Repeating events, one line each rather than one copy per day (see
+# src/drivers/recurrence.c)
+REPEAT_PATH = f"{CALENDAR_PATH}.repeat"
+WEEKDAYS = ["MO", "TU", "WE", "TH", "FR", "SA", "SU"]
+CONFIG_PATH = f"{HOME_DIR}/.config/calenter/config"
+
+
+def read_timezone():
+    """
+    Returns the `timezone` set in the calenter config, or New York.
+    """
+    try:
+        with open(CONFIG_PATH, "r") as config:
+            for line in config:
+                if line.startswith("timezone="):
+                    return ZoneInfo(line[len("timezone="):].strip())
+    except (OSError, KeyError, ValueError):
+        pass
+
+    return ZoneInfo("America/New_York")
+
+
+TIMEZONE = read_timezone()
+
 
 def write_events(events):
-    with open(CALENDAR_PATH, "r") as calendar_txt:
-        calendar = calendar_txt.readlines()
+    """
+    Adds the events to calendar.txt and its repeating events. The files
+    are read and replaced with the lock held, so an edit calenter makes
+    meanwhile isn't lost, and they're replaced with a rename so readers
+    never see half of them.
+    """
+    with open(LOCK_PATH, "a") as lock:
+        fcntl.flock(lock, fcntl.LOCK_EX)
 
-    for id in events:
-        if events[id]["RRULE"] is not None:
-            handle_repeate_rule(events[id], calendar)
-            continue
+        with open(CALENDAR_PATH, "r") as calendar_txt:
+            calendar = calendar_txt.readlines()
 
-        start = events[id]["DTSTART"]
-        summary = events[id]["SUMMARY"]
+        try:
+            with open(REPEAT_PATH, "r") as repeat_file:
+                rules = repeat_file.readlines()
+        except FileNotFoundError:
+            rules = ["# Repeating events, see recurrence.c in calenter\n"]
+        num_rules = len(rules)
+
+        add_events(events, calendar, rules)
 
-        year = start[0:4]
-        month = start[4:6]
-        day = start[6:8]
-        hour = None
-        minute = None
+        replace_file(CALENDAR_PATH, calendar)
+        if len(rules) > num_rules:
+            replace_file(REPEAT_PATH, rules)
 
-        if "T" in start:
-            time = start[start.find("T") + 1 : -1]
-            hour = time[0:2]
-            minute = time[2:4]
 
-            # Time is in UTC timezone (Greenwich) need to convert to NYC
-            if "Z" in start:
-                dt = datetime(int(year), int(month), int(day), int(hour), int(minute), tzinfo=timezone.utc)
-                nyc_tz = ZoneInfo("America/New_York")
-                nyc_dt = dt.astimezone(nyc_tz)
+def replace_file(path, lines):
+    tmp_path = f"{path}.tmp"
+    with open(tmp_path, "w") as tmp:
+        tmp.writelines(lines)
+    os.replace(tmp_path, path)
 
 
-                year, month, day, hour = (
-                    nyc_dt.strftime("%Y"),
-                    nyc_dt.strftime("%m"),
-                    nyc_dt.strftime("%d"),
-                    nyc_dt.strftime("%H")
-                )
+def add_events(events, calendar, rules):
+    for id in events:
+        if events[id]["RRULE"] is not None:
+            handle_repeate_rule(events[id], rules)
+            continue
+
+        summary = events[id]["SUMMARY"]
+        year, month, day, hour, minute = parse_time(events[id]["DTSTART"])
+        end = format_end(events[id]["DTSTART"], events[id]["DTEND"])
 
         pattern = rf"{year}-{month}-{day}"
         matches = [(i, s) for i, s in enumerate(calendar) if re.search(pattern, s)]
 
-        assert len(matches) <= 2 and len(matches) > 0
+        assert len(matches) <= 2
+
+        # Dates past the end of calendar.txt are skipped. Run
+        # `calenter skeleton --fill <year>` to add them.
+        if len(matches) == 0:
+            continue
 
         match = matches[0] if len(matches) == 1 else matches[1]
-        updated_match = add_event(match[1], hour, minute, summary)
+        updated_match = add_event(match[1], hour, minute, summary, end)
 
         calendar[match[0]] = updated_match
 
-    with open(CALENDAR_PATH, "w") as calendar_txt:
-        calendar_txt.writelines(calendar)
-
 
-def handle_repeate_rule(event, calendar):
+def handle_repeate_rule(event, rules):
+    """
+    Adds a repeating event to the table of repeating events as a rule
+    rather than copying it onto every day it happens. Weekly events on
+    several days get one rule per day and yearly ones repeat every 12
+    months. A rule that's already there isn't added again.
+    """
+    rule = event["RRULE"]
     start = event["DTSTART"]
-    year = start[0:4]
-    month = start[4:6]
-    day = start[6:8]
+    year, month, day, hour, minute = parse_time(start)
+    start_date = date(int(year), int(month), int(day))
+    interval = max(int(rule.get("INTERVAL", 1)), 1)
 
-    matches = None
+    until = "-"
+    if "UNTIL" in rule:
+        until = f"{rule['UNTIL'][0:4]}-{rule['UNTIL'][4:6]}-{rule['UNTIL'][6:8]}"
 
-    match event["RRULE"]["FREQ"]:
-        case "YEARLY":
-            pattern = rf"-{month}-{day}"
-            matches = [(i, s) for i, s in enumerate(calendar) if re.search(pattern, s)]
+    match rule["FREQ"]:
+        case "DAILY":
+            starts = [(start_date, "daily", interval)]
         case "WEEKLY":
-            # print(event["RRULE"])
-            repeat_days = event["RRULE"].get("BYDAY")
-
-            repeat_days_pattern = None
-            if repeat_days is None:
-                repeat_days_pattern = map_weekday(
-                    date(int(year), int(month), int(day)).weekday()
-                )
-            else:
-                repeat_days_pattern = "|".join(
-                    list(map(lambda d: f"({map_weekday(d)})", repeat_days.split(",")))
-                )
-
-            pattern = rf"{repeat_days_pattern}"
-            prelim_matches = [
-                (i, s) for i, s in enumerate(calendar) if re.search(pattern, s)
-            ]
-
-            matches = []
-            for match in prelim_matches:
-                dstart = datetime(int(year), int(month), int(day))
-                dmatch = datetime(
-                    int(match[1][0:4]), int(match[1][5:7]), int(match[1][8:10])
-                )
-
-                if "UNTIL" in event["RRULE"].keys():
-                    dend = datetime(
-                        int(event["RRULE"]["UNTIL"][0:4]),
-                        int(event["RRULE"]["UNTIL"][4:6]),
-                        int(event["RRULE"]["UNTIL"][6:8]),
-                    )
-
-                    if dstart <= dmatch <= dend:
-                        matches.append(match)
-                else:
-                    if dstart <= dmatch:
-                        matches.append(match)
+            repeat_days = rule.get("BYDAY")
+            weekdays = [start_date.weekday()]
+            if repeat_days is not None:
+                # Only plain weekdays, "1MO" style prefixes are ignored
+                weekdays = [WEEKDAYS.index(d[-2:]) for d in repeat_days.split(",") if d[-2:] in WEEKDAYS]
+
+            # Each day's rule starts at its first occurrence, in the first
+            # week or the next one the event repeats in
+            week_start = start_date - timedelta(days=start_date.weekday())
+            starts = []
+            for weekday in sorted(set(weekdays)):
+                first = week_start + timedelta(days=weekday)
+                if first < start_date:
+                    first += timedelta(weeks=interval)
+                starts.append((first, "weekly", interval))
+        case "MONTHLY":
+            starts = [(start_date, "monthly", interval)]
+        case "YEARLY":
+            starts = [(start_date, "monthly", 12 * interval)]
         case _:
             print("Unkown repeat rule frequency")
             return
 
-    assert matches is not None
+    time = "ALL DAY" if hour is None else f"{hour}:{minute}{format_end(start, event.get('DTEND'))}"
+    summary = event["SUMMARY"].replace(",", " ").replace("\n", " ")
 
-    hour = None
-    minute = None
+    existing = [line.split(" ", 1)[1].strip() for line in rules if line[0].isdigit()]
+    ids = [int(line.split(" ", 1)[0]) for line in rules if line[0].isdigit()]
+    next_id = max(ids, default=0) + 1
 
-    if "T" in start:
-        time = start[start.find("T") + 1 : -1]
-        hour = time[0:2]
-        minute = time[2:4]
+    for first, frequency, every in starts:
+        entry = f"{first.isoformat()} {frequency} {every} {until} {time} - {summary}"
+        if entry in existing:
+            continue
 
-        # Time is in UTC timezone (Greenwich) need to convert to NYC
-        if "Z" in start:
-            dt = datetime(int(year), int(month), int(day), int(hour), int(minute), tzinfo=timezone.utc)
-            nyc_tz = ZoneInfo("America/New_York")
-            nyc_dt = dt.astimezone(nyc_tz)
+        rules.append(f"{next_id} {entry}\n")
+        existing.append(entry)
+        next_id += 1
 
 
-            year, month, day, hour = (
-                nyc_dt.strftime("%Y"),
-                nyc_dt.strftime("%m"),
-                nyc_dt.strftime("%d"),
-                nyc_dt.strftime("%H")
-            )
+def to_datetime(value):
+    """
+    Converts a DTSTART or DTEND value to a datetime, in the configured zone
+    if it was given in UTC. Returns None for dates without a time.
+    """
+    if "T" not in value:
+        return None
 
-    for match in matches:
-        if len(match[1][0:18].strip()) < 18:
-            continue
-        updated_match = add_event(match[1], hour, minute, event["SUMMARY"])
-        calendar[match[0]] = updated_match
+    time = value[value.find("T") + 1 :]
+    dt = datetime(int(value[0:4]), int(value[4:6]), int(value[6:8]), int(time[0:2]), int(time[2:4]))
+
+    # Time is in UTC timezone (Greenwich) need to convert to the configured zone
+    if "Z" in value:
+        dt = dt.replace(tzinfo=timezone.utc).astimezone(TIMEZONE).replace(tzinfo=None)
 
+    return dt
 
-def add_event(date, hour, minute, summary):
+
+def parse_time(start):
+    """
+    Returns the year, month, day, hour and minute of a DTSTART as strings.
+    The hour and minute are None for all day events.
+    """
+    dt = to_datetime(start)
+    if dt is None:
+        return start[0:4], start[4:6], start[6:8], None, None
+
+    return dt.strftime("%Y"), dt.strftime("%m"), dt.strftime("%d"), dt.strftime("%H"), dt.strftime("%M")
+
+
+def format_end(start, end):
+    """
+    Returns the "-HH:MM" calendar.txt puts after the start time, or "" if
+    the event has no end time or ends more than a day after it starts.
+    """
+    if end is None:
+        return ""
+
+    start_dt = to_datetime(start)
+    end_dt = to_datetime(end)
+    if start_dt is None or end_dt is None:
+        return ""
+
+    if not timedelta(0) < end_dt - start_dt < timedelta(days=1):
+        return ""
+
+    return end_dt.strftime("-%H:%M")
+
+
+def add_event(date, hour, minute, summary, end=""):
     date_prefix = date[0:18]
     days_events = list(
         filter(lambda e: len(e) > 0, map(lambda e: e.strip(), date[18:].split(",")))
@@ -172,7 +234,7 @@ def add_event(date, hour, minute, summary):
         days_events.insert(0, new_event)
 
     else:
-        new_event = f"{hour}:{minute} - {summary}"
+        new_event = f"{hour}:{minute}{end} - {summary}"
 
         if len(days_events) == 0:
             days_events.append(new_event)
@@ -200,41 +262,6 @@ def add_event(date, hour, minute, summary):
     return date_prefix + "  " + ",".join(days_events) + "\n"
 
 
-def map_weekday(weekday):
-    if type(weekday) is int:
-        match weekday:
-            case 0:
-                return "Mon"
-            case 1:
-                return "Tue"
-            case 2:
-                return "Wed"
-            case 3:
-                return "Thu"
-            case 4:
-                return "Fri"
-            case 5:
-                return "Sat"
-            case 6:
-                return "Sun"
-
-    match weekday:
-        case "MO":
-            return "Mon"
-        case "TU":
-            return "Tue"
-        case "WE":
-            return "Wed"
-        case "TH":
-            return "Thu"
-        case "FR":
-            return "Fri"
-        case "SA":  # May not be the right one for saturday
-            return "Sat"
-        case "SU":
-            return "Sun"
-
-
 def extract_time(calendar_event: str) -> tuple[int, int]:
     if calendar_event[0] == "A":
         return (0, 0)
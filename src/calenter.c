@@ -1,9 +1,19 @@
 #include <assert.h>
+#include <errno.h>
+#include <locale.h>
 #include <ncurses.h>
+#include <poll.h>
 #include <stdarg.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
+#include <unistd.h>
 #include "calenter.h"
+#include "drivers/config.h"
+#include "drivers/daemon.h"
+#include "drivers/history.h"
+#include "drivers/reminders.h"
 #include "drivers/sync.h"
 
 
@@ -31,17 +41,66 @@ void debug_log(const char* format, ...) {
 #endif
 }
 
+#define STARTUP_PROFILE_FLAG "--startup-profile"
+#define MAX_PROFILE_MARKS 8
+
+/*
+ * A point reached during startup, for --startup-profile.
+ */
+struct profile_mark {
+    const char* name;
+    struct timespec time;
+};
+
+/*
+ * Where the navigation keys read in one batch have moved the active
+ * window to. Only where they end up is loaded and drawn.
+ */
+struct key_batch {
+    bool calendar_moved; // the calendar's date has already been changed
+    int schedule_day;    // the day the schedule moves to, 0 if it stays
+    int selected_event;  // the item the schedule selects, -1 if it stays
+};
+
 void handle_key_press(Window** active_win, int key);
+bool is_navigation_key(int win_id, int key);
+int handle_navigation(Window* win, int key);
+void fold_navigation_key(Window* win, struct key_batch* batch, int key);
+void flush_navigation(Window* win, struct key_batch* batch);
+int read_key(Window** active_win_ref, int watch_fd, int load_fd, int reminder_fd);
+int read_pending_key(WINDOW* win);
+void apply_config(Window** active_win_ref);
+bool fill_loaded_day(Window** active_win_ref);
+void finish_loading(Window** active_win_ref);
+void mark_startup(const char* name);
+void print_startup_profile();
 
 Window* windows[NUM_WINDOWS];
 
-int main() {
+// When the last sync was started, for sync_interval
+static struct timespec last_sync;
+
+static struct profile_mark profile_marks[MAX_PROFILE_MARKS];
+static int num_profile_marks = 0;
+static double profile_read_ms = 0;
+
+int main(int argc, char* argv[]) {
+    bool profile = argc == 2 && strcmp(argv[1], STARTUP_PROFILE_FLAG) == 0;
+    if (argc > 1 && !profile) {
+        return run_command(argc, argv);
+    }
+
+    mark_startup("start");
     debug_log("Starting UI...\n");
 
     Window* active_win = NULL;
     int active_win_index = 0;
     int ch;
 
+    // Lets ncurses draw multibyte summaries. Only the character type is
+    // taken from the environment so dates and numbers stay as they are.
+    setlocale(LC_CTYPE, "");
+
     initscr();
     set_escdelay(25);
     curs_set(0);
@@ -54,13 +113,28 @@ int main() {
     init_pair(INACTIVE_COLOR_PAIR, COLOR_WHITE, COLOR_BLACK);
     init_pair(INPUT_FIELD_PAIR, COLOR_WHITE, 8);
     init_pair(CONTROLS_COLOR_PAIR, COLOR_BLUE, COLOR_BLACK);
+    init_pair(CONFLICT_COLOR_PAIR, COLOR_RED, COLOR_BLACK);
+    mark_startup("ncurses setup");
+
+    // Read here so the loader thread never parses it at the same time
+    get_config();
+    mark_startup("config");
+
+    // The frame and the empty schedule go out in one update, before any
+    // calendar is read
+    begin_frame();
+
+    int height, width, startx, starty;
 
     // Focusable windows
-    windows[SCHEDULE_WIN] = create_win(SCHEDULE_WIN, "Daily Schedule", LINES - 4, 2 * COLS / 3 - 1, 1, 0);
-    windows[CALENDAR_WIN] = create_win(CALENDAR_WIN, "Calendar", LINES - 4, COLS / 3, 2 * COLS / 3, 0);
+    get_window_geometry(SCHEDULE_WIN, &height, &width, &startx, &starty);
+    windows[SCHEDULE_WIN] = create_win(SCHEDULE_WIN, "Daily Schedule", height, width, startx, starty);
+    get_window_geometry(CALENDAR_WIN, &height, &width, &startx, &starty);
+    windows[CALENDAR_WIN] = create_win(CALENDAR_WIN, "Calendar", height, width, startx, starty);
 
     // Non-focusable windows
-    windows[CONTROLS_WIN] = create_win(CONTROLS_WIN, NULL, 4, COLS, 0, LINES - 4);
+    get_window_geometry(CONTROLS_WIN, &height, &width, &startx, &starty);
+    windows[CONTROLS_WIN] = create_win(CONTROLS_WIN, NULL, height, width, startx, starty);
 
     Widget calendar_widget;
     init_calendar(&calendar_widget);
@@ -76,8 +150,54 @@ int main() {
 
     set_active_window(&active_win, windows[active_win_index]);
 
+    end_frame();
+    mark_startup("first frame");
+
+    int load_fd = start_loader();
+    int sched_index = get_widget_index(windows[SCHEDULE_WIN], SCHEDULE);
+    Schedule* schedule = &windows[SCHEDULE_WIN]->widgets[sched_index].widget.schedule;
+    request_day(schedule->year, schedule->month, schedule->day);
+
+    // Without a loader thread the day has already been read
+    fill_loaded_day(&active_win);
+
+    if (profile) {
+        // Only the startup is profiled, the TUI closes once the day is shown
+        while (schedule->loading) {
+            struct pollfd fd = {.fd = load_fd, .events = POLLIN};
+            poll(&fd, 1, -1);
+            fill_loaded_day(&active_win);
+        }
+
+        stop_loader();
+        free_win(windows[0]);
+        free_win(windows[1]);
+        endwin();
+
+        print_startup_profile();
+        return 0;
+    }
+
+    int watch_fd = watch_config();
+    clock_gettime(CLOCK_MONOTONIC, &last_sync);
+
+    // calenterd sends the reminders for every TUI connected to it
+    wait_for_loader();
+    int reminder_fd = is_daemon_connected() ? -1 : start_reminders();
+
     while (true) {
-        ch = wgetch(active_win->win);
+        ch = read_key(&active_win, watch_fd, load_fd, reminder_fd);
+        latency_begin(classify_key(active_win->id, ch));
+
+        if (is_navigation_key(active_win->id, ch)) {
+            ch = handle_navigation(active_win, ch);
+            latency_end();
+
+            // The batch ends at the first key that isn't navigation, if
+            // one was read, which is handled as usual
+            if (ch == ERR) continue;
+            latency_begin(classify_key(active_win->id, ch));
+        }
 
         switch (ch) {
             case '\t': {
@@ -90,10 +210,27 @@ int main() {
                 break;
             }
             case 's':
+                wait_for_loader();
                 sync_calendar();
+                clock_gettime(CLOCK_MONOTONIC, &last_sync);
+                break;
+            case KEY_RESIZE:
+                wait_for_resize_to_settle(active_win->win);
+                resize_windows(active_win);
                 break;
+            case LATENCY_OVERLAY_KEY: {
+                latency_cancel();
+                render_latency_overlay();
+                for (int i = 0; i < NUM_WINDOWS; i++) {
+                    touchwin(windows[i]->win);
+                    refresh_win(windows[i], windows[i] == active_win);
+                }
+                break;
+            }
             case ERR:
                 debug_log("Received %d from wgetch\n", ch);
+                stop_loader();
+                write_latency_histograms();
                 free_win(windows[0]);
                 free_win(windows[1]);
                 endwin();
@@ -101,11 +238,18 @@ int main() {
             default: handle_key_press(&active_win, ch);
         };
 
+        // Every render path ends in wrefresh, so the frame is on the terminal by now.
+        latency_end();
+
         if (ch == 'q') {
             break;
         }
     }
 
+    stop_loader();
+    stop_reminders();
+    write_latency_histograms();
+
     free_win(windows[0]);
     free_win(windows[1]);
     endwin();
@@ -113,179 +257,442 @@ int main() {
     return 0;
 }
 
+/*
+ * Blocks until a key is pressed or the terminal is resized and returns it.
+ * Meanwhile the config is reloaded when it changes, the calendar is
+ * synced every sync_interval minutes, reminders are sent and days read by
+ * the loader are shown.
+ */
+int read_key(Window** active_win_ref, int watch_fd, int load_fd, int reminder_fd) {
+    // A key put back into curses (see wait_for_resize_to_settle) never
+    // shows up on stdin
+    int pending = read_pending_key((*active_win_ref)->win);
+    if (pending != ERR) return pending;
+
+    while (true) {
+        int timeout = -1;
+        int sync_interval = get_config()->sync_interval;
+
+        if (sync_interval > 0) {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+
+            long elapsed_ms = (now.tv_sec - last_sync.tv_sec) * 1000
+                + (now.tv_nsec - last_sync.tv_nsec) / 1000000;
+            long remaining_ms = sync_interval * 60000L - elapsed_ms;
+
+            // calenterd syncs on the same schedule for every client
+            if (remaining_ms <= 0) {
+                wait_for_loader();
+                if (!is_daemon_connected()) sync_calendar();
+                last_sync = now;
+                remaining_ms = sync_interval * 60000L;
+            }
+            timeout = remaining_ms;
+        }
+
+        // poll skips the descriptors that are -1
+        struct pollfd fds[4] = {
+            {.fd = STDIN_FILENO, .events = POLLIN},
+            {.fd = watch_fd, .events = POLLIN},
+            {.fd = load_fd, .events = POLLIN},
+            {.fd = reminder_fd, .events = POLLIN},
+        };
+        int ready = poll(fds, 4, timeout);
+
+        fill_loaded_day(active_win_ref);
+
+        // wgetch reports the error
+        if (ready < 0 && errno != EINTR) return wgetch((*active_win_ref)->win);
+
+        // SIGHUP interrupts the poll, which is handled like a file change.
+        // The loader reads the config too, so it has to finish first.
+        if (config_reload_pending()) {
+            wait_for_loader();
+            if (reload_config()) {
+                apply_config(active_win_ref);
+                handle_reminders();
+            }
+        }
+
+        // Reminders read the calendars too
+        if (ready > 0 && fds[3].revents != 0) {
+            wait_for_loader();
+            handle_reminders();
+        }
+
+        if (ready > 0 && fds[0].revents != 0) return wgetch((*active_win_ref)->win);
+
+        // So does SIGWINCH, but ncurses only reports a resize from wgetch
+        if (ready < 0) {
+            int ch = read_pending_key((*active_win_ref)->win);
+            if (ch != ERR) return ch;
+        }
+    }
+}
+
+/*
+ * Returns a key that has already been typed, or ERR if there isn't one.
+ */
+int read_pending_key(WINDOW* win) {
+    nodelay(win, true);
+    int ch = wgetch(win);
+    nodelay(win, false);
+
+    return ch;
+}
+
+/*
+ * Brings the UI in line with a freshly reloaded config.
+ */
+void apply_config(Window** active_win_ref) {
+    int sched_index = get_widget_index(windows[SCHEDULE_WIN], SCHEDULE);
+    Schedule* schedule = &windows[SCHEDULE_WIN]->widgets[sched_index].widget.schedule;
+
+    // Undo snapshots refer to calendars by index, which may now be different
+    if (reload_sources()) clear_history();
+
+    load_schedule_events(schedule);
+    if (schedule->selected_event > schedule->events.length) {
+        schedule->selected_event = schedule->events.length;
+    }
+
+    werase(windows[SCHEDULE_WIN]->win);
+    render_schedule(windows[SCHEDULE_WIN], *active_win_ref == windows[SCHEDULE_WIN]);
+
+    // Redraws the controls, which show any config warnings
+    set_active_window(active_win_ref, *active_win_ref);
+}
+
+/*
+ * Shows the day read by the loader if it's the one the schedule is
+ * waiting for. Returns true if it was.
+ */
+bool fill_loaded_day(Window** active_win_ref) {
+    struct loaded_day loaded;
+    if (!take_loaded_day(&loaded)) return false;
+
+    int sched_index = get_widget_index(windows[SCHEDULE_WIN], SCHEDULE);
+    Schedule* schedule = &windows[SCHEDULE_WIN]->widgets[sched_index].widget.schedule;
+
+    if (
+        !schedule->loading ||
+        schedule->year != loaded.year ||
+        schedule->month != loaded.month ||
+        schedule->day != loaded.day
+    ) {
+        free_loaded_day(&loaded);
+        return false;
+    }
+
+    // Only the first day is part of the startup
+    bool first = profile_read_ms == 0;
+    if (first) {
+        mark_startup("day read");
+        profile_read_ms = loaded.read_ms;
+    }
+
+    finish_schedule_load(schedule, &loaded);
+    render_schedule(windows[SCHEDULE_WIN], *active_win_ref == windows[SCHEDULE_WIN]);
+
+    if (first) mark_startup("day drawn");
+
+    return true;
+}
+
+/*
+ * Waits for the loader and shows the day it read, before something that
+ * reads or writes the calendars on this thread.
+ */
+void finish_loading(Window** active_win_ref) {
+    wait_for_loader();
+    fill_loaded_day(active_win_ref);
+}
+
+/*
+ * Records the time a step of the startup finished, for --startup-profile.
+ */
+void mark_startup(const char* name) {
+    if (num_profile_marks == MAX_PROFILE_MARKS) return;
+
+    profile_marks[num_profile_marks].name = name;
+    clock_gettime(CLOCK_MONOTONIC, &profile_marks[num_profile_marks].time);
+    num_profile_marks++;
+}
+
+/*
+ * Prints how long each step of the startup took and when it finished.
+ */
+void print_startup_profile() {
+    fprintf(stderr, "%-16s %10s %10s\n", "step", "took (ms)", "at (ms)");
+
+    struct timespec* start = &profile_marks[0].time;
+    for (int i = 1; i < num_profile_marks; i++) {
+        struct timespec* previous = &profile_marks[i - 1].time;
+        struct timespec* time = &profile_marks[i].time;
+
+        double took = (time->tv_sec - previous->tv_sec) * 1e3 + (time->tv_nsec - previous->tv_nsec) / 1e6;
+        double at = (time->tv_sec - start->tv_sec) * 1e3 + (time->tv_nsec - start->tv_nsec) / 1e6;
+        fprintf(stderr, "%-16s %10.2f %10.2f\n", profile_marks[i].name, took, at);
+    }
+
+    fprintf(stderr, "Reading the calendars on the loader thread took %.2f ms of that\n", profile_read_ms);
+}
+
+/*
+ * Returns true for the keys that only move around a window: the
+ * Calendar's hjklHL and the Daily Schedule's hjkl.
+ */
+bool is_navigation_key(int win_id, int key) {
+    switch (key) {
+        case 'h':
+        case 'j':
+        case 'k':
+        case 'l':
+            return win_id == CALENDAR_WIN || win_id == SCHEDULE_WIN;
+        case 'H':
+        case 'L':
+            return win_id == CALENDAR_WIN;
+        default:
+            return false;
+    }
+}
+
+/*
+ * Handles a navigation key along with every navigation key typed after
+ * it that's already waiting, so a held key is loaded and drawn once per
+ * batch rather than once per repeat. Returns the key that ended the
+ * batch, or ERR if it ran out of keys.
+ */
+int handle_navigation(Window* win, int key) {
+    struct key_batch batch = {false, 0, -1};
+
+    begin_frame();
+
+    while (is_navigation_key(win->id, key)) {
+        fold_navigation_key(win, &batch, key);
+        key = read_pending_key(win->win);
+    }
+    flush_navigation(win, &batch);
+
+    end_frame();
+
+    return key;
+}
+
+/*
+ * Adds a key to the batch. The moves are made the same way as one key at
+ * a time, stopping at the ends of the month and of the list.
+ */
+void fold_navigation_key(Window* win, struct key_batch* batch, int key) {
+    if (win->id == CALENDAR_WIN) {
+        int cal_index = get_widget_index(win, CALENDAR);
+        int months = key == 'L' ? 1 : key == 'H' ? -1 : 0;
+        int days = key == 'l' ? 1 : key == 'h' ? -1 : key == 'j' ? 7 : key == 'k' ? -7 : 0;
+
+        // Only the date is changed, which is cheap
+        move_widget_date(&win->widgets[cal_index], 0, months, days);
+        batch->calendar_moved = true;
+        return;
+    }
+
+    int sched_index = get_widget_index(win, SCHEDULE);
+    Schedule* schedule = &win->widgets[sched_index].widget.schedule;
+
+    if (key == 'h' || key == 'l') {
+        // A new day resets the selection, so a pending selection goes first
+        if (batch->selected_event >= 0) flush_navigation(win, batch);
+
+        int day = batch->schedule_day != 0 ? batch->schedule_day : schedule->day;
+        if (key == 'l' && day < get_days_in_month(schedule->month)) day++;
+        if (key == 'h' && day > 1) day--;
+
+        batch->schedule_day = day == schedule->day ? 0 : day;
+    } else {
+        if (batch->schedule_day != 0) flush_navigation(win, batch);
+
+        int selected = batch->selected_event >= 0 ? batch->selected_event : schedule->selected_event;
+        selected += key == 'j' ? 1 : -1;
+
+        if (selected >= 0 && selected <= (int)schedule->events.length) {
+            batch->selected_event = selected;
+        }
+    }
+}
+
+/*
+ * Loads and draws where the batch has moved to and empties it.
+ */
+void flush_navigation(Window* win, struct key_batch* batch) {
+    if (batch->calendar_moved) {
+        werase(win->win);
+        render_calendar(win, true);
+    }
+
+    if (win->id == SCHEDULE_WIN) {
+        int sched_index = get_widget_index(win, SCHEDULE);
+        Schedule* schedule = &win->widgets[sched_index].widget.schedule;
+
+        if (batch->schedule_day != 0) {
+            schedule->day = batch->schedule_day;
+            start_schedule_load(schedule);
+            render_schedule(win, true);
+        }
+
+        if (batch->selected_event >= 0 && batch->selected_event != schedule->selected_event) {
+            move_schedule_selection(win, batch->selected_event - schedule->selected_event, true);
+        }
+    }
+
+    *batch = (struct key_batch){false, 0, -1};
+}
+
 void handle_key_press(Window** active_win_ref, int key) {
     Window* active_win = *active_win_ref;
 
     if (active_win->id == CALENDAR_WIN) {
         switch (key) {
-            case 'l': {
-                int cal_index = get_widget_index(active_win, CALENDAR);
-                move_widget_date(&active_win->widgets[cal_index], 0, 0, 1);
-                werase(active_win->win);
-                render_calendar(active_win, true);
-                break;
-            }
-            case 'L': {
-                int cal_index = get_widget_index(active_win, CALENDAR);
-                move_widget_date(&active_win->widgets[cal_index], 0, 1, 0);
-                werase(active_win->win);
-                render_calendar(active_win, true);
-                break;
-            }
-            case 'H': {
-                int cal_index = get_widget_index(active_win, CALENDAR);
-                move_widget_date(&active_win->widgets[cal_index], 0, -1, 0);
-                werase(active_win->win);
-                render_calendar(active_win, true);
-                break;
-            }
-            case 'h': {
-                int cal_index = get_widget_index(active_win, CALENDAR);
-                move_widget_date(&active_win->widgets[cal_index], 0, 0, -1);
-                werase(active_win->win);
-                render_calendar(active_win, true);
-                break;
-            }
-            case 'k': {
-                int cal_index = get_widget_index(active_win, CALENDAR);
-                move_widget_date(&active_win->widgets[cal_index], 0, 0, -7);
-                werase(active_win->win);
-                render_calendar(active_win, true);
-                break;
-            }
-            case 'j': {
-                int cal_index = get_widget_index(active_win, CALENDAR);
-                move_widget_date(&active_win->widgets[cal_index], 0, 0, 7);
-                werase(active_win->win);
-                render_calendar(active_win, true);
-                break;
-            }
             case 10: {
                 int cal_index = get_widget_index(active_win, CALENDAR);
                 int sched_index = get_widget_index(windows[SCHEDULE_WIN], SCHEDULE);
 
+                int year = active_win->widgets[cal_index].widget.calendar.year;
                 int month = active_win->widgets[cal_index].widget.calendar.month;
                 int day = active_win->widgets[cal_index].widget.calendar.selected_day;
 
+                windows[SCHEDULE_WIN]->widgets[sched_index].widget.schedule.year = year;
                 windows[SCHEDULE_WIN]->widgets[sched_index].widget.schedule.month = month;
                 windows[SCHEDULE_WIN]->widgets[sched_index].widget.schedule.day = day;
 
-                int year = windows[SCHEDULE_WIN]->widgets[sched_index].widget.schedule.year;
-
-                free_events(windows[SCHEDULE_WIN]->widgets[sched_index].widget.schedule.events);
-                windows[SCHEDULE_WIN]->widgets[sched_index].widget.schedule.events =
-                    get_events(year, month, day);
+                start_schedule_load(&windows[SCHEDULE_WIN]->widgets[sched_index].widget.schedule);
 
                 render_schedule(windows[SCHEDULE_WIN], false);
             }
         }
     } else if (active_win->id == SCHEDULE_WIN) {
         switch (key) {
-            case 'l': {
-                int sched_index = get_widget_index(active_win, SCHEDULE);
-                int days_in_month = get_days_in_month(active_win->widgets[sched_index].widget.schedule.month);
-                if (active_win->widgets[sched_index].widget.schedule.day < days_in_month) {
-                    active_win->widgets[sched_index].widget.schedule.selected_event = 0;
-                    active_win->widgets[sched_index].widget.schedule.day++;
-
-                    int year = active_win->widgets[sched_index].widget.schedule.year;
-                    int month = active_win->widgets[sched_index].widget.schedule.month;
-                    int day = active_win->widgets[sched_index].widget.schedule.day;
-
-                    free_events(active_win->widgets[sched_index].widget.schedule.events);
-                    active_win->widgets[sched_index].widget.schedule.events =
-                        get_events(year, month, day);
-
-                    render_schedule(active_win, true);
-                }
-                break;
-            }
-            case 'h': {
-                int sched_index = get_widget_index(active_win, SCHEDULE);
-                if (active_win->widgets[sched_index].widget.schedule.day > 1) {
-                    active_win->widgets[sched_index].widget.schedule.selected_event = 0;
-                    active_win->widgets[sched_index].widget.schedule.day--;
+            case 'd':
+            case 'D': {
+                finish_loading(active_win_ref);
 
-                    int year = active_win->widgets[sched_index].widget.schedule.year;
-                    int month = active_win->widgets[sched_index].widget.schedule.month;
-                    int day = active_win->widgets[sched_index].widget.schedule.day;
-
-                    free_events(active_win->widgets[sched_index].widget.schedule.events);
-                    active_win->widgets[sched_index].widget.schedule.events =
-                        get_events(year, month, day);
-
-                    render_schedule(active_win, true);
-                }
-                break;
-            }
-            case 'j': {
-                int sched_index = get_widget_index(active_win, SCHEDULE);
-                int num_events = active_win->widgets[sched_index].widget.schedule.events.length;
-                if (active_win->widgets[sched_index].widget.schedule.selected_event < num_events) {
-                    active_win->widgets[sched_index].widget.schedule.selected_event++;
-                    render_schedule(active_win, true);
-                }
-                break;
-            }
-            case 'k': {
-                int sched_index = get_widget_index(active_win, SCHEDULE);
-                if (active_win->widgets[sched_index].widget.schedule.selected_event > 0) {
-                    active_win->widgets[sched_index].widget.schedule.selected_event--;
-                    render_schedule(active_win, true);
-                }
-                break;
-            }
-            case 'd': {
                 int sched_index = get_widget_index(active_win, SCHEDULE);
                 int length = active_win->widgets[sched_index].widget.schedule.events.length;
                 int cur_selection = active_win->widgets[sched_index].widget.schedule.selected_event;
 
-                int year = active_win->widgets[sched_index].widget.schedule.year;
-                int month = active_win->widgets[sched_index].widget.schedule.month;
-                int day = active_win->widgets[sched_index].widget.schedule.day;
-
                 if (cur_selection == length) break;
 
-                delete_event(active_win->widgets[sched_index].widget.schedule.events.events[cur_selection]);
+                // d only deletes the selected occurrence of a repeating event
+                // and D deletes all of them
+                struct event event = active_win->widgets[sched_index].widget.schedule.events.events[cur_selection];
+                if (event.recurrence == 0) {
+                    history_delete_event(event);
+                } else if (key == 'D') {
+                    history_delete_repeating_event(event);
+                } else {
+                    history_delete_occurrence(event);
+                }
 
-                free_events(active_win->widgets[sched_index].widget.schedule.events);
-                active_win->widgets[sched_index].widget.schedule.events =
-                    get_events(year, month, day);
+                load_schedule_events(&active_win->widgets[sched_index].widget.schedule);
 
                 render_schedule(active_win, true);
                 break;
             }
             case 10: {
+                finish_loading(active_win_ref);
+
                 int sched_index = get_widget_index(active_win, SCHEDULE);
                 int length = active_win->widgets[sched_index].widget.schedule.events.length;
                 int cur_selection = active_win->widgets[sched_index].widget.schedule.selected_event;
 
-                struct event new_event;
-                if (cur_selection == length) {
-                    new_event = add_event_modal(windows, NULL);
-                } else {
-                    new_event = add_event_modal(windows,
-                        active_win->widgets[sched_index].widget.schedule.events.events + cur_selection);
-                    if (new_event.summary != NULL) {
-                        delete_event(active_win->widgets[sched_index].widget.schedule.events.events[cur_selection]);
-                    }
-                }
+                struct event* old_event = cur_selection == length ? NULL :
+                    active_win->widgets[sched_index].widget.schedule.events.events + cur_selection;
+
+                enum repeat_freq repeat;
+                struct event new_event = add_event_modal(windows, old_event, &repeat);
 
                 if (new_event.summary != NULL) {
                     new_event.year = active_win->widgets[sched_index].widget.schedule.year;
                     new_event.month = active_win->widgets[sched_index].widget.schedule.month;
                     new_event.day = active_win->widgets[sched_index].widget.schedule.day;
 
-                    add_event(new_event, new_event.year, new_event.month, new_event.day);
+                    if (old_event == NULL && repeat != REPEAT_NONE) {
+                        history_add_repeating_event(new_event, repeat);
+                    } else if (old_event == NULL) {
+                        history_add_event(new_event);
+                    } else if (old_event->recurrence != 0) {
+                        history_edit_occurrence(*old_event, new_event);
+                    } else {
+                        history_edit_event(*old_event, new_event);
+                    }
+                    free(new_event.summary);
 
-                    free_events(active_win->widgets[sched_index].widget.schedule.events);
-                    active_win->widgets[sched_index].widget.schedule.events =
-                        get_events(new_event.year, new_event.month, new_event.day);
+                    load_schedule_events(&active_win->widgets[sched_index].widget.schedule);
 
                     render_schedule(active_win, true);
                 }
                 break;
             }
+            case FREE_SLOTS_KEY: {
+                finish_loading(active_win_ref);
+
+                int sched_index = get_widget_index(active_win, SCHEDULE);
+                Schedule* schedule = &active_win->widgets[sched_index].widget.schedule;
+
+                latency_cancel();
+                int date_key = free_slots_overlay(DATE_KEY(schedule->year, schedule->month, schedule->day));
+
+                if (date_key != 0) {
+                    schedule->year = date_key / 10000;
+                    schedule->month = date_key / 100 % 100;
+                    schedule->day = date_key % 100;
+                    schedule->selected_event = 0;
+                    load_schedule_events(schedule);
+                }
+
+                for (int i = 0; i < NUM_WINDOWS; i++) {
+                    touchwin(windows[i]->win);
+                    refresh_win(windows[i], windows[i] == active_win);
+                }
+                render_schedule(active_win, true);
+                break;
+            }
+            case 'u':
+            case 'r': {
+                finish_loading(active_win_ref);
+
+                int sched_index = get_widget_index(active_win, SCHEDULE);
+                Schedule* schedule = &active_win->widgets[sched_index].widget.schedule;
+
+                struct history_change change;
+                int result = key == 'u' ? undo_edit(&change) : redo_edit(&change);
+                if (result != 0) break;
+
+                // A change to repeating events can show up on any day, so
+                // the day is read again
+                if (
+                    !change.repeating &&
+                    schedule->year == change.year &&
+                    schedule->month == change.month &&
+                    schedule->day == change.day
+                ) {
+                    replace_source_events(&schedule->events, change.source, change.events);
+                    reset_schedule_layouts(schedule);
+                } else {
+                    // Jump to the day that changed so the undo is visible
+                    free_events(change.events);
+                    schedule->year = change.year;
+                    schedule->month = change.month;
+                    schedule->day = change.day;
+                    load_schedule_events(schedule);
+                }
+
+                if (schedule->selected_event > schedule->events.length) {
+                    schedule->selected_event = schedule->events.length;
+                }
+
+                render_schedule(active_win, true);
+                break;
+            }
         }
     }
 }
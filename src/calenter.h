@@ -2,14 +2,18 @@
 #define CALENTERM_H
 
 #include <stddef.h>
+#include <stdint.h>
+#include <wchar.h>
 #include <ncurses.h>
 #include "drivers/calendartxt.h"
+#include "drivers/sources.h"
 
 #define DEBUG
 #define ACTIVE_COLOR_PAIR 1
 #define INACTIVE_COLOR_PAIR 2
 #define INPUT_FIELD_PAIR 3
 #define CONTROLS_COLOR_PAIR 4
+#define CONFLICT_COLOR_PAIR 5
 
 #define SCHEDULE_WIN 0
 #define CALENDAR_WIN 1
@@ -19,18 +23,71 @@
 #define NUM_FOCUSABLE_WINDOWS 2
 
 
+#define LATENCY_OVERLAY_KEY 'P'
+#define FREE_SLOTS_KEY 'f'
+
+// The schedule's first event row. The row above it holds the scroll position.
+#define SCHEDULE_FIRST_ROW 3
+
+// Rows each schedule item takes. Long summaries wrap onto the second.
+#define SCHEDULE_ITEM_ROWS 2
+
+// How long to wait for more resize events before laying out again
+#define RESIZE_SETTLE_MS 50
+
+
+enum latency_action {
+    LATENCY_SCHEDULE_NEXT_DAY,
+    LATENCY_SCHEDULE_PREV_DAY,
+    LATENCY_SCHEDULE_SELECT,
+    LATENCY_SCHEDULE_DELETE,
+    LATENCY_UNDO_REDO,
+    LATENCY_OPEN_MODAL,
+    LATENCY_CALENDAR_MOVE,
+    LATENCY_CALENDAR_GOTO,
+    LATENCY_SWITCH_WINDOW,
+    LATENCY_SYNC,
+    LATENCY_RESIZE,
+    LATENCY_OTHER,
+    NUM_LATENCY_ACTIONS,
+};
+
 typedef struct _calender_widget {
     int selected_day;
     int month;
     int year;
 } Calendar;
 
+/*
+ * Where an event's summary is cut into the rows of its schedule item at a
+ * given width. Worked out once per event and kept until the event or the
+ * width changes.
+ */
+struct event_layout {
+    int width; // columns the layout is for, -1 if it hasn't been done yet
+    int display_width; // columns the whole summary takes
+    int num_rows;
+    int row_start[SCHEDULE_ITEM_ROWS]; // byte offsets into the summary
+    int row_end[SCHEDULE_ITEM_ROWS];
+    bool truncated; // the last row ends with an ellipsis
+    bool show_source;
+    bool conflicting; // overlaps another event, kept when the width changes
+};
+
 typedef struct _schedule_widget {
     int day;
     int month;
     int year;
     int selected_event;
+    int scroll_offset; // index of the first item (event or "Add event") on screen
     struct events events;
+    struct event_layout* layouts; // one for each event
+    int time_width; // of the longest start (and end) time on the day
+    bool loading; // the events are still being read by the loader
+
+    // The days either side, which events can overlap into
+    struct events previous_day;
+    struct events next_day;
 } Schedule;
 
 enum _widget_tag {
@@ -48,6 +105,20 @@ typedef struct _widget {
     union _widget_data widget;
 } Widget;
 
+/*
+ * A day read by the loader thread (see loader.c), with the days either
+ * side of it for finding conflicts.
+ */
+struct loaded_day {
+    int year;
+    int month;
+    int day;
+    struct events events;
+    struct events previous;
+    struct events next;
+    double read_ms; // time spent reading the calendars
+};
+
 typedef struct _window {
     int id;
     WINDOW* win;
@@ -58,6 +129,32 @@ typedef struct _window {
     Widget* widgets;
 } Window;
 
+/*
+ * A text field that wraps to the width of its window. See editor.c.
+ */
+typedef struct _editor {
+    char* text;
+    size_t size;
+    size_t gap_start; // also the cursor
+    size_t gap_end;
+
+    size_t* row_starts; // offset into the text, not counting the gap
+    int num_rows;
+    int rows_size;
+    int top_row; // first row on screen
+    int width; // columns the rows were wrapped to, -1 to redo everything
+    size_t changed; // first offset changed since the last render, SIZE_MAX if none
+} Editor;
+
+enum editor_motion {
+    CHAR_LEFT,
+    CHAR_RIGHT,
+    WORD_LEFT,
+    WORD_RIGHT,
+    TEXT_START,
+    TEXT_END,
+};
+
 
 /*
  * Formats the given date as a human readable string in the following format:
@@ -65,6 +162,13 @@ typedef struct _window {
  */
 void format_pretty_date(char* buffer, int year, int month, int day);
 
+/*
+ * Decodes the character at the start of bytes, looking at no more than
+ * length of them. Returns its length in bytes and sets c to it and width
+ * to the columns it's drawn in.
+ */
+int measure_char(const char* bytes, size_t length, wchar_t* c, int* width);
+
 /*
  * Function to write output to a logfile instead of the terminal
  */
@@ -81,9 +185,59 @@ void free_win(Window* window);
 void refresh_win(Window* window, bool active);
 void set_active_window(Window** active_win, Window* window);
 
+/*
+ * Works out where the window with the given id goes for the current
+ * terminal size (LINES and COLS).
+ */
+void get_window_geometry(int id, int* height, int* width, int* startx, int* starty);
+
+/*
+ * Waits until no resize has happened for RESIZE_SETTLE_MS so a burst of
+ * them is handled once. Any other key read meanwhile is put back.
+ */
+void wait_for_resize_to_settle(WINDOW* win);
+
+/*
+ * Rebuilds every window for the current terminal size and repaints them
+ * from the widgets' state, without reading any calendars.
+ */
+void resize_windows(Window* active_win);
+
+/*
+ * Between these, refresh_win only stages windows and end_frame puts
+ * everything on the terminal with a single update.
+ */
+void begin_frame();
+void end_frame();
+
 void init_schedule(Widget* schedule);
 void render_schedule(Window* win, bool active);
 
+/*
+ * Reads the schedule's day again, throwing away the old events.
+ */
+void load_schedule_events(Schedule* schedule);
+
+/*
+ * Asks the loader for the schedule's day and empties the schedule until
+ * it's been read. finish_schedule_load puts the day in once it has, and
+ * takes ownership of its events.
+ */
+void start_schedule_load(Schedule* schedule);
+void finish_schedule_load(Schedule* schedule, struct loaded_day* day);
+
+/*
+ * Forgets how the events were laid out, after they've changed in place,
+ * and finds which of them conflict.
+ */
+void reset_schedule_layouts(Schedule* schedule);
+
+/*
+ * Moves the schedule's selection by delta items, scrolling by as much as
+ * needed to keep it on screen. Only the rows that change are redrawn.
+ */
+void move_schedule_selection(Window* win, int delta, bool active);
+
 void init_calendar(Widget* calendar);
 void render_calendar(Window* win, bool active);
 
@@ -97,6 +251,109 @@ char* get_month_name(int month);
 int get_days_in_month(int month);
 struct tm get_day_info(int year, int month, int day);
 
-struct event add_event_modal(Window** windows, struct event* event);
+/*
+ * Opens the Add Event window, filled in from event if it isn't NULL.
+ * Returns an event without a summary if it was cancelled. repeat is set
+ * to how often a new event should repeat.
+ */
+struct event add_event_modal(Window** windows, struct event* event, enum repeat_freq* repeat);
+
+/*
+ * Lists the next free slots from the day with the given key (from now if
+ * it's today). Returns the key of the day picked with Enter, or 0 if none
+ * was.
+ */
+int free_slots_overlay(int date_key);
+
+/*
+ * Starts an editor holding a copy of text (which may be NULL), with the
+ * cursor at the end.
+ */
+void init_editor(Editor* editor, const char* text);
+void free_editor(Editor* editor);
+size_t get_editor_length(Editor* editor);
+
+/*
+ * Returns the text as a newly allocated string.
+ */
+char* get_editor_text(Editor* editor);
+
+void editor_insert(Editor* editor, const char* bytes, size_t length);
+void editor_delete_before(Editor* editor);
+void editor_delete_after(Editor* editor);
+void editor_move(Editor* editor, enum editor_motion motion);
+
+/*
+ * Makes the next render draw everything, e.g. into a new window.
+ */
+void invalidate_editor(Editor* editor);
+
+/*
+ * Draws the rows that changed since the last render and, if show_cursor
+ * is set, moves the window's cursor to the editor's. Doesn't refresh.
+ */
+void render_editor(Editor* editor, WINDOW* win, bool show_cursor);
+
+/*
+ * Runs a non-interactive command given on the command line. Returns the exit status.
+ */
+int run_command(int argc, char* argv[]);
+
+/*
+ * Maps a key press in the window with the given id to the action it triggers.
+ */
+enum latency_action classify_key(int win_id, int key);
+
+/*
+ * Starts timing a key press. The sample is recorded by the next call to
+ * latency_end, which should happen once the resulting frame has been flushed.
+ */
+void latency_begin(enum latency_action action);
+void latency_end();
+void latency_cancel();
+
+/*
+ * Returns the given percentile (0-100) of the recorded latencies in microseconds.
+ */
+uint64_t latency_percentile(enum latency_action action, double percentile);
+uint64_t latency_max(enum latency_action action);
+uint64_t latency_count(enum latency_action action);
+const char* get_latency_action_name(enum latency_action action);
+
+/*
+ * Shows p50/p99/max for every action until a key is pressed.
+ */
+void render_latency_overlay();
+
+/*
+ * Writes the histograms to ~/.calendar/latency.txt. Returns 0 on success, -1 on failure.
+ */
+int write_latency_histograms();
+
+/*
+ * Starts the thread that reads days for the UI. Returns a file descriptor
+ * that becomes readable when a day is ready, or -1 if there isn't one, in
+ * which case days are read as they're requested.
+ */
+int start_loader();
+void stop_loader();
+
+/*
+ * Asks for a day to be read, replacing a request that hasn't started yet.
+ */
+void request_day(int year, int month, int day);
+
+/*
+ * Takes the last day read if the UI hasn't taken it yet. Returns false if
+ * there isn't one. The events belong to the caller.
+ */
+bool take_loaded_day(struct loaded_day* day);
+void free_loaded_day(struct loaded_day* day);
+
+/*
+ * Blocks until the loader has finished every request, after which the UI
+ * can read calendars itself.
+ */
+void wait_for_loader();
 
 #endif
@@ -0,0 +1,538 @@
+/*
+ * commands.c
+ *
+ * Non-interactive subcommands, run as `calenter <command> [args]`.
+ * Each command writes to stdout/stderr and never starts ncurses.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "calenter.h"
+#include "drivers/skeleton.h"
+#include "drivers/storage.h"
+#include "drivers/sources.h"
+#include "drivers/import.h"
+#include "drivers/config.h"
+#include "drivers/http.h"
+#include "drivers/sync.h"
+#include "drivers/conflicts.h"
+#include "drivers/freeslots.h"
+#include "drivers/export.h"
+#include "drivers/stats.h"
+#include "drivers/daemon.h"
+
+#define DEFAULT_FREE_DAYS 30
+#define DEFAULT_FREE_COUNT 5
+#define MAX_FREE_COUNT 1000
+
+int skeleton_command(int argc, char* argv[]);
+int convert_command(int argc, char* argv[]);
+int import_command(int argc, char* argv[]);
+int sync_command(int argc, char* argv[]);
+int conflicts_command(int argc, char* argv[]);
+int free_command(int argc, char* argv[]);
+int export_command(int argc, char* argv[]);
+int stats_command(int argc, char* argv[]);
+int daemon_command(int argc, char* argv[]);
+int parse_date_key(const char* text, int* date_key);
+void print_event(struct event* event);
+void print_lock_stats();
+void print_usage();
+
+int run_command(int argc, char* argv[]) {
+    print_config_warnings(stderr);
+
+    if (strcmp(argv[1], "skeleton") == 0) return skeleton_command(argc - 2, argv + 2);
+    if (strcmp(argv[1], "convert") == 0) return convert_command(argc - 2, argv + 2);
+    if (strcmp(argv[1], "import") == 0) return import_command(argc - 2, argv + 2);
+    if (strcmp(argv[1], "sync") == 0) return sync_command(argc - 2, argv + 2);
+    if (strcmp(argv[1], "conflicts") == 0) return conflicts_command(argc - 2, argv + 2);
+    if (strcmp(argv[1], "free") == 0) return free_command(argc - 2, argv + 2);
+    if (strcmp(argv[1], "export") == 0) return export_command(argc - 2, argv + 2);
+    if (strcmp(argv[1], "stats") == 0) return stats_command(argc - 2, argv + 2);
+    if (strcmp(argv[1], "daemon") == 0) return daemon_command(argc - 2, argv + 2);
+
+    if (strcmp(argv[1], "help") != 0 && strcmp(argv[1], "--help") != 0) {
+        fprintf(stderr, "Unknown command: %s\n", argv[1]);
+    }
+    print_usage();
+
+    return 1;
+}
+
+void print_usage() {
+    fprintf(stderr,
+        "Usage: calenter [command]\n"
+        "\n"
+        "Without a command the TUI is started.\n"
+        "\n"
+        "Commands:\n"
+        "  skeleton <first year> <last year>  Print empty calendar.txt lines for the years\n"
+        "  skeleton --fill <year>             Add any missing dates to every calendar through the year\n"
+        "  convert <from> <to>                Copy a calendar between storage backends (.bin is binary)\n"
+        "  import <file.ics> [calendar]       Add the events in an ICS file for this year and next\n"
+        "  sync [url]                         Fetch an http:// feed (remote_url by default) into the\n"
+        "                                     default calendar and wait for it to finish\n"
+        "  conflicts [yyyy-mm]                List the events that overlap in a month (this one by default)\n"
+        "  free <minutes> [HH:MM-HH:MM] [days] [count]\n"
+        "                                     List the next gaps of at least that long in every calendar,\n"
+        "                                     within work_hours and the next 30 days by default\n"
+        "  export --ics [yyyy-mm-dd yyyy-mm-dd] [calendar]\n"
+        "                                     Print a calendar (the default one by default) as an ICS\n"
+        "                                     file, optionally only the days between two dates\n"
+        "  stats [--csv] [calendar]           Count a calendar's events by weekday, hour and year\n"
+        "  daemon                             Serve the calendars to every other calenter until stopped\n");
+}
+
+/*
+ * calenter skeleton <first year> <last year>
+ * calenter skeleton --fill <year>
+ */
+int skeleton_command(int argc, char* argv[]) {
+    if (argc == 2 && strcmp(argv[0], "--fill") == 0) {
+        if (fill_sources(atoi(argv[1])) != 0) {
+            fprintf(stderr, "Failed to fill calendars\n");
+            return 1;
+        }
+        return 0;
+    }
+
+    if (argc != 2) {
+        print_usage();
+        return 1;
+    }
+
+    int first_year = atoi(argv[0]);
+    int last_year = atoi(argv[1]);
+    if (first_year < 1 || last_year > 9999 || first_year > last_year) {
+        fprintf(stderr, "Years must be between 1 and 9999 and in order\n");
+        return 1;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    long lines = write_skeleton(stdout, DATE_KEY(first_year, 1, 1), DATE_KEY(last_year, 12, 31));
+    fflush(stdout);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if (lines < 0) {
+        fprintf(stderr, "Failed to write skeleton\n");
+        return 1;
+    }
+
+    double elapsed_ms = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+    fprintf(stderr, "Wrote %ld days in %.2f ms\n", lines, elapsed_ms);
+
+    return 0;
+}
+
+/*
+ * calenter convert <from> <to>
+ */
+int convert_command(int argc, char* argv[]) {
+    if (argc != 2) {
+        print_usage();
+        return 1;
+    }
+
+    struct storage from, to;
+    if (open_storage(&from, get_storage_driver_for_path(argv[0], NULL), argv[0]) != 0) {
+        fprintf(stderr, "Failed to open %s\n", argv[0]);
+        return 1;
+    }
+    if (open_storage(&to, get_storage_driver_for_path(argv[1], NULL), argv[1]) != 0) {
+        fprintf(stderr, "Failed to open %s\n", argv[1]);
+        close_storage(&from);
+        return 1;
+    }
+
+    long days = copy_storage(&from, &to);
+
+    // The repeating events go along with the calendar
+    if (days >= 0 && copy_recurrences(argv[0], argv[1]) != 0) days = -1;
+
+    close_storage(&from);
+    close_storage(&to);
+
+    if (days < 0) {
+        fprintf(stderr, "Failed to copy %s to %s\n", argv[0], argv[1]);
+        return 1;
+    }
+
+    fprintf(stderr, "Copied %ld days\n", days);
+    return 0;
+}
+
+/*
+ * calenter import <file.ics> [calendar]
+ */
+int import_command(int argc, char* argv[]) {
+    if (argc != 1 && argc != 2) {
+        print_usage();
+        return 1;
+    }
+
+    int source = argc == 2 ? find_source(argv[1]) : get_default_source();
+    if (source < 0) {
+        fprintf(stderr, "No calendar named %s\n", argv[1]);
+        return 1;
+    }
+
+    int first_key, last_key;
+    get_import_window(&first_key, &last_key);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    struct import_stats stats = {0};
+    int result = import_ics_file(argv[0], source, first_key, last_key, &stats);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if (result != 0) {
+        fprintf(stderr, "Failed to import %s\n", argv[0]);
+        return 1;
+    }
+
+    double elapsed_ms = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+    fprintf(stderr, "Imported %ld events (%ld occurrences, %ld new, %ld repeating) in %.2f ms\n",
+        stats.events, stats.instances, stats.added, stats.repeating, elapsed_ms);
+    print_lock_stats();
+
+    return 0;
+}
+
+/*
+ * calenter sync [url]
+ */
+int sync_command(int argc, char* argv[]) {
+    if (argc > 1) {
+        print_usage();
+        return 1;
+    }
+
+    const char* url = argc == 1 ? argv[0] : get_config()->remote_url;
+    if (url == NULL) {
+        fprintf(stderr, "No remote_url in the config file\n");
+        return 1;
+    }
+    if (!is_http_url(url)) {
+        fprintf(stderr, "Only http:// feeds can be fetched directly, others are synced by fetch_calendar.bash\n");
+        return 1;
+    }
+
+    time_t raw_time = time(NULL);
+    struct tm* info = localtime(&raw_time);
+    fill_sources(info->tm_year + 1900 + 1);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    struct sync_result result;
+    SYNC_ERR status = fetch_feed(url, get_default_source(), &result);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double elapsed_ms = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+
+    if (status == FETCH_FAILED) {
+        if (result.status == 0) {
+            fprintf(stderr, "Failed to fetch %s after %d attempts\n", url, result.attempts);
+        } else {
+            fprintf(stderr, "Failed to fetch %s: HTTP %d after %d attempts\n", url, result.status, result.attempts);
+        }
+        return 1;
+    }
+    if (status != SYNC_OK) {
+        fprintf(stderr, "Failed to import %s\n", url);
+        return 1;
+    }
+
+    if (result.unchanged) {
+        fprintf(stderr, "Feed unchanged (%d attempts) in %.2f ms\n", result.attempts, elapsed_ms);
+    } else {
+        fprintf(stderr, "Imported %ld events (%ld occurrences, %ld new, %ld repeating, %d attempts) in %.2f ms\n",
+            result.stats.events, result.stats.instances, result.stats.added, result.stats.repeating, result.attempts, elapsed_ms);
+        print_lock_stats();
+    }
+
+    return 0;
+}
+
+/*
+ * calenter conflicts [yyyy-mm]
+ */
+int conflicts_command(int argc, char* argv[]) {
+    if (argc > 1) {
+        print_usage();
+        return 1;
+    }
+
+    time_t raw_time = time(NULL);
+    struct tm* info = localtime(&raw_time);
+    int year = info->tm_year + 1900;
+    int month = info->tm_mon + 1;
+
+    if (argc == 1 && (sscanf(argv[0], "%d-%d", &year, &month) != 2 || month < 1 || month > 12)) {
+        fprintf(stderr, "Expected a month like 2026-03\n");
+        return 1;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    struct events events;
+    struct conflict* conflicts;
+    int first_key = DATE_KEY(year, month, 1);
+    int last_key = DATE_KEY(year, month, days_in_month(year, month));
+    size_t num_conflicts = find_range_conflicts(first_key, last_key, &events, &conflicts);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    for (size_t i = 0; i < num_conflicts; i++) {
+        print_event(&events.events[conflicts[i].first]);
+        printf("  overlaps  ");
+        print_event(&events.events[conflicts[i].second]);
+        printf("\n");
+    }
+
+    double elapsed_ms = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+    fprintf(stderr, "Found %zu conflicts among %zu events in %.2f ms\n", num_conflicts, events.length, elapsed_ms);
+
+    free(conflicts);
+    free_events(events);
+
+    return 0;
+}
+
+/*
+ * calenter free <minutes> [HH:MM-HH:MM] [days] [count]
+ */
+int free_command(int argc, char* argv[]) {
+    if (argc < 1 || argc > 4) {
+        print_usage();
+        return 1;
+    }
+
+    time_t raw_time = time(NULL);
+    struct tm* info = localtime(&raw_time);
+
+    struct slot_query query;
+    query.start_key = DATE_KEY(info->tm_year + 1900, info->tm_mon + 1, info->tm_mday);
+    query.start_minute = info->tm_hour * 60 + info->tm_min;
+    query.length = atoi(argv[0]);
+    query.num_days = argc > 2 ? atoi(argv[2]) : DEFAULT_FREE_DAYS;
+    get_work_hours(&query.window_start, &query.window_end);
+
+    int count = argc > 3 ? atoi(argv[3]) : DEFAULT_FREE_COUNT;
+
+    if (query.length < 1 || query.length > MINUTES_PER_DAY) {
+        fprintf(stderr, "The length must be between 1 and %d minutes\n", MINUTES_PER_DAY);
+        return 1;
+    }
+    if (argc > 1 && parse_time_window(argv[1], &query.window_start, &query.window_end) != 0) {
+        fprintf(stderr, "Expected hours like 09:00-17:00\n");
+        return 1;
+    }
+    if (query.num_days < 1 || count < 1 || count > MAX_FREE_COUNT) {
+        fprintf(stderr, "Expected at least one day and between 1 and %d slots\n", MAX_FREE_COUNT);
+        return 1;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    struct free_slot* slots = malloc(count * sizeof(struct free_slot));
+    int num_slots = find_free_slots(&query, slots, count);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if (num_slots < 0) {
+        fprintf(stderr, "Failed to read the calendars\n");
+        free(slots);
+        return 1;
+    }
+
+    for (int i = 0; i < num_slots; i++) {
+        int year = slots[i].date_key / 10000;
+        int month = slots[i].date_key / 100 % 100;
+        int day = slots[i].date_key % 100;
+
+        char date[11];
+        format_calendartxt_date(date, year, month, day);
+        struct tm day_info = get_day_info(year, month, day);
+        char weekday[4];
+        strftime(weekday, sizeof(weekday), "%a", &day_info);
+
+        printf("%s %s %02d:%02d-%02d:%02d  (%d min)\n", date, weekday,
+            slots[i].start / 60, slots[i].start % 60, slots[i].end / 60, slots[i].end % 60,
+            slots[i].end - slots[i].start);
+    }
+
+    double elapsed_ms = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+    fprintf(stderr, "Found %d free slots of %d minutes in %d days in %.2f ms\n", num_slots, query.length, query.num_days, elapsed_ms);
+
+    free(slots);
+
+    return 0;
+}
+
+/*
+ * calenter export --ics [yyyy-mm-dd yyyy-mm-dd] [calendar]
+ */
+int export_command(int argc, char* argv[]) {
+    if (argc < 1 || argc > 4 || strcmp(argv[0], "--ics") != 0) {
+        print_usage();
+        return 1;
+    }
+
+    int first_key = DATE_KEY(1, 1, 1);
+    int last_key = DATE_KEY(9999, 12, 31);
+    int source = get_default_source();
+
+    if (argc >= 3) {
+        if (parse_date_key(argv[1], &first_key) != 0 || parse_date_key(argv[2], &last_key) != 0 || first_key > last_key) {
+            fprintf(stderr, "Expected two dates in order like 2026-01-01 2026-12-31\n");
+            return 1;
+        }
+    }
+
+    if (argc == 2 || argc == 4) {
+        source = find_source(argv[argc - 1]);
+        if (source < 0) {
+            fprintf(stderr, "No calendar named %s\n", argv[argc - 1]);
+            return 1;
+        }
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    struct export_stats stats = {0};
+    int result = export_ics(stdout, source, first_key, last_key, &stats);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if (result != 0) {
+        fprintf(stderr, "Failed to export %s\n", get_source_name(source));
+        return 1;
+    }
+
+    double elapsed_ms = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+    fprintf(stderr, "Exported %ld events and %ld repeating events from %ld days in %.2f ms\n",
+        stats.events, stats.repeating, stats.days, elapsed_ms);
+
+    return 0;
+}
+
+/*
+ * calenter stats [--csv] [calendar]
+ */
+int stats_command(int argc, char* argv[]) {
+    bool csv = argc > 0 && strcmp(argv[0], "--csv") == 0;
+    if (csv) {
+        argc--;
+        argv++;
+    }
+    if (argc > 1) {
+        print_usage();
+        return 1;
+    }
+
+    int source = argc == 1 ? find_source(argv[0]) : get_default_source();
+    if (source < 0) {
+        fprintf(stderr, "No calendar named %s\n", argv[0]);
+        return 1;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    struct calendar_stats stats;
+    int result = collect_stats(source, get_config()->parse_threads, &stats);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if (result != 0) {
+        fprintf(stderr, "Failed to read %s\n", get_source_name(source));
+        return 1;
+    }
+
+    if (csv) {
+        print_stats_csv(stdout, &stats);
+    } else {
+        print_stats(stdout, get_source_name(source), &stats);
+    }
+
+    double elapsed_ms = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+    fprintf(stderr, "Counted %ld events in %.2f ms\n", stats.events, elapsed_ms);
+
+    return 0;
+}
+
+/*
+ * calenter daemon
+ */
+int daemon_command(int argc, char* argv[]) {
+    if (argc > 0) {
+        print_usage();
+        return 1;
+    }
+
+    char* socket_path = get_daemon_socket_path();
+    if (socket_path == NULL) {
+        fprintf(stderr, "HOME is not set\n");
+        return 1;
+    }
+
+    fprintf(stderr, "Serving calendars on %s\n", socket_path);
+    int result = run_daemon(socket_path);
+    if (result != 0) {
+        fprintf(stderr, "Failed to serve %s, is another daemon running?\n", socket_path);
+    }
+
+    free(socket_path);
+    return result == 0 ? 0 : 1;
+}
+
+/*
+ * Parses "yyyy-mm-dd". Returns 0 on success, -1 if it isn't a real date.
+ */
+int parse_date_key(const char* text, int* date_key) {
+    int year, month, day;
+    char extra;
+    if (sscanf(text, "%d-%d-%d%c", &year, &month, &day, &extra) != 3) return -1;
+    if (year < 1 || year > 9999 || month < 1 || month > 12 || day < 1 || day > days_in_month(year, month)) return -1;
+
+    *date_key = DATE_KEY(year, month, day);
+    return 0;
+}
+
+/*
+ * Prints an event on one line: "yyyy-mm-dd HH:MM-HH:MM summary [calendar]"
+ */
+void print_event(struct event* event) {
+    char date[11];
+    char time[12];
+    format_calendartxt_date(date, event->year, event->month, event->day);
+    format_time_range(time, *event);
+
+    printf("%s %s %s", date, time, event->summary);
+    if (get_num_sources() > 1) printf(" [%s]", get_source_name(event->source));
+}
+
+/*
+ * Prints how long the calendar lock was held, which is how long a TUI
+ * editing the same calendar could have had to wait.
+ */
+void print_lock_stats() {
+    struct calendar_lock_stats stats;
+    get_calendar_lock_stats(&stats);
+    if (stats.locks == 0) return;
+
+    fprintf(stderr, "Held the calendar lock %ld times for %.2f ms (at most %.2f ms at once), merged %ld days\n",
+        stats.locks, stats.held_ms, stats.max_held_ms, stats.merged_days);
+}
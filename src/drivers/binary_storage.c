@@ -0,0 +1,745 @@
+/*
+ * binary_storage.c
+ *
+ * A binary storage backend made of two files:
+ *
+ * <path>       A header followed by one fixed-size record per day, in
+ *              date order. The record for a date is found by arithmetic
+ *              on the number of days since the first stored date, so
+ *              looking a day up is a single pread.
+ * <path>.heap  An append-only heap holding each day's encoded events.
+ *              A day is rewritten in place when its new events fit in
+ *              the space it already has, otherwise they are appended
+ *              and the day's record is pointed at the new copy.
+ *
+ * Each event in the heap is encoded as the hour and minute (one signed
+ * byte each), the summary length (two bytes) and the summary bytes. An
+ * event with an end time has HAS_END_FLAG added to its hour and its
+ * duration in minutes (two bytes) after the summary length, which files
+ * written before end times existed never contain. A day with a summary
+ * longer than MAX_SUMMARY_LENGTH is refused rather than cut short.
+ *
+ * Slots left behind when a day moves are dead space. Once enough of the
+ * heap is dead (compaction_threshold and compaction_min_size in the
+ * config) the live slots are copied to a new heap file. The directory
+ * names its heap by generation and the new directory is renamed into
+ * place in one step, so a crash mid-compaction leaves the old pair intact.
+ *
+ * Writers hold the same lock on <path>.lock as calendar.txt writers (see
+ * lock_calendar_file). Another process may have written or compacted the
+ * calendar since it was opened, so whenever the directory's version has
+ * changed the header is read again and the heap measured again before
+ * it's used.
+ */
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "storage.h"
+#include "skeleton.h"
+#include "config.h"
+
+#define BINARY_MAGIC "CALBIN01"
+#define BINARY_VERSION 1
+#define HEAP_SUFFIX ".heap"
+
+#define HAS_END_FLAG 64
+#define MAX_SUMMARY_LENGTH UINT16_MAX
+
+// Slack given to a day when it moves to the end of the heap so small
+// edits can be made in place afterwards
+#define MIN_DAY_CAPACITY 64
+
+struct binary_header {
+    char magic[8];
+    uint32_t version;
+    int32_t first_day; // days since 1970-01-01 of the first record
+    uint32_t num_days;
+    uint32_t heap_generation; // heap is <path>.heap for 0, <path>.heap.<n> after
+};
+
+struct day_record {
+    uint64_t offset;
+    uint32_t length;
+    uint32_t capacity;
+};
+
+struct binary_file {
+    char* path;
+    int dir_fd;
+    int heap_fd;
+    struct binary_header header;
+    long long version; // of the directory the header was read from
+
+    // Bytes in the heap and bytes in slots that records point to
+    uint64_t heap_size;
+    uint64_t live_size;
+
+    // Only used for its lock
+    struct calendar_file lock_file;
+};
+
+void* binary_open(const char* path);
+void binary_close(void* handle);
+struct events binary_get_day(void* handle, int year, int month, int day);
+int binary_get_range(void* handle, int start_key, int end_key, day_callback callback, void* data);
+int binary_get_bounds(void* handle, int* first_key, int* last_key);
+int binary_add(void* handle, struct event event);
+int binary_delete(void* handle, struct event event);
+int binary_batch(void* handle, struct day_update* updates, size_t count);
+long long binary_get_version(void* handle);
+int binary_lock(void* handle);
+void binary_unlock(void* handle);
+
+int load_binary_file(struct binary_file* file);
+int refresh_binary_file(struct binary_file* file);
+int lock_binary_file(struct binary_file* file);
+void unlock_binary_file(struct binary_file* file);
+int set_day(struct binary_file* file, struct events events, int year, int month, int day);
+int read_record(struct binary_file* file, long index, struct day_record* record);
+int write_record(struct binary_file* file, long index, struct day_record* record);
+int write_header(struct binary_file* file);
+int measure_heap(struct binary_file* file);
+int compact_heap(struct binary_file* file);
+char* get_heap_path(const char* path, uint32_t generation);
+long ensure_record(struct binary_file* file, long day_number);
+struct events decode_day(char* buffer, size_t length, int year, int month, int day);
+char* encode_day(struct events events, uint32_t* length);
+
+const struct storage_driver binary_driver = {
+    .name = "binary",
+    .open = binary_open,
+    .close = binary_close,
+    .get_day = binary_get_day,
+    .get_range = binary_get_range,
+    .get_bounds = binary_get_bounds,
+    .add = binary_add,
+    .delete = binary_delete,
+    .batch = binary_batch,
+    .get_version = binary_get_version,
+    .fill = NULL,
+    .get_file = NULL,
+    .lock = binary_lock,
+    .unlock = binary_unlock,
+};
+
+void* binary_open(const char* path) {
+    struct binary_file* file = malloc(sizeof(struct binary_file));
+    file->path = strdup(path);
+    file->dir_fd = -1;
+    file->heap_fd = -1;
+    open_calendar_file(&file->lock_file, file->path);
+
+    // A new file gets its header under the lock, so two openers can't both
+    // write one
+    if (lock_binary_file(file) != 0) {
+        binary_close(file);
+        return NULL;
+    }
+
+    int result = load_binary_file(file);
+    unlock_binary_file(file);
+
+    if (result != 0) {
+        binary_close(file);
+        return NULL;
+    }
+
+    return file;
+}
+
+void binary_close(void* handle) {
+    struct binary_file* file = handle;
+
+    if (file->dir_fd >= 0) close(file->dir_fd);
+    if (file->heap_fd >= 0) close(file->heap_fd);
+    close_calendar_file(&file->lock_file);
+    free(file->path);
+    free(file);
+}
+
+/*
+ * Opens the directory at the file's path and the heap it names, and reads
+ * the header and the heap's size. A new file gets an empty header.
+ * Returns 0 on success, -1 on failure.
+ */
+int load_binary_file(struct binary_file* file) {
+    if (file->dir_fd >= 0) close(file->dir_fd);
+    if (file->heap_fd >= 0) close(file->heap_fd);
+    file->heap_fd = -1;
+
+    // The version is taken first so a write made while loading shows up
+    // as a change next time
+    file->version = binary_get_version(file);
+    file->dir_fd = open(file->path, O_RDWR | O_CREAT, 0644);
+    if (file->dir_fd < 0) return -1;
+
+    ssize_t read = pread(file->dir_fd, &file->header, sizeof(struct binary_header), 0);
+
+    if (read == 0) {
+        // A new file
+        memset(&file->header, 0, sizeof(struct binary_header));
+        memcpy(file->header.magic, BINARY_MAGIC, sizeof(file->header.magic));
+        file->header.version = BINARY_VERSION;
+
+        if (write_header(file) != 0) return -1;
+        file->version = binary_get_version(file);
+    } else if (
+        read != sizeof(struct binary_header) ||
+        memcmp(file->header.magic, BINARY_MAGIC, sizeof(file->header.magic)) != 0 ||
+        file->header.version != BINARY_VERSION
+    ) {
+        return -1;
+    }
+
+    char* heap_path = get_heap_path(file->path, file->header.heap_generation);
+    file->heap_fd = open(heap_path, O_RDWR | O_CREAT, 0644);
+    free(heap_path);
+
+    if (file->heap_fd < 0 || measure_heap(file) != 0) return -1;
+
+    return 0;
+}
+
+/*
+ * Loads the file again if anyone has written to it since it was loaded.
+ * Returns 0 on success, -1 if it can't be read.
+ */
+int refresh_binary_file(struct binary_file* file) {
+    if (file->dir_fd >= 0 && binary_get_version(file) == file->version) return 0;
+
+    return load_binary_file(file);
+}
+
+/*
+ * Takes the writers' lock and brings the file up to date under it.
+ */
+int lock_binary_file(struct binary_file* file) {
+    if (lock_calendar_file(&file->lock_file) != 0) return -1;
+
+    if (file->lock_file.lock_depth == 1 && file->dir_fd >= 0 && refresh_binary_file(file) != 0) {
+        unlock_calendar_file(&file->lock_file);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Releases the lock, first taking the version the file has been left at
+ * so this process's own writes don't make it load the file again.
+ */
+void unlock_binary_file(struct binary_file* file) {
+    if (file->lock_file.lock_depth == 1) file->version = binary_get_version(file);
+
+    unlock_calendar_file(&file->lock_file);
+}
+
+struct events binary_get_day(void* handle, int year, int month, int day) {
+    struct binary_file* file = handle;
+
+    if (refresh_binary_file(file) != 0) {
+        struct events events;
+        init_events(&events);
+        return events;
+    }
+
+    long index = days_from_date_key(DATE_KEY(year, month, day)) - file->header.first_day;
+
+    struct day_record record;
+    if (read_record(file, index, &record) != 0 || record.length == 0) {
+        struct events events;
+        init_events(&events);
+        return events;
+    }
+
+    char* buffer = malloc(record.length);
+    if (pread(file->heap_fd, buffer, record.length, record.offset) != record.length) {
+        free(buffer);
+
+        struct events events;
+        init_events(&events);
+        return events;
+    }
+
+    struct events events = decode_day(buffer, record.length, year, month, day);
+    free(buffer);
+
+    return events;
+}
+
+int binary_get_range(void* handle, int start_key, int end_key, day_callback callback, void* data) {
+    struct binary_file* file = handle;
+    if (refresh_binary_file(file) != 0) return -1;
+    if (file->header.num_days == 0) return 0;
+
+    long first = days_from_date_key(start_key) - file->header.first_day;
+    long last = days_from_date_key(end_key) - file->header.first_day;
+    if (first < 0) first = 0;
+    if (last >= (long)file->header.num_days) last = file->header.num_days - 1;
+    if (first > last) return 0;
+
+    // Every record in the range is read with a single pread
+    long count = last - first + 1;
+    struct day_record* records = malloc(count * sizeof(struct day_record));
+    ssize_t expected = count * sizeof(struct day_record);
+    off_t offset = sizeof(struct binary_header) + first * sizeof(struct day_record);
+
+    if (pread(file->dir_fd, records, expected, offset) != expected) {
+        free(records);
+        return -1;
+    }
+
+    char* buffer = NULL;
+    size_t buffer_size = 0;
+    int result = 0;
+
+    for (long i = 0; i < count && result == 0; i++) {
+        int date_key = date_key_from_days(file->header.first_day + first + i);
+        int year = date_key / 10000;
+        int month = date_key / 100 % 100;
+        int day = date_key % 100;
+
+        struct events events;
+        if (records[i].length == 0) {
+            init_events(&events);
+        } else {
+            if (records[i].length > buffer_size) {
+                buffer_size = records[i].length;
+                buffer = realloc(buffer, buffer_size);
+            }
+
+            if (pread(file->heap_fd, buffer, records[i].length, records[i].offset) != records[i].length) {
+                result = -1;
+                break;
+            }
+            events = decode_day(buffer, records[i].length, year, month, day);
+        }
+
+        result = callback(year, month, day, &events, data);
+        free_events(events);
+    }
+
+    free(buffer);
+    free(records);
+
+    return result < 0 ? -1 : 0;
+}
+
+int binary_get_bounds(void* handle, int* first_key, int* last_key) {
+    struct binary_file* file = handle;
+    if (refresh_binary_file(file) != 0 || file->header.num_days == 0) return -1;
+
+    *first_key = date_key_from_days(file->header.first_day);
+    *last_key = date_key_from_days(file->header.first_day + file->header.num_days - 1);
+
+    return 0;
+}
+
+int binary_add(void* handle, struct event event) {
+    if (lock_binary_file(handle) != 0) return -1;
+
+    struct events events = binary_get_day(handle, event.year, event.month, event.day);
+
+    // The caller keeps ownership of the event's summary
+    event.summary = strdup(event.summary);
+    insert_event(&events, event);
+
+    int result = set_day(handle, events, event.year, event.month, event.day);
+    free_events(events);
+    unlock_binary_file(handle);
+
+    return result;
+}
+
+int binary_delete(void* handle, struct event event) {
+    if (lock_binary_file(handle) != 0) return -1;
+
+    struct events events = binary_get_day(handle, event.year, event.month, event.day);
+
+    int result = remove_event(&events, event);
+    if (result == 0) result = set_day(handle, events, event.year, event.month, event.day);
+
+    free_events(events);
+    unlock_binary_file(handle);
+
+    return result;
+}
+
+int binary_batch(void* handle, struct day_update* updates, size_t count) {
+    if (lock_binary_file(handle) != 0) return -1;
+
+    int result = 0;
+    for (size_t i = 0; i < count && result == 0; i++) {
+        struct day_update update = updates[i];
+
+        // As in calendar.txt, a day someone else has changed since the
+        // update was made from it gets both changes
+        struct events events = update.events;
+        bool merged = false;
+        if (update.base != NULL) {
+            struct events current = binary_get_day(handle, update.year, update.month, update.day);
+
+            if (!events_match(&current, update.base)) {
+                events = merge_day_change(update.base, &update.events, &current);
+                merged = true;
+            }
+            free_events(current);
+        }
+
+        result = set_day(handle, events, update.year, update.month, update.day);
+        if (merged) free_events(events);
+    }
+
+    unlock_binary_file(handle);
+
+    return result;
+}
+
+long long binary_get_version(void* handle) {
+    struct binary_file* file = handle;
+
+    // Every write goes through the directory, and compaction replaces it
+    struct stat st;
+    if (stat(file->path, &st) != 0) return -1;
+
+    return (st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec) ^ ((long long)st.st_size << 20) ^ st.st_ino;
+}
+
+int binary_lock(void* handle) {
+    return lock_binary_file(handle);
+}
+
+void binary_unlock(void* handle) {
+    unlock_binary_file(handle);
+}
+
+int set_day(struct binary_file* file, struct events events, int year, int month, int day) {
+    long index = ensure_record(file, days_from_date_key(DATE_KEY(year, month, day)));
+    if (index < 0) return -1;
+
+    struct day_record record;
+    if (read_record(file, index, &record) != 0) return -1;
+
+    uint32_t length;
+    char* buffer = encode_day(events, &length);
+    if (buffer == NULL) return -1;
+    uint32_t encoded_length = length;
+
+    if (length > record.capacity) {
+        file->live_size -= record.capacity;
+
+        record.offset = file->heap_size;
+        record.capacity = length < MIN_DAY_CAPACITY ? MIN_DAY_CAPACITY : length;
+
+        file->heap_size += record.capacity;
+        file->live_size += record.capacity;
+
+        // Write the whole slot so the heap never has holes in it
+        buffer = realloc(buffer, record.capacity);
+        memset(buffer + length, 0, record.capacity - length);
+        length = record.capacity;
+    }
+
+    ssize_t written = pwrite(file->heap_fd, buffer, length, record.offset);
+    free(buffer);
+
+    if (written != length) return -1;
+
+    record.length = encoded_length;
+
+    if (write_record(file, index, &record) != 0) return -1;
+
+    const Config* config = get_config();
+    uint64_t dead_size = file->heap_size - file->live_size;
+    if (
+        file->heap_size >= (uint64_t)config->compaction_min_size * 1024 &&
+        dead_size * 100 >= file->heap_size * config->compaction_threshold
+    ) {
+        return compact_heap(file);
+    }
+
+    return 0;
+}
+
+/*
+ * Returns the index of the record for day_number, growing the directory
+ * with empty records if the day is outside it. Returns -1 on failure.
+ */
+long ensure_record(struct binary_file* file, long day_number) {
+    if (file->header.num_days == 0) {
+        file->header.first_day = day_number;
+    }
+
+    long index = day_number - file->header.first_day;
+
+    if (index >= (long)file->header.num_days) {
+        // Growing at the end only needs the file extended with zeroed records
+        off_t size = sizeof(struct binary_header) + (index + 1) * sizeof(struct day_record);
+        if (ftruncate(file->dir_fd, size) != 0) return -1;
+
+        file->header.num_days = index + 1;
+        if (write_header(file) != 0) return -1;
+
+    } else if (index < 0) {
+        // Growing at the start shifts every record, which only happens
+        // when a date before anything stored is written
+        size_t shift = -index;
+        size_t records_size = file->header.num_days * sizeof(struct day_record);
+        char* records = calloc(shift * sizeof(struct day_record) + records_size, 1);
+
+        if (pread(file->dir_fd, records + shift * sizeof(struct day_record), records_size,
+                sizeof(struct binary_header)) != (ssize_t)records_size) {
+            free(records);
+            return -1;
+        }
+
+        ssize_t expected = shift * sizeof(struct day_record) + records_size;
+        ssize_t written = pwrite(file->dir_fd, records, expected, sizeof(struct binary_header));
+        free(records);
+        if (written != expected) return -1;
+
+        file->header.first_day = day_number;
+        file->header.num_days += shift;
+        if (write_header(file) != 0) return -1;
+
+        index = 0;
+    }
+
+    return index;
+}
+
+int read_record(struct binary_file* file, long index, struct day_record* record) {
+    if (index < 0 || index >= (long)file->header.num_days) return -1;
+
+    off_t offset = sizeof(struct binary_header) + index * sizeof(struct day_record);
+    if (pread(file->dir_fd, record, sizeof(struct day_record), offset) != sizeof(struct day_record)) {
+        return -1;
+    }
+
+    return 0;
+}
+
+int write_record(struct binary_file* file, long index, struct day_record* record) {
+    off_t offset = sizeof(struct binary_header) + index * sizeof(struct day_record);
+    if (pwrite(file->dir_fd, record, sizeof(struct day_record), offset) != sizeof(struct day_record)) {
+        return -1;
+    }
+
+    return 0;
+}
+
+int write_header(struct binary_file* file) {
+    if (pwrite(file->dir_fd, &file->header, sizeof(struct binary_header), 0) != sizeof(struct binary_header)) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Works out the heap's size and how much of it is in use from the directory.
+ */
+int measure_heap(struct binary_file* file) {
+    struct stat st;
+    if (fstat(file->heap_fd, &st) != 0) return -1;
+
+    file->heap_size = st.st_size;
+    file->live_size = 0;
+
+    size_t records_size = file->header.num_days * sizeof(struct day_record);
+    struct day_record* records = malloc(records_size + 1);
+
+    if (pread(file->dir_fd, records, records_size, sizeof(struct binary_header)) != (ssize_t)records_size) {
+        free(records);
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < file->header.num_days; i++) {
+        file->live_size += records[i].capacity;
+    }
+    free(records);
+
+    return 0;
+}
+
+/*
+ * Copies every live slot into the next generation's heap and points a new
+ * directory at it. Returns 0 on success, -1 on failure, in which case the
+ * current files stay in use.
+ */
+int compact_heap(struct binary_file* file) {
+    size_t records_size = file->header.num_days * sizeof(struct day_record);
+    struct day_record* records = malloc(records_size + 1);
+
+    if (pread(file->dir_fd, records, records_size, sizeof(struct binary_header)) != (ssize_t)records_size) {
+        free(records);
+        return -1;
+    }
+
+    uint32_t generation = file->header.heap_generation + 1;
+    char* heap_path = get_heap_path(file->path, generation);
+    int heap_fd = open(heap_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+    int tmp_path_length = strlen(file->path) + 5;
+    char* tmp_path = malloc(sizeof(char) * tmp_path_length);
+    snprintf(tmp_path, tmp_path_length, "%s.tmp", file->path);
+    int dir_fd = -1;
+
+    char* buffer = NULL;
+    size_t buffer_size = 0;
+    uint64_t offset = 0;
+    bool failed = heap_fd < 0;
+
+    for (uint32_t i = 0; i < file->header.num_days && !failed; i++) {
+        if (records[i].capacity == 0) continue;
+
+        if (records[i].capacity > buffer_size) {
+            buffer_size = records[i].capacity;
+            buffer = realloc(buffer, buffer_size);
+        }
+
+        failed = pread(file->heap_fd, buffer, records[i].capacity, records[i].offset) != records[i].capacity ||
+            pwrite(heap_fd, buffer, records[i].capacity, offset) != records[i].capacity;
+
+        records[i].offset = offset;
+        offset += records[i].capacity;
+    }
+    free(buffer);
+
+    struct binary_header header = file->header;
+    header.heap_generation = generation;
+
+    if (!failed) {
+        // The heap has to be on disk before the directory that points at it
+        dir_fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        failed = dir_fd < 0 ||
+            fsync(heap_fd) != 0 ||
+            pwrite(dir_fd, &header, sizeof(header), 0) != sizeof(header) ||
+            pwrite(dir_fd, records, records_size, sizeof(header)) != (ssize_t)records_size ||
+            fsync(dir_fd) != 0 ||
+            rename(tmp_path, file->path) != 0;
+    }
+    free(records);
+
+    if (failed) {
+        if (heap_fd >= 0) close(heap_fd);
+        if (dir_fd >= 0) close(dir_fd);
+        unlink(heap_path);
+        unlink(tmp_path);
+        free(heap_path);
+        free(tmp_path);
+        return -1;
+    }
+
+    char* old_heap_path = get_heap_path(file->path, file->header.heap_generation);
+    unlink(old_heap_path);
+    free(old_heap_path);
+
+    close(file->dir_fd);
+    close(file->heap_fd);
+    file->dir_fd = dir_fd;
+    file->heap_fd = heap_fd;
+    file->header = header;
+    file->heap_size = offset;
+    file->live_size = offset;
+
+    free(heap_path);
+    free(tmp_path);
+
+    return 0;
+}
+
+char* get_heap_path(const char* path, uint32_t generation) {
+    int length = strlen(path) + strlen(HEAP_SUFFIX) + 12;
+    char* heap_path = malloc(sizeof(char) * length);
+
+    if (generation == 0) {
+        snprintf(heap_path, length, "%s%s", path, HEAP_SUFFIX);
+    } else {
+        snprintf(heap_path, length, "%s%s.%u", path, HEAP_SUFFIX, generation);
+    }
+
+    return heap_path;
+}
+
+/*
+ * Returns the day's events encoded for the heap, or NULL if a summary is
+ * too long for its length to be stored.
+ */
+char* encode_day(struct events events, uint32_t* length) {
+    *length = 0;
+    for (size_t i = 0; i < events.length; i++) {
+        size_t summary_length = strlen(events.events[i].summary);
+        if (summary_length > MAX_SUMMARY_LENGTH) return NULL;
+
+        *length += (events.events[i].duration > 0 ? 6 : 4) + summary_length;
+    }
+
+    char* buffer = malloc(*length > 0 ? *length : 1);
+    char* cursor = buffer;
+
+    for (size_t i = 0; i < events.length; i++) {
+        struct event event = events.events[i];
+        uint16_t summary_length = strlen(event.summary);
+
+        cursor[0] = (int8_t)event.hour;
+        cursor[1] = (int8_t)event.min;
+        memcpy(cursor + 2, &summary_length, sizeof(uint16_t));
+        cursor += 4;
+
+        if (event.duration > 0) {
+            uint16_t duration = event.duration;
+            cursor[-4] += HAS_END_FLAG;
+            memcpy(cursor, &duration, sizeof(uint16_t));
+            cursor += 2;
+        }
+
+        memcpy(cursor, event.summary, summary_length);
+        cursor += summary_length;
+    }
+
+    return buffer;
+}
+
+struct events decode_day(char* buffer, size_t length, int year, int month, int day) {
+    struct events events;
+    init_events(&events);
+
+    size_t offset = 0;
+    while (offset + 4 <= length) {
+        struct event event = {0};
+        event.year = year;
+        event.month = month;
+        event.day = day;
+        event.hour = (int8_t)buffer[offset];
+        event.min = (int8_t)buffer[offset + 1];
+
+        uint16_t summary_length;
+        memcpy(&summary_length, buffer + offset + 2, sizeof(uint16_t));
+        size_t header_length = 4;
+
+        if (event.hour >= HAS_END_FLAG) {
+            uint16_t duration;
+            if (offset + 6 > length) break;
+            memcpy(&duration, buffer + offset + 4, sizeof(uint16_t));
+
+            event.hour -= HAS_END_FLAG;
+            event.duration = duration;
+            header_length = 6;
+        }
+
+        if (offset + header_length + summary_length > length) break;
+
+        event.summary = strndup(buffer + offset + header_length, summary_length);
+        append_event(&events, event);
+        offset += header_length + summary_length;
+    }
+
+    return events;
+}
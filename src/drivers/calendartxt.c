@@ -1,19 +1,68 @@
 /*
  * calendartxt.c
  *
- * This file is a driver for interacting with calendar.txt. The
- * two main functions are get_events (for getting the event of
- * a given day).
+ * This file is a driver for interacting with a single calendar.txt
+ * file. The two main functions are read_day (for getting the events
+ * of a given day) and write_day (for replacing them). Each open file
+ * keeps a cache of the byte offset of every date line so lookups
+ * don't have to scan the whole file.
  *
+ * An event with an end time is written "HH:MM-HH:MM - summary". Other
+ * tools that only know "HH:MM - summary" read the end time as the start
+ * of the summary, so the line stays valid for them.
+ *
+ * The TUI, a sync running beside it and write_events.py can all write
+ * the same file. Writers take an flock on "<path>.lock" for the length of
+ * a write, and a day whose line no longer matches the day its update was
+ * made from is merged rather than overwritten.
  */
 
+#include <errno.h>
+#include <fcntl.h>
 #include <stdbool.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "calendartxt.h"
+#include "scanner.h"
+
+#define LOCK_SUFFIX ".lock"
+
+/*
+ * The offset cache while refresh_day_offsets builds it.
+ */
+struct offset_index {
+    struct day_offset* offsets;
+    size_t length;
+    size_t size;
+    bool sorted;
+};
+
+/*
+ * A write_days pass: the file being rewritten, how much of it has been
+ * copied to out and the updates sorted by date.
+ */
+struct day_writer {
+    FILE* out;
+    const char* text;
+    size_t length;
+    size_t copied;
+    struct day_update** sorted;
+    size_t count;
+};
 
-#define CALENDAR_TXT "/.calendar/calendar.txt"
+/*
+ * A read_range pass.
+ */
+struct range_reader {
+    int start_key;
+    int end_key;
+    day_callback callback;
+    void* data;
+};
 
 /*
  * Parses the string event from calendar.txt into a `struct event`
@@ -21,10 +70,95 @@
  */
 struct event parse_event(char* raw_event);
 
-char* get_calendar_path();
-int write_events(struct events events, int year, int month, int day);
+int parse_end_time(const char* text, int hour, int min);
+int day_offset_cmp(const void* a, const void* b);
+int day_update_cmp(const void* a, const void* b);
+struct day_update* find_day_update(struct day_update** sorted, size_t count, int date_key);
+struct events parse_day_line(const char* line, size_t length, int year, int month, int day);
+int add_day_offset(struct date_line* line, void* data);
+int rewrite_day_line(struct date_line* line, void* data);
+int read_range_line(struct date_line* line, void* data);
 int remove_event(struct events* events, struct event event);
 char* stringify_events(struct events events);
+double ms_since(struct timespec* since);
+bool is_indexed_file(struct calendar_file* file, struct stat* st);
+
+static struct calendar_lock_stats lock_stats = {0};
+
+void open_calendar_file(struct calendar_file* file, char* path) {
+    memset(file, 0, sizeof(struct calendar_file));
+    file->path = strdup(path);
+    file->lock_fd = -1;
+}
+
+void close_calendar_file(struct calendar_file* file) {
+    if (file->lock_fd >= 0) close(file->lock_fd);
+
+    free(file->path);
+    free(file->offsets);
+    memset(file, 0, sizeof(struct calendar_file));
+    file->lock_fd = -1;
+}
+
+int lock_calendar_file(struct calendar_file* file) {
+    if (file->lock_depth > 0) {
+        file->lock_depth++;
+        return 0;
+    }
+
+    int path_length = strlen(file->path) + strlen(LOCK_SUFFIX) + 1;
+    char* lock_path = malloc(path_length);
+    snprintf(lock_path, path_length, "%s%s", file->path, LOCK_SUFFIX);
+
+    int fd = open(lock_path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    free(lock_path);
+    if (fd < 0) return -1;
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while (flock(fd, LOCK_EX) != 0) {
+        if (errno != EINTR) {
+            close(fd);
+            return -1;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &file->locked_at);
+    double wait_ms = ms_since(&start);
+
+    lock_stats.locks++;
+    lock_stats.wait_ms += wait_ms;
+    if (wait_ms > lock_stats.max_wait_ms) lock_stats.max_wait_ms = wait_ms;
+
+    file->lock_fd = fd;
+    file->lock_depth = 1;
+
+    return 0;
+}
+
+void unlock_calendar_file(struct calendar_file* file) {
+    if (file->lock_depth == 0 || --file->lock_depth > 0) return;
+
+    double held_ms = ms_since(&file->locked_at);
+    lock_stats.held_ms += held_ms;
+    if (held_ms > lock_stats.max_held_ms) lock_stats.max_held_ms = held_ms;
+
+    // Closing the only descriptor releases the lock
+    close(file->lock_fd);
+    file->lock_fd = -1;
+}
+
+void get_calendar_lock_stats(struct calendar_lock_stats* stats) {
+    *stats = lock_stats;
+}
+
+double ms_since(struct timespec* since) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (now.tv_sec - since->tv_sec) * 1e3 + (now.tv_nsec - since->tv_nsec) / 1e6;
+}
 
 /**
  * Returns the events for the given date
@@ -32,43 +166,69 @@ char* stringify_events(struct events events);
  * Note: month and day are not 0 indexed
  * TODO: May want to validate the input to this function.
  */
-struct events get_events(int year, int month, int day) {
-    char search_str[20];
-    format_calendartxt_date(search_str, year, month, day);
+struct events read_day(struct calendar_file* file, int year, int month, int day) {
+    struct events events;
+    init_events(&events);
 
-    char* calendar_path = get_calendar_path();
+    // The file can be replaced between indexing it and opening it, so the
+    // offset is only used on the file it came from
+    FILE* calendar_file = NULL;
+    long offset = -1;
+    for (int attempt = 0; attempt < 3 && calendar_file == NULL; attempt++) {
+        if (refresh_day_offsets(file) != 0) return events;
+
+        offset = find_day_offset(file, DATE_KEY(year, month, day));
+        if (offset < 0) return events;
+
+        calendar_file = fopen(file->path, "r");
+        if (calendar_file == NULL) return events;
+
+        struct stat st;
+        if (fstat(fileno(calendar_file), &st) != 0 || !is_indexed_file(file, &st)) {
+            fclose(calendar_file);
+            calendar_file = NULL;
+        }
+    }
+    if (calendar_file == NULL) return events;
 
-    FILE* calendar_file = fopen(calendar_path, "r");
-    free(calendar_path);
-    calendar_path = NULL;
+    fseek(calendar_file, offset, SEEK_SET);
 
     char* line = NULL;
     size_t len = 0;
-    int read;
-
-    do {
-        read = getline(&line, &len, calendar_file);
-    } while (strstr(line, search_str) == NULL || read < 19);
+    int read = getline(&line, &len, calendar_file);
+    fclose(calendar_file);
 
-    if (read <= 21) {
-        // There are no events on this day.
-        struct events events;
-        init_events(&events);
-        return events;
+    if (read > 0 && line[read - 1] == '\n') read--;
+    if (read > 20) {
+        free_events(events);
+        events = parse_day_line(line, read, year, month, day);
     }
 
-    char* trimmed_line = malloc(sizeof(char) * read);
-    bzero(trimmed_line, sizeof(char) * read);
-    strcpy(trimmed_line, line + 20);
     free(line);
-    line = NULL;
+    return events;
+}
 
+/*
+ * Parses the events on a date line of length bytes, which doesn't have to
+ * end with a NUL. The line is not modified.
+ */
+struct events parse_day_line(const char* line, size_t length, int year, int month, int day) {
     struct events events;
     init_events(&events);
 
+    // The events start after "yyyy-mm-dd Www wNN  "
+    if (length <= 20) {
+        // There are no events on this day.
+        return events;
+    }
+
+    size_t events_length = length - 20;
+    char* trimmed_line = malloc(sizeof(char) * (events_length + 1));
+    memcpy(trimmed_line, line + 20, events_length);
+    trimmed_line[events_length] = '\0';
+
     char* token = strtok(trimmed_line, ",");
     while (token != NULL) {
-        // printf("%s\n", token);
         struct event event = parse_event(token);
         event.year = year;
         event.month = month;
@@ -78,12 +238,106 @@ struct events get_events(int year, int month, int day) {
         token = strtok(NULL, ",");
     }
     free(trimmed_line);
-    fclose(calendar_file);
     trimmed_line = NULL;
 
     return events;
 }
 
+int refresh_day_offsets(struct calendar_file* file) {
+    struct stat st;
+    if (stat(file->path, &st) != 0) return -1;
+
+    if (is_indexed_file(file, &st)) return 0;
+
+    struct file_block block;
+    if (open_file_block(file->path, &block) != 0) return -1;
+
+    struct offset_index index;
+    index.size = 512;
+    index.length = 0;
+    index.offsets = malloc(index.size * sizeof(struct day_offset));
+    index.sorted = true;
+
+    scan_date_lines(&block, 0, add_day_offset, &index);
+    close_file_block(&block);
+
+    if (!index.sorted) {
+        qsort(index.offsets, index.length, sizeof(struct day_offset), day_offset_cmp);
+    }
+
+    // The cache is for the file that was read, which may not be the one
+    // stat found if it was replaced in between
+    free(file->offsets);
+    file->offsets = index.offsets;
+    file->num_offsets = index.length;
+    file->ino = block.info.st_ino;
+    file->size = block.info.st_size;
+    file->mtime = block.info.st_mtim;
+
+    return 0;
+}
+
+/*
+ * Returns whether st is the file the offsets were read from.
+ */
+bool is_indexed_file(struct calendar_file* file, struct stat* st) {
+    return
+        file->offsets != NULL &&
+        file->ino == st->st_ino &&
+        file->size == st->st_size &&
+        file->mtime.tv_sec == st->st_mtim.tv_sec &&
+        file->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+/*
+ * A date_line_callback that appends the line's offset to an offset_index.
+ */
+int add_day_offset(struct date_line* line, void* data) {
+    struct offset_index* index = data;
+
+    if (index->length == index->size) {
+        index->size *= 2;
+        index->offsets = realloc(index->offsets, index->size * sizeof(struct day_offset));
+    }
+
+    index->offsets[index->length].date_key = line->date_key;
+    index->offsets[index->length].offset = line->offset;
+
+    if (index->length > 0 && index->offsets[index->length - 1].date_key > line->date_key) {
+        index->sorted = false;
+    }
+    index->length++;
+
+    return 0;
+}
+
+long find_day_offset(struct calendar_file* file, int date_key) {
+    size_t low = 0;
+    size_t high = file->num_offsets;
+
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (file->offsets[mid].date_key < date_key) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    if (low < file->num_offsets && file->offsets[low].date_key == date_key) {
+        return file->offsets[low].offset;
+    }
+
+    return -1;
+}
+
+int day_offset_cmp(const void* a, const void* b) {
+    const struct day_offset* offset_a = a;
+    const struct day_offset* offset_b = b;
+
+    return offset_a->date_key - offset_b->date_key;
+}
+
 struct event parse_event(char* raw_event) {
     struct event event = {0};
     int index = 0;
@@ -104,6 +358,8 @@ struct event parse_event(char* raw_event) {
         event.min = atoi(min);
 
         index += 3;
+        event.duration = parse_end_time(raw_event + index, event.hour, event.min);
+        if (event.duration > 0) index += 6;
     } else {
         event.hour = -1;
         event.min = -1;
@@ -125,73 +381,214 @@ struct event parse_event(char* raw_event) {
     return event;
 }
 
-int delete_event(struct event event) {
-    struct events events = get_events(event.year, event.month, event.day);
+/*
+ * Reads the "-HH:MM" that follows an event's start time, if there is one.
+ * Returns the minutes from the start to the end, or 0 without an end.
+ */
+int parse_end_time(const char* text, int hour, int min) {
+    // Stops at the first character that doesn't match, so never reads
+    // past the end of the string
+    const char* pattern = "-00:00";
+    for (int i = 0; pattern[i] != '\0'; i++) {
+        bool matches = pattern[i] == '0' ? text[i] >= '0' && text[i] <= '9' : text[i] == pattern[i];
+        if (!matches) return 0;
+    }
 
-    remove_event(&events, event);
-    if (write_events(events, event.year, event.month, event.day) != 0) return -1;
+    int end_hour = (text[1] - '0') * 10 + text[2] - '0';
+    int end_min = (text[4] - '0') * 10 + text[5] - '0';
+    if (end_hour > 23 || end_min > 59) return 0;
 
-    return 0;
+    // An end at or before the start is on the next day
+    int duration = (end_hour * 60 + end_min) - (hour * 60 + min);
+    if (duration <= 0) duration += 24 * 60;
+
+    return duration;
 }
 
-int add_event(struct event event, int year, int month, int day) {
-    struct events events = get_events(year, month, day);
-    insert_event(&events, event);
+int write_day(struct calendar_file* file, struct events events, int year, int month, int day) {
+    struct day_update update = {year, month, day, events};
+    return write_days(file, &update, 1);
+}
 
-    if (write_events(events, year, month, day) != 0) return -1;
+int write_days(struct calendar_file* file, struct day_update* updates, size_t count) {
+    if (count == 0) return 0;
 
-    return 0;
+    // Sorted by date so each line can be matched with a binary search
+    struct day_update** sorted = malloc(count * sizeof(struct day_update*));
+    for (size_t i = 0; i < count; i++) {
+        sorted[i] = updates + i;
+    }
+    qsort(sorted, count, sizeof(struct day_update*), day_update_cmp);
+
+    if (lock_calendar_file(file) != 0) {
+        free(sorted);
+        return -1;
+    }
+
+    int tmp_path_length = strlen(file->path) + 5;
+    char* tmp_path = malloc(sizeof(char) * tmp_path_length);
+    snprintf(tmp_path, tmp_path_length, "%s.tmp", file->path);
+
+    struct file_block block;
+    FILE* tmp = NULL;
+    bool opened = open_file_block(file->path, &block) == 0;
+    if (opened) tmp = fopen(tmp_path, "w");
+
+    if (tmp == NULL) {
+        if (opened) close_file_block(&block);
+        unlock_calendar_file(file);
+        free(tmp_path);
+        free(sorted);
+        return -1;
+    }
+
+    // Only the updated lines are written on their own, the runs of lines
+    // between them are copied straight from the file
+    struct day_writer writer = {tmp, block.data, block.length, 0, sorted, count};
+    scan_date_lines(&block, 0, rewrite_day_line, &writer);
+    fwrite(block.data + writer.copied, 1, block.length - writer.copied, tmp);
+
+    close_file_block(&block);
+    int result = fclose(tmp) == 0 && rename(tmp_path, file->path) == 0 ? 0 : -1;
+
+    if (result != 0) remove(tmp_path);
+    unlock_calendar_file(file);
+
+    free(tmp_path);
+    free(sorted);
+
+    return result;
 }
 
-int write_events(struct events events, int year, int month, int day) {
-    char search_str[20] = "\0";
-    format_calendartxt_date(search_str, year, month, day);
+/*
+ * A date_line_callback that writes a day's new line in place of the old
+ * one if the day has an update.
+ */
+int rewrite_day_line(struct date_line* line, void* data) {
+    struct day_writer* writer = data;
 
-    char* calendar_path = get_calendar_path();
-    FILE* calendar_file = fopen(calendar_path, "r");
-    FILE* tmp = fopen("tmp.txt", "w");
+    if (line->length < 18) return 0;
 
-    if (calendar_file == NULL || tmp == NULL) return -1;
+    struct day_update* update = find_day_update(writer->sorted, writer->count, line->date_key);
+    if (update == NULL) return 0;
 
-    char* line = NULL;
-    size_t len;
-    int read;
+    fwrite(writer->text + writer->copied, 1, line->offset - writer->copied, writer->out);
 
-    char* str_events = stringify_events(events);
+    // The line is the day's generation: if it isn't what the update was
+    // made from, someone else has written to the day since
+    struct events events = update->events;
+    bool merged = false;
+    if (update->base != NULL) {
+        struct events current = parse_day_line(line->text, line->length, update->year, update->month, update->day);
 
-    do {
-        read = getline(&line, &len, calendar_file);
-        if (strstr(line, search_str) != NULL) {
-            char header[30] = "\0";
-            for (int i = 0; i < 18; i++) {
-                header[i] = line[i];
-            }
+        if (!events_match(&current, update->base)) {
+            events = merge_day_change(update->base, &update->events, &current);
+            merged = true;
+            lock_stats.merged_days++;
+        }
+        free_events(current);
+    }
 
-            fprintf(tmp, "%s  %s\n", header, str_events);
+    // "yyyy-mm-dd Www wNN" is kept as it is
+    fwrite(line->text, 1, 18, writer->out);
+    if (events.length == 0) {
+        fputc('\n', writer->out);
+    } else {
+        char* str_events = stringify_events(events);
+        fprintf(writer->out, "  %s\n", str_events);
+        free(str_events);
+    }
+
+    if (merged) free_events(events);
+
+    // A last line without a line break gets one, as it always has
+    writer->copied = line->offset + line->length + 1;
+    if (writer->copied > writer->length) writer->copied = writer->length;
+
+    return 0;
+}
 
+int read_range(struct calendar_file* file, int start_key, int end_key, day_callback callback, void* data) {
+    if (refresh_day_offsets(file) != 0) return -1;
+
+    // Find the first line on or after start_key
+    size_t low = 0;
+    size_t high = file->num_offsets;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (file->offsets[mid].date_key < start_key) {
+            low = mid + 1;
         } else {
-            fprintf(tmp, "%s", line);
+            high = mid;
         }
-    } while (read >= 0);
+    }
 
-    fclose(calendar_file);
-    fclose(tmp);
-    remove(calendar_path);
-    rename("tmp.txt", calendar_path);
+    if (low == file->num_offsets) return 0;
 
-    free(line);
-    free(calendar_path);
-    free(str_events);
+    struct file_block block;
+    if (open_file_block(file->path, &block) != 0) return -1;
 
-    line = NULL;
-    calendar_path = NULL;
-    str_events = NULL;
+    // If the file was replaced since the cache was built the offset means
+    // nothing, so it's scanned from the start
+    size_t offset = file->offsets[low].offset;
+    if (block.info.st_ino != file->ino || block.info.st_size != file->size) offset = 0;
 
-    free_events(events);
+    struct range_reader reader = {start_key, end_key, callback, data};
+    scan_date_lines(&block, offset, read_range_line, &reader);
+    close_file_block(&block);
 
     return 0;
 }
 
+/*
+ * A date_line_callback that passes a day in the range on to the
+ * range_reader's callback. Stops at the first day after the range.
+ */
+int read_range_line(struct date_line* line, void* data) {
+    struct range_reader* reader = data;
+
+    if (line->date_key < reader->start_key) return 0;
+    if (line->date_key > reader->end_key) return 1;
+
+    int year = line->date_key / 10000;
+    int month = line->date_key / 100 % 100;
+    int day = line->date_key % 100;
+
+    struct events events = parse_day_line(line->text, line->length, year, month, day);
+    int result = reader->callback(year, month, day, &events, reader->data);
+    free_events(events);
+
+    return result;
+}
+
+int day_update_cmp(const void* a, const void* b) {
+    const struct day_update* update_a = *(const struct day_update**)a;
+    const struct day_update* update_b = *(const struct day_update**)b;
+
+    return DATE_KEY(update_a->year, update_a->month, update_a->day)
+        - DATE_KEY(update_b->year, update_b->month, update_b->day);
+}
+
+struct day_update* find_day_update(struct day_update** sorted, size_t count, int date_key) {
+    size_t low = 0;
+    size_t high = count;
+
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        int key = DATE_KEY(sorted[mid]->year, sorted[mid]->month, sorted[mid]->day);
+
+        if (key == date_key) return sorted[mid];
+
+        if (key < date_key) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    return NULL;
+}
+
 char* stringify_events(struct events events) {
     int length = 100;
     for (int i = 0; i < events.length; i++) {
@@ -201,11 +598,11 @@ char* stringify_events(struct events events) {
         if (event.hour == -1) {
             length += 7;
         } else {
-            length += 5;
+            length += event.duration > 0 ? 11 : 5;
         }
 
-        // space for the hyphen
-        length += 3;
+        // space for the hyphen and the comma after the event
+        length += 4;
         length += strlen(event.summary);
     }
 
@@ -219,8 +616,8 @@ char* stringify_events(struct events events) {
         if (write_index >= length) {
             return str_events;
         }
-        char time[10];
-        format_time(time, event.hour, event.min);
+        char time[12];
+        format_time_range(time, event);
         if (i < events.length - 1) {
             sprintf(str_events + write_index, "%s - %s,", time, event.summary);
         } else {
@@ -242,6 +639,7 @@ int find_event(struct events* events, struct event event) {
         if (cur_event.day != event.day) continue;
         if (cur_event.hour != event.hour) continue;
         if (cur_event.min != event.min) continue;
+        if (cur_event.duration != event.duration) continue;
         if (strcmp(cur_event.summary, event.summary) != 0) continue;
 
         return i;
@@ -249,10 +647,44 @@ int find_event(struct events* events, struct event event) {
     return -1;
 }
 
+bool events_match(struct events* a, struct events* b) {
+    if (a->length != b->length) return false;
+
+    for (size_t i = 0; i < a->length; i++) {
+        struct event* event_a = &a->events[i];
+        struct event* event_b = &b->events[i];
+
+        if (event_a->hour != event_b->hour || event_a->min != event_b->min) return false;
+        if (event_a->duration != event_b->duration) return false;
+        if (strcmp(event_a->summary, event_b->summary) != 0) return false;
+    }
+
+    return true;
+}
+
+struct events merge_day_change(struct events* base, struct events* ours, struct events* theirs) {
+    struct events merged = copy_events(*theirs);
+
+    for (size_t i = 0; i < base->length; i++) {
+        if (find_event(ours, base->events[i]) < 0) remove_event(&merged, base->events[i]);
+    }
+
+    for (size_t i = 0; i < ours->length; i++) {
+        struct event event = ours->events[i];
+        if (find_event(base, event) >= 0 || find_event(&merged, event) >= 0) continue;
+
+        event.summary = strdup(event.summary);
+        insert_event(&merged, event);
+    }
+
+    return merged;
+}
+
 int remove_event(struct events* events, struct event event) {
     int index = find_event(events, event);
     if (index < 0) return index;
 
+    free(events->events[index].summary);
     events->length--;
     for (int i = index; i < events->length; i++) {
         events->events[i] = events->events[i + 1];
@@ -280,13 +712,10 @@ void append_event(struct events* events, struct event new_event) {
     if (events->length == events->size) {
         struct event* longer_events = malloc(2 * events->size * sizeof(struct event));
 
-        // printf("events->length = %zu\n", events->length);
+        // The summaries are owned by the events, so only the array is freed
         for (int i = 0; i < events->length; i++) {
             longer_events[i] = events->events[i];
-            // printf("running line %d\n", __LINE__);
-            free(events->events[i].summary);
         }
-        // printf("running line %d\n", __LINE__);
         free(events->events);
 
         events->size *= 2;
@@ -303,6 +732,20 @@ void init_events(struct events* events) {
     events->events = malloc(events->size * sizeof(struct event));
 }
 
+struct events copy_events(struct events events) {
+    struct events copy;
+    copy.length = events.length;
+    copy.size = events.size > 0 ? events.size : 10;
+    copy.events = malloc(copy.size * sizeof(struct event));
+
+    for (size_t i = 0; i < events.length; i++) {
+        copy.events[i] = events.events[i];
+        copy.events[i].summary = strdup(events.events[i].summary);
+    }
+
+    return copy;
+}
+
 void free_events(struct events events) {
     for (int i = 0; i < events.length; i++) {
         free(events.events[i].summary);
@@ -340,6 +783,15 @@ void format_time(char* buffer, int hour, int min) {
     }
 }
 
+void format_time_range(char* buffer, struct event event) {
+    format_time(buffer, event.hour, event.min);
+    if (event.hour == -1 || event.duration <= 0) return;
+
+    int end = (event.hour * 60 + event.min + event.duration) % (24 * 60);
+    buffer[5] = '-';
+    format_time(buffer + 6, end / 60, end % 60);
+}
+
 void format_calendartxt_date(char* buffer, int year, int month, int day) {
     if (month >= 10 && day >= 10) {
         sprintf(buffer, "%d-%d-%d", year, month, day);
@@ -352,18 +804,10 @@ void format_calendartxt_date(char* buffer, int year, int month, int day) {
     }
 }
 
-char* get_calendar_path() {
-    char* home_dir = getenv("HOME");
-    if (home_dir == NULL) {
-        exit(1);
+uint64_t hash_bytes(uint64_t hash, const char* text, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ (unsigned char)text[i]) * 1099511628211ULL;
     }
 
-    int length = strlen(home_dir) + strlen(CALENDAR_TXT) + 100;
-    char* calendar_path = malloc(sizeof(char) * length);
-    memset(calendar_path, 0, sizeof(char) * length);
-    strcpy(calendar_path, home_dir);
-    strcat(calendar_path, CALENDAR_TXT);
-
-    return calendar_path;
+    return hash;
 }
-
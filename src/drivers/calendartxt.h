@@ -1,7 +1,18 @@
 #ifndef CALENDARTXT_H
 #define CALENDARTXT_H
 
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+
+// Packs a date into a single sortable int: yyyymmdd
+#define DATE_KEY(year, month, day) ((year) * 10000 + (month) * 100 + (day))
+
+// Events that end on the next day have minutes past midnight, so an end
+// time can only be up to a day after the start
+#define MAX_EVENT_DURATION (24 * 60 - 1)
 
 // for all day events, hour == min == -1
 struct event {
@@ -11,6 +22,9 @@ struct event {
   int hour;
   int min;
   char* summary;
+  int source; // index of the calendar the event was read from
+  int duration; // minutes until the end time, 0 if the event doesn't have one
+  int recurrence; // id of the repeating event this is an occurrence of, 0 if it's stored on the day
 };
 
 struct events {
@@ -20,19 +34,120 @@ struct events {
 };
 
 /*
- * Gets an array of all the events for a given day from calendar.txt
+ * A change to a whole day, used to apply many edits at once. If base is
+ * set, it's the day the events were made from. When the day has changed
+ * since then (e.g. a sync wrote to it), the change from base to events is
+ * applied to the day as it is now instead of replacing it.
+ */
+struct day_update {
+  int year;
+  int month;
+  int day;
+  struct events events;
+  struct events* base;
+};
+
+/*
+ * Called for every stored day in a range. The events belong to the
+ * caller of the callback and are freed once it returns. Returning
+ * non-zero stops the iteration.
+ */
+typedef int (*day_callback)(int year, int month, int day, struct events* events, void* data);
+
+struct day_offset {
+  int date_key;
+  long offset;
+};
+
+/*
+ * A calendar.txt file on disk along with its read cache. The cache maps
+ * every date to the byte offset of its line and is rebuilt whenever the
+ * file's inode, size or mtime changes.
+ */
+struct calendar_file {
+  char* path;
+  struct day_offset* offsets;
+  size_t num_offsets;
+  ino_t ino;
+  off_t size;
+  struct timespec mtime;
+
+  int lock_fd; // the open lock file while it's locked, otherwise -1
+  int lock_depth;
+  struct timespec locked_at;
+};
+
+/*
+ * How long this process has waited for and held calendar locks, and how
+ * many days were merged because another writer changed them first.
+ */
+struct calendar_lock_stats {
+  long locks;
+  double wait_ms;
+  double max_wait_ms;
+  double held_ms;
+  double max_held_ms;
+  long merged_days;
+};
+
+void open_calendar_file(struct calendar_file* file, char* path);
+void close_calendar_file(struct calendar_file* file);
+
+/*
+ * Takes the advisory lock every writer of the file holds while it writes
+ * (an flock on "<path>.lock", which write_events.py takes as well). It
+ * can be taken again by the same holder and is released by the matching
+ * number of unlocks. Readers don't need it: the file is only ever
+ * replaced with a rename or appended to. Returns 0 on success, -1 if the
+ * lock file can't be opened.
+ */
+int lock_calendar_file(struct calendar_file* file);
+void unlock_calendar_file(struct calendar_file* file);
+
+void get_calendar_lock_stats(struct calendar_lock_stats* stats);
+
+/*
+ * Rebuilds the date -> line offset cache if the file has changed since it
+ * was last built. Returns 0 on success, -1 if the file can't be read.
+ */
+int refresh_day_offsets(struct calendar_file* file);
+
+/*
+ * Binary searches the offset cache. Returns -1 if the date has no line.
+ */
+long find_day_offset(struct calendar_file* file, int date_key);
+
+/*
+ * Gets an array of all the events for a given day from the file. The
+ * array is empty if the file has no line for the date.
  */
-struct events get_events(int year, int month, int day);
+struct events read_day(struct calendar_file* file, int year, int month, int day);
 
 /*
- * Writes the event to calendar.txt. Returns 0 on success, -1 on failure.
+ * Replaces the events on the given day's line. The events are not freed.
+ * Returns 0 on success, -1 on failure.
  */
-int add_event(struct event event, int year, int month, int day);
+int write_day(struct calendar_file* file, struct events events, int year, int month, int day);
 
 /*
- * Deletes an event from calendar.txt. Returns 0 on success, -1 on failure.
+ * Replaces the events on every day in updates with a single pass over the
+ * file, merging the days that changed since their base was read (see
+ * struct day_update). Days without a line are skipped. Returns 0 on
+ * success, -1 on failure.
  */
-int delete_event(struct event event);
+int write_days(struct calendar_file* file, struct day_update* updates, size_t count);
+
+/*
+ * Calls callback for every date line from start_key to end_key inclusive.
+ * Returns 0 on success, -1 if the file can't be read.
+ */
+int read_range(struct calendar_file* file, int start_key, int end_key, day_callback callback, void* data);
+
+/*
+ * Parses one event as it's written on a date line, e.g.
+ * "09:00-10:00 - Planning". Trailing newlines are removed from raw_event.
+ */
+struct event parse_event(char* raw_event);
 
 /*
  * Inializes an empty events array with initial size of 10
@@ -45,6 +160,11 @@ void init_events(struct events* events);
  */
 int find_event(struct events* events, struct event event);
 
+/*
+ * Removes (and frees) the first occurence of event in events. Returns -1 if not found.
+ */
+int remove_event(struct events* events, struct event event);
+
 /*
  * Adds the event to the end of the events array
  */
@@ -55,6 +175,23 @@ void append_event(struct events* events, struct event new_event);
  */
 void insert_event(struct events* events, struct event new_event);
 
+/*
+ * Returns true if both have the same events in the same order.
+ */
+bool events_match(struct events* a, struct events* b);
+
+
+/*
+ * Returns theirs with the change from base to ours applied: the events
+ * ours removed from base are removed and the ones it added are added.
+ * Nothing is freed.
+ */
+struct events merge_day_change(struct events* base, struct events* ours, struct events* theirs);
+
+/*
+ * Returns a deep copy of events
+ */
+struct events copy_events(struct events events);
 
 /*
  * Frees the fields that are dynamically allocated in get events
@@ -81,4 +218,19 @@ void format_calendartxt_date(char* buffer, int year, int month, int day);
  */
 void format_time(char* buffer, int hour, int min);
 
+/*
+ * Formats an event's start and end like so: "HH:MM-HH:MM", or just the
+ * start (see format_time) if it has no end time.
+ *
+ * Note: `buffer` should be at least 12 characters long.
+ */
+void format_time_range(char* buffer, struct event event);
+
+/*
+ * FNV-1a over length bytes of text, continuing from hash. Start from
+ * HASH_SEED.
+ */
+#define HASH_SEED 14695981039346656037ULL
+uint64_t hash_bytes(uint64_t hash, const char* text, size_t length);
+
 #endif
@@ -0,0 +1,72 @@
+/*
+ * chunks.c
+ *
+ * The work queue behind parsing a mapped file on several threads. The
+ * file is cut into chunks at places where parsing can start from scratch
+ * (BEGIN:VEVENT lines in an ICS file, any line in calendar.txt), and each
+ * thread takes the next chunk under a lock until they've all been taken.
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include "chunks.h"
+
+#define CHUNKS_PER_THREAD 4
+
+int get_num_threads(int num_threads, int max_threads) {
+    if (num_threads <= 0) num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (num_threads < 1) num_threads = 1;
+    if (num_threads > max_threads) num_threads = max_threads;
+
+    return num_threads;
+}
+
+void init_chunk_queue(struct chunk_queue* queue, const char* text, size_t length, int num_threads, size_t min_chunk, chunk_boundary boundary) {
+    size_t num_chunks = num_threads * CHUNKS_PER_THREAD;
+    if (num_chunks > length / min_chunk) num_chunks = length / min_chunk;
+    if (num_chunks < 1) num_chunks = 1;
+
+    queue->text = text;
+    queue->chunks = calloc(num_chunks, sizeof(struct text_chunk));
+    queue->num_chunks = 0;
+    queue->next_chunk = 0;
+    queue->stopped = false;
+    pthread_mutex_init(&queue->lock, NULL);
+
+    size_t start = 0;
+    for (size_t i = 1; i <= num_chunks && start < length; i++) {
+        size_t end = i == num_chunks ? length : boundary(text, length, length / num_chunks * i);
+        if (end <= start) continue;
+
+        queue->chunks[queue->num_chunks].start = text + start;
+        queue->chunks[queue->num_chunks].length = end - start;
+        queue->num_chunks++;
+
+        start = end;
+    }
+}
+
+struct text_chunk* take_chunk(struct chunk_queue* queue) {
+    struct text_chunk* chunk = NULL;
+
+    pthread_mutex_lock(&queue->lock);
+    if (!queue->stopped && queue->next_chunk < queue->num_chunks) {
+        chunk = &queue->chunks[queue->next_chunk++];
+    }
+    pthread_mutex_unlock(&queue->lock);
+
+    return chunk;
+}
+
+void stop_chunk_queue(struct chunk_queue* queue) {
+    pthread_mutex_lock(&queue->lock);
+    queue->stopped = true;
+    pthread_mutex_unlock(&queue->lock);
+}
+
+void free_chunk_queue(struct chunk_queue* queue) {
+    free(queue->chunks);
+    queue->chunks = NULL;
+    queue->num_chunks = 0;
+    pthread_mutex_destroy(&queue->lock);
+}
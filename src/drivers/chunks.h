@@ -0,0 +1,63 @@
+#ifndef CHUNKS_H
+#define CHUNKS_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Returns the offset of the first place after from that a chunk may
+ * start at, or length if there isn't one.
+ */
+typedef size_t (*chunk_boundary)(const char* text, size_t length, size_t from);
+
+/*
+ * A run of text that is worked on as a whole.
+ */
+struct text_chunk {
+    const char* start;
+    size_t length;
+};
+
+/*
+ * Text cut into chunks that threads take one at a time, in order, until
+ * there are none left or the queue is stopped.
+ */
+struct chunk_queue {
+    const char* text;
+    struct text_chunk* chunks;
+    size_t num_chunks;
+    size_t next_chunk;
+    bool stopped;
+    pthread_mutex_t lock;
+};
+
+/*
+ * Returns the number of threads to use when num_threads were asked for:
+ * 0 is one per core, and it's kept between 1 and max_threads.
+ */
+int get_num_threads(int num_threads, int max_threads);
+
+/*
+ * Cuts length bytes of text into chunks of about the same size for
+ * num_threads threads, each starting at a boundary apart from the first.
+ * There are a few per thread so threads that finish early take more of
+ * the work, but none is smaller than min_chunk unless the whole text is.
+ */
+void init_chunk_queue(struct chunk_queue* queue, const char* text, size_t length, int num_threads, size_t min_chunk, chunk_boundary boundary);
+
+/*
+ * Returns the next chunk nobody has taken yet, or NULL once they've all
+ * been taken or the queue was stopped. Its index is its offset from
+ * queue->chunks.
+ */
+struct text_chunk* take_chunk(struct chunk_queue* queue);
+
+/*
+ * Makes take_chunk return NULL from now on.
+ */
+void stop_chunk_queue(struct chunk_queue* queue);
+
+void free_chunk_queue(struct chunk_queue* queue);
+
+#endif
@@ -6,30 +6,102 @@
  * It uses the following basic syntax:
  *
  * key=value
+ *
+ * Keys that hold a list (like calendar) may be repeated. Every key is
+ * described in config_keys along with its type, so the file is parsed
+ * straight into the typed Config and anything unknown is reported as a
+ * warning. The parsed config is cached by get_config and only re-read
+ * when the file changes (watched with inotify) or on SIGHUP.
  * */
 
 #include "config.h"
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/inotify.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
+enum config_type {
+    CONFIG_STRING,
+    CONFIG_INT,
+    CONFIG_BOOL,
+    CONFIG_LIST,
+};
+
+struct config_key {
+    const char* name;
+    enum config_type type;
+    size_t offset;
+    int min; // smallest allowed value for CONFIG_INT keys
+};
+
+static const struct config_key config_keys[] = {
+    {"remote_url", CONFIG_STRING, offsetof(Config, remote_url), 0},
+    {"calendar", CONFIG_LIST, offsetof(Config, calendars), 0},
+    {"default_calendar", CONFIG_STRING, offsetof(Config, default_calendar), 0},
+    {"storage", CONFIG_STRING, offsetof(Config, storage), 0},
+    {"timezone", CONFIG_STRING, offsetof(Config, timezone), 0},
+    {"work_hours", CONFIG_STRING, offsetof(Config, work_hours), 0},
+    {"undo_depth", CONFIG_INT, offsetof(Config, undo_depth), 1},
+    {"undo_memory", CONFIG_INT, offsetof(Config, undo_memory), 1},
+    {"cache_size", CONFIG_INT, offsetof(Config, cache_size), 0},
+    {"prefetch_window", CONFIG_INT, offsetof(Config, prefetch_window), 0},
+    {"sync_interval", CONFIG_INT, offsetof(Config, sync_interval), 0},
+    {"compaction_threshold", CONFIG_INT, offsetof(Config, compaction_threshold), 1},
+    {"compaction_min_size", CONFIG_INT, offsetof(Config, compaction_min_size), 0},
+    {"parse_threads", CONFIG_INT, offsetof(Config, parse_threads), 0},
+    {"trace", CONFIG_BOOL, offsetof(Config, trace), 0},
+    {"reminders", CONFIG_BOOL, offsetof(Config, reminders), 0},
+    {"reminder_minutes", CONFIG_INT, offsetof(Config, reminder_minutes), 0},
+    {"reminder_command", CONFIG_STRING, offsetof(Config, reminder_command), 0},
+};
+
+#define NUM_CONFIG_KEYS (sizeof(config_keys) / sizeof(config_keys[0]))
+
+static Config config;
+static bool config_loaded = false;
+static int config_generation = 0;
+
+static int watch_fd = -1;
+static volatile sig_atomic_t hangup = 0;
 
 void config_exists(char* dir);
+void parse_line(Config* config, char* line, int line_number);
+void add_warning(Config* config, int line_number, const char* format, const char* value);
+char* trim(char* text);
+void handle_hangup(int signal);
 
 Config read_config() {
     Config config = {0};
+    config.undo_depth = DEFAULT_UNDO_DEPTH;
+    config.undo_memory = DEFAULT_UNDO_MEMORY;
+    config.cache_size = DEFAULT_CACHE_SIZE;
+    config.prefetch_window = DEFAULT_PREFETCH_WINDOW;
+    config.sync_interval = DEFAULT_SYNC_INTERVAL;
+    config.compaction_threshold = DEFAULT_COMPACTION_THRESHOLD;
+    config.compaction_min_size = DEFAULT_COMPACTION_MIN_SIZE;
+    config.parse_threads = DEFAULT_PARSE_THREADS;
+    config.trace = DEFAULT_TRACE;
+    config.reminders = DEFAULT_REMINDERS;
+    config.reminder_minutes = DEFAULT_REMINDER_MINUTES;
 
     char* home = getenv("HOME");
-    char* config_path = malloc(sizeof(char) * (strlen(home) + strlen(CONFIG_DIR) + strlen(CONFIG_FILE) + 5));
-    memset(config_path, '\0', sizeof(char) * (strlen(home) + strlen(CONFIG_DIR) + strlen(CONFIG_FILE) + 5));
-    sprintf(config_path, "%s%s", home, CONFIG_DIR);
+    if (home == NULL) return config;
+
+    int length = strlen(home) + strlen(CONFIG_DIR) + strlen(CONFIG_FILE) + 1;
+    char* config_path = malloc(sizeof(char) * length);
+    snprintf(config_path, length, "%s%s", home, CONFIG_DIR);
 
     config_exists(config_path);
-    sprintf(config_path, "%s%s", config_path, CONFIG_FILE); 
+    snprintf(config_path, length, "%s%s%s", home, CONFIG_DIR, CONFIG_FILE);
 
     FILE* config_file = fopen(config_path, "r");
 
@@ -39,19 +111,12 @@ Config read_config() {
 
     char* line = NULL;
     size_t len = 0;
-    int read;
-
-    do {
-        read = getline(&line, &len, config_file);
+    int line_number = 0;
 
-        
-        if (strstr(line, "remote_url")) {
-            config.remote_url = strdup(line + strlen("remote_url") + 1);
-            if (config.remote_url[strlen(config.remote_url) - 1] == '\n') {
-                config.remote_url[strlen(config.remote_url) - 1] = '\0';
-            }
-        }
-    } while (read > 0);
+    while (getline(&line, &len, config_file) > 0) {
+        line_number++;
+        parse_line(&config, line, line_number);
+    }
 
     free(line);
     fclose(config_file);
@@ -59,6 +124,207 @@ Config read_config() {
     return config;
 }
 
+void free_config(Config config) {
+    free(config.remote_url);
+    free(config.default_calendar);
+    free(config.storage);
+    free(config.timezone);
+    free(config.work_hours);
+    free(config.reminder_command);
+
+    for (int i = 0; i < config.num_calendars; i++) {
+        free(config.calendars[i]);
+    }
+    free(config.calendars);
+
+    for (int i = 0; i < config.num_warnings; i++) {
+        free(config.warnings[i]);
+    }
+    free(config.warnings);
+}
+
+const Config* get_config() {
+    if (!config_loaded) {
+        config = read_config();
+        config_loaded = true;
+    }
+
+    return &config;
+}
+
+int get_config_generation() {
+    return config_generation;
+}
+
+int watch_config() {
+    if (watch_fd >= 0) return watch_fd;
+
+    struct sigaction action = {0};
+    action.sa_handler = handle_hangup;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGHUP, &action, NULL);
+
+    char* home = getenv("HOME");
+    if (home == NULL) return -1;
+
+    watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watch_fd < 0) return -1;
+
+    // Editors usually save by renaming a new file over the old one, so
+    // the directory is watched rather than the file
+    char dir[4096];
+    snprintf(dir, sizeof(dir), "%s%s", home, CONFIG_DIR);
+
+    if (inotify_add_watch(watch_fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE) < 0) {
+        close(watch_fd);
+        watch_fd = -1;
+    }
+
+    return watch_fd;
+}
+
+bool config_reload_pending() {
+    if (hangup) return true;
+    if (watch_fd < 0) return false;
+
+    // Other files in the directory wake it too, reload_config tells them apart
+    struct pollfd fd = {.fd = watch_fd, .events = POLLIN};
+    return poll(&fd, 1, 0) > 0;
+}
+
+bool reload_config() {
+    bool changed = hangup;
+    hangup = 0;
+
+    if (watch_fd >= 0) {
+        char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+        ssize_t length;
+
+        while ((length = read(watch_fd, buffer, sizeof(buffer))) > 0) {
+            for (char* cursor = buffer; cursor < buffer + length;) {
+                struct inotify_event* event = (struct inotify_event*)cursor;
+                if (event->len > 0 && strcmp(event->name, CONFIG_FILE) == 0) changed = true;
+
+                cursor += sizeof(struct inotify_event) + event->len;
+            }
+        }
+    }
+
+    if (!changed) return false;
+
+    Config fresh = read_config();
+    if (config_loaded) free_config(config);
+    config = fresh;
+    config_loaded = true;
+    config_generation++;
+
+    return true;
+}
+
+void print_config_warnings(FILE* out) {
+    const Config* config = get_config();
+
+    for (int i = 0; i < config->num_warnings; i++) {
+        fprintf(out, "calenter: %s\n", config->warnings[i]);
+    }
+}
+
+/*
+ * Parses a "key=value" line into the matching field. Blank lines and
+ * lines starting with # are skipped.
+ * */
+void parse_line(Config* config, char* line, int line_number) {
+    char* text = trim(line);
+    if (*text == '\0' || *text == '#') return;
+
+    char* equals = strchr(text, '=');
+    if (equals == NULL) {
+        add_warning(config, line_number, "expected key=value but got \"%s\"", text);
+        return;
+    }
+
+    *equals = '\0';
+    char* key = trim(text);
+    char* value = trim(equals + 1);
+
+    const struct config_key* config_key = NULL;
+    for (size_t i = 0; i < NUM_CONFIG_KEYS; i++) {
+        if (strcmp(config_keys[i].name, key) == 0) config_key = &config_keys[i];
+    }
+
+    if (config_key == NULL) {
+        add_warning(config, line_number, "unknown key \"%s\"", key);
+        return;
+    }
+
+    void* field = (char*)config + config_key->offset;
+
+    switch (config_key->type) {
+        case CONFIG_STRING: {
+            char** string = field;
+            free(*string);
+            *string = strdup(value);
+            break;
+        }
+        case CONFIG_INT: {
+            char* end;
+            errno = 0;
+            long number = strtol(value, &end, 10);
+
+            if (*value == '\0' || *end != '\0' || errno != 0 || number < config_key->min || number > 1000000) {
+                add_warning(config, line_number, "invalid number \"%s\"", value);
+                break;
+            }
+            *(int*)field = number;
+            break;
+        }
+        case CONFIG_BOOL: {
+            bool* flag = field;
+            if (strcasecmp(value, "on") == 0 || strcasecmp(value, "true") == 0 || strcmp(value, "1") == 0) {
+                *flag = true;
+            } else if (strcasecmp(value, "off") == 0 || strcasecmp(value, "false") == 0 || strcmp(value, "0") == 0) {
+                *flag = false;
+            } else {
+                add_warning(config, line_number, "expected on or off but got \"%s\"", value);
+            }
+            break;
+        }
+        case CONFIG_LIST: {
+            config->calendars = realloc(config->calendars, sizeof(char*) * (config->num_calendars + 1));
+            config->calendars[config->num_calendars] = strdup(value);
+            config->num_calendars++;
+            break;
+        }
+    }
+}
+
+void add_warning(Config* config, int line_number, const char* format, const char* value) {
+    char message[512];
+    int length = snprintf(message, sizeof(message), "config line %d: ", line_number);
+    snprintf(message + length, sizeof(message) - length, format, value);
+
+    config->warnings = realloc(config->warnings, sizeof(char*) * (config->num_warnings + 1));
+    config->warnings[config->num_warnings] = strdup(message);
+    config->num_warnings++;
+}
+
+/*
+ * Strips leading and trailing whitespace (including the newline) in place.
+ * */
+char* trim(char* text) {
+    while (*text == ' ' || *text == '\t') text++;
+
+    size_t length = strlen(text);
+    while (length > 0 && strchr(" \t\r\n", text[length - 1]) != NULL) length--;
+    text[length] = '\0';
+
+    return text;
+}
+
+void handle_hangup(int signal) {
+    hangup = 1;
+}
+
 
 void config_exists(char* dir) {
     struct stat st;
@@ -69,7 +335,7 @@ void config_exists(char* dir) {
         memset(abs_path, '\0', sizeof(char) * (strlen(dir) + strlen(CONFIG_FILE) + 5));
         sprintf(abs_path, "%s%s", dir, CONFIG_FILE);
         FILE* tmp = fopen(abs_path, "w");
-        fclose(tmp);
+        if (tmp != NULL) fclose(tmp);
         free(abs_path);
     }
 }
@@ -1,16 +1,123 @@
 #ifndef CONFIG_H
 #define CONFIG_H
 
+#include <stdbool.h>
+#include <stdio.h>
+
 #define CONFIG_DIR "/.config/calenter/"
 #define CONFIG_FILE "config"
 
+#define DEFAULT_UNDO_DEPTH 100
+#define DEFAULT_UNDO_MEMORY 1024
+#define DEFAULT_CACHE_SIZE 128
+#define DEFAULT_PREFETCH_WINDOW 7
+#define DEFAULT_SYNC_INTERVAL 0
+#define DEFAULT_COMPACTION_THRESHOLD 50
+#define DEFAULT_COMPACTION_MIN_SIZE 256
+#define DEFAULT_PARSE_THREADS 0
+#define DEFAULT_TRACE true
+#define DEFAULT_REMINDERS false
+#define DEFAULT_REMINDER_MINUTES 10
+#define DEFAULT_REMINDER_COMMAND "notify-send"
+
 
 typedef struct _config {
     char* remote_url;
+
+    // One entry per `calendar=` line, in the order they appear. Each entry
+    // is either a path or "name:path".
+    char** calendars;
+    int num_calendars;
+
+    // Name of the calendar new events are written to
+    char* default_calendar;
+
+    // Storage backend for calendars that don't end in .bin: "txt" or "binary"
+    char* storage;
+
+    // IANA zone synced events are shown in, e.g. "America/New_York".
+    // NULL means $TZ or the system zone.
+    char* timezone;
+
+    // Hours searched for free slots as "HH:MM-HH:MM". NULL means 09:00-17:00.
+    char* work_hours;
+
+    // Limits on the undo history: number of edits and kilobytes of snapshots
+    int undo_depth;
+    int undo_memory;
+
+    // Days kept in memory by the day cache (0 turns it off) and how many
+    // days either side of a missed day are read along with it
+    int cache_size;
+    int prefetch_window;
+
+    // Minutes between automatic syncs while the TUI is open, 0 for never
+    int sync_interval;
+
+    // Binary calendars rewrite their append-only heap once at least
+    // compaction_threshold percent of it is unused and it is bigger than
+    // compaction_min_size kilobytes
+    int compaction_threshold;
+    int compaction_min_size;
+
+    // Threads big files are parsed on by calenter import and calenter
+    // stats, 0 for one per core
+    int parse_threads;
+
+    // Record key to frame latency (see latency.c)
+    bool trace;
+
+    // Run reminder_command this many minutes before each timed event
+    // starts (see reminders.c). NULL means notify-send.
+    bool reminders;
+    int reminder_minutes;
+    char* reminder_command;
+
+    // One message per unknown key or bad value, with its line number
+    char** warnings;
+    int num_warnings;
 } Config;
 
 
+/*
+ * Parses the config file into a new Config. Most code should use
+ * get_config instead, which only parses the file once.
+ */
 Config read_config();
+void free_config(Config config);
+
+/*
+ * Returns the config, parsing the file the first time it's called. The
+ * returned pointer is only valid until the next reload_config.
+ */
+const Config* get_config();
+
+/*
+ * Incremented every time the config is reloaded, so code that caches
+ * values derived from it can tell when to recompute them.
+ */
+int get_config_generation();
+
+/*
+ * Starts watching the config file with inotify and makes SIGHUP request a
+ * reload. Returns a file descriptor that becomes readable when the file
+ * changes, or -1 if inotify isn't available.
+ */
+int watch_config();
+
+/*
+ * Re-reads the config if the file changed or SIGHUP was received since
+ * the last call. Returns true if it was reloaded.
+ */
+bool reload_config();
+
+/*
+ * Returns true if reload_config might re-read the config, without
+ * reading it.
+ */
+bool config_reload_pending();
+
+void print_config_warnings(FILE* out);
 
 
 #endif
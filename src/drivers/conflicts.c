@@ -0,0 +1,137 @@
+/*
+ * conflicts.c
+ *
+ * Finds events whose times overlap. Each event with an end time becomes
+ * an interval of minutes since 1970-01-01, so events that run past
+ * midnight are compared with the next day's too. An event without an end
+ * is a single minute that overlaps whatever is running at that time. The
+ * intervals are sorted by start and swept once: the events still running
+ * when one starts are exactly the ones it overlaps. Finding the conflicts in n
+ * events costs O(n log n) plus the number of conflicts, which keeps a
+ * month of a busy calendar well under a millisecond.
+ */
+
+#include <stdlib.h>
+#include "conflicts.h"
+#include "skeleton.h"
+#include "sources.h"
+
+struct interval {
+    long start;
+    long end;
+    size_t event;
+};
+
+int collect_range_day(int year, int month, int day, struct events* events, void* data);
+int interval_cmp(const void* a, const void* b);
+void add_conflict(struct conflict** conflicts, size_t* length, size_t* size, struct interval* first, struct interval* second);
+
+size_t find_conflicts(const struct events* events, struct conflict** conflicts) {
+    *conflicts = NULL;
+
+    struct interval* intervals = malloc((events->length + 1) * sizeof(struct interval));
+    size_t num_intervals = 0;
+
+    for (size_t i = 0; i < events->length; i++) {
+        struct event* event = &events->events[i];
+        if (event->hour < 0) continue;
+
+        long start = days_from_date_key(DATE_KEY(event->year, event->month, event->day)) * 24 * 60;
+        start += event->hour * 60 + event->min;
+
+        intervals[num_intervals++] = (struct interval){start, start + event->duration, i};
+    }
+
+    qsort(intervals, num_intervals, sizeof(struct interval), interval_cmp);
+
+    // Indexes of the intervals that haven't ended by the current start.
+    // There are rarely more than a few at once.
+    size_t* running = malloc((num_intervals + 1) * sizeof(size_t));
+    size_t num_running = 0;
+
+    size_t length = 0;
+    size_t size = 0;
+
+    for (size_t i = 0; i < num_intervals; i++) {
+        struct interval* interval = &intervals[i];
+
+        size_t kept = 0;
+        for (size_t j = 0; j < num_running; j++) {
+            struct interval* other = &intervals[running[j]];
+
+            // Back to back events don't overlap, and neither do two
+            // events without an end at the same time
+            if (other->end <= interval->start) continue;
+
+            add_conflict(conflicts, &length, &size, other, interval);
+            running[kept++] = running[j];
+        }
+
+        running[kept++] = i;
+        num_running = kept;
+    }
+
+    free(running);
+    free(intervals);
+
+    return length;
+}
+
+/*
+ * A day_callback that adds the day's events to a list.
+ */
+int collect_range_day(int year, int month, int day, struct events* events, void* data) {
+    struct events* collected = data;
+
+    for (size_t i = 0; i < events->length; i++) {
+        append_event(collected, events->events[i]);
+    }
+
+    // The summaries now belong to the list, so only the array is freed
+    events->length = 0;
+
+    return 0;
+}
+
+size_t find_range_conflicts(int start_key, int end_key, struct events* events, struct conflict** conflicts) {
+    init_events(events);
+
+    // An event the day before can run into the range
+    get_range_events(prev_date_key(start_key), end_key, collect_range_day, events);
+
+    size_t length = find_conflicts(events, conflicts);
+
+    // Only conflicts that happen within the range are kept
+    size_t kept = 0;
+    for (size_t i = 0; i < length; i++) {
+        struct event* second = &events->events[(*conflicts)[i].second];
+        if (DATE_KEY(second->year, second->month, second->day) >= start_key) (*conflicts)[kept++] = (*conflicts)[i];
+    }
+
+    return kept;
+}
+
+int interval_cmp(const void* a, const void* b) {
+    const struct interval* first = a;
+    const struct interval* second = b;
+
+    if (first->start != second->start) return first->start < second->start ? -1 : 1;
+
+    // Longer events first, so one without an end is swept while the
+    // events starting with it are running
+    if (first->end != second->end) return first->end > second->end ? -1 : 1;
+
+    // Keeps the order of events that share a time stable
+    return first->event < second->event ? -1 : first->event > second->event;
+}
+
+void add_conflict(struct conflict** conflicts, size_t* length, size_t* size, struct interval* first, struct interval* second) {
+    if (*length == *size) {
+        *size = *size == 0 ? 16 : *size * 2;
+        *conflicts = realloc(*conflicts, *size * sizeof(struct conflict));
+    }
+
+    (*conflicts)[*length].first = first->event;
+    (*conflicts)[*length].second = second->event;
+    (*length)++;
+}
@@ -0,0 +1,32 @@
+#ifndef CONFLICTS_H
+#define CONFLICTS_H
+
+#include <stddef.h>
+#include "calendartxt.h"
+
+/*
+ * Two events that overlap, as indexes into the events that were searched.
+ * first starts no later than second.
+ */
+struct conflict {
+    size_t first;
+    size_t second;
+};
+
+/*
+ * Finds every pair of overlapping events. The events can be from any
+ * number of days and in any order. An event without an end time only
+ * conflicts with events running at its start, and all day events never
+ * do. Sets conflicts to a new array, or NULL if there are none, and
+ * returns its length.
+ */
+size_t find_conflicts(const struct events* events, struct conflict** conflicts);
+
+/*
+ * Finds the conflicts between the events of every calendar from
+ * start_key to end_key inclusive. Sets events to the events searched,
+ * which the conflicts point into.
+ */
+size_t find_range_conflicts(int start_key, int end_key, struct events* events, struct conflict** conflicts);
+
+#endif
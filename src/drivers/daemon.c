@@ -0,0 +1,921 @@
+/*
+ * daemon.c
+ *
+ * calenterd, run as `calenter daemon`: one process that keeps every
+ * calendar its clients open parsed in memory and serves their storage
+ * requests over a Unix socket (see daemon_storage.c for the client). The
+ * TUI, commands and status bar scripts then share one copy of each
+ * calendar instead of each parsing the file, and a day is a round trip
+ * over the socket and a binary search.
+ *
+ * Each calendar's days are read in one range read and kept until its
+ * backend's version changes, which every request checks (a stat for
+ * calendar.txt), so writes from write_events.py, a sync or a client that
+ * reads the file directly are picked up on the next request. Edits go
+ * through the backend like any other write, taking the same lock and
+ * merging the same way, and then only the days they wrote are read back
+ * into memory before the lock is let go, so the daemon's own edits don't
+ * make it read the whole calendar again.
+ *
+ * The daemon also owns the sync schedule and reminders: it syncs every
+ * sync_interval minutes and sends reminders (see reminders.c), and a TUI
+ * connected to it leaves both to the daemon.
+ *
+ * Requests are handled one at a time on a single thread, in the order
+ * they arrive. Client sockets never block: replies are queued and written
+ * as each client takes them, and a client's next requests aren't read
+ * until it has taken the replies to its last, so one that stops reading
+ * only holds up itself. Everything in the protocol is in daemon.h.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+#include "daemon.h"
+#include "config.h"
+#include "sources.h"
+#include "reminders.h"
+#include "sync.h"
+
+// Replies to range reads are written whenever this much of them is ready
+#define RANGE_FLUSH_LENGTH (1 << 16)
+
+#define MAX_DAEMON_CLIENTS 256
+
+/*
+ * A calendar the daemon serves, with all of its stored days in date
+ * order.
+ */
+struct served_calendar {
+    char* path;
+    struct storage storage;
+
+    long long version; // of the days in memory, -1 before they're read
+    struct served_day* days;
+    size_t num_days;
+    size_t size;
+};
+
+struct served_day {
+    int date_key;
+    struct events events;
+};
+
+/*
+ * A connection, the bytes it sent that don't make a whole frame yet and
+ * the replies it hasn't taken yet.
+ */
+struct daemon_client {
+    int fd;
+    struct message in;
+    struct message out;
+};
+
+static struct served_calendar* calendars = NULL;
+static int num_calendars = 0;
+
+static volatile sig_atomic_t stopping = 0;
+
+static long num_requests = 0;
+static double request_us = 0;
+static double max_request_us = 0;
+static long num_reloads = 0;
+
+int listen_on(const char* socket_path);
+void handle_stop(int sig);
+void add_client(struct daemon_client* client, int fd);
+void remove_client(struct daemon_client* client);
+int serve_client(struct daemon_client* client);
+int read_client(struct daemon_client* client);
+int write_client(struct daemon_client* client);
+void handle_request(struct daemon_client* client, struct message* request);
+void serve_open(struct message* request, struct message* reply);
+void serve_range(struct daemon_client* client, struct served_calendar* calendar, int start_key, int end_key);
+void serve_batch(struct served_calendar* calendar, struct message* request, struct message* reply);
+void refresh_calendar(struct served_calendar* calendar);
+bool begin_edit(struct served_calendar* calendar);
+void end_edit(struct served_calendar* calendar, bool locked, const int* date_keys, size_t count);
+int keep_day(int year, int month, int day, struct events* events, void* data);
+void free_calendar_days(struct served_calendar* calendar);
+size_t find_served_day(struct served_calendar* calendar, int date_key);
+void reply_int(struct message* reply, int value);
+double us_since(struct timespec* since);
+
+void init_message(struct message* message) {
+    memset(message, 0, sizeof(struct message));
+}
+
+void free_message(struct message* message) {
+    free(message->data);
+    init_message(message);
+}
+
+/*
+ * Makes room for count more bytes.
+ */
+void grow_message(struct message* message, size_t count) {
+    if (message->length + count <= message->size) return;
+
+    while (message->length + count > message->size) {
+        message->size = message->size == 0 ? 256 : message->size * 2;
+    }
+    message->data = realloc(message->data, message->size);
+}
+
+void put_bytes(struct message* message, const void* bytes, size_t count) {
+    grow_message(message, count);
+    memcpy(message->data + message->length, bytes, count);
+    message->length += count;
+}
+
+void begin_message(struct message* message, int op) {
+    message->frame = message->length;
+
+    unsigned char header[FRAME_HEADER_LENGTH] = {0, 0, 0, 0, op};
+    put_bytes(message, header, FRAME_HEADER_LENGTH);
+}
+
+void end_message(struct message* message) {
+    uint32_t length = message->length - message->frame - 4;
+    memcpy(message->data + message->frame, &length, 4);
+}
+
+void message_put_int(struct message* message, int value) {
+    int32_t field = value;
+    put_bytes(message, &field, sizeof(field));
+}
+
+void message_put_long(struct message* message, long long value) {
+    int64_t field = value;
+    put_bytes(message, &field, sizeof(field));
+}
+
+void message_put_text(struct message* message, const char* text) {
+    size_t length = strlen(text);
+
+    message_put_int(message, length);
+    put_bytes(message, text, length);
+}
+
+void message_put_event(struct message* message, struct event* event) {
+    message_put_int(message, DATE_KEY(event->year, event->month, event->day));
+    message_put_int(message, event->hour);
+    message_put_int(message, event->min);
+    message_put_int(message, event->duration);
+    message_put_text(message, event->summary);
+}
+
+void message_put_events(struct message* message, struct events* events) {
+    message_put_int(message, events->length);
+    for (size_t i = 0; i < events->length; i++) {
+        message_put_event(message, &events->events[i]);
+    }
+}
+
+int message_op(struct message* message) {
+    return message->length >= FRAME_HEADER_LENGTH ? (unsigned char)message->data[4] : 0;
+}
+
+/*
+ * Returns the next count bytes of the frame, or NULL past its end.
+ */
+const char* get_bytes(struct message* message, size_t count) {
+    if (message->bad || message->length - message->pos < count) {
+        message->bad = true;
+        return NULL;
+    }
+
+    const char* bytes = message->data + message->pos;
+    message->pos += count;
+
+    return bytes;
+}
+
+int message_get_int(struct message* message) {
+    int32_t field = 0;
+    const char* bytes = get_bytes(message, sizeof(field));
+    if (bytes != NULL) memcpy(&field, bytes, sizeof(field));
+
+    return field;
+}
+
+long long message_get_long(struct message* message) {
+    int64_t field = 0;
+    const char* bytes = get_bytes(message, sizeof(field));
+    if (bytes != NULL) memcpy(&field, bytes, sizeof(field));
+
+    return field;
+}
+
+char* message_get_text(struct message* message) {
+    int length = message_get_int(message);
+    if (length < 0) message->bad = true;
+
+    const char* bytes = message->bad ? NULL : get_bytes(message, length);
+    if (bytes == NULL) return strdup("");
+
+    return strndup(bytes, length);
+}
+
+struct event message_get_event(struct message* message) {
+    struct event event = {0};
+
+    int date_key = message_get_int(message);
+    event.year = date_key / 10000;
+    event.month = date_key / 100 % 100;
+    event.day = date_key % 100;
+    event.hour = message_get_int(message);
+    event.min = message_get_int(message);
+    event.duration = message_get_int(message);
+    event.summary = message_get_text(message);
+
+    return event;
+}
+
+struct events message_get_events(struct message* message) {
+    struct events events;
+    init_events(&events);
+
+    int count = message_get_int(message);
+    for (int i = 0; i < count && !message->bad; i++) {
+        append_event(&events, message_get_event(message));
+    }
+
+    return events;
+}
+
+int send_message(int fd, struct message* message) {
+    size_t sent = 0;
+
+    while (sent < message->length) {
+        ssize_t count = send(fd, message->data + sent, message->length - sent, MSG_NOSIGNAL);
+        if (count < 0 && errno == EINTR) continue;
+        if (count <= 0) return -1;
+
+        sent += count;
+    }
+
+    message->length = 0;
+    message->frame = 0;
+
+    return 0;
+}
+
+/*
+ * Reads exactly count bytes. Returns -1 if the connection closed first.
+ */
+int read_exactly(int fd, char* buffer, size_t count) {
+    size_t received = 0;
+
+    while (received < count) {
+        ssize_t length = recv(fd, buffer + received, count - received, 0);
+        if (length < 0 && errno == EINTR) continue;
+        if (length <= 0) return -1;
+
+        received += length;
+    }
+
+    return 0;
+}
+
+int receive_message(int fd, struct message* message) {
+    message->length = 0;
+    message->pos = FRAME_HEADER_LENGTH;
+    message->bad = false;
+
+    grow_message(message, FRAME_HEADER_LENGTH);
+    if (read_exactly(fd, message->data, FRAME_HEADER_LENGTH) != 0) return -1;
+
+    uint32_t length;
+    memcpy(&length, message->data, 4);
+    if (length < 1 || length > MAX_DAEMON_FRAME) return -1;
+
+    grow_message(message, length + 4);
+    if (read_exactly(fd, message->data + FRAME_HEADER_LENGTH, length - 1) != 0) return -1;
+    message->length = length + 4;
+
+    return 0;
+}
+
+size_t complete_frame_length(const char* data, size_t length) {
+    if (length < FRAME_HEADER_LENGTH) return 0;
+
+    uint32_t frame_length;
+    memcpy(&frame_length, data, 4);
+    if (frame_length < 1 || length < frame_length + 4) return 0;
+
+    return frame_length + 4;
+}
+
+char* get_daemon_socket_path() {
+    char* home = getenv("HOME");
+    if (home == NULL) return NULL;
+
+    int length = strlen(home) + strlen(DAEMON_SOCKET_PATH) + 1;
+    char* path = malloc(length);
+    snprintf(path, length, "%s%s", home, DAEMON_SOCKET_PATH);
+
+    return path;
+}
+
+int run_daemon(const char* socket_path) {
+    // The daemon reads the files itself, and so does a sync it forks
+    disable_daemon_storage();
+
+    int listen_fd = listen_on(socket_path);
+    if (listen_fd < 0) return -1;
+
+    // No SA_RESTART, so a stop interrupts the poll
+    struct sigaction action = {0};
+    action.sa_handler = handle_stop;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    int watch_fd = watch_config();
+    int reminder_fd = start_reminders();
+    struct timespec last_sync;
+    clock_gettime(CLOCK_MONOTONIC, &last_sync);
+
+    struct daemon_client* clients = calloc(MAX_DAEMON_CLIENTS, sizeof(struct daemon_client));
+    int num_clients = 0;
+    struct pollfd* fds = calloc(MAX_DAEMON_CLIENTS + 3, sizeof(struct pollfd));
+
+    while (!stopping) {
+        int timeout = -1;
+        int sync_interval = get_config()->sync_interval;
+
+        if (sync_interval > 0) {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+
+            long elapsed_ms = (now.tv_sec - last_sync.tv_sec) * 1000
+                + (now.tv_nsec - last_sync.tv_nsec) / 1000000;
+            long remaining_ms = sync_interval * 60000L - elapsed_ms;
+
+            if (remaining_ms <= 0) {
+                sync_calendar();
+                last_sync = now;
+                remaining_ms = sync_interval * 60000L;
+            }
+            timeout = remaining_ms;
+        }
+
+        // poll skips the descriptors that are -1
+        fds[0] = (struct pollfd){.fd = listen_fd, .events = POLLIN};
+        fds[1] = (struct pollfd){.fd = watch_fd, .events = POLLIN};
+        fds[2] = (struct pollfd){.fd = reminder_fd, .events = POLLIN};
+        for (int i = 0; i < num_clients; i++) {
+            short events = clients[i].out.length > 0 ? POLLOUT : POLLIN;
+            fds[i + 3] = (struct pollfd){.fd = clients[i].fd, .events = events};
+        }
+
+        int ready = poll(fds, num_clients + 3, timeout);
+        if (ready < 0 && errno != EINTR) break;
+
+        // SIGHUP interrupts the poll, so a reload is looked for first. The
+        // calendar list matters for the sync and reminders, the served
+        // calendars are whatever the clients open
+        if (config_reload_pending() && reload_config()) {
+            reload_sources();
+            handle_reminders();
+        } else if (ready > 0 && fds[2].revents != 0) {
+            handle_reminders();
+        }
+
+        if (ready <= 0) continue;
+
+        for (int i = num_clients - 1; i >= 0; i--) {
+            if (fds[i + 3].revents == 0 || serve_client(&clients[i]) == 0) continue;
+
+            remove_client(&clients[i]);
+            clients[i] = clients[--num_clients];
+        }
+
+        if (fds[0].revents & POLLIN) {
+            int fd = accept(listen_fd, NULL, NULL);
+            if (fd >= 0 && num_clients == MAX_DAEMON_CLIENTS) {
+                close(fd);
+            } else if (fd >= 0) {
+                add_client(&clients[num_clients++], fd);
+            }
+        }
+    }
+
+    for (int i = 0; i < num_clients; i++) {
+        remove_client(&clients[i]);
+    }
+    free(clients);
+    free(fds);
+    stop_reminders();
+
+    close(listen_fd);
+    unlink(socket_path);
+
+    for (int i = 0; i < num_calendars; i++) {
+        free_calendar_days(&calendars[i]);
+        close_storage(&calendars[i].storage);
+        free(calendars[i].path);
+    }
+    free(calendars);
+    calendars = NULL;
+    num_calendars = 0;
+
+    fprintf(stderr, "Served %ld requests in %.1f us on average (at most %.1f us), read calendars %ld times\n",
+        num_requests, num_requests > 0 ? request_us / num_requests : 0, max_request_us, num_reloads);
+
+    return 0;
+}
+
+/*
+ * Binds the socket, replacing one left behind by a daemon that didn't
+ * stop cleanly. Returns the listening socket or -1.
+ */
+int listen_on(const char* socket_path) {
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+    if (strlen(socket_path) >= sizeof(address.sun_path)) return -1;
+    strcpy(address.sun_path, socket_path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+
+    // A socket that still accepts connections belongs to a running daemon
+    if (connect(fd, (struct sockaddr*)&address, sizeof(address)) == 0) {
+        close(fd);
+        return -1;
+    }
+    close(fd);
+    unlink(socket_path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+
+    // Only this user can connect
+    mode_t mask = umask(077);
+    int bound = bind(fd, (struct sockaddr*)&address, sizeof(address));
+    umask(mask);
+
+    if (bound != 0 || listen(fd, 16) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+void handle_stop(int sig) {
+    stopping = 1;
+}
+
+/*
+ * Takes on an accepted connection, which is made non-blocking so a client
+ * can't hold up the others.
+ */
+void add_client(struct daemon_client* client, int fd) {
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    client->fd = fd;
+    init_message(&client->in);
+    init_message(&client->out);
+}
+
+void remove_client(struct daemon_client* client) {
+    close(client->fd);
+    free_message(&client->in);
+    free_message(&client->out);
+}
+
+/*
+ * Writes what it can of the client's queued replies once it can take
+ * more, or reads and answers its requests once they're all out. Returns
+ * -1 once the client has gone or sent something it shouldn't.
+ */
+int serve_client(struct daemon_client* client) {
+    if (client->out.length == 0 && read_client(client) != 0) return -1;
+    if (write_client(client) != 0) return -1;
+
+    // Don't hold on to the room a big range read needed
+    if (client->out.length == 0 && client->out.size > 2 * RANGE_FLUSH_LENGTH) free_message(&client->out);
+
+    return 0;
+}
+
+/*
+ * Reads what a client sent and queues the replies to every whole request
+ * in it. Returns -1 once the client has gone or sent something it
+ * shouldn't.
+ */
+int read_client(struct daemon_client* client) {
+    struct message* in = &client->in;
+
+    grow_message(in, 4096);
+    ssize_t count = recv(client->fd, in->data + in->length, in->size - in->length, 0);
+    if (count < 0 && (errno == EAGAIN || errno == EINTR)) return 0;
+    if (count <= 0) return -1;
+    in->length += count;
+
+    size_t offset = 0;
+    size_t frame_length;
+    while ((frame_length = complete_frame_length(in->data + offset, in->length - offset)) > 0) {
+        // The request is read in place
+        struct message request = {in->data + offset, frame_length, frame_length, 0, FRAME_HEADER_LENGTH, false};
+        handle_request(client, &request);
+        offset += frame_length;
+    }
+
+    memmove(in->data, in->data + offset, in->length - offset);
+    in->length -= offset;
+
+    // A frame that can never be complete
+    if (in->length > MAX_DAEMON_FRAME + FRAME_HEADER_LENGTH) return -1;
+
+    return 0;
+}
+
+/*
+ * Writes as much of the client's queued replies as its socket takes
+ * without waiting, and keeps the rest for when it takes more. Returns -1
+ * once the client has gone.
+ */
+int write_client(struct daemon_client* client) {
+    struct message* out = &client->out;
+    size_t sent = 0;
+
+    while (sent < out->length) {
+        ssize_t count = send(client->fd, out->data + sent, out->length - sent, MSG_NOSIGNAL);
+        if (count < 0 && errno == EINTR) continue;
+        if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        if (count <= 0) return -1;
+
+        sent += count;
+    }
+
+    // Only ever called between frames, so nothing half-built moves
+    memmove(out->data, out->data + sent, out->length - sent);
+    out->length -= sent;
+
+    return 0;
+}
+
+/*
+ * Queues the reply to a request for the client.
+ */
+void handle_request(struct daemon_client* client, struct message* request) {
+    struct message* reply = &client->out;
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    int op = message_op(request);
+    if (op == DAEMON_OPEN) {
+        serve_open(request, reply);
+    } else {
+        int id = message_get_int(request);
+        struct served_calendar* calendar = id >= 0 && id < num_calendars ? &calendars[id] : NULL;
+        struct storage* storage = calendar == NULL ? NULL : &calendar->storage;
+
+        if (calendar == NULL || request->bad) op = 0;
+
+        switch (op) {
+            case DAEMON_GET_DAY: {
+                int date_key = message_get_int(request);
+                refresh_calendar(calendar);
+
+                // Days that aren't stored go to the backend, which extends
+                // a calendar.txt that's read past its end
+                size_t index = find_served_day(calendar, date_key);
+                begin_message(reply, DAEMON_OK);
+                if (index < calendar->num_days && calendar->days[index].date_key == date_key) {
+                    message_put_events(reply, &calendar->days[index].events);
+                } else {
+                    struct events events = storage->driver->get_day(storage->handle,
+                        date_key / 10000, date_key / 100 % 100, date_key % 100);
+                    message_put_events(reply, &events);
+                    free_events(events);
+                }
+                end_message(reply);
+                break;
+            }
+            case DAEMON_GET_RANGE: {
+                int start_key = message_get_int(request);
+                int end_key = message_get_int(request);
+                serve_range(client, calendar, start_key, end_key);
+                break;
+            }
+            case DAEMON_GET_BOUNDS: {
+                int first_key = 0, last_key = 0;
+                int result = storage->driver->get_bounds(storage->handle, &first_key, &last_key);
+
+                begin_message(reply, DAEMON_OK);
+                message_put_int(reply, result);
+                message_put_int(reply, first_key);
+                message_put_int(reply, last_key);
+                end_message(reply);
+                break;
+            }
+            case DAEMON_ADD:
+            case DAEMON_DELETE: {
+                struct event event = message_get_event(request);
+                int result = -1;
+                if (!request->bad) {
+                    int date_key = DATE_KEY(event.year, event.month, event.day);
+                    bool locked = begin_edit(calendar);
+
+                    result = op == DAEMON_ADD ? storage->driver->add(storage->handle, event)
+                        : storage->driver->delete(storage->handle, event);
+                    end_edit(calendar, locked, &date_key, 1);
+                }
+                free(event.summary);
+
+                reply_int(reply, result);
+                break;
+            }
+            case DAEMON_BATCH:
+                serve_batch(calendar, request, reply);
+                break;
+            case DAEMON_GET_VERSION:
+                begin_message(reply, DAEMON_OK);
+                message_put_long(reply, storage->driver->get_version(storage->handle));
+                end_message(reply);
+                break;
+            case DAEMON_FILL: {
+                int date_key = message_get_int(request);
+                bool fills = storage->driver->fill != NULL && !request->bad;
+                reply_int(reply, fills ? storage->driver->fill(storage->handle, date_key) : 0);
+                break;
+            }
+            default:
+                begin_message(reply, DAEMON_ERROR);
+                end_message(reply);
+        }
+    }
+
+    double elapsed_us = us_since(&start);
+    num_requests++;
+    request_us += elapsed_us;
+    if (elapsed_us > max_request_us) max_request_us = elapsed_us;
+}
+
+/*
+ * Finds or opens the calendar at a path. Every client opening the same
+ * path shares it.
+ */
+void serve_open(struct message* request, struct message* reply) {
+    char* backend_name = message_get_text(request);
+    char* path = message_get_text(request);
+    const struct storage_driver* backend = get_storage_driver(backend_name);
+
+    int id = -1;
+    for (int i = 0; i < num_calendars && id < 0; i++) {
+        if (strcmp(calendars[i].path, path) == 0 && calendars[i].storage.driver == backend) id = i;
+    }
+
+    if (id < 0 && backend != NULL && !request->bad) {
+        calendars = realloc(calendars, (num_calendars + 1) * sizeof(struct served_calendar));
+
+        struct served_calendar* calendar = &calendars[num_calendars];
+        memset(calendar, 0, sizeof(struct served_calendar));
+        calendar->path = strdup(path);
+        calendar->version = -1;
+
+        if (open_storage(&calendar->storage, backend, path) == 0) {
+            id = num_calendars++;
+        } else {
+            free(calendar->path);
+        }
+    }
+
+    if (id < 0) {
+        begin_message(reply, DAEMON_ERROR);
+        end_message(reply);
+    } else {
+        reply_int(reply, id);
+    }
+
+    free(backend_name);
+    free(path);
+}
+
+/*
+ * Queues every stored day in a range as a DAEMON_DAY, followed by
+ * DAEMON_OK, writing a batch of them at a time while the client keeps up.
+ */
+void serve_range(struct daemon_client* client, struct served_calendar* calendar, int start_key, int end_key) {
+    struct message* reply = &client->out;
+    refresh_calendar(calendar);
+
+    for (size_t i = find_served_day(calendar, start_key); i < calendar->num_days; i++) {
+        struct served_day* day = &calendar->days[i];
+        if (day->date_key < start_key) continue;
+        if (day->date_key > end_key) break;
+
+        begin_message(reply, DAEMON_DAY);
+        message_put_int(reply, day->date_key);
+        message_put_events(reply, &day->events);
+        end_message(reply);
+
+        // A client that's gone shows up on the next write
+        if (reply->length >= RANGE_FLUSH_LENGTH) write_client(client);
+    }
+
+    reply_int(reply, 0);
+}
+
+void serve_batch(struct served_calendar* calendar, struct message* request, struct message* reply) {
+    int count = message_get_int(request);
+    if (count < 0 || (size_t)count > request->length) count = 0;
+
+    struct day_update* updates = calloc(count > 0 ? count : 1, sizeof(struct day_update));
+    struct events* bases = calloc(count > 0 ? count : 1, sizeof(struct events));
+    int* date_keys = calloc(count > 0 ? count : 1, sizeof(int));
+
+    for (int i = 0; i < count; i++) {
+        int date_key = message_get_int(request);
+        date_keys[i] = date_key;
+        updates[i].year = date_key / 10000;
+        updates[i].month = date_key / 100 % 100;
+        updates[i].day = date_key % 100;
+        updates[i].events = message_get_events(request);
+
+        init_events(&bases[i]);
+        if (message_get_int(request) != 0) {
+            free_events(bases[i]);
+            bases[i] = message_get_events(request);
+            updates[i].base = &bases[i];
+        }
+    }
+
+    int result = -1;
+    if (!request->bad) {
+        struct storage* storage = &calendar->storage;
+        bool locked = begin_edit(calendar);
+
+        result = storage->driver->batch(storage->handle, updates, count);
+        end_edit(calendar, locked, date_keys, count);
+    }
+
+    for (int i = 0; i < count; i++) {
+        free_events(updates[i].events);
+        free_events(bases[i]);
+    }
+    free(updates);
+    free(bases);
+    free(date_keys);
+
+    reply_int(reply, result);
+}
+
+/*
+ * Reads the calendar's days again if its backend's version changed since
+ * they were read.
+ */
+void refresh_calendar(struct served_calendar* calendar) {
+    struct storage* storage = &calendar->storage;
+
+    // The version is taken first: a write during the read only makes the
+    // next request read it again
+    long long version = storage->driver->get_version(storage->handle);
+    if (version == calendar->version && version != -1) return;
+
+    free_calendar_days(calendar);
+    num_reloads++;
+
+    int first_key, last_key;
+    if (storage->driver->get_bounds(storage->handle, &first_key, &last_key) != 0) {
+        calendar->version = version;
+        return;
+    }
+
+    if (storage->driver->get_range(storage->handle, first_key, last_key, keep_day, calendar) != 0) {
+        free_calendar_days(calendar);
+        return;
+    }
+
+    calendar->version = version;
+}
+
+/*
+ * Takes the backend's lock for an edit and brings the days in memory up
+ * to date under it, so the edit is the only change they miss. Returns
+ * false if the backend can't be locked.
+ */
+bool begin_edit(struct served_calendar* calendar) {
+    struct storage* storage = &calendar->storage;
+    if (storage->driver->lock == NULL || storage->driver->lock(storage->handle) != 0) return false;
+
+    refresh_calendar(calendar);
+
+    return true;
+}
+
+/*
+ * Reads the days an edit wrote back into memory, takes the version it
+ * left the calendar at and lets go of the lock. Whether or not the edit
+ * went through, its days are read as they're now stored. An edit that
+ * moved the calendar's bounds (a calendar.txt gets a line for every date
+ * up to the one written), or one made without the lock, has the whole
+ * calendar read again on the next request instead.
+ */
+void end_edit(struct served_calendar* calendar, bool locked, const int* date_keys, size_t count) {
+    struct storage* storage = &calendar->storage;
+    if (!locked) return;
+
+    int first_key, last_key;
+    bool same_bounds = calendar->version != -1 && calendar->num_days > 0
+        && storage->driver->get_bounds(storage->handle, &first_key, &last_key) == 0
+        && first_key == calendar->days[0].date_key
+        && last_key == calendar->days[calendar->num_days - 1].date_key;
+
+    // Every date between the bounds is in memory, even the empty ones, and
+    // nothing outside them was stored
+    for (size_t i = 0; i < count && same_bounds; i++) {
+        size_t index = find_served_day(calendar, date_keys[i]);
+        if (index == calendar->num_days || calendar->days[index].date_key != date_keys[i]) continue;
+
+        struct served_day* day = &calendar->days[index];
+        free_events(day->events);
+        day->events = storage->driver->get_day(storage->handle,
+            date_keys[i] / 10000, date_keys[i] / 100 % 100, date_keys[i] % 100);
+    }
+
+    calendar->version = same_bounds ? storage->driver->get_version(storage->handle) : -1;
+    storage->driver->unlock(storage->handle);
+}
+
+/*
+ * A day_callback that keeps a day in a served_calendar.
+ */
+int keep_day(int year, int month, int day, struct events* events, void* data) {
+    struct served_calendar* calendar = data;
+
+    if (calendar->num_days == calendar->size) {
+        calendar->size = calendar->size == 0 ? 1024 : calendar->size * 2;
+        calendar->days = realloc(calendar->days, calendar->size * sizeof(struct served_day));
+    }
+
+    struct served_day* served = &calendar->days[calendar->num_days++];
+    served->date_key = DATE_KEY(year, month, day);
+    served->events = *events;
+
+    // The caller frees what's left in events once this returns
+    init_events(events);
+
+    return 0;
+}
+
+void free_calendar_days(struct served_calendar* calendar) {
+    for (size_t i = 0; i < calendar->num_days; i++) {
+        free_events(calendar->days[i].events);
+    }
+    free(calendar->days);
+
+    calendar->days = NULL;
+    calendar->num_days = 0;
+    calendar->size = 0;
+    calendar->version = -1;
+}
+
+/*
+ * Returns the index of the day, or of the first day after it if it isn't
+ * stored (num_days if there's none).
+ */
+size_t find_served_day(struct served_calendar* calendar, int date_key) {
+    size_t low = 0;
+    size_t high = calendar->num_days;
+
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (calendar->days[mid].date_key < date_key) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    return low;
+}
+
+void reply_int(struct message* reply, int value) {
+    begin_message(reply, DAEMON_OK);
+    message_put_int(reply, value);
+    end_message(reply);
+}
+
+double us_since(struct timespec* since) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (now.tv_sec - since->tv_sec) * 1e6 + (now.tv_nsec - since->tv_nsec) / 1e3;
+}
@@ -0,0 +1,143 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "calendartxt.h"
+#include "storage.h"
+
+#define DAEMON_SOCKET_PATH "/.calendar/calenterd.sock"
+
+// Frames bigger than this are refused, whichever side sends them
+#define MAX_DAEMON_FRAME (16 << 20)
+
+/*
+ * The first byte of every frame after its length. Requests name a
+ * calendar by the id DAEMON_OPEN returned, which every connection can
+ * use.
+ *
+ * DAEMON_OPEN         backend, path          -> DAEMON_OK id
+ * DAEMON_GET_DAY      id, date               -> DAEMON_OK events
+ * DAEMON_GET_RANGE    id, first, last        -> DAEMON_DAY date, events (per day), DAEMON_OK
+ * DAEMON_GET_BOUNDS   id                     -> DAEMON_OK result, first, last
+ * DAEMON_ADD          id, event              -> DAEMON_OK result
+ * DAEMON_DELETE       id, event              -> DAEMON_OK result
+ * DAEMON_BATCH        id, count, updates     -> DAEMON_OK result
+ * DAEMON_GET_VERSION  id                     -> DAEMON_OK version
+ * DAEMON_FILL         id, date               -> DAEMON_OK result
+ *
+ * A request that can't be served gets DAEMON_ERROR instead.
+ */
+enum daemon_op {
+    DAEMON_OPEN = 1,
+    DAEMON_GET_DAY,
+    DAEMON_GET_RANGE,
+    DAEMON_GET_BOUNDS,
+    DAEMON_ADD,
+    DAEMON_DELETE,
+    DAEMON_BATCH,
+    DAEMON_GET_VERSION,
+    DAEMON_FILL,
+
+    DAEMON_OK = 64,
+    DAEMON_DAY,
+    DAEMON_ERROR,
+};
+
+/*
+ * Frames being built or read. A frame is its length (4 bytes, not
+ * counting itself), its op and then its fields: ints and longs in the
+ * host's byte order, since both ends are on the same machine, and
+ * strings with their length first. A message being built can hold many
+ * frames that are sent in one write.
+ */
+struct message {
+    char* data;
+    size_t length;
+    size_t size;
+    size_t frame; // where the frame being built starts
+    size_t pos; // the next field to read
+    bool bad; // a read ran past the end of the frame
+};
+
+#define FRAME_HEADER_LENGTH 5
+
+void init_message(struct message* message);
+void free_message(struct message* message);
+
+/*
+ * Starts a new frame after any already in the message, and finishes it
+ * once its fields are in.
+ */
+void begin_message(struct message* message, int op);
+void end_message(struct message* message);
+
+void message_put_int(struct message* message, int value);
+void message_put_long(struct message* message, long long value);
+void message_put_text(struct message* message, const char* text);
+void message_put_event(struct message* message, struct event* event);
+void message_put_events(struct message* message, struct events* events);
+
+/*
+ * Read the next field of a received frame. Reading past the end sets bad
+ * and gives 0, "" or no events.
+ */
+int message_op(struct message* message);
+int message_get_int(struct message* message);
+long long message_get_long(struct message* message);
+char* message_get_text(struct message* message);
+struct event message_get_event(struct message* message);
+struct events message_get_events(struct message* message);
+
+/*
+ * Writes every frame in the message and empties it. Returns 0 on success,
+ * -1 if the connection is gone.
+ */
+int send_message(int fd, struct message* message);
+
+/*
+ * Reads exactly one frame into message. Returns 0 on success, -1 if the
+ * connection closed, timed out or sent something too big.
+ */
+int receive_message(int fd, struct message* message);
+
+/*
+ * Returns the length of the whole frame at the start of data, or 0 if
+ * not all of it is there yet.
+ */
+size_t complete_frame_length(const char* data, size_t length);
+
+/*
+ * Returns "$HOME/.calendar/calenterd.sock", or NULL without a home. The
+ * string is allocated.
+ */
+char* get_daemon_socket_path();
+
+/*
+ * Serves calendars on a Unix socket at socket_path until SIGINT or
+ * SIGTERM, and syncs every sync_interval minutes and sends reminders
+ * meanwhile. Returns 0 once it's stopped, or -1 if the socket couldn't
+ * be set up (e.g. another daemon is serving it).
+ */
+int run_daemon(const char* socket_path);
+
+/*
+ * Opens a calendar through a running daemon, which reads it with the
+ * given backend. Returns 0 on success, or -1 if no daemon is running or
+ * daemons are turned off for this process, in which case the calendar
+ * should be opened directly.
+ */
+int open_daemon_storage(struct storage* storage, const struct storage_driver* backend, const char* path);
+
+/*
+ * Makes open_daemon_storage always fail, so the daemon itself (and
+ * anything it forks) reads the files.
+ */
+void disable_daemon_storage();
+
+/*
+ * Returns true if any calendar is currently served by a daemon.
+ */
+bool is_daemon_connected();
+
+#endif
@@ -0,0 +1,454 @@
+/*
+ * daemon_storage.c
+ *
+ * The client side of calenterd (see daemon.c): a storage backend whose
+ * every operation is a request over the daemon's socket. sources.c opens
+ * calendars through it when a daemon is running, so the layers above
+ * don't know the difference.
+ *
+ * A process has one connection that all its calendars share. It's made
+ * when the first calendar is opened, and a process forked after that
+ * (a sync) makes its own rather than talking over its parent's. If the
+ * daemon goes away the calendars carry on reading their files directly.
+ * A write whose reply never came isn't retried, since the daemon may
+ * have made it.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "daemon.h"
+
+// A daemon that takes longer than this to answer is taken to be gone
+#define DAEMON_TIMEOUT_MS 5000
+
+/*
+ * A calendar opened through the daemon.
+ */
+struct daemon_calendar {
+    int id; // the daemon's
+    char* path;
+    const struct storage_driver* backend;
+
+    // The file opened directly once the daemon is gone
+    struct storage direct;
+};
+
+void* daemon_open(const char* path);
+void daemon_close(void* handle);
+struct events daemon_get_day(void* handle, int year, int month, int day);
+int daemon_get_range(void* handle, int start_key, int end_key, day_callback callback, void* data);
+int daemon_get_bounds(void* handle, int* first_key, int* last_key);
+int daemon_add(void* handle, struct event event);
+int daemon_delete(void* handle, struct event event);
+int daemon_batch(void* handle, struct day_update* updates, size_t count);
+long long daemon_get_version(void* handle);
+int daemon_fill(void* handle, int date_key);
+const char* daemon_get_file(void* handle);
+int connect_daemon();
+void disconnect_daemon();
+struct storage* get_direct_storage(struct daemon_calendar* calendar);
+void begin_request(struct message* request, int op, struct daemon_calendar* calendar);
+int call_daemon(struct message* request, struct message* reply);
+int call_daemon_for_int(struct message* request, int* value);
+
+const struct storage_driver daemon_driver = {
+    .name = "daemon",
+    .open = daemon_open,
+    .close = daemon_close,
+    .get_day = daemon_get_day,
+    .get_range = daemon_get_range,
+    .get_bounds = daemon_get_bounds,
+    .add = daemon_add,
+    .delete = daemon_delete,
+    .batch = daemon_batch,
+    .get_version = daemon_get_version,
+    .fill = daemon_fill,
+    .get_file = daemon_get_file,
+    .lock = NULL,
+    .unlock = NULL,
+};
+
+static int daemon_fd = -1;
+static pid_t daemon_pid = -1; // the process the connection belongs to
+static bool daemon_lost = false; // the daemon stopped answering, so the files are read
+static bool disabled = false;
+static int num_open = 0;
+
+int open_daemon_storage(struct storage* storage, const struct storage_driver* backend, const char* path) {
+    if (disabled || daemon_lost || connect_daemon() != 0) return -1;
+
+    struct message request, reply;
+    init_message(&request);
+    init_message(&reply);
+
+    begin_message(&request, DAEMON_OPEN);
+    message_put_text(&request, backend->name);
+    message_put_text(&request, path);
+    end_message(&request);
+
+    int id = -1;
+    if (call_daemon(&request, &reply) == 0) id = message_get_int(&reply);
+    bool opened = id >= 0 && !reply.bad;
+
+    free_message(&request);
+    free_message(&reply);
+
+    if (!opened) {
+        if (num_open == 0) disconnect_daemon();
+        return -1;
+    }
+
+    struct daemon_calendar* calendar = calloc(1, sizeof(struct daemon_calendar));
+    calendar->id = id;
+    calendar->path = strdup(path);
+    calendar->backend = backend;
+    num_open++;
+
+    storage->driver = &daemon_driver;
+    storage->handle = calendar;
+
+    return 0;
+}
+
+void disable_daemon_storage() {
+    disabled = true;
+}
+
+bool is_daemon_connected() {
+    return daemon_fd >= 0 && daemon_pid == getpid() && !daemon_lost;
+}
+
+void* daemon_open(const char* path) {
+    struct storage storage;
+    if (open_daemon_storage(&storage, get_storage_driver_for_path(path, NULL), path) != 0) return NULL;
+
+    return storage.handle;
+}
+
+void daemon_close(void* handle) {
+    struct daemon_calendar* calendar = handle;
+
+    close_storage(&calendar->direct);
+    free(calendar->path);
+    free(calendar);
+
+    // The daemon keeps the calendar for its other clients
+    if (--num_open == 0) disconnect_daemon();
+}
+
+struct events daemon_get_day(void* handle, int year, int month, int day) {
+    struct daemon_calendar* calendar = handle;
+    struct storage* direct = get_direct_storage(calendar);
+    if (direct != NULL) return direct->driver->get_day(direct->handle, year, month, day);
+
+    struct message request, reply;
+    init_message(&request);
+    init_message(&reply);
+
+    begin_request(&request, DAEMON_GET_DAY, calendar);
+    message_put_int(&request, DATE_KEY(year, month, day));
+    end_message(&request);
+
+    struct events events;
+    if (call_daemon(&request, &reply) == 0) {
+        events = message_get_events(&reply);
+    } else if ((direct = get_direct_storage(calendar)) != NULL) {
+        events = direct->driver->get_day(direct->handle, year, month, day);
+    } else {
+        init_events(&events);
+    }
+
+    free_message(&request);
+    free_message(&reply);
+
+    return events;
+}
+
+int daemon_get_range(void* handle, int start_key, int end_key, day_callback callback, void* data) {
+    struct daemon_calendar* calendar = handle;
+    struct storage* direct = get_direct_storage(calendar);
+    if (direct != NULL) return direct->driver->get_range(direct->handle, start_key, end_key, callback, data);
+
+    struct message request, reply;
+    init_message(&request);
+    init_message(&reply);
+
+    begin_request(&request, DAEMON_GET_RANGE, calendar);
+    message_put_int(&request, start_key);
+    message_put_int(&request, end_key);
+    end_message(&request);
+
+    int result = call_daemon(&request, &reply);
+    bool stopped = false;
+
+    // The days come one frame each, and all of them are read even after
+    // the callback stops the iteration so the next reply starts clean
+    while (result == 0 && message_op(&reply) == DAEMON_DAY) {
+        int date_key = message_get_int(&reply);
+        struct events events = message_get_events(&reply);
+
+        if (!stopped && !reply.bad) {
+            stopped = callback(date_key / 10000, date_key / 100 % 100, date_key % 100, &events, data) != 0;
+        }
+        free_events(events);
+
+        if (receive_message(daemon_fd, &reply) != 0) {
+            disconnect_daemon();
+            daemon_lost = true;
+            result = -1;
+        }
+    }
+
+    free_message(&request);
+    free_message(&reply);
+
+    // Days already passed on aren't passed again from the file
+    return result == 0 ? 0 : -1;
+}
+
+int daemon_get_bounds(void* handle, int* first_key, int* last_key) {
+    struct daemon_calendar* calendar = handle;
+    struct storage* direct = get_direct_storage(calendar);
+    if (direct != NULL) return direct->driver->get_bounds(direct->handle, first_key, last_key);
+
+    struct message request, reply;
+    init_message(&request);
+    init_message(&reply);
+
+    begin_request(&request, DAEMON_GET_BOUNDS, calendar);
+    end_message(&request);
+
+    int result;
+    if (call_daemon(&request, &reply) == 0) {
+        result = message_get_int(&reply);
+        *first_key = message_get_int(&reply);
+        *last_key = message_get_int(&reply);
+    } else {
+        direct = get_direct_storage(calendar);
+        result = direct == NULL ? -1 : direct->driver->get_bounds(direct->handle, first_key, last_key);
+    }
+
+    free_message(&request);
+    free_message(&reply);
+
+    return result;
+}
+
+int daemon_add(void* handle, struct event event) {
+    struct daemon_calendar* calendar = handle;
+    struct storage* direct = get_direct_storage(calendar);
+    if (direct != NULL) return direct->driver->add(direct->handle, event);
+
+    struct message request;
+    init_message(&request);
+
+    begin_request(&request, DAEMON_ADD, calendar);
+    message_put_event(&request, &event);
+    end_message(&request);
+
+    int result;
+    if (call_daemon_for_int(&request, &result) != 0) result = -1;
+
+    free_message(&request);
+
+    return result;
+}
+
+int daemon_delete(void* handle, struct event event) {
+    struct daemon_calendar* calendar = handle;
+    struct storage* direct = get_direct_storage(calendar);
+    if (direct != NULL) return direct->driver->delete(direct->handle, event);
+
+    struct message request;
+    init_message(&request);
+
+    begin_request(&request, DAEMON_DELETE, calendar);
+    message_put_event(&request, &event);
+    end_message(&request);
+
+    int result;
+    if (call_daemon_for_int(&request, &result) != 0) result = -1;
+
+    free_message(&request);
+
+    return result;
+}
+
+int daemon_batch(void* handle, struct day_update* updates, size_t count) {
+    struct daemon_calendar* calendar = handle;
+    struct storage* direct = get_direct_storage(calendar);
+    if (direct != NULL) return direct->driver->batch(direct->handle, updates, count);
+
+    struct message request;
+    init_message(&request);
+
+    begin_request(&request, DAEMON_BATCH, calendar);
+    message_put_int(&request, count);
+    for (size_t i = 0; i < count; i++) {
+        message_put_int(&request, DATE_KEY(updates[i].year, updates[i].month, updates[i].day));
+        message_put_events(&request, &updates[i].events);
+
+        message_put_int(&request, updates[i].base != NULL);
+        if (updates[i].base != NULL) message_put_events(&request, updates[i].base);
+    }
+    end_message(&request);
+
+    int result;
+    if (call_daemon_for_int(&request, &result) != 0) result = -1;
+
+    free_message(&request);
+
+    return result;
+}
+
+long long daemon_get_version(void* handle) {
+    struct daemon_calendar* calendar = handle;
+    struct storage* direct = get_direct_storage(calendar);
+    if (direct != NULL) return direct->driver->get_version(direct->handle);
+
+    struct message request, reply;
+    init_message(&request);
+    init_message(&reply);
+
+    begin_request(&request, DAEMON_GET_VERSION, calendar);
+    end_message(&request);
+
+    long long version;
+    if (call_daemon(&request, &reply) == 0) {
+        version = message_get_long(&reply);
+    } else {
+        direct = get_direct_storage(calendar);
+        version = direct == NULL ? -1 : direct->driver->get_version(direct->handle);
+    }
+
+    free_message(&request);
+    free_message(&reply);
+
+    return version;
+}
+
+int daemon_fill(void* handle, int date_key) {
+    struct daemon_calendar* calendar = handle;
+    struct storage* direct = get_direct_storage(calendar);
+    if (direct != NULL) return direct->driver->fill == NULL ? 0 : direct->driver->fill(direct->handle, date_key);
+
+    struct message request;
+    init_message(&request);
+
+    begin_request(&request, DAEMON_FILL, calendar);
+    message_put_int(&request, date_key);
+    end_message(&request);
+
+    int result;
+    if (call_daemon_for_int(&request, &result) != 0) result = -1;
+
+    free_message(&request);
+
+    return result;
+}
+
+const char* daemon_get_file(void* handle) {
+    struct daemon_calendar* calendar = handle;
+
+    // Reading the file directly doesn't get in the daemon's way
+    return calendar->backend->get_file == NULL ? NULL : calendar->path;
+}
+
+/*
+ * Connects to the daemon unless this process already is. Returns -1 if
+ * none is running.
+ */
+int connect_daemon() {
+    if (daemon_fd >= 0 && daemon_pid == getpid()) return 0;
+
+    // A forked child has its parent's connection, which it mustn't use
+    if (daemon_fd >= 0) close(daemon_fd);
+    daemon_fd = -1;
+
+    char* path = get_daemon_socket_path();
+    if (path == NULL) return -1;
+
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+    bool fits = strlen(path) < sizeof(address.sun_path);
+    if (fits) strcpy(address.sun_path, path);
+    free(path);
+    if (!fits) return -1;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+
+    if (connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    struct timeval timeout = {DAEMON_TIMEOUT_MS / 1000, DAEMON_TIMEOUT_MS % 1000 * 1000};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    daemon_fd = fd;
+    daemon_pid = getpid();
+
+    return 0;
+}
+
+void disconnect_daemon() {
+    if (daemon_fd >= 0) close(daemon_fd);
+    daemon_fd = -1;
+}
+
+/*
+ * Returns the calendar's file opened directly if the daemon is gone,
+ * opening it the first time, or NULL while the daemon serves it. A
+ * forked process that can't reach the daemon reads the file too.
+ */
+struct storage* get_direct_storage(struct daemon_calendar* calendar) {
+    if (!daemon_lost && !disabled && connect_daemon() == 0) return NULL;
+
+    if (calendar->direct.handle == NULL) {
+        if (open_storage(&calendar->direct, calendar->backend, calendar->path) != 0) return NULL;
+    }
+
+    return &calendar->direct;
+}
+
+void begin_request(struct message* request, int op, struct daemon_calendar* calendar) {
+    begin_message(request, op);
+    message_put_int(request, calendar->id);
+}
+
+/*
+ * Sends a request and reads the first frame of the reply. Returns -1,
+ * and stops using the daemon, if it couldn't be asked or didn't answer,
+ * or if it couldn't serve the request.
+ */
+int call_daemon(struct message* request, struct message* reply) {
+    if (send_message(daemon_fd, request) != 0 || receive_message(daemon_fd, reply) != 0) {
+        disconnect_daemon();
+        daemon_lost = true;
+        return -1;
+    }
+
+    return message_op(reply) == DAEMON_ERROR ? -1 : 0;
+}
+
+/*
+ * call_daemon for the requests answered with a single int.
+ */
+int call_daemon_for_int(struct message* request, int* value) {
+    struct message reply;
+    init_message(&reply);
+
+    int result = call_daemon(request, &reply);
+    if (result == 0) *value = message_get_int(&reply);
+    if (reply.bad) result = -1;
+
+    free_message(&reply);
+
+    return result;
+}
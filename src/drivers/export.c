@@ -0,0 +1,318 @@
+/*
+ * export.c
+ *
+ * Writes a calendar out as an ICS file. Days are streamed from the
+ * storage backend one at a time (see get_source_range), so only a day's
+ * events are held in memory however big the calendar is, and the output
+ * goes through one large buffer instead of a write per line.
+ *
+ * calendar.txt doesn't have UIDs, so each event's UID is a hash of what
+ * identifies it (see format_event_uid). Repeating events use their id in
+ * the recurrence table instead, with skipped occurrences as EXDATEs and
+ * edited ones as extra VEVENTs with a RECURRENCE-ID.
+ *
+ * Content lines are folded at 75 octets without splitting a UTF-8
+ * character, and summaries are escaped as TEXT values.
+ */
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "export.h"
+#include "recurrence.h"
+#include "skeleton.h"
+#include "sources.h"
+
+// Content lines are at most this many octets before the line break
+#define ICS_FOLD_LENGTH 75
+
+/*
+ * An export in progress.
+ */
+struct ics_writer {
+    FILE* out;
+    char* buffer;
+    size_t length;
+    bool failed;
+
+    const char* calendar;
+    char stamp[17]; // the DTSTAMP of every event: when the export started
+    struct export_stats stats;
+};
+
+int export_day(int year, int month, int day, struct events* events, void* data);
+void export_recurrence(struct ics_writer* writer, struct recurrence* rule);
+void begin_event(struct ics_writer* writer, const char* uid, int date_key, struct event* event);
+void write_text_line(struct ics_writer* writer, const char* name, const char* text);
+void write_linef(struct ics_writer* writer, const char* format, ...);
+void write_line(struct ics_writer* writer, const char* line, size_t length);
+void write_raw(struct ics_writer* writer, const char* text, size_t length);
+void flush_writer(struct ics_writer* writer);
+void format_ics_time(char* buffer, int date_key, int hour, int min);
+
+int export_ics(FILE* out, int source, int first_key, int last_key, struct export_stats* stats) {
+    const char* calendar = get_source_name(source);
+    if (calendar == NULL) return -1;
+
+    struct ics_writer writer = {0};
+    writer.out = out;
+    writer.buffer = malloc(EXPORT_BUFFER_SIZE);
+    writer.calendar = calendar;
+
+    time_t now = time(NULL);
+    struct tm utc;
+    gmtime_r(&now, &utc);
+    strftime(writer.stamp, sizeof(writer.stamp), "%Y%m%dT%H%M%SZ", &utc);
+
+    write_linef(&writer, "BEGIN:VCALENDAR");
+    write_linef(&writer, "VERSION:2.0");
+    write_linef(&writer, "PRODID:-//calenter//calenter//EN");
+    write_linef(&writer, "CALSCALE:GREGORIAN");
+    write_text_line(&writer, "X-WR-CALNAME", calendar);
+
+    int result = get_source_range(source, first_key, last_key, export_day, &writer);
+
+    struct recurrence_table* recurrences = get_source_recurrences(source);
+    for (size_t i = 0; result == 0 && recurrences != NULL && i < recurrences->length; i++) {
+        struct recurrence* rule = &recurrences->rules[i];
+
+        if (rule->start_key > last_key) continue;
+        if (rule->until_key != 0 && rule->until_key < first_key) continue;
+
+        export_recurrence(&writer, rule);
+    }
+
+    write_linef(&writer, "END:VCALENDAR");
+    flush_writer(&writer);
+    if (fflush(out) != 0) writer.failed = true;
+
+    free(writer.buffer);
+
+    if (stats != NULL) *stats = writer.stats;
+
+    return result == 0 && !writer.failed ? 0 : -1;
+}
+
+void format_event_uid(char* buffer, const char* calendar, int date_key, struct event* event, int duplicate) {
+    char time[7];
+    format_time(time, event->hour, event->min);
+
+    uint64_t hash = HASH_SEED;
+    hash = hash_bytes(hash, calendar, strlen(calendar) + 1);
+    hash = hash_bytes(hash, time, strlen(time) + 1);
+    hash = hash_bytes(hash, event->summary, strlen(event->summary));
+
+    sprintf(buffer, "%08d-%016llx-%d@calenter", date_key, (unsigned long long)hash, duplicate);
+}
+
+/*
+ * A day_callback that writes a VEVENT for every event on the day.
+ */
+int export_day(int year, int month, int day, struct events* events, void* data) {
+    struct ics_writer* writer = data;
+    int date_key = DATE_KEY(year, month, day);
+
+    for (size_t i = 0; i < events->length; i++) {
+        struct event* event = &events->events[i];
+
+        // Identical events on the same day are told apart by their order
+        int duplicate = 0;
+        for (size_t j = 0; j < i; j++) {
+            struct event* other = &events->events[j];
+            if (other->hour == event->hour && other->min == event->min && strcmp(other->summary, event->summary) == 0) {
+                duplicate++;
+            }
+        }
+
+        char uid[48];
+        format_event_uid(uid, writer->calendar, date_key, event, duplicate);
+
+        begin_event(writer, uid, date_key, event);
+        write_linef(writer, "END:VEVENT");
+    }
+
+    writer->stats.days++;
+    writer->stats.events += events->length;
+
+    return writer->failed ? -1 : 0;
+}
+
+/*
+ * Writes a repeating event and the occurrences that were edited.
+ */
+void export_recurrence(struct ics_writer* writer, struct recurrence* rule) {
+    static const char* frequencies[] = {NULL, "DAILY", "WEEKLY", "MONTHLY"};
+
+    char uid[48];
+    snprintf(uid, sizeof(uid), "repeat-%d-%016llx@calenter", rule->id,
+        (unsigned long long)hash_bytes(HASH_SEED, writer->calendar, strlen(writer->calendar)));
+
+    begin_event(writer, uid, rule->start_key, &rule->event);
+
+    char until[32] = "";
+    if (rule->until_key != 0) {
+        // UNTIL has to be the same type of value as DTSTART
+        if (rule->event.hour < 0) {
+            snprintf(until, sizeof(until), ";UNTIL=%08d", rule->until_key);
+        } else {
+            snprintf(until, sizeof(until), ";UNTIL=%08dT235959", rule->until_key);
+        }
+    }
+    write_linef(writer, "RRULE:FREQ=%s;INTERVAL=%d%s", frequencies[rule->freq], rule->interval, until);
+
+    char time[32];
+    for (size_t i = 0; i < rule->num_exceptions; i++) {
+        struct recurrence_exception* exception = &rule->exceptions[i];
+        if (!exception->skipped) continue;
+
+        format_ics_time(time, exception->date_key, rule->event.hour, rule->event.min);
+        write_linef(writer, "EXDATE%s", time);
+    }
+
+    write_linef(writer, "END:VEVENT");
+
+    for (size_t i = 0; i < rule->num_exceptions; i++) {
+        struct recurrence_exception* exception = &rule->exceptions[i];
+        if (exception->skipped) continue;
+
+        begin_event(writer, uid, exception->date_key, &exception->event);
+
+        format_ics_time(time, exception->date_key, rule->event.hour, rule->event.min);
+        write_linef(writer, "RECURRENCE-ID%s", time);
+        write_linef(writer, "END:VEVENT");
+    }
+
+    writer->stats.repeating++;
+}
+
+/*
+ * Writes the start of a VEVENT up to its summary. The caller adds
+ * anything else and the END line.
+ */
+void begin_event(struct ics_writer* writer, const char* uid, int date_key, struct event* event) {
+    char time[32];
+
+    write_linef(writer, "BEGIN:VEVENT");
+    write_linef(writer, "UID:%s", uid);
+    write_linef(writer, "DTSTAMP:%s", writer->stamp);
+
+    format_ics_time(time, date_key, event->hour, event->min);
+    write_linef(writer, "DTSTART%s", time);
+
+    if (event->hour < 0) {
+        // All day events end at the start of the next day
+        format_ics_time(time, next_date_key(date_key), -1, -1);
+        write_linef(writer, "DTEND%s", time);
+    } else if (event->duration > 0) {
+        int end = event->hour * 60 + event->min + event->duration;
+        int end_key = end >= 24 * 60 ? next_date_key(date_key) : date_key;
+        end %= 24 * 60;
+
+        format_ics_time(time, end_key, end / 60, end % 60);
+        write_linef(writer, "DTEND%s", time);
+    }
+
+    write_text_line(writer, "SUMMARY", event->summary);
+}
+
+/*
+ * Writes "NAME:value" with the value escaped as TEXT.
+ */
+void write_text_line(struct ics_writer* writer, const char* name, const char* text) {
+    size_t name_length = strlen(name);
+    char* line = malloc(name_length + 2 * strlen(text) + 2);
+
+    memcpy(line, name, name_length);
+    size_t length = name_length;
+    line[length++] = ':';
+
+    for (const char* c = text; *c != '\0'; c++) {
+        if (*c == '\\' || *c == ';' || *c == ',') {
+            line[length++] = '\\';
+            line[length++] = *c;
+        } else if (*c == '\n') {
+            line[length++] = '\\';
+            line[length++] = 'n';
+        } else if (*c != '\r') {
+            line[length++] = *c;
+        }
+    }
+
+    write_line(writer, line, length);
+    free(line);
+}
+
+/*
+ * Writes a short content line that doesn't need escaping.
+ */
+void write_linef(struct ics_writer* writer, const char* format, ...) {
+    char line[256];
+
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+
+    if (length >= (int)sizeof(line)) length = sizeof(line) - 1;
+    write_line(writer, line, length);
+}
+
+/*
+ * Writes a content line, folded onto as many lines as it needs, and its
+ * CRLF.
+ */
+void write_line(struct ics_writer* writer, const char* line, size_t length) {
+    // Continuation lines start with a space, which counts towards the limit
+    size_t limit = ICS_FOLD_LENGTH;
+
+    while (length > limit) {
+        size_t cut = limit;
+        while (cut > 1 && ((unsigned char)line[cut] & 0xC0) == 0x80) cut--;
+
+        write_raw(writer, line, cut);
+        write_raw(writer, "\r\n ", 3);
+
+        line += cut;
+        length -= cut;
+        limit = ICS_FOLD_LENGTH - 1;
+    }
+
+    write_raw(writer, line, length);
+    write_raw(writer, "\r\n", 2);
+}
+
+void write_raw(struct ics_writer* writer, const char* text, size_t length) {
+    while (length > 0) {
+        if (writer->length == EXPORT_BUFFER_SIZE) flush_writer(writer);
+
+        size_t space = EXPORT_BUFFER_SIZE - writer->length;
+        size_t count = length < space ? length : space;
+
+        memcpy(writer->buffer + writer->length, text, count);
+        writer->length += count;
+        text += count;
+        length -= count;
+    }
+}
+
+void flush_writer(struct ics_writer* writer) {
+    if (writer->length > 0 && fwrite(writer->buffer, 1, writer->length, writer->out) != writer->length) {
+        writer->failed = true;
+    }
+    writer->length = 0;
+}
+
+/*
+ * Formats the parameters and value of a DTSTART-like property:
+ * ";VALUE=DATE:yyyymmdd" for all day (hour = -1) or ":yyyymmddTHHMM00".
+ */
+void format_ics_time(char* buffer, int date_key, int hour, int min) {
+    if (hour < 0) {
+        sprintf(buffer, ";VALUE=DATE:%08d", date_key);
+    } else {
+        sprintf(buffer, ":%08dT%02d%02d00", date_key, hour, min);
+    }
+}
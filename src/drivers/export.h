@@ -0,0 +1,33 @@
+#ifndef EXPORT_H
+#define EXPORT_H
+
+#include <stdio.h>
+#include "calendartxt.h"
+
+// Output is collected into a buffer this big before it's written
+#define EXPORT_BUFFER_SIZE (1 << 20)
+
+struct export_stats {
+    long days;
+    long events;
+    long repeating;
+};
+
+/*
+ * Writes the events of a calendar from first_key to last_key inclusive to
+ * out as an ICS file (RFC 5545). Repeating events are written once with
+ * an RRULE if any of them fall in the range. Times are floating, i.e. in
+ * whatever zone the calendar is read in. Returns 0 on success, -1 if the
+ * calendar couldn't be read or out couldn't be written.
+ */
+int export_ics(FILE* out, int source, int first_key, int last_key, struct export_stats* stats);
+
+/*
+ * Returns the UID an event on date_key is exported with. It only depends
+ * on the calendar's name, the date, the start time, the summary and which
+ * of the day's identical events it is, so exporting again gives the same
+ * UIDs. buffer should be at least 48 characters long.
+ */
+void format_event_uid(char* buffer, const char* calendar, int date_key, struct event* event, int duplicate);
+
+#endif
@@ -0,0 +1,94 @@
+#ifndef FREESLOTS_H
+#define FREESLOTS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "calendartxt.h"
+
+#define MINUTES_PER_DAY (24 * 60)
+#define BITMAP_WORDS ((MINUTES_PER_DAY + 63) / 64)
+
+// Minutes an event without an end time is taken to last
+#define UNTIMED_EVENT_MINUTES 30
+
+// Hours searched when work_hours isn't set in the config
+#define DEFAULT_WORK_START (9 * 60)
+#define DEFAULT_WORK_END (17 * 60)
+
+/*
+ * One bit per minute of a day, set for minutes that are taken. Bit i of
+ * words[i / 64] is minute i.
+ */
+struct day_bitmap {
+    uint64_t words[BITMAP_WORDS];
+};
+
+/*
+ * A search for gaps of at least length minutes between window_start and
+ * window_end (minutes since midnight) on num_days days from start_key.
+ * Nothing before start_minute on the first day counts as free.
+ */
+struct slot_query {
+    int start_key;
+    int start_minute;
+    int num_days;
+    int window_start;
+    int window_end;
+    int length;
+};
+
+/*
+ * A gap found by a search: the whole run of free minutes, which is at
+ * least as long as the query asked for.
+ */
+struct free_slot {
+    int date_key;
+    int start;
+    int end;
+};
+
+/*
+ * Marks the minutes from start up to (but not including) end as taken.
+ */
+void mark_minutes(struct day_bitmap* bitmap, int start, int end);
+
+/*
+ * Marks the events in bitmaps, which hold num_days days from first_key.
+ * Events running past midnight are marked on the next day too, and
+ * events outside the days are skipped. Marking several calendars' events
+ * into the same bitmaps combines them.
+ */
+void mark_events(struct day_bitmap* bitmaps, int first_key, int num_days, const struct events* events);
+
+/*
+ * Finds the runs of at least length minutes that are inside window and
+ * not taken in busy, on num_days days from first_key. Writes up to
+ * max_slots of them to slots in order and returns how many it wrote.
+ */
+size_t scan_free_slots(
+    const struct day_bitmap* busy, const struct day_bitmap* window, int first_key, int num_days,
+    int length, struct free_slot* slots, size_t max_slots
+);
+
+/*
+ * Finds the first max_slots gaps matching the query in every calendar.
+ * The days are read a few weeks at a time, so a search that's answered
+ * early doesn't read the whole horizon. Returns the number of slots
+ * found or -1 if the calendars couldn't be read.
+ */
+int find_free_slots(const struct slot_query* query, struct free_slot* slots, size_t max_slots);
+
+/*
+ * Parses "HH:MM-HH:MM" into minutes since midnight. An end of 24:00 is
+ * allowed. Returns 0 on success, -1 if the text isn't a range that ends
+ * after it starts.
+ */
+int parse_time_window(const char* text, int* start, int* end);
+
+/*
+ * Sets start and end to the work_hours in the config, or the default
+ * hours if it isn't set or isn't valid.
+ */
+void get_work_hours(int* start, int* end);
+
+#endif
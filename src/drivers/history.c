@@ -0,0 +1,370 @@
+/*
+ * history.c
+ *
+ * This file keeps the undo/redo history for edits made from the TUI.
+ * Every edit to a stored event changes exactly one day in one calendar,
+ * so an edit is stored as a pair of snapshots of that day: before and
+ * after. The rest of the calendar is never copied.
+ *
+ * Snapshots are reference counted. When several edits in a row touch
+ * the same day, the "after" snapshot of one edit is the "before"
+ * snapshot of the next, so each version of a day is stored once.
+ *
+ * Undoing an edit writes the "before" snapshot back to its day line
+ * and hands a copy of it to the caller, so the UI can swap it into
+ * what it is showing without reading the calendar again.
+ *
+ * Edits to repeating events are made to the calendar's table of them
+ * rather than to a day, so their snapshots hold the whole table as it is
+ * saved in its file. Undoing one writes that back.
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "history.h"
+#include "sources.h"
+#include "config.h"
+
+struct day_snapshot {
+    int refs;
+    int source;
+    int year;
+    int month;
+    int day;
+    size_t bytes;
+    struct events events;
+    char* repeating; // the saved table of repeating events, instead of events
+};
+
+/*
+ * The changes to repeating events that can be undone.
+ */
+enum repeating_edit {
+    ADD_REPEATING,
+    DELETE_REPEATING,
+    DELETE_OCCURRENCE,
+    EDIT_OCCURRENCE,
+};
+
+struct edit {
+    struct day_snapshot* before;
+    struct day_snapshot* after;
+};
+
+struct edit_stack {
+    struct edit* edits;
+    size_t length;
+    size_t size;
+};
+
+static struct edit_stack undo_stack = {0};
+static struct edit_stack redo_stack = {0};
+
+// Total size of every live snapshot
+static size_t history_bytes = 0;
+
+int edit_repeating(enum repeating_edit kind, struct event event, struct event new_event, enum repeat_freq freq);
+void record_edit(int source, int year, int month, int day, struct events before, struct events after);
+void add_edit(struct edit edit);
+struct day_snapshot* new_snapshot(int source, int year, int month, int day, struct events events);
+struct day_snapshot* new_repeating_snapshot(int source, int year, int month, int day, char* repeating);
+void release_snapshot(struct day_snapshot* snapshot);
+void push_edit(struct edit_stack* stack, struct edit edit);
+void clear_stack(struct edit_stack* stack);
+void trim_history();
+int swap_day(struct edit_stack* from, struct edit_stack* to, bool undo, struct history_change* change);
+
+int history_add_event(struct event event) {
+    struct events before = get_source_events(event.source, event.year, event.month, event.day);
+    struct events after = copy_events(before);
+
+    event.summary = strdup(event.summary);
+    insert_event(&after, event);
+
+    if (set_source_events(event.source, after, &before, event.year, event.month, event.day) != 0) {
+        free_events(before);
+        free_events(after);
+        return -1;
+    }
+
+    record_edit(event.source, event.year, event.month, event.day, before, after);
+    return 0;
+}
+
+int history_delete_event(struct event event) {
+    struct events before = get_source_events(event.source, event.year, event.month, event.day);
+    struct events after = copy_events(before);
+
+    if (
+        remove_event(&after, event) != 0 ||
+        set_source_events(event.source, after, &before, event.year, event.month, event.day) != 0
+    ) {
+        free_events(before);
+        free_events(after);
+        return -1;
+    }
+
+    record_edit(event.source, event.year, event.month, event.day, before, after);
+    return 0;
+}
+
+/*
+ * The old event is removed and the new one inserted in a single write so
+ * the edit is undone in one step.
+ */
+int history_edit_event(struct event old_event, struct event new_event) {
+    struct events before = get_source_events(old_event.source, old_event.year, old_event.month, old_event.day);
+    struct events after = copy_events(before);
+
+    new_event.source = old_event.source;
+    new_event.summary = strdup(new_event.summary);
+
+    if (remove_event(&after, old_event) != 0) {
+        free(new_event.summary);
+        free_events(before);
+        free_events(after);
+        return -1;
+    }
+    insert_event(&after, new_event);
+
+    if (set_source_events(old_event.source, after, &before, old_event.year, old_event.month, old_event.day) != 0) {
+        free_events(before);
+        free_events(after);
+        return -1;
+    }
+
+    record_edit(old_event.source, old_event.year, old_event.month, old_event.day, before, after);
+    return 0;
+}
+
+int history_add_repeating_event(struct event event, enum repeat_freq freq) {
+    return edit_repeating(ADD_REPEATING, event, event, freq);
+}
+
+int history_delete_repeating_event(struct event event) {
+    return edit_repeating(DELETE_REPEATING, event, event, REPEAT_NONE);
+}
+
+int history_delete_occurrence(struct event event) {
+    return edit_repeating(DELETE_OCCURRENCE, event, event, REPEAT_NONE);
+}
+
+int history_edit_occurrence(struct event old_event, struct event new_event) {
+    return edit_repeating(EDIT_OCCURRENCE, old_event, new_event, REPEAT_NONE);
+}
+
+/*
+ * Makes a change to the repeating events of event's calendar and records
+ * the table before and after it. The calendar stays locked in between so
+ * the snapshots only differ by this change.
+ */
+int edit_repeating(enum repeating_edit kind, struct event event, struct event new_event, enum repeat_freq freq) {
+    struct recurrence_table* table = get_source_recurrences(event.source);
+    if (table == NULL || lock_recurrences(table) != 0) return -1;
+
+    if (refresh_recurrences(table) != 0) {
+        unlock_recurrences(table);
+        return -1;
+    }
+
+    char* before = save_recurrences(table);
+    int result = -1;
+
+    switch (kind) {
+        case ADD_REPEATING: result = add_repeating_event(event, freq); break;
+        case DELETE_REPEATING: result = delete_repeating_event(event); break;
+        case DELETE_OCCURRENCE: result = delete_occurrence(event); break;
+        case EDIT_OCCURRENCE: result = edit_occurrence_event(event, new_event); break;
+    }
+
+    if (result == 0) {
+        struct edit edit;
+        edit.before = new_repeating_snapshot(event.source, event.year, event.month, event.day, before);
+        edit.after = new_repeating_snapshot(event.source, event.year, event.month, event.day, save_recurrences(table));
+        add_edit(edit);
+    } else {
+        free(before);
+    }
+
+    unlock_recurrences(table);
+    return result;
+}
+
+int undo_edit(struct history_change* change) {
+    return swap_day(&undo_stack, &redo_stack, true, change);
+}
+
+int redo_edit(struct history_change* change) {
+    return swap_day(&redo_stack, &undo_stack, false, change);
+}
+
+void clear_history() {
+    clear_stack(&undo_stack);
+    clear_stack(&redo_stack);
+}
+
+/*
+ * Moves the top edit from one stack to the other and writes the snapshot
+ * on the far side of it to disk.
+ */
+int swap_day(struct edit_stack* from, struct edit_stack* to, bool undo, struct history_change* change) {
+    if (from->length == 0) return -1;
+
+    struct edit edit = from->edits[from->length - 1];
+    struct day_snapshot* current = undo ? edit.after : edit.before;
+    struct day_snapshot* target = undo ? edit.before : edit.after;
+
+    if (target->repeating != NULL) {
+        // The table is only written back if it's still the one the edit left
+        struct recurrence_table* table = get_source_recurrences(target->source);
+        if (table == NULL || restore_recurrences(table, target->repeating, current->repeating) != 0) return -1;
+    } else {
+        // Don't clobber a day that was changed behind our back (e.g. by a
+        // sync). One that changes after this check is merged by the write.
+        struct events on_disk = get_source_events(target->source, target->year, target->month, target->day);
+        bool unchanged = events_match(&on_disk, &current->events);
+        free_events(on_disk);
+
+        if (!unchanged) return -1;
+
+        if (set_source_events(target->source, target->events, &current->events, target->year, target->month, target->day) != 0) {
+            return -1;
+        }
+    }
+
+    from->length--;
+    push_edit(to, edit);
+
+    change->source = target->source;
+    change->year = target->year;
+    change->month = target->month;
+    change->day = target->day;
+    change->events = copy_events(target->events);
+    change->repeating = target->repeating != NULL;
+
+    return 0;
+}
+
+/*
+ * Takes ownership of before and after.
+ */
+void record_edit(int source, int year, int month, int day, struct events before, struct events after) {
+    struct edit edit;
+
+    // Share the previous edit's result if this edit picks up where it left off
+    struct edit* last = undo_stack.length > 0 ? &undo_stack.edits[undo_stack.length - 1] : NULL;
+    if (
+        last != NULL &&
+        last->after->repeating == NULL &&
+        last->after->source == source &&
+        DATE_KEY(last->after->year, last->after->month, last->after->day) == DATE_KEY(year, month, day) &&
+        events_match(&last->after->events, &before)
+    ) {
+        edit.before = last->after;
+        edit.before->refs++;
+        free_events(before);
+    } else {
+        edit.before = new_snapshot(source, year, month, day, before);
+    }
+
+    edit.after = new_snapshot(source, year, month, day, after);
+
+    add_edit(edit);
+}
+
+/*
+ * Pushes a new edit, which makes the undone ones unreachable.
+ */
+void add_edit(struct edit edit) {
+    clear_stack(&redo_stack);
+    push_edit(&undo_stack, edit);
+    trim_history();
+}
+
+/*
+ * Drops the oldest edits until the history fits in the configured limits.
+ * The most recent edit is always kept.
+ */
+void trim_history() {
+    const Config* config = get_config();
+    int max_depth = config->undo_depth;
+    size_t max_bytes = (size_t)config->undo_memory * 1024;
+
+    size_t drop = 0;
+    while (
+        undo_stack.length - drop > 1 &&
+        ((int)(undo_stack.length - drop) > max_depth || history_bytes > max_bytes)
+    ) {
+        release_snapshot(undo_stack.edits[drop].before);
+        release_snapshot(undo_stack.edits[drop].after);
+        drop++;
+    }
+
+    if (drop == 0) return;
+
+    memmove(undo_stack.edits, undo_stack.edits + drop, (undo_stack.length - drop) * sizeof(struct edit));
+    undo_stack.length -= drop;
+}
+
+struct day_snapshot* new_snapshot(int source, int year, int month, int day, struct events events) {
+    struct day_snapshot* snapshot = malloc(sizeof(struct day_snapshot));
+    snapshot->refs = 1;
+    snapshot->source = source;
+    snapshot->year = year;
+    snapshot->month = month;
+    snapshot->day = day;
+    snapshot->events = events;
+    snapshot->repeating = NULL;
+
+    snapshot->bytes = sizeof(struct day_snapshot) + events.size * sizeof(struct event);
+    for (size_t i = 0; i < events.length; i++) {
+        snapshot->bytes += strlen(events.events[i].summary) + 1;
+    }
+    history_bytes += snapshot->bytes;
+
+    return snapshot;
+}
+
+/*
+ * Takes ownership of repeating, a table returned by save_recurrences.
+ */
+struct day_snapshot* new_repeating_snapshot(int source, int year, int month, int day, char* repeating) {
+    struct events events;
+    init_events(&events);
+
+    struct day_snapshot* snapshot = new_snapshot(source, year, month, day, events);
+    snapshot->repeating = repeating;
+    snapshot->bytes += strlen(repeating) + 1;
+    history_bytes += strlen(repeating) + 1;
+
+    return snapshot;
+}
+
+void release_snapshot(struct day_snapshot* snapshot) {
+    snapshot->refs--;
+    if (snapshot->refs > 0) return;
+
+    history_bytes -= snapshot->bytes;
+    free_events(snapshot->events);
+    free(snapshot->repeating);
+    free(snapshot);
+}
+
+void push_edit(struct edit_stack* stack, struct edit edit) {
+    if (stack->length == stack->size) {
+        stack->size = stack->size == 0 ? 16 : stack->size * 2;
+        stack->edits = realloc(stack->edits, stack->size * sizeof(struct edit));
+    }
+
+    stack->edits[stack->length] = edit;
+    stack->length++;
+}
+
+void clear_stack(struct edit_stack* stack) {
+    for (size_t i = 0; i < stack->length; i++) {
+        release_snapshot(stack->edits[i].before);
+        release_snapshot(stack->edits[i].after);
+    }
+    stack->length = 0;
+}
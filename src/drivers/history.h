@@ -0,0 +1,54 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stdbool.h>
+#include "calendartxt.h"
+#include "recurrence.h"
+
+/*
+ * The result of an undo or redo: the day that changed and the events the
+ * source now has on it. The events are a copy owned by the caller. When
+ * repeating is set the change was to the source's repeating events
+ * instead, which can change any day, and the day is the one the edit
+ * was made on, with no events.
+ */
+struct history_change {
+    int source;
+    int year;
+    int month;
+    int day;
+    struct events events;
+    bool repeating;
+};
+
+/*
+ * Adds, deletes or replaces an event like add_event/delete_event and
+ * records the change so it can be undone. Returns 0 on success, -1 on failure.
+ */
+int history_add_event(struct event event);
+int history_delete_event(struct event event);
+int history_edit_event(struct event old_event, struct event new_event);
+
+/*
+ * The same for repeating events, like add_repeating_event,
+ * delete_repeating_event, delete_occurrence and edit_occurrence_event.
+ */
+int history_add_repeating_event(struct event event, enum repeat_freq freq);
+int history_delete_repeating_event(struct event event);
+int history_delete_occurrence(struct event event);
+int history_edit_occurrence(struct event old_event, struct event new_event);
+
+/*
+ * Reverts the most recent edit (or reapplies the most recently undone one).
+ * Returns 0 on success and -1 if there is nothing to undo/redo or the day
+ * was changed by something else since the edit was made.
+ */
+int undo_edit(struct history_change* change);
+int redo_edit(struct history_change* change);
+
+/*
+ * Forgets every edit, e.g. when the calendars they were made in change.
+ */
+void clear_history();
+
+#endif
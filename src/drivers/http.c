@@ -0,0 +1,390 @@
+/*
+ * http.c
+ *
+ * A small HTTP/1.1 client for fetching calendar feeds. It only does what
+ * a feed needs: one GET per connection, conditional requests with
+ * If-None-Match and If-Modified-Since, and bodies sent with either a
+ * Content-Length, chunked encoding or by closing the connection. The body
+ * is handed to a callback in pieces as it is read so it never has to be
+ * held in memory or written to disk. TLS isn't supported.
+ */
+
+#include <errno.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "http.h"
+
+#define HTTP_PREFIX "http://"
+#define HTTP_BUFFER_SIZE (1 << 16)
+#define HTTP_MAX_LINE 8192
+
+/*
+ * A buffered reader over the socket.
+ */
+struct http_connection {
+    int fd;
+    int timeout_ms;
+    char* buffer;
+    size_t start;
+    size_t end;
+};
+
+struct http_url {
+    char* host;
+    char* port;
+    char* path;
+};
+
+int parse_http_url(const char* url, struct http_url* parsed);
+void free_http_url(struct http_url* parsed);
+int connect_to(struct http_url* url, int timeout_ms);
+int send_request(int fd, const struct http_request* request, struct http_url* url);
+int read_response(struct http_connection* connection, struct http_response* response, http_body_callback callback, void* data);
+int fill_buffer(struct http_connection* connection);
+int read_line(struct http_connection* connection, char* line, size_t size);
+int read_body(struct http_connection* connection, long length, http_body_callback callback, void* data);
+int read_chunked_body(struct http_connection* connection, http_body_callback callback, void* data);
+char* trim_header_value(char* value);
+
+bool is_http_url(const char* url) {
+    return strncasecmp(url, HTTP_PREFIX, strlen(HTTP_PREFIX)) == 0;
+}
+
+int http_get(const struct http_request* request, struct http_response* response, http_body_callback callback, void* data) {
+    memset(response, 0, sizeof(struct http_response));
+
+    struct http_url url;
+    if (parse_http_url(request->url, &url) != 0) return -1;
+
+    struct http_connection connection = {0};
+    connection.timeout_ms = request->timeout_ms;
+    connection.fd = connect_to(&url, request->timeout_ms);
+
+    if (connection.fd < 0 || send_request(connection.fd, request, &url) != 0) {
+        if (connection.fd >= 0) close(connection.fd);
+        free_http_url(&url);
+        return -1;
+    }
+    free_http_url(&url);
+
+    connection.buffer = malloc(HTTP_BUFFER_SIZE);
+    int result = read_response(&connection, response, callback, data);
+
+    close(connection.fd);
+    free(connection.buffer);
+
+    return result;
+}
+
+void free_http_response(struct http_response* response) {
+    free(response->etag);
+    free(response->last_modified);
+    memset(response, 0, sizeof(struct http_response));
+}
+
+/*
+ * Reads the status line and headers, then the body if the status is 200.
+ */
+int read_response(struct http_connection* connection, struct http_response* response, http_body_callback callback, void* data) {
+    char line[HTTP_MAX_LINE];
+
+    // Status line: "HTTP/1.1 200 OK"
+    if (read_line(connection, line, sizeof(line)) != 0 || sscanf(line, "HTTP/%*d.%*d %d", &response->status) != 1) {
+        return -1;
+    }
+
+    long content_length = -1;
+    bool chunked = false;
+
+    while (true) {
+        if (read_line(connection, line, sizeof(line)) != 0) return -1;
+        if (line[0] == '\0') break;
+
+        char* colon = strchr(line, ':');
+        if (colon == NULL) continue;
+        *colon = '\0';
+        char* value = trim_header_value(colon + 1);
+
+        if (strcasecmp(line, "ETag") == 0) {
+            free(response->etag);
+            response->etag = strdup(value);
+        } else if (strcasecmp(line, "Last-Modified") == 0) {
+            free(response->last_modified);
+            response->last_modified = strdup(value);
+        } else if (strcasecmp(line, "Content-Length") == 0) {
+            content_length = strtol(value, NULL, 10);
+        } else if (strcasecmp(line, "Transfer-Encoding") == 0) {
+            // Chunked is always the last encoding applied
+            size_t length = strlen(value);
+            chunked = length >= 7 && strcasecmp(value + length - 7, "chunked") == 0;
+        }
+    }
+
+    // Nothing needs the body of any other response, and the connection is
+    // closed afterwards anyway
+    if (response->status != 200) return 0;
+
+    return chunked ?
+        read_chunked_body(connection, callback, data) :
+        read_body(connection, content_length, callback, data);
+}
+
+/*
+ * Splits "http://host[:port][/path]" into its parts. Hosts can be IPv6
+ * addresses in brackets. Returns -1 if it isn't an http url.
+ */
+int parse_http_url(const char* url, struct http_url* parsed) {
+    if (!is_http_url(url)) return -1;
+
+    const char* host = url + strlen(HTTP_PREFIX);
+    const char* path = host + strcspn(host, "/?#");
+    const char* host_end = path;
+    const char* port = NULL;
+
+    if (*host == '[') {
+        const char* bracket = memchr(host, ']', path - host);
+        if (bracket == NULL) return -1;
+
+        if (bracket + 1 < path && bracket[1] == ':') port = bracket + 2;
+        host_end = bracket;
+        host++;
+    } else {
+        port = memchr(host, ':', path - host);
+        if (port != NULL) {
+            host_end = port;
+            port++;
+        }
+    }
+
+    if (host_end == host) return -1;
+
+    parsed->host = strndup(host, host_end - host);
+    parsed->port = port != NULL && port < path ? strndup(port, path - port) : strdup("80");
+
+    if (*path == '/') {
+        parsed->path = strndup(path, strcspn(path, "#"));
+    } else {
+        // "http://host?query" still needs a leading slash
+        size_t length = strcspn(path, "#") + 2;
+        parsed->path = malloc(sizeof(char) * length);
+        snprintf(parsed->path, length, "/%s", path);
+    }
+
+    return 0;
+}
+
+void free_http_url(struct http_url* parsed) {
+    free(parsed->host);
+    free(parsed->port);
+    free(parsed->path);
+}
+
+/*
+ * Connects to the first address of the host that answers within the
+ * timeout. Returns the socket or -1.
+ */
+int connect_to(struct http_url* url, int timeout_ms) {
+    struct addrinfo hints = {0};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    struct addrinfo* addresses;
+    if (getaddrinfo(url->host, url->port, &hints, &addresses) != 0) return -1;
+
+    int fd = -1;
+    for (struct addrinfo* address = addresses; address != NULL && fd < 0; address = address->ai_next) {
+        fd = socket(address->ai_family, address->ai_socktype | SOCK_CLOEXEC | SOCK_NONBLOCK, address->ai_protocol);
+        if (fd < 0) continue;
+
+        if (connect(fd, address->ai_addr, address->ai_addrlen) != 0) {
+            struct pollfd pollfd = {.fd = fd, .events = POLLOUT};
+            int error = 0;
+            socklen_t error_length = sizeof(error);
+
+            if (
+                errno != EINPROGRESS ||
+                poll(&pollfd, 1, timeout_ms) != 1 ||
+                getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &error_length) != 0 ||
+                error != 0
+            ) {
+                close(fd);
+                fd = -1;
+            }
+        }
+    }
+
+    freeaddrinfo(addresses);
+
+    return fd;
+}
+
+int send_request(int fd, const struct http_request* request, struct http_url* url) {
+    char* headers = malloc(HTTP_MAX_LINE * 2);
+    bool ipv6 = strchr(url->host, ':') != NULL;
+
+    int length = snprintf(headers, HTTP_MAX_LINE * 2,
+        "GET %s HTTP/1.1\r\n"
+        "Host: %s%s%s%s%s\r\n"
+        "User-Agent: calenter\r\n"
+        "Accept: text/calendar\r\n"
+        "Accept-Encoding: identity\r\n"
+        "Connection: close\r\n",
+        url->path,
+        ipv6 ? "[" : "", url->host, ipv6 ? "]" : "",
+        strcmp(url->port, "80") == 0 ? "" : ":", strcmp(url->port, "80") == 0 ? "" : url->port);
+
+    if (request->etag != NULL) {
+        length += snprintf(headers + length, HTTP_MAX_LINE * 2 - length, "If-None-Match: %s\r\n", request->etag);
+    }
+    if (request->last_modified != NULL && length < HTTP_MAX_LINE * 2) {
+        length += snprintf(headers + length, HTTP_MAX_LINE * 2 - length, "If-Modified-Since: %s\r\n", request->last_modified);
+    }
+    if (length < HTTP_MAX_LINE * 2) {
+        length += snprintf(headers + length, HTTP_MAX_LINE * 2 - length, "\r\n");
+    }
+
+    if (length >= HTTP_MAX_LINE * 2) {
+        free(headers);
+        return -1;
+    }
+
+    int sent = 0;
+    while (sent < length) {
+        struct pollfd pollfd = {.fd = fd, .events = POLLOUT};
+        int ready = poll(&pollfd, 1, request->timeout_ms);
+        if (ready == 0 || (ready < 0 && errno != EINTR)) break;
+
+        ssize_t written = send(fd, headers + sent, length - sent, MSG_NOSIGNAL);
+        if (written < 0 && errno != EAGAIN && errno != EINTR) break;
+        if (written > 0) sent += written;
+    }
+    free(headers);
+
+    return sent == length ? 0 : -1;
+}
+
+/*
+ * Reads more data into the buffer, moving what's left to the front.
+ * Returns the number of bytes read, 0 at the end of the stream and -1 on
+ * an error or timeout.
+ */
+int fill_buffer(struct http_connection* connection) {
+    if (connection->start > 0) {
+        memmove(connection->buffer, connection->buffer + connection->start, connection->end - connection->start);
+        connection->end -= connection->start;
+        connection->start = 0;
+    }
+
+    if (connection->end == HTTP_BUFFER_SIZE) return -1;
+
+    while (true) {
+        ssize_t received = recv(connection->fd, connection->buffer + connection->end,
+            HTTP_BUFFER_SIZE - connection->end, 0);
+
+        if (received >= 0) {
+            connection->end += received;
+            return received;
+        }
+        if (errno == EINTR) continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK) return -1;
+
+        struct pollfd pollfd = {.fd = connection->fd, .events = POLLIN};
+        int ready = poll(&pollfd, 1, connection->timeout_ms);
+        if (ready == 0 || (ready < 0 && errno != EINTR)) return -1;
+    }
+}
+
+/*
+ * Reads a line without its CRLF. Returns -1 if the stream ends first or
+ * the line doesn't fit.
+ */
+int read_line(struct http_connection* connection, char* line, size_t size) {
+    while (true) {
+        char* buffer = connection->buffer + connection->start;
+        size_t available = connection->end - connection->start;
+        char* newline = memchr(buffer, '\n', available);
+
+        if (newline != NULL) {
+            size_t length = newline - buffer;
+            if (length > 0 && buffer[length - 1] == '\r') length--;
+            if (length >= size) return -1;
+
+            memcpy(line, buffer, length);
+            line[length] = '\0';
+            connection->start += newline - buffer + 1;
+
+            return 0;
+        }
+
+        if (available >= size || fill_buffer(connection) <= 0) return -1;
+    }
+}
+
+/*
+ * Passes length bytes of body to callback, or everything up to the end of
+ * the stream if length is -1.
+ */
+int read_body(struct http_connection* connection, long length, http_body_callback callback, void* data) {
+    long remaining = length;
+
+    while (remaining != 0) {
+        if (connection->start == connection->end) {
+            int received = fill_buffer(connection);
+            if (received < 0) return -1;
+            if (received == 0) return length < 0 ? 0 : -1;
+        }
+
+        size_t available = connection->end - connection->start;
+        if (remaining > 0 && (size_t)remaining < available) available = remaining;
+
+        if (callback(connection->buffer + connection->start, available, data) != 0) return -1;
+
+        connection->start += available;
+        if (remaining > 0) remaining -= available;
+    }
+
+    return 0;
+}
+
+int read_chunked_body(struct http_connection* connection, http_body_callback callback, void* data) {
+    char line[HTTP_MAX_LINE];
+
+    while (true) {
+        // Chunk size in hex, possibly followed by ";extensions"
+        if (read_line(connection, line, sizeof(line)) != 0) return -1;
+
+        char* end;
+        long size = strtol(line, &end, 16);
+        if (end == line || size < 0) return -1;
+
+        if (size == 0) break;
+        if (read_body(connection, size, callback, data) != 0) return -1;
+
+        // Every chunk ends with a CRLF
+        if (read_line(connection, line, sizeof(line)) != 0 || line[0] != '\0') return -1;
+    }
+
+    // Skip any trailers
+    do {
+        if (read_line(connection, line, sizeof(line)) != 0) return -1;
+    } while (line[0] != '\0');
+
+    return 0;
+}
+
+char* trim_header_value(char* value) {
+    while (*value == ' ' || *value == '\t') value++;
+
+    size_t length = strlen(value);
+    while (length > 0 && (value[length - 1] == ' ' || value[length - 1] == '\t')) length--;
+    value[length] = '\0';
+
+    return value;
+}
@@ -0,0 +1,46 @@
+#ifndef HTTP_H
+#define HTTP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Called with each piece of a 200 response's body as it arrives.
+ * Returning non-zero stops the transfer.
+ */
+typedef int (*http_body_callback)(const char* data, size_t length, void* user);
+
+struct http_request {
+    const char* url;
+
+    // Validators from the last response, sent so the server can answer
+    // 304 Not Modified. Either may be NULL.
+    const char* etag;
+    const char* last_modified;
+
+    // Limit on connecting and on each wait for data
+    int timeout_ms;
+};
+
+struct http_response {
+    int status;
+    char* etag;
+    char* last_modified;
+};
+
+/*
+ * Returns true if the url is one http_get can fetch (plain http://).
+ */
+bool is_http_url(const char* url);
+
+/*
+ * Sends a GET request and streams the body of a 200 response to callback.
+ * Other responses' bodies are discarded. Returns 0 once a whole response
+ * has been received (whatever its status) and -1 if the connection failed,
+ * timed out, the response was malformed or callback stopped the transfer.
+ */
+int http_get(const struct http_request* request, struct http_response* response, http_body_callback callback, void* data);
+
+void free_http_response(struct http_response* response);
+
+#endif
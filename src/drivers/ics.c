@@ -1,12 +1,20 @@
 /*
  * ics.c
  *
- * This file contains functions to parse events in a ICS
- * file into data structures that can be written to calendat.txt
- * using the functions in calendartxt.c.
+ * This file contains a parser for the events in an ICS file (RFC 5545).
+ * It is a push parser: input is fed in chunks as it arrives, folded lines
+ * are joined back together and every VEVENT is handed to a callback as
+ * soon as its END line is seen. Only the properties calenter uses are
+ * kept (UID, SUMMARY, DTSTART, DTEND, DURATION and RRULE).
  *
- * NOTE: This file does not work yet and is not actually compiled and
- * linked into the project yet.
+ * Big files can be parsed on several threads instead. The file is mapped
+ * and cut into chunks just before BEGIN:VEVENT lines (see chunks.c). A
+ * line that starts with a letter can't be the continuation of a folded
+ * line and VEVENTs don't nest, so every chunk can be parsed from a fresh
+ * parser state and gives exactly the events it would have given in one
+ * pass. Each thread takes the next unparsed chunk and keeps its events,
+ * and the calling thread hands them to the callback chunk by chunk in
+ * file order while the later chunks are still being parsed.
  */
 
 #include <stddef.h>
@@ -14,107 +22,514 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <stdbool.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "ics.h"
+#include "chunks.h"
 
-#define INIT_EVENTS_SIZE 500
+#define INIT_LINE_SIZE 256
+#define READ_CHUNK_SIZE (1 << 16)
+#define INIT_CHUNK_EVENTS 64
 
-typedef struct _ics_line {
-    char* line;
-    int length;
-    FILE* ics_file;
-} Line;
+// Files smaller than two chunks are parsed in one pass
+#define MIN_PARSE_CHUNK (1 << 16)
 
-typedef struct _param {
-    char* name;
-    char** values;
-} Param;
-
-typedef struct _content_line {
-    char* name;
-    Param* params;
-} ContentLine;
+/*
+ * The events parsed from one chunk of a mapped file.
+ */
+struct ics_chunk {
+    struct ics_event* events;
+    size_t num_events;
+    size_t size;
+    bool done;
+};
 
 /*
- * Gets the next line in the ics file (accounting for line folding).
- * Returns the number of characters read or EOF if the end of file was reached.
- * */
-int get_line(Line* line) {
-    int buf_len = 2048;
-    char* buffer = malloc(sizeof(char) * buf_len);
-    memset(buffer, '\0', buf_len);
-    
-    char c;
-    int index = 0;
-
-    // I know this is probably dumb to have while (true) loop but I don't care
-    while (true) {
-        while ((c = fgetc(line->ics_file)) != '\r') {
-            if (c == EOF) return EOF;
-
-            if (index == buf_len) {
-                char* bigger_buffer = malloc(sizeof(char) * 2 * buf_len);
-                memset(buffer, '\0', buf_len);
-
-                for (int i = 0; i < buf_len; i++) {
-                    bigger_buffer[i] = buffer[i];
-                }
-                buf_len *= 2;
-
-                free(buffer);
-                buffer = bigger_buffer;
+ * Shared by the threads parsing one file.
+ */
+struct parse_job {
+    struct chunk_queue queue; // stopped once the callback stops the parser
+    struct ics_chunk* chunks; // one for each chunk in the queue
+    pthread_cond_t chunk_done; // waited on with the queue's lock
+};
+
+void append_line(struct ics_parser* parser, const char* text, size_t length);
+void end_line(struct ics_parser* parser);
+void parse_content_line(struct ics_parser* parser, char* line);
+char* get_param(char* params, char* params_end, const char* name);
+char* find_value(char* line);
+char* unescape_text(const char* value);
+void parse_time_property(char* value, char* params, char* params_end, struct ics_time* time);
+size_t find_event_start(const char* map, size_t length, size_t from);
+int deliver_chunks(struct parse_job* job, ics_event_callback callback, void* data);
+void* parse_chunks(void* data);
+int collect_event(struct ics_event* event, void* data);
+void free_chunk_events(struct ics_chunk* chunk);
+
+void init_ics_parser(struct ics_parser* parser, ics_event_callback callback, void* data) {
+    memset(parser, 0, sizeof(struct ics_parser));
+    parser->size = INIT_LINE_SIZE;
+    parser->line = malloc(parser->size);
+    parser->callback = callback;
+    parser->data = data;
+}
+
+int feed_ics(struct ics_parser* parser, const char* buffer, size_t length) {
+    size_t index = 0;
+
+    while (index < length && parser->result == 0) {
+        if (parser->line_complete) {
+            // A line starting with whitespace continues the previous one
+            if (buffer[index] == ' ' || buffer[index] == '\t') {
+                parser->line_complete = false;
+                index++;
+                continue;
             }
+            end_line(parser);
+            if (parser->result != 0) break;
+        }
+
+        const char* newline = memchr(buffer + index, '\n', length - index);
+        size_t end = newline == NULL ? length : (size_t)(newline - buffer);
+
+        append_line(parser, buffer + index, end - index);
+        if (newline == NULL) break;
+
+        if (parser->length > 0 && parser->line[parser->length - 1] == '\r') parser->length--;
+        parser->line_complete = true;
+        index = end + 1;
+    }
+
+    return parser->result;
+}
+
+int finish_ics(struct ics_parser* parser) {
+    if (parser->result == 0 && (parser->line_complete || parser->length > 0)) {
+        end_line(parser);
+    }
+
+    free(parser->line);
+    parser->line = NULL;
+    free_ics_event(&parser->event);
 
-            buffer[index] = c;
-            index++;
+    return parser->result;
+}
+
+int parse_ics_file(const char* path, ics_event_callback callback, void* data) {
+    FILE* ics_file = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if (ics_file == NULL) return -1;
+
+    struct ics_parser parser;
+    init_ics_parser(&parser, callback, data);
+
+    char* buffer = malloc(READ_CHUNK_SIZE);
+    size_t read;
+    while ((read = fread(buffer, 1, READ_CHUNK_SIZE, ics_file)) > 0) {
+        if (feed_ics(&parser, buffer, read) != 0) break;
+    }
+
+    free(buffer);
+    if (ics_file != stdin) fclose(ics_file);
+
+    return finish_ics(&parser);
+}
+
+int parse_ics_file_parallel(const char* path, int num_threads, ics_event_callback callback, void* data) {
+    num_threads = get_num_threads(num_threads, MAX_PARSE_THREADS);
+
+    if (strcmp(path, "-") == 0) return parse_ics_file(path, callback, data);
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    // Pipes can't be mapped and small files aren't worth the threads
+    size_t length = info.st_size;
+    if (!S_ISREG(info.st_mode) || length < 2 * MIN_PARSE_CHUNK) {
+        close(fd);
+        return parse_ics_file(path, callback, data);
+    }
+
+    char* map = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return parse_ics_file(path, callback, data);
+
+    struct parse_job job;
+    init_chunk_queue(&job.queue, map, length, num_threads, MIN_PARSE_CHUNK, find_event_start);
+    job.chunks = calloc(job.queue.num_chunks, sizeof(struct ics_chunk));
+    pthread_cond_init(&job.chunk_done, NULL);
+
+    pthread_t threads[MAX_PARSE_THREADS];
+    int num_started = 0;
+    for (int i = 0; i < num_threads; i++) {
+        if (pthread_create(&threads[num_started], NULL, parse_chunks, &job) == 0) num_started++;
+    }
+
+    // Without any threads the whole file is parsed here first
+    if (num_started == 0) parse_chunks(&job);
+
+    int result = deliver_chunks(&job, callback, data);
+
+    for (int i = 0; i < num_started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    for (size_t i = 0; i < job.queue.num_chunks; i++) {
+        free_chunk_events(&job.chunks[i]);
+    }
+    free(job.chunks);
+    free_chunk_queue(&job.queue);
+    pthread_cond_destroy(&job.chunk_done);
+    munmap(map, length);
+
+    return result;
+}
+
+/*
+ * Returns the offset of the first BEGIN:VEVENT line after from, or length
+ * if there isn't one.
+ */
+size_t find_event_start(const char* map, size_t length, size_t from) {
+    static const char marker[] = "BEGIN:VEVENT";
+    size_t marker_length = sizeof(marker) - 1;
+
+    size_t index = from;
+    while (index < length) {
+        const char* newline = memchr(map + index, '\n', length - index);
+        if (newline == NULL) break;
+        index = newline - map + 1;
+
+        if (length - index <= marker_length) break;
+        if (strncasecmp(map + index, marker, marker_length) != 0) continue;
+
+        char after = map[index + marker_length];
+        if (after == '\r' || after == '\n') return index;
+    }
+
+    return length;
+}
+
+/*
+ * Waits for each chunk in turn and passes its events to the callback.
+ * Returns 0, or the callback's non-zero result once it has stopped.
+ */
+int deliver_chunks(struct parse_job* job, ics_event_callback callback, void* data) {
+    for (size_t i = 0; i < job->queue.num_chunks; i++) {
+        struct ics_chunk* chunk = &job->chunks[i];
+
+        pthread_mutex_lock(&job->queue.lock);
+        while (!chunk->done) pthread_cond_wait(&job->chunk_done, &job->queue.lock);
+        pthread_mutex_unlock(&job->queue.lock);
+
+        for (size_t j = 0; j < chunk->num_events; j++) {
+            int result = callback(&chunk->events[j], data);
+            if (result == 0) continue;
+
+            stop_chunk_queue(&job->queue);
+            return result;
         }
 
-        c = fgetc(line->ics_file); // takes care of the newline
-        c = fgetc(line->ics_file);
-        if (c == ' ' || c == '\t') {
-            ungetc(c, line->ics_file);
-        } else {
-            break;
+        free_chunk_events(chunk);
+    }
+
+    return 0;
+}
+
+/*
+ * The body of a parsing thread: parses chunks until there are none left.
+ */
+void* parse_chunks(void* data) {
+    struct parse_job* job = data;
+
+    struct text_chunk* text;
+    while ((text = take_chunk(&job->queue)) != NULL) {
+        struct ics_chunk* chunk = &job->chunks[text - job->queue.chunks];
+
+        struct ics_parser parser;
+        init_ics_parser(&parser, collect_event, chunk);
+        feed_ics(&parser, text->start, text->length);
+        finish_ics(&parser);
+
+        pthread_mutex_lock(&job->queue.lock);
+        chunk->done = true;
+        pthread_cond_broadcast(&job->chunk_done);
+        pthread_mutex_unlock(&job->queue.lock);
+    }
+
+    return NULL;
+}
+
+/*
+ * An ics_event_callback that keeps the event in the chunk passed as data.
+ * The parser frees the event it passes, so its strings are moved out.
+ */
+int collect_event(struct ics_event* event, void* data) {
+    struct ics_chunk* chunk = data;
+
+    if (chunk->num_events == chunk->size) {
+        chunk->size = chunk->size == 0 ? INIT_CHUNK_EVENTS : chunk->size * 2;
+        chunk->events = realloc(chunk->events, chunk->size * sizeof(struct ics_event));
+    }
+
+    chunk->events[chunk->num_events++] = *event;
+    memset(event, 0, sizeof(struct ics_event));
+
+    return 0;
+}
+
+void free_chunk_events(struct ics_chunk* chunk) {
+    for (size_t i = 0; i < chunk->num_events; i++) {
+        free_ics_event(&chunk->events[i]);
+    }
+    free(chunk->events);
+
+    chunk->events = NULL;
+    chunk->num_events = 0;
+    chunk->size = 0;
+}
+
+void free_ics_event(struct ics_event* event) {
+    free(event->uid);
+    free(event->summary);
+    free(event->start.tzid);
+    free(event->end.tzid);
+    free(event->rrule);
+    memset(event, 0, sizeof(struct ics_event));
+}
+
+void append_line(struct ics_parser* parser, const char* text, size_t length) {
+    if (parser->length + length + 1 > parser->size) {
+        while (parser->length + length + 1 > parser->size) parser->size *= 2;
+        parser->line = realloc(parser->line, parser->size);
+    }
+
+    memcpy(parser->line + parser->length, text, length);
+    parser->length += length;
+}
+
+/*
+ * Handles the unfolded line in the buffer and empties it.
+ */
+void end_line(struct ics_parser* parser) {
+    parser->line[parser->length] = '\0';
+    if (parser->length > 0) parse_content_line(parser, parser->line);
+
+    parser->length = 0;
+    parser->line_complete = false;
+}
+
+/*
+ * Parses "NAME;PARAM=VALUE;...:VALUE" and updates the current event.
+ */
+void parse_content_line(struct ics_parser* parser, char* line) {
+    char* value = find_value(line);
+    if (value == NULL) return;
+
+    // The name ends at the first parameter or the value
+    char* params = line + strcspn(line, ";:");
+    char name_end = *params;
+    *params = '\0';
+
+    if (strcasecmp(line, "BEGIN") == 0) {
+        if (parser->in_event) {
+            // Nested components like VALARM have their own SUMMARY
+            parser->depth++;
+        } else if (strcasecmp(value, "VEVENT") == 0) {
+            free_ics_event(&parser->event);
+            parser->in_event = true;
         }
+        return;
     }
-    ungetc(c, line->ics_file);
 
-    line->line = buffer;
-    line->length = buf_len;
+    if (strcasecmp(line, "END") == 0) {
+        if (parser->depth > 0) {
+            parser->depth--;
+        } else if (parser->in_event && strcasecmp(value, "VEVENT") == 0) {
+            parser->in_event = false;
+            if (parser->event.start.year > 0 && parser->event.summary != NULL) {
+                parser->result = parser->callback(&parser->event, parser->data);
+            }
+            free_ics_event(&parser->event);
+        }
+        return;
+    }
+
+    if (!parser->in_event || parser->depth > 0) return;
+
+    struct ics_event* event = &parser->event;
+    *params = name_end;
+    char* params_end = value - 1;
+    *params_end = '\0';
+    char* name = strndup(line, params - line);
 
-    return index;
+    if (strcasecmp(name, "DTSTART") == 0) {
+        parse_time_property(value, params, params_end, &event->start);
+    } else if (strcasecmp(name, "DTEND") == 0) {
+        parse_time_property(value, params, params_end, &event->end);
+    } else if (strcasecmp(name, "DURATION") == 0) {
+        if (parse_ics_duration(value, &event->duration) != 0) event->duration = 0;
+    } else if (strcasecmp(name, "SUMMARY") == 0) {
+        free(event->summary);
+        event->summary = unescape_text(value);
+    } else if (strcasecmp(name, "UID") == 0) {
+        free(event->uid);
+        event->uid = strdup(value);
+    } else if (strcasecmp(name, "RRULE") == 0) {
+        free(event->rrule);
+        event->rrule = strdup(value);
+    }
+
+    free(name);
 }
 
-ContentLine parse_content_line(Line line) {
-    ContentLine cline = {0};
+/*
+ * Replaces time with a DTSTART or DTEND value, unless it is malformed.
+ */
+void parse_time_property(char* value, char* params, char* params_end, struct ics_time* time) {
+    struct ics_time parsed = {0};
+    char* type = get_param(params, params_end, "VALUE");
+    parsed.tzid = get_param(params, params_end, "TZID");
 
-    // parse name
-    // parse the list of params
-    // parse value
+    if (parse_ics_time(value, &parsed) == 0) {
+        if (type != NULL && strcasecmp(type, "DATE") == 0) parsed.date_only = true;
 
-    return cline;
+        free(time->tzid);
+        *time = parsed;
+    } else {
+        free(parsed.tzid);
+    }
+    free(type);
+}
+
+/*
+ * Returns a pointer to the value after the first colon that isn't inside
+ * a quoted parameter value, or NULL if there isn't one.
+ */
+char* find_value(char* line) {
+    bool quoted = false;
+
+    for (char* c = line; *c != '\0'; c++) {
+        if (*c == '"') quoted = !quoted;
+        if (*c == ':' && !quoted) return c + 1;
+    }
+
+    return NULL;
 }
 
+/*
+ * Returns a copy of a parameter's value (without quotes) from the
+ * ";NAME=VALUE;..." text between params and params_end, or NULL.
+ */
+char* get_param(char* params, char* params_end, const char* name) {
+    size_t name_length = strlen(name);
+    char* cursor = params;
 
-void parse_ics(char* path) {
-    Line line = {0};
-    line.ics_file = fopen(path, "r");
+    while (cursor < params_end && *cursor == ';') {
+        cursor++;
 
-    while (get_line(&line) != EOF) {
-        printf("%s\n", line.line);
-        free(line.line);
-        line.line = NULL;
+        char* equals = strchr(cursor, '=');
+        if (equals == NULL || equals > params_end) return NULL;
+
+        char* start = equals + 1;
+        char* end = start;
+        if (*start == '"') {
+            start++;
+            end = strchr(start, '"');
+            if (end == NULL) return NULL;
+        } else {
+            end = start + strcspn(start, ";");
+        }
+
+        if ((size_t)(equals - cursor) == name_length && strncasecmp(cursor, name, name_length) == 0) {
+            return strndup(start, end - start);
+        }
+
+        cursor = *end == '"' ? end + 1 : end;
     }
 
-    fclose(line.ics_file);
+    return NULL;
 }
 
+int parse_ics_time(char* value, struct ics_time* time) {
+    if (sscanf(value, "%4d%2d%2d", &time->year, &time->month, &time->day) != 3) return -1;
+    if (time->month < 1 || time->month > 12 || time->day < 1 || time->day > 31) return -1;
 
-int main(int argc, char* argv[]) {
-    if (argc != 2) {
-        printf("Usage: ./ics path/to/ics/file\n");
+    if (value[8] != 'T') {
+        time->date_only = true;
+        return 0;
     }
 
-    parse_ics(argv[1]);
+    if (sscanf(value + 9, "%2d%2d%2d", &time->hour, &time->min, &time->sec) != 3) return -1;
+    time->utc = value[15] == 'Z';
 
     return 0;
 }
+
+int parse_ics_duration(const char* value, long* seconds) {
+    *seconds = 0;
+
+    const char* c = value;
+    if (*c == '+') c++;
+    if (*c++ != 'P') return -1;
+
+    bool in_time = false;
+    while (*c != '\0') {
+        if (*c == 'T') {
+            in_time = true;
+            c++;
+            continue;
+        }
+
+        char* end;
+        long amount = strtol(c, &end, 10);
+        if (end == c || amount < 0) return -1;
+
+        if (*end == 'W') {
+            *seconds += amount * 7 * 86400;
+        } else if (*end == 'D') {
+            *seconds += amount * 86400;
+        } else if (*end == 'H' && in_time) {
+            *seconds += amount * 3600;
+        } else if (*end == 'M' && in_time) {
+            *seconds += amount * 60;
+        } else if (*end == 'S' && in_time) {
+            *seconds += amount;
+        } else {
+            return -1;
+        }
+        c = end + 1;
+    }
+
+    return 0;
+}
+
+/*
+ * Undoes TEXT escaping. Newlines become spaces since summaries are a
+ * single line.
+ */
+char* unescape_text(const char* value) {
+    char* text = malloc(strlen(value) + 1);
+    size_t length = 0;
+
+    for (const char* c = value; *c != '\0'; c++) {
+        if (*c == '\\' && c[1] != '\0') {
+            c++;
+            text[length++] = (*c == 'n' || *c == 'N') ? ' ' : *c;
+        } else {
+            text[length++] = *c;
+        }
+    }
+    text[length] = '\0';
+
+    return text;
+}
@@ -0,0 +1,103 @@
+#ifndef ICS_H
+#define ICS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define MAX_PARSE_THREADS 8
+
+/*
+ * A DTSTART or DTEND value. Times are either UTC (a trailing Z), in the zone named
+ * by tzid, or floating (neither) which means local to whoever reads them.
+ */
+struct ics_time {
+    int year;
+    int month;
+    int day;
+    int hour;
+    int min;
+    int sec;
+    bool date_only; // VALUE=DATE, i.e. an all day event
+    bool utc;
+    char* tzid;
+};
+
+struct ics_event {
+    char* uid;
+    char* summary;
+    struct ics_time start;
+    struct ics_time end; // year is 0 if there is no DTEND
+    long duration; // DURATION in seconds, 0 if there isn't one
+    char* rrule; // the raw RRULE value or NULL
+};
+
+/*
+ * Called for every complete VEVENT. The event is freed once the callback
+ * returns, so anything kept must be copied. Returning non-zero stops the
+ * parser.
+ */
+typedef int (*ics_event_callback)(struct ics_event* event, void* data);
+
+/*
+ * Push parser state. Input can be fed in chunks of any size (e.g. as it
+ * comes off the network) and lines split across chunks are handled.
+ */
+struct ics_parser {
+    char* line;
+    size_t length;
+    size_t size;
+    bool line_complete; // line ended but may still be folded onto
+
+    bool in_event;
+    int depth; // components nested inside the current VEVENT
+    struct ics_event event;
+
+    ics_event_callback callback;
+    void* data;
+    int result;
+};
+
+void init_ics_parser(struct ics_parser* parser, ics_event_callback callback, void* data);
+
+/*
+ * Parses the next chunk of input. Returns 0 to keep going, or the
+ * callback's non-zero result once it has stopped the parser.
+ */
+int feed_ics(struct ics_parser* parser, const char* buffer, size_t length);
+
+/*
+ * Handles whatever is left once the input has ended and frees the
+ * parser's buffers. Returns the same as feed_ics.
+ */
+int finish_ics(struct ics_parser* parser);
+
+/*
+ * Parses a whole file ("-" for stdin). Returns -1 if it can't be read,
+ * otherwise the same as feed_ics.
+ */
+int parse_ics_file(const char* path, ics_event_callback callback, void* data);
+
+/*
+ * Parses a whole file like parse_ics_file, with the file split into
+ * chunks at BEGIN:VEVENT lines that are parsed on num_threads threads (0
+ * for one per core, up to MAX_PARSE_THREADS). The callback is still only
+ * called on the calling thread, for every event in the order they appear
+ * in the file.
+ */
+int parse_ics_file_parallel(const char* path, int num_threads, ics_event_callback callback, void* data);
+
+void free_ics_event(struct ics_event* event);
+
+/*
+ * Parses a DATE ("YYYYMMDD") or DATE-TIME ("YYYYMMDDTHHMMSS[Z]") value.
+ * Returns 0 on success, -1 if it is malformed.
+ */
+int parse_ics_time(char* value, struct ics_time* time);
+
+/*
+ * Parses a DURATION value such as "PT1H30M" or "P1D". Returns 0 on
+ * success, -1 if it is malformed or negative.
+ */
+int parse_ics_duration(const char* value, long* seconds);
+
+#endif
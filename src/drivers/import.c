@@ -0,0 +1,604 @@
+/*
+ * import.c
+ *
+ * Adds the events from an ICS file to a calendar. This replaces what
+ * scripts/write_events.py does: times are converted to the zone set by
+ * `timezone` in the config file, and repeating events go into the
+ * calendar's table of repeating events (see recurrence.c) rather than
+ * onto every day they happen.
+ *
+ * Times are converted in two steps. While parsing, each occurrence is
+ * turned into a UTC time using the zone it was written in (a TZID
+ * parameter or a trailing Z). Once the whole file has been read every
+ * occurrence is converted to the display zone in one pass with
+ * utc_to_local_times. Repeats are expanded in the event's own zone so a
+ * 9:00 meeting stays at 9:00 there across DST changes.
+ *
+ * End times come from DTEND or DURATION. calendar.txt can only hold an
+ * end within a day of the start, so longer events are added without one.
+ *
+ * Supported RRULE parts: FREQ (DAILY, WEEKLY, MONTHLY, YEARLY), INTERVAL,
+ * COUNT, UNTIL and BYDAY for weekly rules.
+ *
+ * A rule in the table keeps its time on every day, so only events that
+ * are all day, floating or in a zone that's always the same as the
+ * display zone are kept as rules. Weekly events on several days become
+ * one rule per day, yearly ones a monthly rule every 12 months, and COUNT
+ * and UNTIL become the date of the last occurrence. Events in any other
+ * zone are expanded between the import's dates as before.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include "config.h"
+#include "import.h"
+#include "skeleton.h"
+#include "sources.h"
+
+#define INIT_INSTANCES_SIZE 1024
+
+// Occurrences can move a day either way once converted to the display zone
+#define WINDOW_SLACK_DAYS 2
+
+// How far past the import's dates the last occurrence of a rule is looked
+// for. One that ends later is kept without an end.
+#define RULE_SEARCH_YEARS 100
+
+struct rrule {
+    char freq; // 'D', 'W', 'M' or 'Y'
+    int interval;
+    long count; // 0 for no limit
+    bool has_until;
+    struct ics_time until;
+    int byday; // bit 0 is Monday through bit 6 for Sunday
+};
+
+/*
+ * Everything needed to add the occurrences of one event.
+ */
+struct expansion {
+    struct ics_import* import;
+    int event;
+    struct ics_time* start;
+    const struct time_zone* zone; // NULL for all day and floating times
+    int first_key;
+    int stop_key;
+    int64_t until; // wall clock seconds in the event's zone
+    long count;
+    long max_count;
+    int duration;
+
+    bool counting; // only the last occurrence is wanted, nothing is added
+    int last_key;
+    bool ended; // stopped by COUNT or UNTIL
+};
+
+int parse_rrule(const char* value, struct rrule* rule);
+void expand_event(struct expansion* expansion, struct rrule* rule);
+bool add_rules(struct expansion* expansion, struct rrule* rule);
+bool keeps_wall_clock(const struct time_zone* zone, const struct time_zone* display_zone);
+void add_rule(struct ics_import* import, int start_key, enum repeat_freq freq, int interval, int until_key, struct event event);
+bool add_occurrence(struct expansion* expansion, int date_key);
+void add_instance(struct ics_import* import, struct import_instance instance);
+int instance_cmp(const void* a, const void* b);
+bool is_duplicate(struct events* events, struct event event);
+char* clean_summary(const char* summary);
+int get_event_duration(struct ics_event* event, const struct time_zone* zone);
+int64_t get_utc_seconds(struct ics_time* time, const struct time_zone* zone);
+
+void init_import(struct ics_import* import, int first_key, int last_key) {
+    memset(import, 0, sizeof(struct ics_import));
+    import->first_key = first_key;
+    import->last_key = last_key;
+    import->display_zone = get_display_time_zone();
+
+    import->size = INIT_INSTANCES_SIZE;
+    import->instances = malloc(import->size * sizeof(struct import_instance));
+}
+
+int import_event(struct ics_event* event, void* data) {
+    struct ics_import* import = data;
+
+    struct rrule rule;
+    bool repeats = event->rrule != NULL;
+    if (repeats && parse_rrule(event->rrule, &rule) != 0) {
+        // Unknown frequencies only get their first occurrence
+        repeats = false;
+    }
+
+    import->summaries = realloc(import->summaries, (import->num_events + 1) * sizeof(char*));
+    import->summaries[import->num_events] = clean_summary(event->summary);
+
+    struct expansion expansion = {0};
+    expansion.import = import;
+    expansion.event = import->num_events;
+    expansion.start = &event->start;
+    expansion.until = INT64_MAX;
+
+    import->num_events++;
+
+    if (!event->start.date_only) {
+        if (event->start.utc) {
+            expansion.zone = get_time_zone("UTC");
+        } else if (event->start.tzid != NULL) {
+            // Unknown TZIDs are treated as floating times
+            expansion.zone = get_time_zone(event->start.tzid);
+        }
+    }
+
+    expansion.duration = get_event_duration(event, expansion.zone);
+
+    expansion.first_key = import->first_key;
+    expansion.stop_key = import->last_key;
+    for (int i = 0; i < WINDOW_SLACK_DAYS; i++) {
+        expansion.first_key = prev_date_key(expansion.first_key);
+        expansion.stop_key = next_date_key(expansion.stop_key);
+    }
+
+    if (!repeats) {
+        add_occurrence(&expansion, DATE_KEY(event->start.year, event->start.month, event->start.day));
+        return 0;
+    }
+
+    expansion.max_count = rule.count;
+
+    if (rule.has_until) {
+        struct ics_time* until = &rule.until;
+        expansion.until = civil_to_seconds(until->year, until->month, until->day, until->hour, until->min, until->sec);
+
+        if (until->date_only) {
+            expansion.until += 86399;
+        } else if (until->utc && expansion.zone != NULL) {
+            expansion.until += get_utc_offset(expansion.zone, expansion.until);
+        }
+    }
+
+    if (!add_rules(&expansion, &rule)) expand_event(&expansion, &rule);
+
+    return 0;
+}
+
+void convert_import_times(struct ics_import* import) {
+    int64_t* times = malloc((import->num_instances + 1) * sizeof(int64_t));
+    size_t count = 0;
+
+    for (size_t i = 0; i < import->num_instances; i++) {
+        if (import->instances[i].needs_conversion) times[count++] = import->instances[i].utc;
+    }
+
+    utc_to_local_times(import->display_zone, times, times, count);
+
+    count = 0;
+    for (size_t i = 0; i < import->num_instances; i++) {
+        struct import_instance* instance = &import->instances[i];
+        if (!instance->needs_conversion) continue;
+
+        seconds_to_civil(times[count++], &instance->date_key, &instance->hour, &instance->min);
+        instance->needs_conversion = false;
+    }
+
+    free(times);
+}
+
+int finish_import(struct ics_import* import, int source, struct import_stats* stats) {
+    convert_import_times(import);
+    qsort(import->instances, import->num_instances, sizeof(struct import_instance), instance_cmp);
+
+    struct day_update* updates = NULL;
+    size_t num_updates = 0;
+    long added = 0;
+
+    size_t i = 0;
+    while (i < import->num_instances) {
+        int date_key = import->instances[i].date_key;
+        if (date_key < import->first_key || date_key > import->last_key) {
+            i++;
+            continue;
+        }
+
+        int year = date_key / 10000;
+        int month = date_key / 100 % 100;
+        int day = date_key % 100;
+
+        struct events events = get_source_events(source, year, month, day);
+        struct events* base = NULL;
+
+        for (; i < import->num_instances && import->instances[i].date_key == date_key; i++) {
+            struct import_instance* instance = &import->instances[i];
+
+            struct event event = {year, month, day, instance->hour, instance->min, import->summaries[instance->event], source, instance->duration};
+            if (is_duplicate(&events, event)) continue;
+
+            // Kept so an edit made to the day during the import is merged
+            if (base == NULL) {
+                base = malloc(sizeof(struct events));
+                *base = copy_events(events);
+            }
+
+            event.summary = strdup(event.summary);
+            insert_event(&events, event);
+            added++;
+        }
+
+        if (base == NULL) {
+            free_events(events);
+            continue;
+        }
+
+        updates = realloc(updates, (num_updates + 1) * sizeof(struct day_update));
+        updates[num_updates] = (struct day_update){year, month, day, events, base};
+        num_updates++;
+    }
+
+    int result = num_updates > 0 ? set_source_days(source, updates, num_updates) : 0;
+
+    long repeating = 0;
+    if (result == 0 && import->num_rules > 0) {
+        struct recurrence_table* recurrences = get_source_recurrences(source);
+        repeating = recurrences == NULL ? -1 : merge_recurrences(recurrences, import->rules, import->num_rules);
+        if (repeating < 0) result = -1;
+    }
+
+    if (stats != NULL) {
+        stats->events = import->num_events;
+        stats->instances = import->num_instances;
+        stats->added = result == 0 ? added : 0;
+        stats->repeating = result == 0 ? repeating : 0;
+    }
+
+    for (size_t j = 0; j < num_updates; j++) {
+        free_events(updates[j].events);
+        free_events(*updates[j].base);
+        free(updates[j].base);
+    }
+    free(updates);
+
+    free_import(import);
+
+    return result;
+}
+
+void get_import_window(int* first_key, int* last_key) {
+    time_t raw_time = time(NULL);
+    struct tm* info = localtime(&raw_time);
+    int year = info->tm_year + 1900;
+
+    *first_key = DATE_KEY(year, 1, 1);
+    *last_key = DATE_KEY(year + 1, 12, 31);
+}
+
+int import_ics_file(const char* path, int source, int first_key, int last_key, struct import_stats* stats) {
+    struct ics_import import;
+    init_import(&import, first_key, last_key);
+
+    if (parse_ics_file_parallel(path, get_config()->parse_threads, import_event, &import) != 0) {
+        free_import(&import);
+        return -1;
+    }
+
+    return finish_import(&import, source, stats);
+}
+
+/*
+ * Parses "FREQ=WEEKLY;INTERVAL=2;BYDAY=MO,WE;UNTIL=20261231T000000Z".
+ * Returns -1 if the frequency isn't supported.
+ */
+int parse_rrule(const char* value, struct rrule* rule) {
+    static const char* weekdays[7] = {"MO", "TU", "WE", "TH", "FR", "SA", "SU"};
+
+    memset(rule, 0, sizeof(struct rrule));
+    rule->interval = 1;
+
+    char* copy = strdup(value);
+    char* save = NULL;
+
+    for (char* part = strtok_r(copy, ";", &save); part != NULL; part = strtok_r(NULL, ";", &save)) {
+        char* equals = strchr(part, '=');
+        if (equals == NULL) continue;
+        *equals = '\0';
+        char* part_value = equals + 1;
+
+        if (strcasecmp(part, "FREQ") == 0) {
+            if (strcasecmp(part_value, "DAILY") == 0) rule->freq = 'D';
+            if (strcasecmp(part_value, "WEEKLY") == 0) rule->freq = 'W';
+            if (strcasecmp(part_value, "MONTHLY") == 0) rule->freq = 'M';
+            if (strcasecmp(part_value, "YEARLY") == 0) rule->freq = 'Y';
+        } else if (strcasecmp(part, "INTERVAL") == 0) {
+            rule->interval = atoi(part_value);
+        } else if (strcasecmp(part, "COUNT") == 0) {
+            rule->count = atol(part_value);
+        } else if (strcasecmp(part, "UNTIL") == 0) {
+            rule->has_until = parse_ics_time(part_value, &rule->until) == 0;
+        } else if (strcasecmp(part, "BYDAY") == 0) {
+            char* day_save = NULL;
+            for (char* day = strtok_r(part_value, ",", &day_save); day != NULL; day = strtok_r(NULL, ",", &day_save)) {
+                // Only plain weekdays, "1MO" style prefixes are ignored
+                size_t length = strlen(day);
+                if (length < 2) continue;
+
+                for (int i = 0; i < 7; i++) {
+                    if (strcasecmp(day + length - 2, weekdays[i]) == 0) rule->byday |= 1 << i;
+                }
+            }
+        }
+    }
+
+    free(copy);
+
+    if (rule->interval < 1) rule->interval = 1;
+    return rule->freq == 0 ? -1 : 0;
+}
+
+void expand_event(struct expansion* expansion, struct rrule* rule) {
+    struct ics_time* start = expansion->start;
+    int start_key = DATE_KEY(start->year, start->month, start->day);
+    long start_days = days_from_date_key(start_key);
+
+    if (rule->freq == 'D') {
+        for (long days = start_days; add_occurrence(expansion, date_key_from_days(days)); days += rule->interval);
+    } else if (rule->freq == 'W') {
+        int byday = rule->byday == 0 ? 1 << weekday_from_days(start_days) : rule->byday;
+        long week_start = start_days - weekday_from_days(start_days);
+
+        for (long week = week_start; ; week += 7 * rule->interval) {
+            for (int wday = 0; wday < 7; wday++) {
+                if ((byday & (1 << wday)) == 0 || week + wday < start_days) continue;
+                if (!add_occurrence(expansion, date_key_from_days(week + wday))) return;
+            }
+        }
+    } else {
+        int months = rule->freq == 'M' ? rule->interval : 12 * rule->interval;
+        int year = start->year;
+        int month = start->month;
+
+        while (DATE_KEY(year, month, 1) <= expansion->stop_key) {
+            // Months without the day (e.g. the 31st) are skipped, not clamped
+            if (start->day <= days_in_month(year, month)) {
+                if (!add_occurrence(expansion, DATE_KEY(year, month, start->day))) return;
+            }
+
+            month += months;
+            year += (month - 1) / 12;
+            month = (month - 1) % 12 + 1;
+        }
+    }
+}
+
+/*
+ * Adds a repeating event to the import as rules for the calendar's
+ * repeating events rather than as an occurrence on every day. Returns
+ * false if its time would move in the display zone, in which case it has
+ * to be expanded instead.
+ */
+bool add_rules(struct expansion* expansion, struct rrule* rule) {
+    struct ics_import* import = expansion->import;
+    struct ics_time* start = expansion->start;
+    if (!keeps_wall_clock(expansion->zone, import->display_zone)) return false;
+
+    int start_key = DATE_KEY(start->year, start->month, start->day);
+    long start_days = days_from_date_key(start_key);
+
+    int until_key = 0;
+    if (expansion->max_count > 0 || expansion->until != INT64_MAX) {
+        struct expansion last = *expansion;
+        last.counting = true;
+        last.stop_key = DATE_KEY(import->last_key / 10000 + RULE_SEARCH_YEARS, 12, 31);
+        expand_event(&last, rule);
+
+        // Nothing to add for a series that was over before the import's
+        // dates, as when it was expanded
+        if (last.count == 0 || (last.ended && last.last_key < import->first_key)) return true;
+        if (last.ended) until_key = last.last_key;
+    }
+
+    struct event event = {0};
+    event.hour = start->date_only ? -1 : start->hour;
+    event.min = start->date_only ? -1 : start->min;
+    event.duration = expansion->duration;
+    event.summary = import->summaries[expansion->event];
+
+    if (rule->freq == 'D') {
+        add_rule(import, start_key, REPEAT_DAILY, rule->interval, until_key, event);
+    } else if (rule->freq == 'M' || rule->freq == 'Y') {
+        int months = rule->freq == 'M' ? rule->interval : 12 * rule->interval;
+        add_rule(import, start_key, REPEAT_MONTHLY, months, until_key, event);
+    } else {
+        // Each day's rule starts at its first occurrence, in the first
+        // week of the series or the next one it repeats in
+        int byday = rule->byday == 0 ? 1 << weekday_from_days(start_days) : rule->byday;
+        long week_start = start_days - weekday_from_days(start_days);
+
+        for (int wday = 0; wday < 7; wday++) {
+            if ((byday & (1 << wday)) == 0) continue;
+
+            long first = week_start + wday;
+            if (first < start_days) first += 7 * rule->interval;
+
+            int first_key = date_key_from_days(first);
+            if (until_key == 0 || first_key <= until_key) {
+                add_rule(import, first_key, REPEAT_WEEKLY, rule->interval, until_key, event);
+            }
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Whether a time in zone is always the same wall clock time in the
+ * display zone. Floating times (a NULL zone) are shown as written.
+ */
+bool keeps_wall_clock(const struct time_zone* zone, const struct time_zone* display_zone) {
+    if (zone == NULL || zone == display_zone) return true;
+    if (display_zone == NULL) return false;
+
+    return zone->num_transitions == 0 && display_zone->num_transitions == 0 &&
+        zone->initial_offset == display_zone->initial_offset;
+}
+
+void add_rule(struct ics_import* import, int start_key, enum repeat_freq freq, int interval, int until_key, struct event event) {
+    import->rules = realloc(import->rules, (import->num_rules + 1) * sizeof(struct recurrence));
+
+    struct recurrence* rule = &import->rules[import->num_rules++];
+    memset(rule, 0, sizeof(struct recurrence));
+    rule->start_key = start_key;
+    rule->start_day = days_from_date_key(start_key);
+    rule->freq = freq;
+    rule->interval = interval;
+    rule->until_key = until_key;
+    rule->event = event;
+    rule->event.year = start_key / 10000;
+    rule->event.month = start_key / 100 % 100;
+    rule->event.day = start_key % 100;
+}
+
+/*
+ * Adds the event's occurrence on the given day in its own zone. Returns
+ * false once there can be no more occurrences.
+ */
+bool add_occurrence(struct expansion* expansion, int date_key) {
+    struct ics_time* start = expansion->start;
+    int year = date_key / 10000;
+    int month = date_key / 100 % 100;
+    int day = date_key % 100;
+
+    if (date_key > expansion->stop_key) return false;
+    if (expansion->max_count > 0 && expansion->count >= expansion->max_count) {
+        expansion->ended = true;
+        return false;
+    }
+
+    int64_t local = civil_to_seconds(year, month, day, start->hour, start->min, start->sec);
+    if (local > expansion->until) {
+        expansion->ended = true;
+        return false;
+    }
+
+    expansion->count++;
+    expansion->last_key = date_key;
+    if (expansion->counting || date_key < expansion->first_key) return true;
+
+    struct import_instance instance = {0};
+    instance.event = expansion->event;
+    instance.date_key = date_key;
+    instance.hour = start->date_only ? -1 : start->hour;
+    instance.min = start->date_only ? -1 : start->min;
+    instance.duration = expansion->duration;
+
+    if (expansion->zone != NULL) {
+        instance.utc = local_to_utc(expansion->zone, local);
+        instance.needs_conversion = true;
+    }
+
+    add_instance(expansion->import, instance);
+    return true;
+}
+
+void add_instance(struct ics_import* import, struct import_instance instance) {
+    if (import->num_instances == import->size) {
+        import->size *= 2;
+        import->instances = realloc(import->instances, import->size * sizeof(struct import_instance));
+    }
+
+    import->instances[import->num_instances] = instance;
+    import->num_instances++;
+}
+
+int instance_cmp(const void* a, const void* b) {
+    const struct import_instance* first = a;
+    const struct import_instance* second = b;
+
+    if (first->date_key != second->date_key) return first->date_key < second->date_key ? -1 : 1;
+
+    int cmp = time_cmp(first->hour, first->min, second->hour, second->min);
+    if (cmp != 0) return cmp;
+
+    return first->event - second->event;
+}
+
+/*
+ * Returns the minutes from an event's start to its end, or 0 if it has no
+ * end time that calendar.txt can hold. zone is the start's zone.
+ */
+int get_event_duration(struct ics_event* event, const struct time_zone* zone) {
+    if (event->start.date_only) return 0;
+
+    long seconds = event->duration;
+    if (event->end.year != 0 && !event->end.date_only) {
+        const struct time_zone* end_zone = zone;
+        if (event->end.utc) {
+            end_zone = get_time_zone("UTC");
+        } else if (event->end.tzid != NULL) {
+            end_zone = get_time_zone(event->end.tzid);
+        }
+
+        // Floating times are compared as they're written
+        if (zone == NULL || end_zone == NULL) {
+            zone = NULL;
+            end_zone = NULL;
+        }
+
+        seconds = get_utc_seconds(&event->end, end_zone) - get_utc_seconds(&event->start, zone);
+    }
+
+    long minutes = seconds / 60;
+    if (minutes <= 0 || minutes > MAX_EVENT_DURATION) return 0;
+
+    return minutes;
+}
+
+/*
+ * Converts a DTSTART or DTEND to seconds since the epoch in UTC, or as
+ * written if zone is NULL.
+ */
+int64_t get_utc_seconds(struct ics_time* time, const struct time_zone* zone) {
+    int64_t local = civil_to_seconds(time->year, time->month, time->day, time->hour, time->min, time->sec);
+    return zone == NULL ? local : local_to_utc(zone, local);
+}
+
+/*
+ * Events synced before are already in the calendar, so an event at the
+ * same time with the same summary isn't added again.
+ */
+bool is_duplicate(struct events* events, struct event event) {
+    for (size_t i = 0; i < events->length; i++) {
+        struct event existing = events->events[i];
+
+        if (existing.hour != event.hour || existing.min != event.min) continue;
+        if (strcasecmp(existing.summary, event.summary) == 0) return true;
+    }
+
+    return false;
+}
+
+/*
+ * Trims the summary and replaces commas, which separate events in
+ * calendar.txt.
+ */
+char* clean_summary(const char* summary) {
+    while (*summary == ' ' || *summary == '\t') summary++;
+
+    char* cleaned = strdup(summary);
+    size_t length = strlen(cleaned);
+    while (length > 0 && (cleaned[length - 1] == ' ' || cleaned[length - 1] == '\t')) length--;
+    cleaned[length] = '\0';
+
+    for (char* c = cleaned; *c != '\0'; c++) {
+        if (*c == ',') *c = ' ';
+    }
+
+    return cleaned;
+}
+
+void free_import(struct ics_import* import) {
+    for (int i = 0; i < import->num_events; i++) {
+        free(import->summaries[i]);
+    }
+    free(import->summaries);
+    free(import->instances);
+    free(import->rules);
+}
@@ -0,0 +1,90 @@
+#ifndef IMPORT_H
+#define IMPORT_H
+
+#include <stdint.h>
+#include "ics.h"
+#include "recurrence.h"
+#include "tz.h"
+
+/*
+ * One occurrence of an imported event on a calendar day. Until the import
+ * is finished, timed occurrences hold a UTC time that still needs to be
+ * converted to the display zone.
+ */
+struct import_instance {
+    int event;
+    int date_key;
+    int hour; // -1 for all day
+    int min;
+    int duration; // minutes, 0 without an end time
+    int64_t utc;
+    bool needs_conversion;
+};
+
+/*
+ * Collects events from an ICS parser and writes them to a calendar once
+ * the input is done. Repeating events become rules for the calendar's
+ * repeating events where they can, and are otherwise expanded between
+ * first_key and last_key.
+ */
+struct ics_import {
+    int first_key;
+    int last_key;
+    const struct time_zone* display_zone;
+
+    char** summaries; // one per event
+    int num_events;
+
+    struct import_instance* instances;
+    size_t num_instances;
+    size_t size;
+
+    struct recurrence* rules; // summaries point into summaries
+    size_t num_rules;
+};
+
+struct import_stats {
+    long events;
+    long instances;
+    long added;
+    long repeating; // rules added to the calendar's repeating events
+};
+
+void init_import(struct ics_import* import, int first_key, int last_key);
+
+/*
+ * An ics_event_callback that adds the event to the import passed as data.
+ */
+int import_event(struct ics_event* event, void* data);
+
+/*
+ * Converts every instance to the display zone in one pass. Done by
+ * finish_import, but can be called on its own to time the conversion.
+ */
+void convert_import_times(struct ics_import* import);
+
+/*
+ * Adds the collected events to a calendar, skipping ones that are already
+ * there, and frees the import. Returns 0 on success, -1 on failure.
+ */
+int finish_import(struct ics_import* import, int source, struct import_stats* stats);
+
+/*
+ * Frees an import without adding anything, e.g. when its input was cut off.
+ */
+void free_import(struct ics_import* import);
+
+/*
+ * The dates repeating events that can't be kept as rules are expanded
+ * between when importing a feed: the start of this year through the end
+ * of next year.
+ */
+void get_import_window(int* first_key, int* last_key);
+
+/*
+ * Imports a whole ICS file ("-" for stdin) into a calendar. Returns 0 on
+ * success, -1 on failure.
+ */
+int import_ics_file(const char* path, int source, int first_key, int last_key, struct import_stats* stats);
+
+#endif
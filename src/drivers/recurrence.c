@@ -0,0 +1,625 @@
+/*
+ * recurrence.c
+ *
+ * Repeating events made in the TUI or synced from a feed are not copied
+ * onto every day they happen. Each calendar has a small table of them in a file next to it
+ * (calendar.txt.repeat), and their occurrences are worked out when a day
+ * is read, so only the days asked for are ever expanded and calendar.txt
+ * stays the size it was. Changes to a single occurrence are kept in the
+ * table as exceptions to the rule.
+ *
+ * The file has one line per repeating event followed by one per
+ * exception, with the event written as it would be on a date line:
+ *
+ * 1 2026-10-19 weekly 1 - 09:00-10:00 - Team sync
+ * 1 skip 2026-10-26
+ * 1 edit 2026-11-02 10:00-11:00 - Team sync (moved)
+ *
+ * The fields of the first line are the id, first date, frequency
+ * (daily, weekly or monthly), interval and last date ("-" for none).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include "recurrence.h"
+#include "skeleton.h"
+
+static const char* repeat_names[] = {NULL, "daily", "weekly", "monthly"};
+
+void clear_recurrences(struct recurrence_table* table);
+int read_recurrences(struct recurrence_table* table, FILE* file);
+void parse_recurrence_line(struct recurrence_table* table, char* line);
+struct recurrence* new_recurrence(struct recurrence_table* table);
+struct recurrence* find_recurrence(struct recurrence_table* table, int id);
+struct recurrence* find_same_recurrence(struct recurrence_table* table, struct recurrence* rule);
+bool is_stored(struct events* events, struct event* event);
+struct recurrence_exception* find_exception(struct recurrence* rule, int date_key);
+bool occurs_on(struct recurrence* rule, int date_key, long day);
+int write_recurrences(struct recurrence_table* table);
+void print_recurrences(struct recurrence_table* table, FILE* file);
+int start_change(struct recurrence_table* table);
+int write_recurrences_text(struct recurrence_table* table, const char* text);
+void write_event_text(FILE* file, struct event* event);
+void remember_file(struct recurrence_table* table);
+
+void open_recurrences(struct recurrence_table* table, const char* calendar_path) {
+    memset(table, 0, sizeof(struct recurrence_table));
+    table->next_id = 1;
+
+    int length = strlen(calendar_path) + strlen(RECURRENCE_SUFFIX) + 1;
+    table->path = malloc(sizeof(char) * length);
+    snprintf(table->path, length, "%s%s", calendar_path, RECURRENCE_SUFFIX);
+
+    open_calendar_file(&table->calendar, (char*)calendar_path);
+}
+
+void close_recurrences(struct recurrence_table* table) {
+    clear_recurrences(table);
+    close_calendar_file(&table->calendar);
+    free(table->rules);
+    free(table->path);
+    memset(table, 0, sizeof(struct recurrence_table));
+}
+
+int lock_recurrences(struct recurrence_table* table) {
+    return lock_calendar_file(&table->calendar);
+}
+
+void unlock_recurrences(struct recurrence_table* table) {
+    unlock_calendar_file(&table->calendar);
+}
+
+char* save_recurrences(struct recurrence_table* table) {
+    char* text = NULL;
+    size_t length = 0;
+
+    FILE* file = open_memstream(&text, &length);
+    print_recurrences(table, file);
+    fclose(file);
+
+    return text;
+}
+
+int restore_recurrences(struct recurrence_table* table, const char* saved, const char* expected) {
+    if (start_change(table) != 0) return -1;
+
+    char* current = save_recurrences(table);
+    int result = strcmp(current, expected) == 0 ? write_recurrences_text(table, saved) : -1;
+    free(current);
+
+    // The table is read back from what was written
+    if (result == 0) {
+        table->exists = false;
+        result = refresh_recurrences(table);
+    }
+
+    unlock_recurrences(table);
+    return result;
+}
+
+/*
+ * Locks the table's calendar and reads the table again if its file has
+ * changed, so a change is made to the latest table. Returns 0 on success
+ * and -1 on failure, with the lock released.
+ */
+int start_change(struct recurrence_table* table) {
+    if (lock_recurrences(table) != 0) return -1;
+
+    if (refresh_recurrences(table) != 0) {
+        unlock_recurrences(table);
+        return -1;
+    }
+
+    return 0;
+}
+
+int refresh_recurrences(struct recurrence_table* table) {
+    struct stat st;
+    if (stat(table->path, &st) != 0) {
+        // No file is the same as an empty table
+        if (table->exists) clear_recurrences(table);
+        table->exists = false;
+        return 0;
+    }
+
+    if (
+        table->exists &&
+        table->ino == st.st_ino &&
+        table->file_size == st.st_size &&
+        table->mtime.tv_sec == st.st_mtim.tv_sec &&
+        table->mtime.tv_nsec == st.st_mtim.tv_nsec
+    ) {
+        return 0;
+    }
+
+    FILE* file = fopen(table->path, "r");
+    if (file == NULL) return -1;
+
+    clear_recurrences(table);
+    int result = read_recurrences(table, file);
+    fclose(file);
+
+    table->exists = true;
+    table->ino = st.st_ino;
+    table->file_size = st.st_size;
+    table->mtime = st.st_mtim;
+
+    return result;
+}
+
+long long get_recurrences_version(struct recurrence_table* table) {
+    struct stat st;
+    if (stat(table->path, &st) != 0) return 0;
+
+    return (st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec) ^ ((long long)st.st_size << 20) ^ st.st_ino;
+}
+
+size_t add_occurrences(struct recurrence_table* table, int date_key, int source, struct events* events) {
+    if (table->length == 0) return 0;
+
+    long day = days_from_date_key(date_key);
+    size_t added = 0;
+
+    for (size_t i = 0; i < table->length; i++) {
+        struct recurrence* rule = &table->rules[i];
+        if (!occurs_on(rule, date_key, day)) continue;
+
+        struct event event = rule->event;
+        struct recurrence_exception* exception = find_exception(rule, date_key);
+        if (exception != NULL) {
+            if (exception->skipped) continue;
+            event = exception->event;
+        }
+        if (is_stored(events, &event)) continue;
+
+        event.year = date_key / 10000;
+        event.month = date_key / 100 % 100;
+        event.day = date_key % 100;
+        event.source = source;
+        event.recurrence = rule->id;
+        event.summary = strdup(event.summary);
+
+        insert_event(events, event);
+        added++;
+    }
+
+    return added;
+}
+
+int add_recurrence(struct recurrence_table* table, struct event event, enum repeat_freq freq, int interval) {
+    if (freq == REPEAT_NONE || start_change(table) != 0) return -1;
+
+    struct recurrence* rule = new_recurrence(table);
+    rule->id = table->next_id++;
+    rule->start_key = DATE_KEY(event.year, event.month, event.day);
+    rule->start_day = days_from_date_key(rule->start_key);
+    rule->freq = freq;
+    rule->interval = interval > 0 ? interval : 1;
+    rule->event = event;
+    rule->event.summary = strdup(event.summary);
+    rule->event.recurrence = rule->id;
+
+    int result = write_recurrences(table) == 0 ? rule->id : -1;
+    unlock_recurrences(table);
+
+    return result;
+}
+
+long merge_recurrences(struct recurrence_table* table, struct recurrence* rules, size_t count) {
+    if (count == 0) return 0;
+    if (start_change(table) != 0) return -1;
+
+    long added = 0;
+    bool changed = false;
+
+    for (size_t i = 0; i < count; i++) {
+        struct recurrence* same = find_same_recurrence(table, &rules[i]);
+        if (same != NULL) {
+            changed |= same->until_key != rules[i].until_key;
+            same->until_key = rules[i].until_key;
+            continue;
+        }
+
+        struct recurrence* rule = new_recurrence(table);
+        rule->id = table->next_id++;
+        rule->start_key = rules[i].start_key;
+        rule->start_day = days_from_date_key(rule->start_key);
+        rule->freq = rules[i].freq;
+        rule->interval = rules[i].interval > 0 ? rules[i].interval : 1;
+        rule->until_key = rules[i].until_key;
+        rule->event = rules[i].event;
+        rule->event.summary = strdup(rules[i].event.summary);
+        rule->event.recurrence = rule->id;
+
+        added++;
+        changed = true;
+    }
+
+    int result = changed ? write_recurrences(table) : 0;
+    unlock_recurrences(table);
+
+    return result == 0 ? added : -1;
+}
+
+int delete_recurrence(struct recurrence_table* table, int id) {
+    if (start_change(table) != 0) return -1;
+
+    struct recurrence* rule = find_recurrence(table, id);
+    if (rule == NULL) {
+        unlock_recurrences(table);
+        return -1;
+    }
+
+    free(rule->event.summary);
+    for (size_t i = 0; i < rule->num_exceptions; i++) {
+        free(rule->exceptions[i].event.summary);
+    }
+    free(rule->exceptions);
+
+    size_t index = rule - table->rules;
+    memmove(rule, rule + 1, (table->length - index - 1) * sizeof(struct recurrence));
+    table->length--;
+
+    int result = write_recurrences(table);
+    unlock_recurrences(table);
+
+    return result;
+}
+
+int skip_occurrence(struct recurrence_table* table, int id, int date_key) {
+    struct event skipped = {0};
+    skipped.hour = -1;
+    skipped.min = -1;
+
+    return edit_occurrence(table, id, date_key, skipped);
+}
+
+int edit_occurrence(struct recurrence_table* table, int id, int date_key, struct event event) {
+    if (start_change(table) != 0) return -1;
+
+    struct recurrence* rule = find_recurrence(table, id);
+    if (rule == NULL || !occurs_on(rule, date_key, days_from_date_key(date_key))) {
+        unlock_recurrences(table);
+        return -1;
+    }
+
+    struct recurrence_exception* exception = find_exception(rule, date_key);
+    if (exception == NULL) {
+        rule->exceptions = realloc(rule->exceptions, (rule->num_exceptions + 1) * sizeof(struct recurrence_exception));
+        exception = &rule->exceptions[rule->num_exceptions++];
+    } else {
+        free(exception->event.summary);
+    }
+
+    // An event without a summary stands for skipping the occurrence
+    exception->date_key = date_key;
+    exception->skipped = event.summary == NULL;
+    exception->event = event;
+    exception->event.summary = event.summary == NULL ? NULL : strdup(event.summary);
+    exception->event.recurrence = id;
+
+    int result = write_recurrences(table);
+    unlock_recurrences(table);
+
+    return result;
+}
+
+int copy_recurrences(const char* from_path, const char* to_path) {
+    struct recurrence_table table;
+    open_recurrences(&table, from_path);
+
+    int result = refresh_recurrences(&table);
+    if (result == 0 && table.exists) {
+        free(table.path);
+        int length = strlen(to_path) + strlen(RECURRENCE_SUFFIX) + 1;
+        table.path = malloc(sizeof(char) * length);
+        snprintf(table.path, length, "%s%s", to_path, RECURRENCE_SUFFIX);
+
+        close_calendar_file(&table.calendar);
+        open_calendar_file(&table.calendar, (char*)to_path);
+
+        result = lock_recurrences(&table);
+        if (result == 0) {
+            result = write_recurrences(&table);
+            unlock_recurrences(&table);
+        }
+    }
+
+    close_recurrences(&table);
+    return result;
+}
+
+const char* get_repeat_name(enum repeat_freq freq) {
+    return repeat_names[freq];
+}
+
+void clear_recurrences(struct recurrence_table* table) {
+    for (size_t i = 0; i < table->length; i++) {
+        struct recurrence* rule = &table->rules[i];
+
+        free(rule->event.summary);
+        for (size_t j = 0; j < rule->num_exceptions; j++) {
+            free(rule->exceptions[j].event.summary);
+        }
+        free(rule->exceptions);
+    }
+
+    table->length = 0;
+    table->next_id = 1;
+}
+
+int read_recurrences(struct recurrence_table* table, FILE* file) {
+    char* line = NULL;
+    size_t size = 0;
+
+    while (getline(&line, &size, file) > 0) {
+        if (line[0] == '#' || line[0] == '\n') continue;
+        parse_recurrence_line(table, line);
+    }
+
+    free(line);
+    return ferror(file) ? -1 : 0;
+}
+
+/*
+ * Adds the repeating event or exception on a line of the file. Lines that
+ * can't be parsed are skipped.
+ */
+void parse_recurrence_line(struct recurrence_table* table, char* line) {
+    int id, year, month, day, offset = 0;
+    char kind[16];
+    if (sscanf(line, "%d %15s %n", &id, kind, &offset) != 2 || id < 1) return;
+
+    if (strcmp(kind, "skip") == 0 || strcmp(kind, "edit") == 0) {
+        char* rest = line + offset;
+        offset = 0;
+        if (sscanf(rest, "%d-%d-%d %n", &year, &month, &day, &offset) != 3) return;
+        if (kind[0] == 'e' && (offset == 0 || rest[offset] == '\0')) return;
+
+        struct recurrence* rule = find_recurrence(table, id);
+        if (rule == NULL) return;
+
+        rule->exceptions = realloc(rule->exceptions, (rule->num_exceptions + 1) * sizeof(struct recurrence_exception));
+        struct recurrence_exception* exception = &rule->exceptions[rule->num_exceptions++];
+        memset(exception, 0, sizeof(struct recurrence_exception));
+        exception->date_key = DATE_KEY(year, month, day);
+        exception->skipped = kind[0] == 's';
+
+        if (!exception->skipped) {
+            exception->event = parse_event(rest + offset);
+            exception->event.recurrence = id;
+        }
+        return;
+    }
+
+    char freq_name[16], until[16];
+    int interval;
+    offset = 0;
+    if (sscanf(line, "%d %d-%d-%d %15s %d %15s %n", &id, &year, &month, &day, freq_name, &interval, until, &offset) != 7) {
+        return;
+    }
+
+    enum repeat_freq freq = REPEAT_NONE;
+    for (int i = REPEAT_DAILY; i <= REPEAT_MONTHLY; i++) {
+        if (strcmp(freq_name, repeat_names[i]) == 0) freq = i;
+    }
+    if (freq == REPEAT_NONE || offset == 0 || line[offset] == '\0') return;
+
+    struct recurrence* rule = new_recurrence(table);
+    rule->id = id;
+    rule->start_key = DATE_KEY(year, month, day);
+    rule->start_day = days_from_date_key(rule->start_key);
+    rule->freq = freq;
+    rule->interval = interval > 0 ? interval : 1;
+
+    int until_year, until_month, until_day;
+    if (sscanf(until, "%d-%d-%d", &until_year, &until_month, &until_day) == 3) {
+        rule->until_key = DATE_KEY(until_year, until_month, until_day);
+    }
+
+    rule->event = parse_event(line + offset);
+    rule->event.recurrence = id;
+
+    if (id >= table->next_id) table->next_id = id + 1;
+}
+
+/*
+ * Adds an empty rule to the end of the table.
+ */
+struct recurrence* new_recurrence(struct recurrence_table* table) {
+    if (table->length == table->size) {
+        table->size = table->size == 0 ? 8 : table->size * 2;
+        table->rules = realloc(table->rules, table->size * sizeof(struct recurrence));
+    }
+
+    struct recurrence* rule = &table->rules[table->length++];
+    memset(rule, 0, sizeof(struct recurrence));
+
+    return rule;
+}
+
+struct recurrence* find_recurrence(struct recurrence_table* table, int id) {
+    for (size_t i = 0; i < table->length; i++) {
+        if (table->rules[i].id == id) return &table->rules[i];
+    }
+
+    return NULL;
+}
+
+/*
+ * Finds the rule that repeats the same event the same way as rule, up to
+ * its last date.
+ */
+struct recurrence* find_same_recurrence(struct recurrence_table* table, struct recurrence* rule) {
+    for (size_t i = 0; i < table->length; i++) {
+        struct recurrence* other = &table->rules[i];
+
+        if (
+            other->start_key == rule->start_key &&
+            other->freq == rule->freq &&
+            other->interval == rule->interval &&
+            other->event.hour == rule->event.hour &&
+            other->event.min == rule->event.min &&
+            other->event.duration == rule->event.duration &&
+            strcasecmp(other->event.summary, rule->event.summary) == 0
+        ) {
+            return other;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Whether events already has event stored on the day rather than as an
+ * occurrence, at the same time and with the same summary.
+ */
+bool is_stored(struct events* events, struct event* event) {
+    for (size_t i = 0; i < events->length; i++) {
+        struct event* stored = &events->events[i];
+        if (stored->recurrence != 0 || stored->hour != event->hour || stored->min != event->min) continue;
+
+        if (strcasecmp(stored->summary, event->summary) == 0) return true;
+    }
+
+    return false;
+}
+
+struct recurrence_exception* find_exception(struct recurrence* rule, int date_key) {
+    for (size_t i = 0; i < rule->num_exceptions; i++) {
+        if (rule->exceptions[i].date_key == date_key) return &rule->exceptions[i];
+    }
+
+    return NULL;
+}
+
+/*
+ * Whether the rule has an occurrence on date_key, which is day days
+ * after 1970-01-01.
+ */
+bool occurs_on(struct recurrence* rule, int date_key, long day) {
+    if (date_key < rule->start_key) return false;
+    if (rule->until_key != 0 && date_key > rule->until_key) return false;
+
+    long days = day - rule->start_day;
+
+    switch (rule->freq) {
+        case REPEAT_DAILY:
+            return days % rule->interval == 0;
+        case REPEAT_WEEKLY:
+            return days % (7L * rule->interval) == 0;
+        case REPEAT_MONTHLY: {
+            if (date_key % 100 != rule->start_key % 100) return false;
+
+            int months = (date_key / 10000 * 12 + date_key / 100 % 100) -
+                (rule->start_key / 10000 * 12 + rule->start_key / 100 % 100);
+            return months % rule->interval == 0;
+        }
+        default:
+            return false;
+    }
+}
+
+/*
+ * Writes the table to a temporary file and moves it over the old one, so
+ * a crash never leaves half a table behind. The calendar has to be
+ * locked.
+ */
+int write_recurrences(struct recurrence_table* table) {
+    char* text = save_recurrences(table);
+    int result = write_recurrences_text(table, text);
+    free(text);
+
+    if (result == 0) remember_file(table);
+    return result;
+}
+
+void print_recurrences(struct recurrence_table* table, FILE* file) {
+    fprintf(file, "# Repeating events, see recurrence.c in calenter\n");
+
+    for (size_t i = 0; i < table->length; i++) {
+        struct recurrence* rule = &table->rules[i];
+
+        char start[11];
+        format_calendartxt_date(start, rule->start_key / 10000, rule->start_key / 100 % 100, rule->start_key % 100);
+        char until[11] = "-";
+        if (rule->until_key != 0) {
+            format_calendartxt_date(until, rule->until_key / 10000, rule->until_key / 100 % 100, rule->until_key % 100);
+        }
+
+        fprintf(file, "%d %s %s %d %s ", rule->id, start, repeat_names[rule->freq], rule->interval, until);
+        write_event_text(file, &rule->event);
+
+        for (size_t j = 0; j < rule->num_exceptions; j++) {
+            struct recurrence_exception* exception = &rule->exceptions[j];
+
+            char date[11];
+            format_calendartxt_date(date, exception->date_key / 10000, exception->date_key / 100 % 100, exception->date_key % 100);
+
+            if (exception->skipped) {
+                fprintf(file, "%d skip %s\n", rule->id, date);
+            } else {
+                fprintf(file, "%d edit %s ", rule->id, date);
+                write_event_text(file, &exception->event);
+            }
+        }
+    }
+}
+
+/*
+ * Replaces the table's file with text, by way of a temporary file.
+ */
+int write_recurrences_text(struct recurrence_table* table, const char* text) {
+    int tmp_path_length = strlen(table->path) + 5;
+    char* tmp_path = malloc(sizeof(char) * tmp_path_length);
+    snprintf(tmp_path, tmp_path_length, "%s.tmp", table->path);
+
+    FILE* file = fopen(tmp_path, "w");
+    if (file == NULL) {
+        free(tmp_path);
+        return -1;
+    }
+
+    fputs(text, file);
+
+    bool failed = ferror(file) != 0;
+    failed |= fclose(file) != 0;
+    failed = failed || rename(tmp_path, table->path) != 0;
+
+    if (failed) remove(tmp_path);
+    free(tmp_path);
+
+    return failed ? -1 : 0;
+}
+
+/*
+ * Writes an event the way it appears on a date line, then a newline.
+ */
+void write_event_text(FILE* file, struct event* event) {
+    char time[12];
+    format_time_range(time, *event);
+
+    // Line breaks would start a new entry
+    fprintf(file, "%s - ", time);
+    for (const char* c = event->summary; *c != '\0'; c++) {
+        fputc(*c == '\n' ? ' ' : *c, file);
+    }
+    fputc('\n', file);
+}
+
+/*
+ * Records the file just written as the one the table matches, so it
+ * isn't read back in.
+ */
+void remember_file(struct recurrence_table* table) {
+    struct stat st;
+    if (stat(table->path, &st) != 0) return;
+
+    table->exists = true;
+    table->ino = st.st_ino;
+    table->file_size = st.st_size;
+    table->mtime = st.st_mtim;
+}
@@ -0,0 +1,146 @@
+#ifndef RECURRENCE_H
+#define RECURRENCE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "calendartxt.h"
+
+// The table is kept next to its calendar, e.g. calendar.txt.repeat
+#define RECURRENCE_SUFFIX ".repeat"
+
+enum repeat_freq {
+  REPEAT_NONE,
+  REPEAT_DAILY,
+  REPEAT_WEEKLY,
+  REPEAT_MONTHLY,
+};
+
+/*
+ * A change to a single occurrence of a repeating event: either it doesn't
+ * happen, or it happens with a different time or summary.
+ */
+struct recurrence_exception {
+  int date_key;
+  bool skipped;
+  struct event event; // the replacement when not skipped
+};
+
+/*
+ * A repeating event. It occurs on start_key and every interval days,
+ * weeks or months after it, up to until_key. Monthly events skip months
+ * without their day.
+ */
+struct recurrence {
+  int id;
+  int start_key;
+  long start_day; // days_from_date_key(start_key)
+  enum repeat_freq freq;
+  int interval;
+  int until_key; // 0 for no end
+  struct event event; // the time, end and summary of every occurrence
+  struct recurrence_exception* exceptions;
+  size_t num_exceptions;
+};
+
+/*
+ * The repeating events of one calendar, read from its .repeat file and
+ * read again whenever the file changes.
+ */
+struct recurrence_table {
+  char* path;
+  struct recurrence* rules;
+  size_t length;
+  size_t size;
+  int next_id;
+  ino_t ino;
+  off_t file_size;
+  struct timespec mtime;
+  bool exists;
+  struct calendar_file calendar; // only used for the calendar's lock
+};
+
+void open_recurrences(struct recurrence_table* table, const char* calendar_path);
+void close_recurrences(struct recurrence_table* table);
+
+/*
+ * Reads the table again if its file changed since it was last read.
+ * Returns 0 on success, -1 if the file exists but couldn't be read.
+ */
+int refresh_recurrences(struct recurrence_table* table);
+
+/*
+ * Takes and releases the lock of the table's calendar, which every change
+ * to the table is made under. Returns 0 on success, -1 on failure.
+ */
+int lock_recurrences(struct recurrence_table* table);
+void unlock_recurrences(struct recurrence_table* table);
+
+/*
+ * Returns the table as it is written to its file. The string belongs to
+ * the caller.
+ */
+char* save_recurrences(struct recurrence_table* table);
+
+/*
+ * Writes back a table returned by save_recurrences, unless the table is
+ * no longer expected (e.g. a sync changed it). Returns 0 on success, -1
+ * on failure.
+ */
+int restore_recurrences(struct recurrence_table* table, const char* saved, const char* expected);
+
+/*
+ * Returns a value that changes whenever the table's file does, 0 if
+ * there is no file.
+ */
+long long get_recurrences_version(struct recurrence_table* table);
+
+/*
+ * Inserts the occurrences on date_key into events in chronological
+ * order, tagged with source and the id of their recurrence. One that's
+ * already stored on the day at the same time with the same summary (e.g.
+ * copied there by an older sync) isn't added again. Returns the number
+ * added.
+ */
+size_t add_occurrences(struct recurrence_table* table, int date_key, int source, struct events* events);
+
+/*
+ * Adds a repeating event starting on the event's date. Returns the new
+ * event's id, or -1 on failure.
+ */
+int add_recurrence(struct recurrence_table* table, struct event event, enum repeat_freq freq, int interval);
+
+/*
+ * Adds repeating events read from a feed in one write. A rule the table
+ * already has (same first date, frequency, interval, time and summary)
+ * only takes on the feed's last date, so syncing again adds nothing.
+ * The rules' summaries are copied. Returns the number added, or -1 on
+ * failure.
+ */
+long merge_recurrences(struct recurrence_table* table, struct recurrence* rules, size_t count);
+
+/*
+ * Removes a repeating event with all of its occurrences.
+ * Returns 0 on success, -1 on failure.
+ */
+int delete_recurrence(struct recurrence_table* table, int id);
+
+/*
+ * Removes the occurrence of a repeating event on date_key, or replaces
+ * it with event. Returns 0 on success, -1 on failure.
+ */
+int skip_occurrence(struct recurrence_table* table, int id, int date_key);
+int edit_occurrence(struct recurrence_table* table, int id, int date_key, struct event event);
+
+/*
+ * Copies the repeating events of the calendar at from_path, if it has
+ * any, to the calendar at to_path. Returns 0 on success, -1 on failure.
+ */
+int copy_recurrences(const char* from_path, const char* to_path);
+
+/*
+ * Returns the name used for freq in the table ("daily", ...), or NULL
+ * for REPEAT_NONE.
+ */
+const char* get_repeat_name(enum repeat_freq freq);
+
+#endif
@@ -0,0 +1,618 @@
+/*
+ * reminders.c
+ *
+ * Runs reminder_command reminder_minutes before each timed event starts.
+ * The upcoming events are kept in a min-heap ordered by when their
+ * reminder is due, and a single timerfd is set for the top of the heap,
+ * so a process with nothing due sleeps until the next reminder instead of
+ * checking the calendars every minute.
+ *
+ * The heap holds a window of days, from today through the day after the
+ * last one a reminder could currently be due for, read with
+ * get_range_events so repeating events are included. The timer also wakes
+ * when a reminder could be due for the day after the window, which then
+ * grows by that day alone. The calendars' directories are watched with
+ * inotify, and when a change alters a calendar's version the window is
+ * read again, but only the days whose events differ from the last read
+ * have their reminders replaced.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "reminders.h"
+#include "config.h"
+#include "skeleton.h"
+#include "sources.h"
+#include "tz.h"
+
+// A reminder this long after its event started isn't sent at all, e.g.
+// when the machine wakes from a suspend
+#define MISSED_REMINDER_SECONDS 300
+
+/*
+ * An upcoming event's reminder, in the heap.
+ */
+struct reminder {
+    int64_t due; // in UTC seconds, like start
+    int64_t start;
+    int date_key;
+    uint64_t key; // see get_event_key
+    struct event event;
+};
+
+/*
+ * A day of one calendar in the window as it was last read. Days without
+ * events aren't kept.
+ */
+struct reminder_day {
+    int source;
+    int date_key;
+    uint64_t checksum;
+    bool seen; // by the read in progress
+};
+
+/*
+ * A reminder already sent for an event that hasn't started yet, so that
+ * reading its day again doesn't send it twice.
+ */
+struct sent_reminder {
+    int64_t start;
+    uint64_t key;
+};
+
+static struct reminder* heap = NULL;
+static size_t heap_length = 0;
+static size_t heap_size = 0;
+
+static struct reminder_day* days = NULL;
+static size_t num_days = 0;
+static size_t days_size = 0;
+
+static struct sent_reminder* sent = NULL;
+static size_t num_sent = 0;
+static size_t sent_size = 0;
+
+static long long* versions = NULL; // one per source, as of the last read
+static int num_versions = 0;
+
+// The days read into the heap, first_key through last_key
+static int first_key = 0;
+static int last_key = 0;
+
+static bool enabled = false;
+static int lead_seconds = 0;
+static int config_generation = -1;
+
+static int reminder_fd = -1; // an epoll set of the two below
+static int timer_fd = -1;
+static int watch_fd = -1;
+
+void rebuild_reminders(int64_t now);
+void clear_reminders();
+void watch_calendars();
+bool drain_watch();
+bool calendars_changed();
+void extend_window(int64_t now);
+void read_window(int from_key, int to_key, int64_t now);
+int read_reminder_day(int year, int month, int day, struct events* events, void* data);
+struct reminder_day* find_reminder_day(int source, int date_key);
+void remove_day_reminders(int source, int date_key);
+void send_due_reminders(int64_t now);
+void send_reminder(struct reminder* reminder);
+bool was_sent(uint64_t key);
+void set_timer(int64_t now);
+int get_window_end(int64_t now);
+int64_t get_start_time(int date_key, int hour, int min);
+int get_local_date_key(int64_t utc);
+uint64_t get_event_key(struct event* event, int date_key);
+void push_reminder(struct reminder reminder);
+struct reminder pop_reminder();
+void sift_up(size_t i);
+void sift_down(size_t i);
+bool is_due_before(struct reminder* a, struct reminder* b);
+
+int start_reminders() {
+    if (reminder_fd >= 0) return reminder_fd;
+
+    // Reminders are due at wall clock times, so the timer follows the
+    // real time clock, which also makes it fire late rather than never
+    // after a suspend
+    timer_fd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC);
+    reminder_fd = epoll_create1(EPOLL_CLOEXEC);
+
+    if (timer_fd < 0 || reminder_fd < 0) {
+        stop_reminders();
+        return -1;
+    }
+
+    struct epoll_event event = {.events = EPOLLIN, .data.fd = timer_fd};
+    epoll_ctl(reminder_fd, EPOLL_CTL_ADD, timer_fd, &event);
+
+    handle_reminders();
+
+    return reminder_fd;
+}
+
+void handle_reminders() {
+    if (reminder_fd < 0) return;
+
+    bool changed = drain_watch();
+
+    // Setting the clock cancels the timer, and every due time is worked
+    // out again in case the zone changed with it
+    uint64_t expirations;
+    if (read(timer_fd, &expirations, sizeof(expirations)) < 0 && errno == ECANCELED) config_generation = -1;
+
+    int64_t now = time(NULL);
+
+    if (config_generation != get_config_generation()) {
+        rebuild_reminders(now);
+    } else if (enabled && changed && calendars_changed()) {
+        read_window(first_key, last_key, now);
+    }
+
+    if (enabled) {
+        extend_window(now);
+        send_due_reminders(now);
+    }
+
+    set_timer(now);
+}
+
+void stop_reminders() {
+    clear_reminders();
+
+    free(heap);
+    free(days);
+    free(sent);
+    free(versions);
+    heap = NULL;
+    days = NULL;
+    sent = NULL;
+    versions = NULL;
+    heap_size = 0;
+    days_size = 0;
+    num_sent = 0;
+    sent_size = 0;
+    num_versions = 0;
+
+    if (reminder_fd >= 0) close(reminder_fd);
+    if (timer_fd >= 0) close(timer_fd);
+    if (watch_fd >= 0) close(watch_fd);
+    reminder_fd = -1;
+    timer_fd = -1;
+    watch_fd = -1;
+
+    enabled = false;
+    config_generation = -1;
+}
+
+/*
+ * Reads the window again from scratch with the current config. Reminders
+ * already sent stay sent.
+ */
+void rebuild_reminders(int64_t now) {
+    const Config* config = get_config();
+    config_generation = get_config_generation();
+
+    clear_reminders();
+    enabled = config->reminders;
+    lead_seconds = config->reminder_minutes * 60;
+
+    watch_calendars();
+    if (!enabled) return;
+
+    calendars_changed();
+    first_key = get_local_date_key(now);
+    last_key = get_window_end(now);
+    read_window(first_key, last_key, now);
+}
+
+void clear_reminders() {
+    for (size_t i = 0; i < heap_length; i++) {
+        free(heap[i].event.summary);
+    }
+    heap_length = 0;
+    num_days = 0;
+}
+
+/*
+ * Watches the directory of every calendar, or none while reminders are
+ * off. Calendars are written by renaming a new file over the old one or
+ * in place, so watching the directory catches both.
+ */
+void watch_calendars() {
+    // Starting over is simpler than working out which watches are stale
+    if (watch_fd >= 0) close(watch_fd);
+    watch_fd = -1;
+
+    if (!enabled) return;
+
+    watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watch_fd < 0) return;
+
+    struct epoll_event event = {.events = EPOLLIN, .data.fd = watch_fd};
+    epoll_ctl(reminder_fd, EPOLL_CTL_ADD, watch_fd, &event);
+
+    for (int i = 0; i < get_num_sources(); i++) {
+        char* dir = strdup(get_source_path(i));
+        char* slash = strrchr(dir, '/');
+
+        if (slash == NULL) {
+            strcpy(dir, ".");
+        } else {
+            slash[slash == dir ? 1 : 0] = '\0';
+        }
+
+        // A directory watched twice keeps its one watch
+        inotify_add_watch(watch_fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE);
+        free(dir);
+    }
+}
+
+/*
+ * Empties the watch. Returns true if anything in the directories changed.
+ */
+bool drain_watch() {
+    if (watch_fd < 0) return false;
+
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    bool changed = false;
+
+    // Lock files and the like wake it too, calendars_changed tells them apart
+    while (read(watch_fd, buffer, sizeof(buffer)) > 0) {
+        changed = true;
+    }
+
+    return changed;
+}
+
+/*
+ * Returns true if any calendar's version changed since the last call.
+ */
+bool calendars_changed() {
+    int count = get_num_sources();
+    bool changed = false;
+
+    if (count != num_versions) {
+        free(versions);
+        versions = calloc(count, sizeof(long long));
+        num_versions = count;
+        changed = true;
+    }
+
+    for (int i = 0; i < count; i++) {
+        long long version = get_source_version(i);
+        if (version != versions[i]) changed = true;
+        versions[i] = version;
+    }
+
+    return changed;
+}
+
+/*
+ * Drops the days that have passed and reads the days a reminder could
+ * now be due for.
+ */
+void extend_window(int64_t now) {
+    int today = get_local_date_key(now);
+
+    if (today > first_key) {
+        size_t kept = 0;
+        for (size_t i = 0; i < num_days; i++) {
+            if (days[i].date_key >= today) days[kept++] = days[i];
+        }
+        num_days = kept;
+        first_key = today;
+    }
+
+    int end_key = get_window_end(now);
+    if (end_key <= last_key) return;
+
+    // After a long suspend the window can be behind today
+    int from_key = next_date_key(last_key);
+    read_window(from_key > today ? from_key : today, end_key, now);
+    last_key = end_key;
+}
+
+/*
+ * Reads the days from from_key through to_key and replaces the reminders
+ * of the ones that changed since they were last read.
+ */
+void read_window(int from_key, int to_key, int64_t now) {
+    for (size_t i = 0; i < num_days; i++) {
+        days[i].seen = false;
+    }
+
+    get_range_events(from_key, to_key, read_reminder_day, &now);
+
+    // Days whose events are all gone aren't passed at all
+    size_t kept = 0;
+    for (size_t i = 0; i < num_days; i++) {
+        struct reminder_day* day = &days[i];
+
+        if (!day->seen && day->date_key >= from_key && day->date_key <= to_key) {
+            remove_day_reminders(day->source, day->date_key);
+        } else {
+            days[kept++] = *day;
+        }
+    }
+    num_days = kept;
+}
+
+/*
+ * A day_callback that adds the reminders of a calendar's day, unless the
+ * day is the same as when it was last read.
+ */
+int read_reminder_day(int year, int month, int day, struct events* events, void* data) {
+    int64_t now = *(int64_t*)data;
+    if (events->length == 0) return 0;
+
+    int date_key = DATE_KEY(year, month, day);
+    int source = events->events[0].source;
+
+    uint64_t checksum = HASH_SEED;
+    for (size_t i = 0; i < events->length; i++) {
+        checksum = checksum * 31 + get_event_key(&events->events[i], date_key) + events->events[i].duration;
+    }
+
+    struct reminder_day* known = find_reminder_day(source, date_key);
+    if (known != NULL) {
+        known->seen = true;
+        if (known->checksum == checksum) return 0;
+
+        known->checksum = checksum;
+        remove_day_reminders(source, date_key);
+    } else {
+        if (num_days == days_size) {
+            days_size = days_size == 0 ? 16 : days_size * 2;
+            days = realloc(days, days_size * sizeof(struct reminder_day));
+        }
+        days[num_days++] = (struct reminder_day){source, date_key, checksum, true};
+    }
+
+    for (size_t i = 0; i < events->length; i++) {
+        struct event* event = &events->events[i];
+        if (event->hour < 0) continue;
+
+        struct reminder reminder;
+        reminder.start = get_start_time(date_key, event->hour, event->min);
+        reminder.due = reminder.start - lead_seconds;
+        reminder.date_key = date_key;
+        reminder.key = get_event_key(event, date_key);
+
+        // An event added after its reminder was due still gets one, as
+        // long as it hasn't started
+        if (reminder.start <= now || was_sent(reminder.key)) continue;
+
+        reminder.event = *event;
+        reminder.event.summary = strdup(event->summary);
+        push_reminder(reminder);
+    }
+
+    return 0;
+}
+
+struct reminder_day* find_reminder_day(int source, int date_key) {
+    // The window is a few days, so a scan is cheaper than an index
+    for (size_t i = 0; i < num_days; i++) {
+        if (days[i].source == source && days[i].date_key == date_key) return &days[i];
+    }
+
+    return NULL;
+}
+
+void remove_day_reminders(int source, int date_key) {
+    size_t kept = 0;
+    for (size_t i = 0; i < heap_length; i++) {
+        if (heap[i].event.source == source && heap[i].date_key == date_key) {
+            free(heap[i].event.summary);
+        } else {
+            heap[kept++] = heap[i];
+        }
+    }
+
+    if (kept == heap_length) return;
+    heap_length = kept;
+
+    for (size_t i = heap_length / 2; i-- > 0;) {
+        sift_down(i);
+    }
+}
+
+void send_due_reminders(int64_t now) {
+    // Only events that haven't started can be read again
+    size_t kept = 0;
+    for (size_t i = 0; i < num_sent; i++) {
+        if (sent[i].start > now) sent[kept++] = sent[i];
+    }
+    num_sent = kept;
+
+    while (heap_length > 0 && heap[0].due <= now) {
+        struct reminder reminder = pop_reminder();
+
+        if (reminder.start + MISSED_REMINDER_SECONDS > now) {
+            send_reminder(&reminder);
+
+            if (num_sent == sent_size) {
+                sent_size = sent_size == 0 ? 16 : sent_size * 2;
+                sent = realloc(sent, sent_size * sizeof(struct sent_reminder));
+            }
+            sent[num_sent++] = (struct sent_reminder){reminder.start, reminder.key};
+        }
+
+        free(reminder.event.summary);
+    }
+}
+
+/*
+ * Runs reminder_command with the event's summary and its time (and its
+ * calendar, if there are several) as arguments, without waiting for it.
+ */
+void send_reminder(struct reminder* reminder) {
+    const Config* config = get_config();
+    const char* command = config->reminder_command != NULL ? config->reminder_command : DEFAULT_REMINDER_COMMAND;
+    struct event* event = &reminder->event;
+
+    char when[64];
+    int length = snprintf(when, sizeof(when), "%02d:%02d", event->hour, event->min);
+    if (event->duration > 0) {
+        int end = event->hour * 60 + event->min + event->duration;
+        length += snprintf(when + length, sizeof(when) - length, "-%02d:%02d", end / 60 % 24, end % 60);
+    }
+    if (get_num_sources() > 1) {
+        snprintf(when + length, sizeof(when) - length, " in %s", get_source_name(event->source));
+    }
+
+    // The command can have arguments of its own, so it's run by the
+    // shell, with the event passed after them as is
+    char* script = malloc(strlen(command) + 16);
+    sprintf(script, "%s \"$1\" \"$2\"", command);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        // The command runs in a grandchild that init reaps, so its exit
+        // doesn't have to be waited for here
+        if (fork() == 0) {
+            int null_fd = open("/dev/null", O_RDWR);
+            dup2(null_fd, STDIN_FILENO);
+            dup2(null_fd, STDOUT_FILENO);
+            dup2(null_fd, STDERR_FILENO);
+
+            execl("/bin/sh", "sh", "-c", script, "sh", event->summary, when, NULL);
+        }
+        _exit(0);
+    }
+    if (pid > 0) waitpid(pid, NULL, 0);
+
+    free(script);
+}
+
+bool was_sent(uint64_t key) {
+    for (size_t i = 0; i < num_sent; i++) {
+        if (sent[i].key == key) return true;
+    }
+
+    return false;
+}
+
+/*
+ * Sets the timer for the next reminder, or for when the window next has
+ * to grow if that's sooner.
+ */
+void set_timer(int64_t now) {
+    struct itimerspec timer = {0};
+
+    if (enabled) {
+        int64_t next = get_start_time(next_date_key(last_key), 0, 0) - lead_seconds;
+        if (heap_length > 0 && heap[0].due < next) next = heap[0].due;
+
+        timer.it_value.tv_sec = next > now ? next : now + 1;
+    }
+
+    timerfd_settime(timer_fd, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET, &timer, NULL);
+}
+
+/*
+ * Returns the last day of the window: the day after the one a reminder
+ * due now would be for.
+ */
+int get_window_end(int64_t now) {
+    return next_date_key(get_local_date_key(now + lead_seconds));
+}
+
+/*
+ * Returns when a time on a day in the display zone is, in UTC seconds.
+ */
+int64_t get_start_time(int date_key, int hour, int min) {
+    int64_t local = civil_to_seconds(date_key / 10000, date_key / 100 % 100, date_key % 100, hour, min, 0);
+    return local_to_utc(get_display_time_zone(), local);
+}
+
+int get_local_date_key(int64_t utc) {
+    int64_t local;
+    utc_to_local_times(get_display_time_zone(), &utc, &local, 1);
+
+    int date_key, hour, min;
+    seconds_to_civil(local, &date_key, &hour, &min);
+
+    return date_key;
+}
+
+/*
+ * Identifies an event by its calendar, date, time and summary.
+ */
+uint64_t get_event_key(struct event* event, int date_key) {
+    int fields[4] = {event->source, date_key, event->hour, event->min};
+
+    uint64_t hash = HASH_SEED;
+    hash = hash_bytes(hash, (const char*)fields, sizeof(fields));
+    return hash_bytes(hash, event->summary, strlen(event->summary));
+}
+
+void push_reminder(struct reminder reminder) {
+    if (heap_length == heap_size) {
+        heap_size = heap_size == 0 ? 16 : heap_size * 2;
+        heap = realloc(heap, heap_size * sizeof(struct reminder));
+    }
+
+    heap[heap_length] = reminder;
+    sift_up(heap_length++);
+}
+
+struct reminder pop_reminder() {
+    struct reminder top = heap[0];
+
+    heap[0] = heap[--heap_length];
+    sift_down(0);
+
+    return top;
+}
+
+void sift_up(size_t i) {
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+        if (!is_due_before(&heap[i], &heap[parent])) break;
+
+        struct reminder swap = heap[i];
+        heap[i] = heap[parent];
+        heap[parent] = swap;
+        i = parent;
+    }
+}
+
+void sift_down(size_t i) {
+    while (true) {
+        size_t first = i;
+        size_t left = 2 * i + 1;
+        size_t right = left + 1;
+
+        if (left < heap_length && is_due_before(&heap[left], &heap[first])) first = left;
+        if (right < heap_length && is_due_before(&heap[right], &heap[first])) first = right;
+        if (first == i) break;
+
+        struct reminder swap = heap[i];
+        heap[i] = heap[first];
+        heap[first] = swap;
+        i = first;
+    }
+}
+
+/*
+ * Orders the heap by due time, and events due together by start.
+ */
+bool is_due_before(struct reminder* a, struct reminder* b) {
+    if (a->due != b->due) return a->due < b->due;
+
+    return a->start < b->start;
+}
@@ -0,0 +1,24 @@
+#ifndef REMINDERS_H
+#define REMINDERS_H
+
+/*
+ * Starts sending reminders for the timed events in every calendar, as
+ * configured by reminders, reminder_minutes and reminder_command. Returns
+ * a file descriptor that becomes readable when a reminder is due or a
+ * calendar changes, which should then be passed to handle_reminders, or
+ * -1 if the timer couldn't be made. While reminders are off in the
+ * config it never becomes readable.
+ */
+int start_reminders();
+
+/*
+ * Sends the reminders that are due and brings the upcoming ones in line
+ * with the calendars and the config. Has to be called after the config or
+ * the calendar list is reloaded, as well as when the descriptor is
+ * readable.
+ */
+void handle_reminders();
+
+void stop_reminders();
+
+#endif
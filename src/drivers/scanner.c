@@ -0,0 +1,141 @@
+/*
+ * scanner.c
+ *
+ * The pass over a whole calendar.txt that building the offset cache,
+ * rewriting days, filling in missing dates and counting stats all make.
+ * The file is mapped (or read in one go) instead of being read a line at
+ * a time with getline, line breaks are found with memchr, which libc
+ * vectorises, and a date is only looked for in a line's first ten bytes,
+ * so nothing is copied or sscanf'd until a caller wants the line.
+ *
+ * Mapping is safe against other writers because calendar.txt is only
+ * ever replaced with a rename or appended to: a mapping keeps the file it
+ * was made from, and appended bytes are past its length.
+ */
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "scanner.h"
+
+int read_file_block(int fd, struct file_block* block);
+
+int open_file_block(const char* path, struct file_block* block) {
+    memset(block, 0, sizeof(struct file_block));
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+
+    if (fstat(fd, &block->info) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    block->length = block->info.st_size;
+    if (S_ISREG(block->info.st_mode) && block->length > 0) {
+        void* map = mmap(NULL, block->length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            madvise(map, block->length, MADV_SEQUENTIAL);
+            block->data = map;
+            block->mapped = true;
+        }
+    }
+
+    int result = block->mapped ? 0 : read_file_block(fd, block);
+    close(fd);
+
+    return result;
+}
+
+/*
+ * Reads what's left of the file into a buffer where it couldn't be
+ * mapped.
+ */
+int read_file_block(int fd, struct file_block* block) {
+    size_t size = block->length > 0 ? block->length : 4096;
+    char* buffer = malloc(size);
+    size_t length = 0;
+
+    while (true) {
+        if (length == size) {
+            size *= 2;
+            buffer = realloc(buffer, size);
+        }
+
+        ssize_t count = read(fd, buffer + length, size - length);
+        if (count == 0) break;
+        if (count < 0) {
+            free(buffer);
+            return -1;
+        }
+        length += count;
+    }
+
+    block->data = buffer;
+    block->length = length;
+
+    return 0;
+}
+
+void close_file_block(struct file_block* block) {
+    if (block->mapped) {
+        munmap((void*)block->data, block->length);
+    } else {
+        free((void*)block->data);
+    }
+
+    block->data = NULL;
+    block->length = 0;
+}
+
+int scan_date_lines(struct file_block* block, size_t offset, date_line_callback callback, void* data) {
+    if (offset >= block->length) return 0;
+
+    return scan_date_text(block->data + offset, block->length - offset, offset, callback, data);
+}
+
+int scan_date_text(const char* text, size_t length, size_t offset, date_line_callback callback, void* data) {
+    const char* end = text + length;
+    struct date_line line;
+
+    const char* next;
+    for (const char* start = text; start < end; start = next) {
+        const char* newline = memchr(start, '\n', end - start);
+        size_t line_length = (newline == NULL ? end : newline) - start;
+        next = start + line_length + 1;
+
+        int date_key = parse_line_date(start, line_length);
+        if (date_key == 0) continue;
+
+        line.date_key = date_key;
+        line.offset = offset + (start - text);
+        line.text = start;
+        line.length = line_length;
+
+        int result = callback(&line, data);
+        if (result != 0) return result;
+    }
+
+    return 0;
+}
+
+size_t find_line_start(const char* text, size_t length, size_t from) {
+    const char* newline = memchr(text + from, '\n', length - from);
+    return newline == NULL ? length : (size_t)(newline - text) + 1;
+}
+
+int parse_line_date(const char* line, size_t length) {
+    if (length < 10 || line[4] != '-' || line[7] != '-') return 0;
+
+    int date_key = 0;
+    for (int i = 0; i < 10; i++) {
+        if (i == 4 || i == 7) continue;
+        if (line[i] < '0' || line[i] > '9') return 0;
+
+        date_key = date_key * 10 + line[i] - '0';
+    }
+
+    return date_key;
+}
@@ -0,0 +1,68 @@
+#ifndef SCANNER_H
+#define SCANNER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/stat.h>
+
+/*
+ * A whole file in memory: mapped, or read into a buffer where it can't
+ * be mapped (e.g. it's empty).
+ */
+struct file_block {
+    const char* data;
+    size_t length;
+    struct stat info; // of the file that was read, which a rename may have replaced since
+    bool mapped;
+};
+
+/*
+ * A line of calendar.txt that starts with a "yyyy-mm-dd" date. The
+ * length doesn't include the line break.
+ */
+struct date_line {
+    int date_key;
+    size_t offset; // from the start of the file
+    const char* text;
+    size_t length;
+};
+
+/*
+ * Called for every date line in order. Returning non-zero stops the scan.
+ */
+typedef int (*date_line_callback)(struct date_line* line, void* data);
+
+/*
+ * Reads the file at path into block. Returns 0 on success, -1 if it
+ * can't be read.
+ */
+int open_file_block(const char* path, struct file_block* block);
+void close_file_block(struct file_block* block);
+
+/*
+ * Calls callback for every line from offset to the end of the block that
+ * starts with a date, skipping any other line. offset must be the start
+ * of a line. Returns what the callback stopped the scan with, otherwise
+ * 0.
+ */
+int scan_date_lines(struct file_block* block, size_t offset, date_line_callback callback, void* data);
+
+/*
+ * The same over length bytes at text, which start at offset in the file.
+ * For scanning part of a block (see find_line_start).
+ */
+int scan_date_text(const char* text, size_t length, size_t offset, date_line_callback callback, void* data);
+
+/*
+ * Returns the offset of the first line that starts after from, or length
+ * if there isn't one.
+ */
+size_t find_line_start(const char* text, size_t length, size_t from);
+
+/*
+ * Returns the DATE_KEY of a line starting with "yyyy-mm-dd", or 0 if it
+ * doesn't.
+ */
+int parse_line_date(const char* line, size_t length);
+
+#endif
@@ -0,0 +1,373 @@
+/*
+ * skeleton.c
+ *
+ * calendar.txt expects a line for every date, even ones without
+ * events. This file generates those empty "yyyy-mm-dd Www wNN" lines
+ * in bulk and uses them to extend a calendar past its last date or to
+ * fill in dates that are missing.
+ *
+ * The dates are generated by stepping a day at a time and keeping the
+ * weekday and ISO week number up to date incrementally, so no calls to
+ * mktime/strftime are needed and the lines are written straight into a
+ * large buffer.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "scanner.h"
+#include "skeleton.h"
+
+#define SKELETON_BUFFER_SIZE (1 << 16)
+#define SKELETON_LINE_LENGTH 19
+
+/*
+ * A fill_calendar pass: the file being rewritten, how much of it has been
+ * copied to out and the first date that hasn't been written yet.
+ */
+struct skeleton_filler {
+    FILE* out;
+    const char* text;
+    size_t copied;
+    int next_key;
+};
+
+static const char* wday_names[7] = {"Mon", "Tue", "Wed", "Thu", "Fri", "Sat", "Sun"};
+
+int iso_weekday(int year, int month, int day);
+int iso_weeks_in_year(int year);
+int day_of_year(int year, int month, int day);
+long days_from_civil(int year, int month, int day);
+void put_digits(char* buffer, int value, int digits);
+int append_skeleton(struct calendar_file* file, int date_key);
+int rewrite_skeleton(struct calendar_file* file, int date_key);
+int fill_gap_before(struct date_line* line, void* data);
+
+long write_skeleton(FILE* out, int start_key, int end_key) {
+    if (start_key > end_key) return 0;
+
+    char* buffer = malloc(SKELETON_BUFFER_SIZE);
+    size_t used = 0;
+    long lines = 0;
+
+    int year = start_key / 10000;
+    int month = start_key / 100 % 100;
+    int day = start_key % 100;
+
+    int wday = iso_weekday(year, month, day);
+    int ordinal = day_of_year(year, month, day);
+    int weeks = iso_weeks_in_year(year);
+    int prev_weeks = iso_weeks_in_year(year - 1);
+    int month_days = days_in_month(year, month);
+
+    while (DATE_KEY(year, month, day) <= end_key) {
+        // Week 1 is the week with the year's first Thursday in it
+        int week = (ordinal - wday + 10) / 7;
+        if (week < 1) {
+            week = prev_weeks;
+        } else if (week > weeks) {
+            week = 1;
+        }
+
+        if (used + SKELETON_LINE_LENGTH > SKELETON_BUFFER_SIZE) {
+            if (fwrite(buffer, 1, used, out) != used) {
+                free(buffer);
+                return -1;
+            }
+            used = 0;
+        }
+
+        char* line = buffer + used;
+        put_digits(line, year, 4);
+        line[4] = '-';
+        put_digits(line + 5, month, 2);
+        line[7] = '-';
+        put_digits(line + 8, day, 2);
+        line[10] = ' ';
+        memcpy(line + 11, wday_names[wday - 1], 3);
+        line[14] = ' ';
+        line[15] = 'w';
+        put_digits(line + 16, week, 2);
+        line[18] = '\n';
+
+        used += SKELETON_LINE_LENGTH;
+        lines++;
+
+        wday = wday == 7 ? 1 : wday + 1;
+        ordinal++;
+        day++;
+
+        if (day > month_days) {
+            day = 1;
+            month++;
+
+            if (month > 12) {
+                month = 1;
+                year++;
+                ordinal = 1;
+                prev_weeks = weeks;
+                weeks = iso_weeks_in_year(year);
+            }
+
+            month_days = days_in_month(year, month);
+        }
+    }
+
+    if (fwrite(buffer, 1, used, out) != used) lines = -1;
+    free(buffer);
+
+    return lines;
+}
+
+int extend_calendar(struct calendar_file* file, int date_key) {
+    // Reading a date that's already there mustn't wait for a writer
+    if (
+        refresh_day_offsets(file) == 0 &&
+        file->num_offsets > 0 &&
+        file->offsets[file->num_offsets - 1].date_key >= date_key
+    ) {
+        return 0;
+    }
+
+    if (lock_calendar_file(file) != 0) return -1;
+    int result = append_skeleton(file, date_key);
+    unlock_calendar_file(file);
+
+    return result;
+}
+
+/*
+ * extend_calendar with the lock held. Another writer may have extended
+ * the file while it was waiting, so it checks again.
+ */
+int append_skeleton(struct calendar_file* file, int date_key) {
+    int end_key = DATE_KEY(date_key / 10000, 12, 31);
+    int start_key = DATE_KEY(date_key / 10000, 1, 1);
+    bool needs_newline = false;
+
+    if (refresh_day_offsets(file) == 0 && file->num_offsets > 0) {
+        int last_key = file->offsets[file->num_offsets - 1].date_key;
+        if (last_key >= date_key) return 0;
+
+        start_key = next_date_key(last_key);
+
+        // Don't glue the first new line onto an unterminated last line
+        FILE* calendar_file = fopen(file->path, "r");
+        if (calendar_file != NULL) {
+            if (fseek(calendar_file, -1, SEEK_END) == 0) {
+                needs_newline = fgetc(calendar_file) != '\n';
+            }
+            fclose(calendar_file);
+        }
+    }
+
+    FILE* calendar_file = fopen(file->path, "a");
+    if (calendar_file == NULL) return -1;
+
+    if (needs_newline) fputc('\n', calendar_file);
+    long lines = write_skeleton(calendar_file, start_key, end_key);
+
+    if (fclose(calendar_file) != 0 || lines < 0) return -1;
+
+    return 0;
+}
+
+int fill_calendar(struct calendar_file* file, int date_key) {
+    if (lock_calendar_file(file) != 0) return -1;
+    int result = rewrite_skeleton(file, date_key);
+    unlock_calendar_file(file);
+
+    return result;
+}
+
+/*
+ * fill_calendar with the lock held.
+ */
+int rewrite_skeleton(struct calendar_file* file, int date_key) {
+    if (refresh_day_offsets(file) != 0 || file->num_offsets == 0) {
+        return extend_calendar(file, date_key);
+    }
+
+    int first_key = file->offsets[0].date_key;
+    int last_key = file->offsets[file->num_offsets - 1].date_key;
+
+    long expected_lines = days_from_date_key(last_key) - days_from_date_key(first_key) + 1;
+
+    bool has_gaps = (long)file->num_offsets < expected_lines;
+    if (!has_gaps && date_key >= first_key) {
+        return extend_calendar(file, date_key);
+    }
+
+    int start_key = date_key < first_key ? DATE_KEY(date_key / 10000, 1, 1) : first_key;
+    int end_key = DATE_KEY(date_key / 10000, 12, 31);
+    if (end_key < last_key) end_key = last_key;
+
+    int tmp_path_length = strlen(file->path) + 5;
+    char* tmp_path = malloc(sizeof(char) * tmp_path_length);
+    snprintf(tmp_path, tmp_path_length, "%s.tmp", file->path);
+
+    struct file_block block;
+    FILE* tmp = NULL;
+    bool opened = open_file_block(file->path, &block) == 0;
+    if (opened) tmp = fopen(tmp_path, "w");
+
+    if (tmp == NULL) {
+        if (opened) close_file_block(&block);
+        free(tmp_path);
+        return -1;
+    }
+
+    // The file's lines are copied in runs between the gaps
+    struct skeleton_filler filler = {tmp, block.data, 0, start_key};
+    scan_date_lines(&block, 0, fill_gap_before, &filler);
+    fwrite(block.data + filler.copied, 1, block.length - filler.copied, tmp);
+    if (block.length > 0 && block.data[block.length - 1] != '\n') fputc('\n', tmp);
+
+    long lines = write_skeleton(tmp, filler.next_key, end_key);
+    close_file_block(&block);
+
+    if (fclose(tmp) != 0 || lines < 0 || rename(tmp_path, file->path) != 0) {
+        remove(tmp_path);
+        free(tmp_path);
+        return -1;
+    }
+
+    free(tmp_path);
+
+    return 0;
+}
+
+/*
+ * A date_line_callback that writes the lines for the dates missing
+ * before a line.
+ */
+int fill_gap_before(struct date_line* line, void* data) {
+    struct skeleton_filler* filler = data;
+    if (line->date_key < filler->next_key) return 0;
+
+    fwrite(filler->text + filler->copied, 1, line->offset - filler->copied, filler->out);
+    filler->copied = line->offset;
+
+    write_skeleton(filler->out, filler->next_key, prev_date_key(line->date_key));
+    filler->next_key = next_date_key(line->date_key);
+
+    return 0;
+}
+
+int is_leap_year(int year) {
+    return (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+}
+
+int days_in_month(int year, int month) {
+    static const int month_days[12] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+
+    if (month == 2 && is_leap_year(year)) return 29;
+    return month_days[month - 1];
+}
+
+int next_date_key(int date_key) {
+    int year = date_key / 10000;
+    int month = date_key / 100 % 100;
+    int day = date_key % 100 + 1;
+
+    if (day > days_in_month(year, month)) {
+        day = 1;
+        month++;
+    }
+    if (month > 12) {
+        month = 1;
+        year++;
+    }
+
+    return DATE_KEY(year, month, day);
+}
+
+int prev_date_key(int date_key) {
+    int year = date_key / 10000;
+    int month = date_key / 100 % 100;
+    int day = date_key % 100 - 1;
+
+    if (day < 1) {
+        month--;
+        if (month < 1) {
+            month = 12;
+            year--;
+        }
+        day = days_in_month(year, month);
+    }
+
+    return DATE_KEY(year, month, day);
+}
+
+/*
+ * Returns 1 for Monday through 7 for Sunday (Sakamoto's method).
+ */
+int iso_weekday(int year, int month, int day) {
+    static const int offsets[12] = {0, 3, 2, 5, 0, 3, 5, 1, 4, 6, 2, 4};
+
+    if (month < 3) year--;
+    int wday = (year + year / 4 - year / 100 + year / 400 + offsets[month - 1] + day) % 7;
+
+    return wday == 0 ? 7 : wday;
+}
+
+/*
+ * A year has 53 ISO weeks if it starts on a Thursday, or on a Wednesday in a leap year.
+ */
+int iso_weeks_in_year(int year) {
+    int jan1 = iso_weekday(year, 1, 1);
+    return (jan1 == 4 || (jan1 == 3 && is_leap_year(year))) ? 53 : 52;
+}
+
+int day_of_year(int year, int month, int day) {
+    int ordinal = day;
+    for (int i = 1; i < month; i++) {
+        ordinal += days_in_month(year, i);
+    }
+    return ordinal;
+}
+
+/*
+ * Days since 1970-01-01 in the proleptic Gregorian calendar.
+ */
+long days_from_civil(int year, int month, int day) {
+    year -= month <= 2;
+    long era = (year >= 0 ? year : year - 399) / 400;
+    long year_of_era = year - era * 400;
+    long day_of_year = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    long day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+
+    return era * 146097 + day_of_era - 719468;
+}
+
+long days_from_date_key(int date_key) {
+    return days_from_civil(date_key / 10000, date_key / 100 % 100, date_key % 100);
+}
+
+int date_key_from_days(long days) {
+    days += 719468;
+    long era = (days >= 0 ? days : days - 146096) / 146097;
+    long day_of_era = days - era * 146097;
+    long year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 - day_of_era / 146096) / 365;
+    long day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+    long month_index = (5 * day_of_year + 2) / 153;
+
+    int day = day_of_year - (153 * month_index + 2) / 5 + 1;
+    int month = month_index < 10 ? month_index + 3 : month_index - 9;
+    int year = year_of_era + era * 400 + (month <= 2);
+
+    return DATE_KEY(year, month, day);
+}
+
+int weekday_from_days(long days) {
+    // 1970-01-01 was a Thursday
+    return (int)(((days + 3) % 7 + 7) % 7);
+}
+
+void put_digits(char* buffer, int value, int digits) {
+    for (int i = digits - 1; i >= 0; i--) {
+        buffer[i] = '0' + value % 10;
+        value /= 10;
+    }
+}
@@ -0,0 +1,50 @@
+#ifndef SKELETON_H
+#define SKELETON_H
+
+#include <stdio.h>
+#include "calendartxt.h"
+
+/*
+ * Writes an empty "yyyy-mm-dd Www wNN" line for every date from start to
+ * end inclusive (both DATE_KEYs). Returns the number of lines written or -1
+ * on a write error.
+ */
+long write_skeleton(FILE* out, int start_key, int end_key);
+
+/*
+ * Appends empty lines to the file up to the end of the year containing
+ * date_key if the file ends before it. Creates the file if it doesn't
+ * exist. Returns 0 on success, -1 on failure.
+ */
+int extend_calendar(struct calendar_file* file, int date_key);
+
+/*
+ * Makes sure the file has a line for every date from its first line (or
+ * date_key if that is earlier) through the end of date_key's year,
+ * rewriting it if dates are missing in the middle or at the start.
+ * Returns 0 on success, -1 on failure.
+ */
+int fill_calendar(struct calendar_file* file, int date_key);
+
+int is_leap_year(int year);
+int days_in_month(int year, int month);
+
+/*
+ * Converts between DATE_KEYs and days since 1970-01-01.
+ */
+long days_from_date_key(int date_key);
+int date_key_from_days(long days);
+
+/*
+ * Returns the weekday of a day since 1970-01-01, 0 for Monday through 6
+ * for Sunday.
+ */
+int weekday_from_days(long days);
+
+/*
+ * Returns the DATE_KEY of the day after/before the given one.
+ */
+int next_date_key(int date_key);
+int prev_date_key(int date_key);
+
+#endif
@@ -0,0 +1,823 @@
+/*
+ * sources.c
+ *
+ * This file keeps track of every calendar.txt file listed in the
+ * config file and presents them as a single calendar. Days are
+ * looked up in each file separately and merged at query time, so
+ * the files are never concatenated or rewritten as a whole. Edits
+ * only ever touch the file the event belongs to.
+ *
+ * Sources are listed in the config file with one line per file:
+ *
+ * calendar=work:~/work/calendar.txt
+ * calendar=~/.calendar/calendar.txt
+ *
+ * The name before the colon is optional. Without any calendar lines
+ * the default ~/.calendar/calendar.txt is used. Each calendar is read
+ * through the storage backend picked for it (see storage.c).
+ *
+ * Merged days are kept in a small LRU cache (cache_size in the config).
+ * A miss reads prefetch_window days either side of the day with one
+ * range read per calendar, since the TUI almost always asks for the
+ * neighbouring days next. The cache is dropped whenever a calendar's
+ * version changes, whether the write came from here or another program.
+ *
+ * Each calendar can also have a table of repeating events (see
+ * recurrence.c). Their occurrences are added to a calendar's days as
+ * they're read, so they show up in merged days and range reads like any
+ * other event, but are never written to the calendar itself.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sources.h"
+#include "skeleton.h"
+#include "storage.h"
+#include "config.h"
+#include "daemon.h"
+#include "recurrence.h"
+
+struct calendar_source {
+    char* name;
+    char* path;
+    struct storage storage;
+    struct recurrence_table recurrences;
+};
+
+struct cached_day {
+    int date_key;
+    struct events events;
+    unsigned long last_used;
+};
+
+/*
+ * A get_range_events call in progress.
+ */
+struct range_read {
+    int source;
+    day_callback callback;
+    void* data;
+    int next_key; // first day not passed to the callback yet
+    int end_key;
+};
+
+/*
+ * The days read by a prefetch, indexed by day and then source.
+ */
+struct prefetch {
+    long first_day;
+    long num_days;
+    int source;
+    struct events* days;
+};
+
+static struct calendar_source* sources = NULL;
+static int num_sources = 0;
+static int default_source = 0;
+
+// The config lines the sources were loaded from, to tell if a reload
+// changed them
+static char* sources_signature = NULL;
+
+static struct cached_day* day_cache = NULL;
+static int num_cached = 0;
+static unsigned long cache_clock = 0;
+static long long* cached_versions = NULL; // one per source, as of the cached reads
+static int cache_generation = -1;
+
+void load_sources();
+void close_sources();
+char* get_sources_signature(const Config* config);
+void add_source(char* entry, const char* backend);
+int open_source_storage(struct storage* storage, const struct storage_driver* driver, const char* path);
+char* expand_home(char* path);
+struct events read_merged_day(int year, int month, int day);
+struct events merge_events(struct events* per_source);
+bool check_day_cache();
+void clear_day_cache();
+struct cached_day* find_cached_day(int date_key);
+void cache_day(int date_key, struct events events);
+void prefetch_days(int date_key);
+int prefetch_day(int year, int month, int day, struct events* events, void* data);
+int tag_range_day(int year, int month, int day, struct events* events, void* data);
+int tag_source_day(int year, int month, int day, struct events* events, void* data);
+int pass_occurrence_days(struct range_read* range, int stop_key);
+void refresh_all_recurrences();
+struct recurrence_table* get_event_recurrences(struct event event);
+
+struct events get_events(int year, int month, int day) {
+    load_sources();
+    if (!check_day_cache()) return read_merged_day(year, month, day);
+
+    int date_key = DATE_KEY(year, month, day);
+    struct cached_day* cached = find_cached_day(date_key);
+
+    if (cached == NULL) {
+        prefetch_days(date_key);
+        cached = find_cached_day(date_key);
+
+        // The prefetch gives up if a calendar changes while it reads
+        if (cached == NULL) return read_merged_day(year, month, day);
+    }
+
+    cached->last_used = ++cache_clock;
+    return copy_events(cached->events);
+}
+
+int get_range_events(int start_key, int end_key, day_callback callback, void* data) {
+    load_sources();
+
+    refresh_all_recurrences();
+
+    struct range_read range = {0, callback, data, start_key, end_key};
+    int result = 0;
+
+    for (int i = 0; i < num_sources; i++) {
+        struct storage* storage = &sources[i].storage;
+
+        range.source = i;
+        range.next_key = start_key;
+        if (storage->driver->get_range(storage->handle, start_key, end_key, tag_range_day, &range) != 0) result = -1;
+
+        // Repeating events can fall after the last stored day
+        if (range.next_key <= end_key && result == 0) pass_occurrence_days(&range, next_date_key(end_key));
+    }
+
+    return result;
+}
+
+/*
+ * A day_callback that tags a source's events and adds its repeating
+ * events before passing them on.
+ */
+int tag_range_day(int year, int month, int day, struct events* events, void* data) {
+    struct range_read* range = data;
+    int date_key = DATE_KEY(year, month, day);
+
+    // Days the calendar doesn't store can still have repeating events
+    int result = pass_occurrence_days(range, date_key);
+    if (result != 0) return result;
+
+    for (size_t i = 0; i < events->length; i++) {
+        events->events[i].source = range->source;
+    }
+    add_occurrences(&sources[range->source].recurrences, date_key, range->source, events);
+    range->next_key = next_date_key(date_key);
+
+    return range->callback(year, month, day, events, range->data);
+}
+
+/*
+ * A day_callback that only tags a source's events before passing them on.
+ */
+int tag_source_day(int year, int month, int day, struct events* events, void* data) {
+    struct range_read* range = data;
+
+    for (size_t i = 0; i < events->length; i++) {
+        events->events[i].source = range->source;
+    }
+
+    return range->callback(year, month, day, events, range->data);
+}
+
+/*
+ * Passes the days from range->next_key up to stop_key that only have
+ * repeating events to the callback.
+ */
+int pass_occurrence_days(struct range_read* range, int stop_key) {
+    struct recurrence_table* recurrences = &sources[range->source].recurrences;
+    if (recurrences->length == 0) {
+        range->next_key = stop_key;
+        return 0;
+    }
+
+    for (; range->next_key < stop_key && range->next_key <= range->end_key; range->next_key = next_date_key(range->next_key)) {
+        int date_key = range->next_key;
+
+        struct events events;
+        init_events(&events);
+        if (add_occurrences(recurrences, date_key, range->source, &events) == 0) {
+            free_events(events);
+            continue;
+        }
+
+        int result = range->callback(date_key / 10000, date_key / 100 % 100, date_key % 100, &events, range->data);
+        free_events(events);
+
+        if (result != 0) {
+            range->next_key = next_date_key(date_key);
+            return result;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Reads a day from every source without going through the cache.
+ */
+struct events read_merged_day(int year, int month, int day) {
+    struct events* per_source = malloc(num_sources * sizeof(struct events));
+    refresh_all_recurrences();
+
+    for (int i = 0; i < num_sources; i++) {
+        per_source[i] = get_source_events(i, year, month, day);
+        add_occurrences(&sources[i].recurrences, DATE_KEY(year, month, day), i, &per_source[i]);
+    }
+
+    struct events events = merge_events(per_source);
+    free(per_source);
+
+    return events;
+}
+
+/*
+ * Merges one already sorted list per source into a single list. Takes
+ * ownership of the lists but not of the per_source array.
+ */
+struct events merge_events(struct events* per_source) {
+    if (num_sources == 1) return per_source[0];
+
+    size_t* heads = calloc(num_sources, sizeof(size_t));
+
+    struct events events;
+    init_events(&events);
+
+    // There are only ever a handful of sources, so picking the earliest
+    // head with a linear scan is cheaper than maintaining a heap. Ties go
+    // to the source listed first, which keeps the order stable.
+    while (true) {
+        int earliest = -1;
+        for (int i = 0; i < num_sources; i++) {
+            if (heads[i] == per_source[i].length) continue;
+
+            struct event head = per_source[i].events[heads[i]];
+            if (
+                earliest == -1 ||
+                time_cmp(head.hour, head.min,
+                    per_source[earliest].events[heads[earliest]].hour,
+                    per_source[earliest].events[heads[earliest]].min) < 0
+            ) {
+                earliest = i;
+            }
+        }
+
+        if (earliest == -1) break;
+
+        append_event(&events, per_source[earliest].events[heads[earliest]]);
+        heads[earliest]++;
+    }
+
+    // The summaries now belong to the merged list
+    for (int i = 0; i < num_sources; i++) {
+        free(per_source[i].events);
+    }
+    free(heads);
+
+    return events;
+}
+
+int add_event(struct event event, int year, int month, int day) {
+    load_sources();
+    if (event.source < 0 || event.source >= num_sources) return -1;
+
+    event.year = year;
+    event.month = month;
+    event.day = day;
+    clear_day_cache();
+
+    struct storage* storage = &sources[event.source].storage;
+    return storage->driver->add(storage->handle, event);
+}
+
+int delete_event(struct event event) {
+    load_sources();
+    if (event.source < 0 || event.source >= num_sources) return -1;
+    clear_day_cache();
+
+    struct storage* storage = &sources[event.source].storage;
+    return storage->driver->delete(storage->handle, event);
+}
+
+struct events get_source_events(int source, int year, int month, int day) {
+    load_sources();
+
+    struct events events;
+    if (source < 0 || source >= num_sources) {
+        init_events(&events);
+        return events;
+    }
+
+    struct storage* storage = &sources[source].storage;
+    events = storage->driver->get_day(storage->handle, year, month, day);
+    for (size_t i = 0; i < events.length; i++) {
+        events.events[i].source = source;
+    }
+
+    return events;
+}
+
+int get_source_range(int source, int start_key, int end_key, day_callback callback, void* data) {
+    load_sources();
+    if (source < 0 || source >= num_sources) return -1;
+
+    struct range_read range = {source, callback, data, start_key, end_key};
+    struct storage* storage = &sources[source].storage;
+
+    return storage->driver->get_range(storage->handle, start_key, end_key, tag_source_day, &range);
+}
+
+struct recurrence_table* get_source_recurrences(int source) {
+    load_sources();
+    if (source < 0 || source >= num_sources) return NULL;
+
+    refresh_recurrences(&sources[source].recurrences);
+    return &sources[source].recurrences;
+}
+
+int set_source_events(int source, struct events events, struct events* base, int year, int month, int day) {
+    load_sources();
+    if (source < 0 || source >= num_sources) return -1;
+    clear_day_cache();
+
+    struct storage* storage = &sources[source].storage;
+    struct day_update update = {year, month, day, events, base};
+
+    return storage->driver->batch(storage->handle, &update, 1);
+}
+
+int set_source_days(int source, struct day_update* updates, size_t count) {
+    load_sources();
+    if (source < 0 || source >= num_sources) return -1;
+    clear_day_cache();
+
+    struct storage* storage = &sources[source].storage;
+    return storage->driver->batch(storage->handle, updates, count);
+}
+
+void replace_source_events(struct events* merged, int source, struct events events) {
+    struct events result;
+    init_events(&result);
+
+    size_t head = 0;
+    for (size_t i = 0; i < merged->length; i++) {
+        struct event event = merged->events[i];
+
+        // Occurrences of repeating events aren't stored on the day, so
+        // they stay
+        if (event.source == source && event.recurrence == 0) {
+            free(event.summary);
+            continue;
+        }
+
+        // Same tie breaking as get_events: earlier sources go first
+        while (
+            head < events.length &&
+            (time_cmp(events.events[head].hour, events.events[head].min, event.hour, event.min) < 0 ||
+            (time_cmp(events.events[head].hour, events.events[head].min, event.hour, event.min) == 0 &&
+                source < event.source))
+        ) {
+            append_event(&result, events.events[head]);
+            head++;
+        }
+        append_event(&result, event);
+    }
+
+    while (head < events.length) {
+        append_event(&result, events.events[head]);
+        head++;
+    }
+
+    free(merged->events);
+    free(events.events);
+    *merged = result;
+}
+
+int fill_sources(int year) {
+    load_sources();
+
+    int result = 0;
+    for (int i = 0; i < num_sources; i++) {
+        // Only calendar.txt needs a line for every date
+        struct storage* storage = &sources[i].storage;
+        if (storage->driver->fill == NULL) continue;
+
+        if (storage->driver->fill(storage->handle, DATE_KEY(year, 12, 31)) != 0) result = -1;
+    }
+
+    return result;
+}
+
+int get_num_sources() {
+    load_sources();
+    return num_sources;
+}
+
+const char* get_source_name(int source) {
+    load_sources();
+    if (source < 0 || source >= num_sources) return NULL;
+
+    return sources[source].name;
+}
+
+const char* get_source_path(int source) {
+    load_sources();
+    if (source < 0 || source >= num_sources) return NULL;
+
+    return sources[source].path;
+}
+
+const char* get_source_file(int source) {
+    load_sources();
+    if (source < 0 || source >= num_sources) return NULL;
+
+    struct storage* storage = &sources[source].storage;
+    if (storage->driver->get_file == NULL) return NULL;
+
+    return storage->driver->get_file(storage->handle);
+}
+
+int find_source(const char* name) {
+    load_sources();
+
+    for (int i = 0; i < num_sources; i++) {
+        if (strcmp(sources[i].name, name) == 0) return i;
+    }
+
+    return -1;
+}
+
+int get_default_source() {
+    load_sources();
+    return default_source;
+}
+
+bool reload_sources() {
+    if (sources == NULL) return false;
+
+    char* signature = get_sources_signature(get_config());
+    bool changed = strcmp(signature, sources_signature) != 0;
+    free(signature);
+
+    if (!changed) return false;
+
+    close_sources();
+    load_sources();
+
+    return true;
+}
+
+/*
+ * Reads the list of calendars from the config the first time it's called.
+ */
+void load_sources() {
+    if (sources != NULL) return;
+
+    const Config* config = get_config();
+    sources_signature = get_sources_signature(config);
+
+    for (int i = 0; i < config->num_calendars; i++) {
+        add_source(config->calendars[i], config->storage);
+    }
+
+    if (num_sources == 0) {
+        char* home = getenv("HOME");
+        if (home == NULL) exit(1);
+
+        bool binary = get_storage_driver(config->storage) == &binary_driver;
+        char* default_path = binary ? DEFAULT_CALENDAR_BIN : DEFAULT_CALENDAR_TXT;
+
+        int length = strlen(home) + strlen(default_path) + 1;
+        char* path = malloc(sizeof(char) * length);
+        snprintf(path, length, "%s%s", home, default_path);
+
+        sources = malloc(sizeof(struct calendar_source));
+        sources[0].name = strdup("calendar");
+        sources[0].path = path;
+        if (open_source_storage(&sources[0].storage, get_storage_driver_for_path(path, config->storage), path) != 0) {
+            exit(1);
+        }
+        open_recurrences(&sources[0].recurrences, path);
+        num_sources = 1;
+    }
+
+    if (config->default_calendar != NULL) {
+        for (int i = 0; i < num_sources; i++) {
+            if (strcmp(sources[i].name, config->default_calendar) == 0) {
+                default_source = i;
+            }
+        }
+    }
+
+    cached_versions = calloc(num_sources, sizeof(long long));
+}
+
+void close_sources() {
+    clear_day_cache();
+
+    for (int i = 0; i < num_sources; i++) {
+        close_storage(&sources[i].storage);
+        close_recurrences(&sources[i].recurrences);
+        free(sources[i].name);
+        free(sources[i].path);
+    }
+
+    free(sources);
+    free(sources_signature);
+    free(cached_versions);
+    sources = NULL;
+    sources_signature = NULL;
+    cached_versions = NULL;
+    num_sources = 0;
+    default_source = 0;
+}
+
+/*
+ * Joins the config values that decide which calendars are open.
+ */
+char* get_sources_signature(const Config* config) {
+    const char* storage = config->storage != NULL ? config->storage : "";
+    const char* default_calendar = config->default_calendar != NULL ? config->default_calendar : "";
+
+    size_t length = strlen(storage) + strlen(default_calendar) + 3;
+    for (int i = 0; i < config->num_calendars; i++) {
+        length += strlen(config->calendars[i]) + 1;
+    }
+
+    char* signature = malloc(sizeof(char) * length);
+    size_t offset = snprintf(signature, length, "%s\n%s\n", storage, default_calendar);
+    for (int i = 0; i < config->num_calendars; i++) {
+        offset += snprintf(signature + offset, length - offset, "%s\n", config->calendars[i]);
+    }
+
+    return signature;
+}
+
+/*
+ * Adds a source from a config entry of the form "name:path" or "path".
+ */
+void add_source(char* entry, const char* backend) {
+    char* name = NULL;
+    char* path = entry;
+
+    char* colon = strchr(entry, ':');
+    if (colon != NULL && colon != entry && memchr(entry, '/', colon - entry) == NULL) {
+        name = strndup(entry, colon - entry);
+        path = colon + 1;
+    }
+
+    char* full_path = expand_home(path);
+
+    if (name == NULL) {
+        // Fall back on the file name without its extension
+        char* base = strrchr(full_path, '/');
+        base = base == NULL ? full_path : base + 1;
+
+        char* dot = strrchr(base, '.');
+        name = dot == NULL || dot == base ? strdup(base) : strndup(base, dot - base);
+    }
+
+    sources = realloc(sources, (num_sources + 1) * sizeof(struct calendar_source));
+    sources[num_sources].name = name;
+    sources[num_sources].path = full_path;
+
+    const struct storage_driver* driver = get_storage_driver_for_path(full_path, backend);
+    if (open_source_storage(&sources[num_sources].storage, driver, full_path) != 0) {
+        // Skip calendars that can't be opened rather than refusing to start
+        free(name);
+        free(full_path);
+        return;
+    }
+    open_recurrences(&sources[num_sources].recurrences, full_path);
+    num_sources++;
+}
+
+/*
+ * Opens a calendar through calenterd if it's running, so it's parsed once
+ * for every process, and otherwise reads the file directly.
+ */
+int open_source_storage(struct storage* storage, const struct storage_driver* driver, const char* path) {
+    if (open_daemon_storage(storage, driver, path) == 0) return 0;
+
+    return open_storage(storage, driver, path);
+}
+
+/*
+ * Returns a copy of path with a leading "~/" replaced by the home directory.
+ */
+char* expand_home(char* path) {
+    char* home = getenv("HOME");
+    if (strncmp(path, "~/", 2) != 0 || home == NULL) return strdup(path);
+
+    int length = strlen(home) + strlen(path);
+    char* expanded = malloc(sizeof(char) * length);
+    snprintf(expanded, length, "%s%s", home, path + 1);
+
+    return expanded;
+}
+
+/*
+ * Drops the cache if the config or any calendar changed since it was
+ * filled. Returns false if the cache is turned off.
+ */
+bool check_day_cache() {
+    if (cache_generation != get_config_generation()) {
+        // cache_size may have changed, so the array is reallocated on the next insert
+        clear_day_cache();
+        free(day_cache);
+        day_cache = NULL;
+        cache_generation = get_config_generation();
+    }
+
+    if (get_config()->cache_size <= 0) return false;
+
+    for (int i = 0; i < num_sources && num_cached > 0; i++) {
+        if (get_source_version(i) != cached_versions[i]) clear_day_cache();
+    }
+
+    return true;
+}
+
+void clear_day_cache() {
+    for (int i = 0; i < num_cached; i++) {
+        free_events(day_cache[i].events);
+    }
+    num_cached = 0;
+}
+
+struct cached_day* find_cached_day(int date_key) {
+    for (int i = 0; i < num_cached; i++) {
+        if (day_cache[i].date_key == date_key) return &day_cache[i];
+    }
+
+    return NULL;
+}
+
+/*
+ * Adds a merged day to the cache, evicting the least recently used day if
+ * it's full. Takes ownership of events.
+ */
+void cache_day(int date_key, struct events events) {
+    int cache_size = get_config()->cache_size;
+    if (day_cache == NULL) day_cache = malloc(cache_size * sizeof(struct cached_day));
+
+    struct cached_day* entry = find_cached_day(date_key);
+
+    if (entry != NULL) {
+        free_events(entry->events);
+    } else if (num_cached < cache_size) {
+        entry = &day_cache[num_cached++];
+    } else {
+        // The cache is small, so a scan is cheaper than keeping a list
+        entry = &day_cache[0];
+        for (int i = 1; i < num_cached; i++) {
+            if (day_cache[i].last_used < entry->last_used) entry = &day_cache[i];
+        }
+        free_events(entry->events);
+    }
+
+    entry->date_key = date_key;
+    entry->events = events;
+    entry->last_used = ++cache_clock;
+}
+
+/*
+ * Reads the days around date_key from every source and caches them. The
+ * day itself is cached last so it is the most recently used.
+ */
+void prefetch_days(int date_key) {
+    const Config* config = get_config();
+
+    int window = config->prefetch_window;
+    if (window * 2 + 1 > config->cache_size) window = (config->cache_size - 1) / 2;
+
+    long day_number = days_from_date_key(date_key);
+    struct prefetch prefetch = {day_number - window, window * 2 + 1, 0, NULL};
+    prefetch.days = malloc(prefetch.num_days * num_sources * sizeof(struct events));
+
+    for (long i = 0; i < prefetch.num_days * num_sources; i++) {
+        init_events(&prefetch.days[i]);
+    }
+
+    long long* versions = malloc(num_sources * sizeof(long long));
+    bool failed = false;
+
+    int start_key = date_key_from_days(prefetch.first_day);
+    int end_key = date_key_from_days(prefetch.first_day + prefetch.num_days - 1);
+
+    for (int i = 0; i < num_sources && !failed; i++) {
+        struct storage* storage = &sources[i].storage;
+
+        versions[i] = get_source_version(i);
+        prefetch.source = i;
+        failed = storage->driver->get_range(storage->handle, start_key, end_key, prefetch_day, &prefetch) != 0 ||
+            get_source_version(i) != versions[i];
+    }
+
+    if (!failed) {
+        refresh_all_recurrences();
+        for (long i = 0; i < prefetch.num_days * num_sources; i++) {
+            int day_key = date_key_from_days(prefetch.first_day + i / num_sources);
+            add_occurrences(&sources[i % num_sources].recurrences, day_key, i % num_sources, &prefetch.days[i]);
+        }
+
+        if (num_cached > 0 && memcmp(versions, cached_versions, num_sources * sizeof(long long)) != 0) {
+            clear_day_cache();
+        }
+        memcpy(cached_versions, versions, num_sources * sizeof(long long));
+
+        for (long i = 0; i < prefetch.num_days; i++) {
+            if (i == window) continue;
+            cache_day(date_key_from_days(prefetch.first_day + i), merge_events(&prefetch.days[i * num_sources]));
+        }
+        cache_day(date_key, merge_events(&prefetch.days[window * num_sources]));
+    } else {
+        for (long i = 0; i < prefetch.num_days * num_sources; i++) {
+            free_events(prefetch.days[i]);
+        }
+    }
+
+    free(prefetch.days);
+    free(versions);
+}
+
+/*
+ * A day_callback that moves a source's day into the prefetch buffer.
+ */
+int prefetch_day(int year, int month, int day, struct events* events, void* data) {
+    struct prefetch* prefetch = data;
+
+    long index = days_from_date_key(DATE_KEY(year, month, day)) - prefetch->first_day;
+    if (index < 0 || index >= prefetch->num_days) return 0;
+
+    for (size_t i = 0; i < events->length; i++) {
+        events->events[i].source = prefetch->source;
+    }
+
+    struct events* slot = &prefetch->days[index * num_sources + prefetch->source];
+    free_events(*slot);
+    *slot = *events;
+
+    // The caller frees what's left in events once this returns
+    init_events(events);
+
+    return 0;
+}
+
+long long get_source_version(int source) {
+    load_sources();
+    if (source < 0 || source >= num_sources) return 0;
+
+    struct storage* storage = &sources[source].storage;
+
+    // A change to the repeating events changes the calendar's days too
+    return storage->driver->get_version(storage->handle) ^ (get_recurrences_version(&sources[source].recurrences) * 31);
+}
+
+void refresh_all_recurrences() {
+    for (int i = 0; i < num_sources; i++) {
+        refresh_recurrences(&sources[i].recurrences);
+    }
+}
+
+/*
+ * Returns the table of the calendar the event belongs to, or NULL.
+ */
+struct recurrence_table* get_event_recurrences(struct event event) {
+    load_sources();
+    if (event.source < 0 || event.source >= num_sources) return NULL;
+
+    clear_day_cache();
+    return &sources[event.source].recurrences;
+}
+
+int add_repeating_event(struct event event, enum repeat_freq freq) {
+    struct recurrence_table* recurrences = get_event_recurrences(event);
+    if (recurrences == NULL) return -1;
+
+    return add_recurrence(recurrences, event, freq, 1) < 0 ? -1 : 0;
+}
+
+int delete_repeating_event(struct event event) {
+    struct recurrence_table* recurrences = get_event_recurrences(event);
+    if (recurrences == NULL) return -1;
+
+    return delete_recurrence(recurrences, event.recurrence);
+}
+
+int delete_occurrence(struct event event) {
+    struct recurrence_table* recurrences = get_event_recurrences(event);
+    if (recurrences == NULL) return -1;
+
+    return skip_occurrence(recurrences, event.recurrence, DATE_KEY(event.year, event.month, event.day));
+}
+
+int edit_occurrence_event(struct event old_event, struct event new_event) {
+    struct recurrence_table* recurrences = get_event_recurrences(old_event);
+    if (recurrences == NULL) return -1;
+
+    int date_key = DATE_KEY(old_event.year, old_event.month, old_event.day);
+    return edit_occurrence(recurrences, old_event.recurrence, date_key, new_event);
+}
@@ -0,0 +1,146 @@
+#ifndef SOURCES_H
+#define SOURCES_H
+
+#include <stdbool.h>
+#include "calendartxt.h"
+#include "recurrence.h"
+
+#define DEFAULT_CALENDAR_TXT "/.calendar/calendar.txt"
+#define DEFAULT_CALENDAR_BIN "/.calendar/calendar.bin"
+
+/*
+ * Gets the events for a given day from every calendar listed in the config.
+ * Each source's list is already sorted, so they are k-way merged into one
+ * chronological list. Every event is tagged with the index of its source.
+ */
+struct events get_events(int year, int month, int day);
+
+/*
+ * Calls callback for every stored day from start_key to end_key inclusive
+ * in each calendar in turn, with the events tagged with their source.
+ * Returns 0 on success, -1 if any calendar couldn't be read.
+ */
+int get_range_events(int start_key, int end_key, day_callback callback, void* data);
+
+/*
+ * Writes the event to the calendar given by event.source. Returns 0 on success, -1 on failure.
+ */
+int add_event(struct event event, int year, int month, int day);
+
+/*
+ * Deletes an event from the calendar given by event.source. Returns 0 on success, -1 on failure.
+ */
+int delete_event(struct event event);
+
+/*
+ * Adds a repeating event to the calendar given by event.source, starting
+ * on the event's date. Returns 0 on success, -1 on failure.
+ */
+int add_repeating_event(struct event event, enum repeat_freq freq);
+
+/*
+ * Deletes the repeating event an occurrence belongs to, with every other
+ * occurrence. Returns 0 on success, -1 on failure.
+ */
+int delete_repeating_event(struct event event);
+
+/*
+ * Deletes or replaces a single occurrence of a repeating event, leaving
+ * the others alone. Returns 0 on success, -1 on failure.
+ */
+int delete_occurrence(struct event event);
+int edit_occurrence_event(struct event old_event, struct event new_event);
+
+/*
+ * Gets the events for a given day from a single calendar, tagged with the
+ * source. Repeating events aren't included since they aren't stored on
+ * the day.
+ */
+struct events get_source_events(int source, int year, int month, int day);
+
+/*
+ * Calls callback for every stored day from start_key to end_key in a
+ * single calendar, tagged with the source. Like get_source_events, this
+ * leaves out repeating events. Returns 0 on success, -1 on failure.
+ */
+int get_source_range(int source, int start_key, int end_key, day_callback callback, void* data);
+
+/*
+ * Returns the repeating events of a single calendar, read again if their
+ * file changed, or NULL if source is out of range.
+ */
+struct recurrence_table* get_source_recurrences(int source);
+
+/*
+ * Replaces a day in a single calendar. base is the day the events were
+ * made from, or NULL (see struct day_update). Nothing is freed. Returns
+ * 0 on success, -1 on failure.
+ */
+int set_source_events(int source, struct events events, struct events* base, int year, int month, int day);
+
+/*
+ * Replaces many days in a single calendar in one write. The updates are
+ * not freed. Returns 0 on success, -1 on failure.
+ */
+int set_source_days(int source, struct day_update* updates, size_t count);
+
+/*
+ * Swaps the events one source stores on an already merged day for the
+ * given events without touching the disk, keeping the occurrences of its
+ * repeating events. Takes ownership of events.
+ */
+void replace_source_events(struct events* merged, int source, struct events events);
+
+/*
+ * Adds a line for every missing date in every calendar, from its first
+ * date through the end of the given year. Returns 0 on success, -1 if any
+ * calendar couldn't be filled.
+ */
+int fill_sources(int year);
+
+/*
+ * Returns the number of calendars. There is always at least one.
+ */
+int get_num_sources();
+
+/*
+ * Returns the display name of a calendar or NULL if source is out of range.
+ */
+const char* get_source_name(int source);
+
+/*
+ * Returns the path a calendar was opened from, whatever its backend, or
+ * NULL if source is out of range.
+ */
+const char* get_source_path(int source);
+
+/*
+ * Returns the path of a calendar stored as calendar.txt, or NULL if it
+ * uses another backend or source is out of range.
+ */
+const char* get_source_file(int source);
+
+/*
+ * Returns a value that changes whenever a calendar or its repeating
+ * events change on disk, or 0 if source is out of range.
+ */
+long long get_source_version(int source);
+
+/*
+ * Returns the index of the calendar with the given name or -1.
+ */
+int find_source(const char* name);
+
+/*
+ * Returns the index of the calendar new events are written to.
+ */
+int get_default_source();
+
+/*
+ * Reopens the calendars if the calendar list, default calendar or storage
+ * backend changed in the config since they were loaded. Source indexes
+ * held by callers are invalid after a reload. Returns true if it reloaded.
+ */
+bool reload_sources();
+
+#endif
@@ -0,0 +1,338 @@
+/*
+ * stats.c
+ *
+ * Counts a calendar's events by weekday, hour of the week and year for
+ * `calenter stats`. A calendar.txt file is mapped and cut into chunks at
+ * line breaks (see chunks.c), so every chunk holds whole days. Each
+ * thread takes the next chunk, parses its events with parse_event and
+ * counts them into its own calendar_stats, and the threads' stats are
+ * summed once they've all finished, so no counter is ever shared.
+ *
+ * Repeating events aren't in the file. Their occurrences are counted
+ * afterwards on the calling thread, for every day from the first stored
+ * day to the last.
+ */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "stats.h"
+#include "chunks.h"
+#include "recurrence.h"
+#include "scanner.h"
+#include "skeleton.h"
+#include "sources.h"
+
+#define MIN_STATS_CHUNK (1 << 16)
+
+// The widest bar in the weekday chart
+#define STATS_BAR_WIDTH 40
+
+static const char* weekday_names[7] = {"Mon", "Tue", "Wed", "Thu", "Fri", "Sat", "Sun"};
+
+// Heatmap cells from none to the busiest hour
+static const char heat_ramp[] = " .:-=+*#%@";
+
+/*
+ * A thread and the stats it has counted so far.
+ */
+struct stats_worker {
+    struct chunk_queue* queue;
+    struct calendar_stats stats;
+
+    // parse_event needs its own copy of each event to end it
+    char* buffer;
+    size_t buffer_size;
+};
+
+void* count_chunks(void* data);
+int count_line(struct date_line* line, void* data);
+int count_day(int year, int month, int day, struct events* events, void* data);
+void count_occurrences(struct recurrence_table* table, int source, struct calendar_stats* stats);
+void record_day(struct calendar_stats* stats, int date_key);
+void count_event(struct calendar_stats* stats, int date_key, int weekday, struct event* event);
+void add_stats(struct calendar_stats* total, struct calendar_stats* part);
+
+int collect_stats(int source, int num_threads, struct calendar_stats* stats) {
+    memset(stats, 0, sizeof(struct calendar_stats));
+
+    const char* path = get_source_file(source);
+    int result;
+    if (path != NULL) {
+        result = collect_file_stats(path, num_threads, stats);
+    } else {
+        result = get_source_range(source, 0, DATE_KEY(9999, 12, 31), count_day, stats);
+    }
+    if (result != 0) return -1;
+
+    count_occurrences(get_source_recurrences(source), source, stats);
+
+    return 0;
+}
+
+int collect_file_stats(const char* path, int num_threads, struct calendar_stats* stats) {
+    num_threads = get_num_threads(num_threads, MAX_STATS_THREADS);
+
+    struct file_block block;
+    if (open_file_block(path, &block) != 0) return -1;
+
+    size_t length = block.length;
+    if (length == 0) {
+        close_file_block(&block);
+        return 0;
+    }
+
+    struct chunk_queue queue;
+    init_chunk_queue(&queue, block.data, length, num_threads, MIN_STATS_CHUNK, find_line_start);
+
+    // Small files don't have a chunk for every thread
+    if (num_threads > (int)queue.num_chunks) num_threads = queue.num_chunks;
+
+    struct stats_worker* workers = calloc(num_threads, sizeof(struct stats_worker));
+    pthread_t threads[MAX_STATS_THREADS];
+    bool started[MAX_STATS_THREADS] = {false};
+
+    // The calling thread is the first worker, so one thread starts none
+    for (int i = 0; i < num_threads; i++) {
+        workers[i].queue = &queue;
+        if (i > 0) started[i] = pthread_create(&threads[i], NULL, count_chunks, &workers[i]) == 0;
+    }
+    count_chunks(&workers[0]);
+
+    for (int i = 0; i < num_threads; i++) {
+        if (started[i]) pthread_join(threads[i], NULL);
+        add_stats(stats, &workers[i].stats);
+        free(workers[i].buffer);
+    }
+
+    free(workers);
+    free_chunk_queue(&queue);
+    close_file_block(&block);
+
+    return 0;
+}
+
+/*
+ * The body of a counting thread: counts chunks until there are none left.
+ */
+void* count_chunks(void* data) {
+    struct stats_worker* worker = data;
+    struct chunk_queue* queue = worker->queue;
+
+    struct text_chunk* chunk;
+    while ((chunk = take_chunk(queue)) != NULL) {
+        scan_date_text(chunk->start, chunk->length, chunk->start - queue->text, count_line, worker);
+    }
+
+    return NULL;
+}
+
+/*
+ * A date_line_callback that counts a day and its events for a worker.
+ */
+int count_line(struct date_line* line, void* data) {
+    struct stats_worker* worker = data;
+    struct calendar_stats* stats = &worker->stats;
+
+    record_day(stats, line->date_key);
+
+    // The events start after "yyyy-mm-dd Www wNN  ", as in read_day
+    if (line->length <= 20) return 0;
+
+    size_t events_length = line->length - 20;
+    if (events_length + 1 > worker->buffer_size) {
+        worker->buffer_size = events_length + 1;
+        worker->buffer = realloc(worker->buffer, worker->buffer_size);
+    }
+    memcpy(worker->buffer, line->text + 20, events_length);
+    worker->buffer[events_length] = '\0';
+
+    int weekday = weekday_from_days(days_from_date_key(line->date_key));
+    char* saveptr;
+    for (char* token = strtok_r(worker->buffer, ",", &saveptr); token != NULL; token = strtok_r(NULL, ",", &saveptr)) {
+        struct event event = parse_event(token);
+        count_event(stats, line->date_key, weekday, &event);
+        free(event.summary);
+    }
+
+    return 0;
+}
+
+/*
+ * A day_callback that counts a day read from a backend other than
+ * calendar.txt.
+ */
+int count_day(int year, int month, int day, struct events* events, void* data) {
+    struct calendar_stats* stats = data;
+    int date_key = DATE_KEY(year, month, day);
+    int weekday = weekday_from_days(days_from_date_key(date_key));
+
+    record_day(stats, date_key);
+    for (size_t i = 0; i < events->length; i++) {
+        count_event(stats, date_key, weekday, &events->events[i]);
+    }
+
+    return 0;
+}
+
+void count_occurrences(struct recurrence_table* table, int source, struct calendar_stats* stats) {
+    if (table == NULL || table->length == 0 || stats->first_key == 0) return;
+
+    for (int date_key = stats->first_key; date_key <= stats->last_key; date_key = next_date_key(date_key)) {
+        struct events events;
+        init_events(&events);
+
+        if (add_occurrences(table, date_key, source, &events) > 0) {
+            int weekday = weekday_from_days(days_from_date_key(date_key));
+            for (size_t i = 0; i < events.length; i++) {
+                count_event(stats, date_key, weekday, &events.events[i]);
+            }
+        }
+
+        free_events(events);
+    }
+}
+
+void record_day(struct calendar_stats* stats, int date_key) {
+    stats->days++;
+    if (stats->first_key == 0 || date_key < stats->first_key) stats->first_key = date_key;
+    if (date_key > stats->last_key) stats->last_key = date_key;
+}
+
+void count_event(struct calendar_stats* stats, int date_key, int weekday, struct event* event) {
+    int year = date_key / 10000 - STATS_FIRST_YEAR;
+    bool in_table = year >= 0 && year < STATS_NUM_YEARS;
+
+    stats->events++;
+    stats->weekdays[weekday]++;
+    if (in_table) stats->year_events[year]++;
+
+    if (event->hour < 0) {
+        stats->all_day++;
+        return;
+    }
+
+    if (in_table) stats->year_minutes[year] += event->duration;
+
+    // Events that run past midnight carry on into the next weekday
+    int first_hour = event->hour;
+    int last_hour = event->duration > 0 ? (event->hour * 60 + event->min + event->duration - 1) / 60 : first_hour;
+    for (int hour = first_hour; hour <= last_hour; hour++) {
+        stats->busy[(weekday + hour / 24) % 7][hour % 24]++;
+    }
+}
+
+void add_stats(struct calendar_stats* total, struct calendar_stats* part) {
+    if (part->days == 0) return;
+
+    total->days += part->days;
+    if (total->first_key == 0 || part->first_key < total->first_key) total->first_key = part->first_key;
+    if (part->last_key > total->last_key) total->last_key = part->last_key;
+
+    total->events += part->events;
+    total->all_day += part->all_day;
+
+    for (int day = 0; day < 7; day++) {
+        total->weekdays[day] += part->weekdays[day];
+        for (int hour = 0; hour < 24; hour++) {
+            total->busy[day][hour] += part->busy[day][hour];
+        }
+    }
+
+    for (int year = 0; year < STATS_NUM_YEARS; year++) {
+        total->year_events[year] += part->year_events[year];
+        total->year_minutes[year] += part->year_minutes[year];
+    }
+}
+
+void print_stats(FILE* out, const char* calendar, struct calendar_stats* stats) {
+    if (stats->days == 0) {
+        fprintf(out, "%s doesn't have any days\n", calendar);
+        return;
+    }
+
+    char first[11], last[11];
+    format_calendartxt_date(first, stats->first_key / 10000, stats->first_key / 100 % 100, stats->first_key % 100);
+    format_calendartxt_date(last, stats->last_key / 10000, stats->last_key / 100 % 100, stats->last_key % 100);
+    fprintf(out, "%s: %ld events (%ld all day) on %ld days from %s to %s\n",
+        calendar, stats->events, stats->all_day, stats->days, first, last);
+
+    long most = 1;
+    for (int day = 0; day < 7; day++) {
+        if (stats->weekdays[day] > most) most = stats->weekdays[day];
+    }
+
+    fprintf(out, "\nEvents per weekday\n");
+    char bar[STATS_BAR_WIDTH + 1];
+    memset(bar, '#', STATS_BAR_WIDTH);
+    bar[STATS_BAR_WIDTH] = '\0';
+    for (int day = 0; day < 7; day++) {
+        int width = stats->weekdays[day] * STATS_BAR_WIDTH / most;
+        fprintf(out, "  %s %9ld  %.*s\n", weekday_names[day], stats->weekdays[day], width, bar);
+    }
+
+    long busiest = 1;
+    for (int day = 0; day < 7; day++) {
+        for (int hour = 0; hour < 24; hour++) {
+            if (stats->busy[day][hour] > busiest) busiest = stats->busy[day][hour];
+        }
+    }
+
+    // Any hour with an event gets at least the first mark
+    int levels = sizeof(heat_ramp) - 2;
+    fprintf(out, "\nBusy hours (timed events in progress, '%c' is %ld)\n     ", heat_ramp[levels], busiest);
+    for (int hour = 0; hour < 24; hour++) {
+        fprintf(out, " %02d", hour);
+    }
+    fprintf(out, "\n");
+    for (int day = 0; day < 7; day++) {
+        fprintf(out, "  %s", weekday_names[day]);
+        for (int hour = 0; hour < 24; hour++) {
+            long busy = stats->busy[day][hour];
+            int level = busy == 0 ? 0 : 1 + (busy * levels - 1) / busiest;
+            fprintf(out, "  %c", heat_ramp[level]);
+        }
+        fprintf(out, "\n");
+    }
+
+    int first_year = stats->first_key / 10000 - STATS_FIRST_YEAR;
+    int last_year = stats->last_key / 10000 - STATS_FIRST_YEAR;
+    if (first_year < 0) first_year = 0;
+    if (last_year >= STATS_NUM_YEARS) last_year = STATS_NUM_YEARS - 1;
+
+    fprintf(out, "\nYear over year\n  %4s %9s %11s %8s\n", "year", "events", "busy hours", "change");
+    for (int year = first_year; year <= last_year; year++) {
+        fprintf(out, "  %4d %9ld %11.1f", STATS_FIRST_YEAR + year, stats->year_events[year], stats->year_minutes[year] / 60.0);
+
+        long previous = year > first_year ? stats->year_events[year - 1] : 0;
+        if (previous > 0) {
+            fprintf(out, " %+7.1f%%", (stats->year_events[year] - previous) * 100.0 / previous);
+        }
+        fprintf(out, "\n");
+    }
+}
+
+void print_stats_csv(FILE* out, struct calendar_stats* stats) {
+    fprintf(out, "weekday,events\n");
+    for (int day = 0; day < 7; day++) {
+        fprintf(out, "%s,%ld\n", weekday_names[day], stats->weekdays[day]);
+    }
+
+    fprintf(out, "\nweekday,hour,busy\n");
+    for (int day = 0; day < 7; day++) {
+        for (int hour = 0; hour < 24; hour++) {
+            fprintf(out, "%s,%d,%ld\n", weekday_names[day], hour, stats->busy[day][hour]);
+        }
+    }
+
+    fprintf(out, "\nyear,events,busy_hours\n");
+    if (stats->days == 0) return;
+
+    for (int year = stats->first_key / 10000; year <= stats->last_key / 10000; year++) {
+        int index = year - STATS_FIRST_YEAR;
+        if (index < 0 || index >= STATS_NUM_YEARS) continue;
+
+        fprintf(out, "%d,%ld,%.1f\n", year, stats->year_events[index], stats->year_minutes[index] / 60.0);
+    }
+}
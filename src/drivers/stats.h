@@ -0,0 +1,55 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include "calendartxt.h"
+
+#define MAX_STATS_THREADS 8
+
+// Events outside these years are counted in the totals only
+#define STATS_FIRST_YEAR 1900
+#define STATS_NUM_YEARS 400
+
+/*
+ * What a calendar's events add up to. Weekdays run from Monday (0) to
+ * Sunday (6).
+ */
+struct calendar_stats {
+    long days; // stored days
+    int first_key; // first and last stored day, 0 without any
+    int last_key;
+
+    long events;
+    long all_day;
+    long weekdays[7];
+
+    // How many timed events are in progress during each hour of the week.
+    // An event without an end time only counts towards its start.
+    long busy[7][24];
+
+    long year_events[STATS_NUM_YEARS];
+    long year_minutes[STATS_NUM_YEARS]; // from the events with an end time
+};
+
+/*
+ * Counts the events of a calendar, repeating ones included. A
+ * calendar.txt file is cut into chunks at line breaks that are parsed on
+ * num_threads threads (0 for one per core, up to MAX_STATS_THREADS), and
+ * other backends are read in one pass. Returns 0 on success, -1 if the
+ * calendar couldn't be read.
+ */
+int collect_stats(int source, int num_threads, struct calendar_stats* stats);
+
+/*
+ * The calendar.txt part of collect_stats, for the file at path. Stats
+ * are added to, so it should start zeroed.
+ */
+int collect_file_stats(const char* path, int num_threads, struct calendar_stats* stats);
+
+/*
+ * Prints the stats as a report, or as CSV tables separated by blank lines.
+ */
+void print_stats(FILE* out, const char* calendar, struct calendar_stats* stats);
+void print_stats_csv(FILE* out, struct calendar_stats* stats);
+
+#endif
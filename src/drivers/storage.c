@@ -0,0 +1,96 @@
+/*
+ * storage.c
+ *
+ * Picks and opens storage backends. Everything above this layer only
+ * talks to a `struct storage` and never to a file format directly.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "storage.h"
+
+#define BINARY_EXTENSION ".bin"
+
+struct copy_state {
+    struct day_update* updates;
+    size_t length;
+    size_t size;
+};
+
+int copy_day(int year, int month, int day, struct events* events, void* data);
+
+const struct storage_driver* get_storage_driver(const char* name) {
+    if (name == NULL || strcmp(name, calendartxt_driver.name) == 0) return &calendartxt_driver;
+    if (strcmp(name, binary_driver.name) == 0) return &binary_driver;
+
+    return NULL;
+}
+
+const struct storage_driver* get_storage_driver_for_path(const char* path, const char* fallback) {
+    size_t length = strlen(path);
+    size_t extension_length = strlen(BINARY_EXTENSION);
+
+    if (length > extension_length && strcmp(path + length - extension_length, BINARY_EXTENSION) == 0) {
+        return &binary_driver;
+    }
+
+    const struct storage_driver* driver = get_storage_driver(fallback);
+    return driver == NULL ? &calendartxt_driver : driver;
+}
+
+int open_storage(struct storage* storage, const struct storage_driver* driver, const char* path) {
+    storage->driver = driver;
+    storage->handle = driver->open(path);
+
+    return storage->handle == NULL ? -1 : 0;
+}
+
+void close_storage(struct storage* storage) {
+    if (storage->handle != NULL) {
+        storage->driver->close(storage->handle);
+    }
+
+    storage->handle = NULL;
+}
+
+long copy_storage(struct storage* from, struct storage* to) {
+    int first_key, last_key;
+    if (from->driver->get_bounds(from->handle, &first_key, &last_key) != 0) return 0;
+
+    struct copy_state state = {0};
+    if (from->driver->get_range(from->handle, first_key, last_key, copy_day, &state) != 0) {
+        for (size_t i = 0; i < state.length; i++) {
+            free_events(state.updates[i].events);
+        }
+        free(state.updates);
+        return -1;
+    }
+
+    int result = to->driver->batch(to->handle, state.updates, state.length);
+
+    for (size_t i = 0; i < state.length; i++) {
+        free_events(state.updates[i].events);
+    }
+    free(state.updates);
+
+    return result == 0 ? (long)state.length : -1;
+}
+
+/*
+ * Collects every day, including empty ones so the destination covers the
+ * same dates as the source.
+ */
+int copy_day(int year, int month, int day, struct events* events, void* data) {
+    struct copy_state* state = data;
+
+    if (state->length == state->size) {
+        state->size = state->size == 0 ? 1024 : state->size * 2;
+        state->updates = realloc(state->updates, state->size * sizeof(struct day_update));
+    }
+
+    struct day_update update = {year, month, day, copy_events(*events)};
+    state->updates[state->length] = update;
+    state->length++;
+
+    return 0;
+}
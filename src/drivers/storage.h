@@ -0,0 +1,81 @@
+#ifndef STORAGE_H
+#define STORAGE_H
+
+#include <stddef.h>
+#include "calendartxt.h"
+
+/*
+ * The operations every storage backend implements. `handle` is whatever
+ * the backend's open returned.
+ */
+struct storage_driver {
+  const char* name;
+
+  // Opens (creating if needed) the calendar at path. Returns NULL on failure.
+  void* (*open)(const char* path);
+  void (*close)(void* handle);
+
+  struct events (*get_day)(void* handle, int year, int month, int day);
+  int (*get_range)(void* handle, int start_key, int end_key, day_callback callback, void* data);
+
+  // Gets the first and last stored dates. Returns -1 if the calendar is empty.
+  int (*get_bounds)(void* handle, int* first_key, int* last_key);
+
+  int (*add)(void* handle, struct event event);
+  int (*delete)(void* handle, struct event event);
+
+  // Replaces every day in updates in one go. The updates are not freed.
+  int (*batch)(void* handle, struct day_update* updates, size_t count);
+
+  // Returns a value that changes whenever the calendar's files change,
+  // including when another program writes to them
+  long long (*get_version)(void* handle);
+
+  // Adds a line for every missing date through date_key, for formats that
+  // need one. NULL if the backend doesn't.
+  int (*fill)(void* handle, int date_key);
+
+  // Returns the calendar.txt the days can be read from directly, or NULL
+  // if they aren't stored as one
+  const char* (*get_file)(void* handle);
+
+  // Holds off every other writer, in any process, until unlock. Calls nest,
+  // and writes made while holding it take it again. NULL if the backend
+  // can't be locked by its callers.
+  int (*lock)(void* handle);
+  void (*unlock)(void* handle);
+};
+
+struct storage {
+  const struct storage_driver* driver;
+  void* handle;
+};
+
+extern const struct storage_driver calendartxt_driver;
+extern const struct storage_driver binary_driver;
+extern const struct storage_driver daemon_driver;
+
+/*
+ * Returns the driver with the given name ("txt" or "binary") or NULL.
+ */
+const struct storage_driver* get_storage_driver(const char* name);
+
+/*
+ * Picks the driver for a path: files ending in .bin use the binary
+ * backend, everything else uses fallback (or calendar.txt if NULL).
+ */
+const struct storage_driver* get_storage_driver_for_path(const char* path, const char* fallback);
+
+/*
+ * Opens path with the given driver. Returns 0 on success, -1 on failure.
+ */
+int open_storage(struct storage* storage, const struct storage_driver* driver, const char* path);
+void close_storage(struct storage* storage);
+
+/*
+ * Copies every day from one storage into another. Returns the number of
+ * days copied or -1 on failure.
+ */
+long copy_storage(struct storage* from, struct storage* to);
+
+#endif
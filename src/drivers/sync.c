@@ -1,51 +1,240 @@
 /*
  * sync.c
  *
- * This file provides a single function for downloading
- * the ics file from the url specified in the config file.
- * Currently it uses the python/bash script setup that I
- * developed initially but I would like to migrate that over
- * to a C version.
+ * This file keeps the default calendar in step with the ICS feed at the
+ * url in the config file. Plain http feeds are fetched in a child
+ * process with the client in http.c: the body is parsed as it arrives
+ * and imported straight into the calendar, and the ETag and
+ * Last-Modified of the last import are sent back so an unchanged feed
+ * costs a single 304. Failed attempts are retried with exponential
+ * backoff. Feeds the client can't fetch (https) still go through the
+ * fetch_calendar.bash script.
  * */
 
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 #include "sync.h"
 #include "config.h"
+#include "http.h"
+#include "ics.h"
+#include "sources.h"
 
 #define SYNC_SCRIPT "fetch_calendar.bash"
 #define SYNC_SCRIPT_PATH "/.calendar/scripts/fetch_calendar.bash"
 
-typedef enum _ERRNO {
-    OK,
-    NO_SYNC_SCRIPT_PATH,
-    NO_REMOTE
-} SYNC_ERR;
+// The validators from the last import, with the url they belong to
+#define SYNC_STATE_PATH "/.calendar/sync_state"
+
+// Total time spent on attempts and the waits between them, the wait
+// after the first failure (doubled after each one) and the limit on any
+// single connect or read
+#define SYNC_TIMEOUT_MS 10000
+#define SYNC_FIRST_DELAY_MS 500
+#define SYNC_ATTEMPT_TIMEOUT_MS 5000
+
+/*
+ * An import being fed from a response body.
+ */
+struct feed {
+    struct ics_parser parser;
+    struct ics_import import;
+};
+
+static pid_t sync_pid = -1;
 
 char* get_sync_script_path();
+char* get_sync_state_path();
+void read_sync_state(const char* url, char** etag, char** last_modified);
+void write_sync_state(const char* url, const char* etag, const char* last_modified);
+int receive_feed(const char* data, size_t length, void* user);
+long elapsed_ms(struct timespec* since);
+void notify(const char* urgency, const char* message);
 
-int sync_calendar() {
+SYNC_ERR sync_calendar() {
 
-    Config config = read_config();
-    if (config.remote_url == NULL) return NO_REMOTE;
+    const Config* config = get_config();
+    if (config->remote_url == NULL) return NO_REMOTE;
 
-    char* sync_script_path = get_sync_script_path();
+    // Only one sync runs at a time, and finished ones are reaped here
+    if (sync_pid > 0 && waitpid(sync_pid, NULL, WNOHANG) == 0) return SYNC_IN_PROGRESS;
+    sync_pid = -1;
 
-    if (sync_script_path == NULL) return NO_SYNC_SCRIPT_PATH;
+    char* sync_script_path = NULL;
+    if (!is_http_url(config->remote_url)) {
+        sync_script_path = get_sync_script_path();
+        if (sync_script_path == NULL) return NO_SYNC_SCRIPT_PATH;
+    }
+
+    // Events can only be written to dates that already have a line
+    time_t raw_time = time(NULL);
+    struct tm* info = localtime(&raw_time);
+    fill_sources(info->tm_year + 1900 + 1);
 
-    if (fork() == 0) {
+    sync_pid = fork();
+    if (sync_pid == 0) {
         freopen("/dev/null", "w", stdout);
         freopen("/dev/null", "w", stderr);
 
-        execl(sync_script_path, SYNC_SCRIPT, config.remote_url, NULL);
+        if (sync_script_path != NULL) {
+            execl(sync_script_path, SYNC_SCRIPT, config->remote_url, NULL);
+            _exit(1);
+        }
+
+        struct sync_result result;
+        SYNC_ERR status = fetch_feed(config->remote_url, get_default_source(), &result);
+
+        if (status == SYNC_OK) {
+            notify("normal", "Google Calendar sync successful");
+        } else if (status == IMPORT_FAILED) {
+            notify("critical", "Failed to write Google Calendar event to calendar.txt");
+        } else {
+            notify("critical", "Failed to download Google Calendar ICS file");
+        }
+        _exit(status == SYNC_OK ? 0 : 1);
+    }
+
+    free(sync_script_path);
+
+    return SYNC_OK;
+}
+
+SYNC_ERR fetch_feed(const char* url, int source, struct sync_result* result) {
+    memset(result, 0, sizeof(struct sync_result));
+
+    int first_key, last_key;
+    get_import_window(&first_key, &last_key);
+
+    char* etag;
+    char* last_modified;
+    read_sync_state(url, &etag, &last_modified);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    int delay_ms = SYNC_FIRST_DELAY_MS;
+    SYNC_ERR status = FETCH_FAILED;
+
+    while (true) {
+        result->attempts++;
+
+        struct feed feed;
+        init_import(&feed.import, first_key, last_key);
+        init_ics_parser(&feed.parser, import_event, &feed.import);
+
+        struct http_request request = {url, etag, last_modified, SYNC_ATTEMPT_TIMEOUT_MS};
+        struct http_response response;
+
+        int fetched = http_get(&request, &response, receive_feed, &feed);
+        finish_ics(&feed.parser);
+        result->status = response.status;
+
+        if (fetched == 0 && response.status == 200) {
+            status = finish_import(&feed.import, source, &result->stats) == 0 ? SYNC_OK : IMPORT_FAILED;
+            if (status == SYNC_OK) write_sync_state(url, response.etag, response.last_modified);
+
+            free_http_response(&response);
+            break;
+        }
+
+        free_import(&feed.import);
+        free_http_response(&response);
+
+        if (fetched == 0 && result->status == 304) {
+            result->unchanged = true;
+            status = SYNC_OK;
+            break;
+        }
+
+        // Only failures that could go away on their own are retried
+        bool retry = fetched != 0 || result->status >= 500 || result->status == 429;
+        if (!retry || elapsed_ms(&start) + delay_ms > SYNC_TIMEOUT_MS) break;
+
+        struct timespec delay = {delay_ms / 1000, (delay_ms % 1000) * 1000000L};
+        nanosleep(&delay, NULL);
+        delay_ms *= 2;
+    }
+
+    free(etag);
+    free(last_modified);
+
+    return status;
+}
+
+/*
+ * An http_body_callback that feeds the body to the ICS parser.
+ */
+int receive_feed(const char* data, size_t length, void* user) {
+    struct feed* feed = user;
+    return feed_ics(&feed->parser, data, length);
+}
+
+/*
+ * Reads the ETag and Last-Modified saved by the last import of url. Both
+ * are set to NULL if there aren't any.
+ */
+void read_sync_state(const char* url, char** etag, char** last_modified) {
+    *etag = NULL;
+    *last_modified = NULL;
+
+    char* path = get_sync_state_path();
+    FILE* state_file = path == NULL ? NULL : fopen(path, "r");
+    free(path);
+    if (state_file == NULL) return;
+
+    // One value per line: url, ETag, Last-Modified (empty if missing)
+    char* lines[3] = {NULL, NULL, NULL};
+    size_t size = 0;
+    for (int i = 0; i < 3; i++) {
+        if (getline(&lines[i], &size, state_file) < 0) break;
+        lines[i][strcspn(lines[i], "\r\n")] = '\0';
+        size = 0;
     }
+    fclose(state_file);
 
-    free(config.remote_url);
+    if (lines[2] != NULL && strcmp(lines[0], url) == 0) {
+        if (lines[1][0] != '\0') *etag = strdup(lines[1]);
+        if (lines[2][0] != '\0') *last_modified = strdup(lines[2]);
+    }
 
-    return 0;
+    for (int i = 0; i < 3; i++) {
+        free(lines[i]);
+    }
+}
+
+void write_sync_state(const char* url, const char* etag, const char* last_modified) {
+    char* path = get_sync_state_path();
+    if (path == NULL) return;
+
+    FILE* state_file = fopen(path, "w");
+    if (state_file != NULL) {
+        fprintf(state_file, "%s\n%s\n%s\n", url, etag != NULL ? etag : "", last_modified != NULL ? last_modified : "");
+        fclose(state_file);
+    }
+
+    free(path);
+}
+
+long elapsed_ms(struct timespec* since) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (now.tv_sec - since->tv_sec) * 1000 + (now.tv_nsec - since->tv_nsec) / 1000000;
+}
+
+/*
+ * Shows a desktop notification. Only called from the sync process, which
+ * it replaces.
+ */
+void notify(const char* urgency, const char* message) {
+    char urgency_arg[32];
+    snprintf(urgency_arg, sizeof(urgency_arg), "--urgency=%s", urgency);
+
+    execlp("notify-send", "notify-send", urgency_arg, "calendar.txt", message, NULL);
 }
 
 /*
@@ -64,3 +253,14 @@ char* get_sync_script_path() {
 
     return sync_script_path;
 }
+
+char* get_sync_state_path() {
+    char* home = getenv("HOME");
+    if (home == NULL) return NULL;
+
+    int length = strlen(home) + strlen(SYNC_STATE_PATH) + 1;
+    char* path = malloc(sizeof(char) * length);
+    snprintf(path, length, "%s%s", home, SYNC_STATE_PATH);
+
+    return path;
+}
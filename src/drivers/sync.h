@@ -1,6 +1,35 @@
 #ifndef SYNC_H
 #define  SYNC_H
 
-int sync_calendar(); 
+#include <stdbool.h>
+#include "import.h"
+
+typedef enum _ERRNO {
+    SYNC_OK,
+    NO_SYNC_SCRIPT_PATH,
+    NO_REMOTE,
+    SYNC_IN_PROGRESS,
+    FETCH_FAILED,
+    IMPORT_FAILED
+} SYNC_ERR;
+
+struct sync_result {
+    int attempts;
+    int status; // HTTP status of the last attempt, 0 if it got no response
+    bool unchanged; // the server answered 304 Not Modified
+    struct import_stats stats;
+};
+
+/*
+ * Starts syncing the default calendar with remote_url in the background.
+ * Returns SYNC_OK once the sync has started.
+ */
+SYNC_ERR sync_calendar();
+
+/*
+ * Fetches an http:// feed and imports it into a calendar, retrying with
+ * exponential backoff. Blocks until it's done.
+ */
+SYNC_ERR fetch_feed(const char* url, int source, struct sync_result* result);
 
 #endif
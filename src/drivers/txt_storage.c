@@ -0,0 +1,154 @@
+/*
+ * txt_storage.c
+ *
+ * The calendar.txt storage backend. This is a thin layer over the
+ * functions in calendartxt.c that also keeps the file covering every
+ * date that is read or written (see skeleton.c).
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "storage.h"
+#include "skeleton.h"
+
+void* txt_open(const char* path);
+void txt_close(void* handle);
+struct events txt_get_day(void* handle, int year, int month, int day);
+int txt_get_range(void* handle, int start_key, int end_key, day_callback callback, void* data);
+int txt_get_bounds(void* handle, int* first_key, int* last_key);
+int txt_add(void* handle, struct event event);
+int txt_delete(void* handle, struct event event);
+int txt_batch(void* handle, struct day_update* updates, size_t count);
+long long txt_get_version(void* handle);
+int txt_fill(void* handle, int date_key);
+const char* txt_get_file(void* handle);
+int txt_lock(void* handle);
+void txt_unlock(void* handle);
+
+const struct storage_driver calendartxt_driver = {
+    .name = "txt",
+    .open = txt_open,
+    .close = txt_close,
+    .get_day = txt_get_day,
+    .get_range = txt_get_range,
+    .get_bounds = txt_get_bounds,
+    .add = txt_add,
+    .delete = txt_delete,
+    .batch = txt_batch,
+    .get_version = txt_get_version,
+    .fill = txt_fill,
+    .get_file = txt_get_file,
+    .lock = txt_lock,
+    .unlock = txt_unlock,
+};
+
+void* txt_open(const char* path) {
+    struct calendar_file* file = malloc(sizeof(struct calendar_file));
+    open_calendar_file(file, (char*)path);
+
+    return file;
+}
+
+void txt_close(void* handle) {
+    close_calendar_file(handle);
+    free(handle);
+}
+
+struct events txt_get_day(void* handle, int year, int month, int day) {
+    // Navigating past the end of a calendar grows it a year at a time
+    extend_calendar(handle, DATE_KEY(year, month, day));
+
+    return read_day(handle, year, month, day);
+}
+
+int txt_get_range(void* handle, int start_key, int end_key, day_callback callback, void* data) {
+    return read_range(handle, start_key, end_key, callback, data);
+}
+
+int txt_get_bounds(void* handle, int* first_key, int* last_key) {
+    struct calendar_file* file = handle;
+    if (refresh_day_offsets(file) != 0 || file->num_offsets == 0) return -1;
+
+    *first_key = file->offsets[0].date_key;
+    *last_key = file->offsets[file->num_offsets - 1].date_key;
+
+    return 0;
+}
+
+int txt_add(void* handle, struct event event) {
+    struct events base = txt_get_day(handle, event.year, event.month, event.day);
+    struct events events = copy_events(base);
+
+    // The caller keeps ownership of the event's summary
+    event.summary = strdup(event.summary);
+    insert_event(&events, event);
+
+    struct day_update update = {event.year, event.month, event.day, events, &base};
+    int result = txt_batch(handle, &update, 1);
+    free_events(events);
+    free_events(base);
+
+    return result;
+}
+
+int txt_delete(void* handle, struct event event) {
+    struct events base = read_day(handle, event.year, event.month, event.day);
+    struct events events = copy_events(base);
+
+    if (remove_event(&events, event) != 0) {
+        free_events(events);
+        free_events(base);
+        return -1;
+    }
+
+    struct day_update update = {event.year, event.month, event.day, events, &base};
+    int result = txt_batch(handle, &update, 1);
+    free_events(events);
+    free_events(base);
+
+    return result;
+}
+
+int txt_batch(void* handle, struct day_update* updates, size_t count) {
+    if (count == 0) return 0;
+
+    int first_key = DATE_KEY(updates[0].year, updates[0].month, updates[0].day);
+    int last_key = first_key;
+    for (size_t i = 1; i < count; i++) {
+        int key = DATE_KEY(updates[i].year, updates[i].month, updates[i].day);
+        if (key < first_key) first_key = key;
+        if (key > last_key) last_key = key;
+    }
+
+    // Every updated date needs a line to be written to
+    if (fill_calendar(handle, first_key) != 0) return -1;
+    if (fill_calendar(handle, last_key) != 0) return -1;
+
+    return write_days(handle, updates, count);
+}
+
+long long txt_get_version(void* handle) {
+    struct calendar_file* file = handle;
+
+    struct stat st;
+    if (stat(file->path, &st) != 0) return -1;
+
+    return (st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec) ^ ((long long)st.st_size << 20) ^ st.st_ino;
+}
+
+int txt_fill(void* handle, int date_key) {
+    return fill_calendar(handle, date_key);
+}
+
+const char* txt_get_file(void* handle) {
+    return ((struct calendar_file*)handle)->path;
+}
+
+int txt_lock(void* handle) {
+    return lock_calendar_file(handle);
+}
+
+void txt_unlock(void* handle) {
+    unlock_calendar_file(handle);
+}
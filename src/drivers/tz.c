@@ -0,0 +1,543 @@
+/*
+ * tz.c
+ *
+ * Time zone conversion without going through the C library's global TZ
+ * state. Each zone's TZif file (RFC 8536) is read once into a sorted
+ * table of UTC transition times and converting a time is a binary
+ * search over that table.
+ *
+ * TZif files only list transitions up to some year and describe the rest
+ * with a POSIX TZ string like "EST5EDT,M3.2.0,M11.1.0" at the end of the
+ * file. The rule is expanded into explicit transitions through
+ * TZ_RULE_LAST_YEAR when the zone is loaded.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "tz.h"
+#include "config.h"
+#include "skeleton.h"
+#include "calendartxt.h"
+
+#define TZIF_HEADER_SIZE 44
+#define TZ_RULE_LAST_YEAR 2200
+#define SECONDS_PER_DAY 86400
+
+// One DST start or end in a POSIX TZ string
+struct tz_rule {
+    char kind; // 'M' for Mm.w.d, 'J' for Jn, 'N' for n
+    int month;
+    int week;
+    int wday;
+    int day;
+    int32_t time; // seconds after local midnight, may be negative or > 24h
+};
+
+struct posix_tz {
+    int32_t std_offset;
+    int32_t dst_offset;
+    bool has_dst;
+    struct tz_rule start;
+    struct tz_rule end;
+};
+
+struct cached_zone {
+    char* name;
+    struct time_zone* zone; // NULL if the zone failed to load
+};
+
+static struct cached_zone* cache = NULL;
+static size_t cache_length = 0;
+static const struct time_zone* display_zone = NULL;
+static int display_zone_generation = -1;
+
+char* read_zone_file(const char* name, size_t* length);
+int parse_tzif(struct time_zone* zone, const unsigned char* data, size_t length);
+void add_transition(struct time_zone* zone, size_t* size, int64_t time, int32_t offset);
+int parse_posix_tz(const char* string, struct posix_tz* tz);
+const char* parse_tz_name(const char* string);
+const char* parse_tz_offset(const char* string, int32_t* seconds);
+const char* parse_tz_rule(const char* string, struct tz_rule* rule);
+int64_t rule_to_local(const struct tz_rule* rule, int year);
+void extend_with_rule(struct time_zone* zone, size_t* size, const struct posix_tz* tz);
+size_t find_transition(const struct time_zone* zone, int64_t utc);
+int64_t floor_div(int64_t a, int64_t b);
+int64_t read_be(const unsigned char* data, int bytes);
+
+int load_time_zone(struct time_zone* zone, const char* name) {
+    memset(zone, 0, sizeof(struct time_zone));
+
+    size_t length;
+    char* data = read_zone_file(name, &length);
+
+    if (data == NULL) {
+        // Containers often ship without tzdata, but UTC is always known
+        if (strcmp(name, "UTC") == 0 || strcmp(name, "Etc/UTC") == 0 || strcmp(name, "Z") == 0) {
+            zone->name = strdup(name);
+            return 0;
+        }
+        return -1;
+    }
+
+    int result = parse_tzif(zone, (unsigned char*)data, length);
+    free(data);
+
+    if (result != 0) {
+        free_time_zone(zone);
+        return -1;
+    }
+
+    zone->name = strdup(name);
+    return 0;
+}
+
+void free_time_zone(struct time_zone* zone) {
+    free(zone->name);
+    free(zone->transitions);
+    free(zone->offsets);
+    memset(zone, 0, sizeof(struct time_zone));
+}
+
+const struct time_zone* get_time_zone(const char* name) {
+    for (size_t i = 0; i < cache_length; i++) {
+        if (strcmp(cache[i].name, name) == 0) return cache[i].zone;
+    }
+
+    struct time_zone* zone = malloc(sizeof(struct time_zone));
+    if (load_time_zone(zone, name) != 0) {
+        free(zone);
+        zone = NULL;
+    }
+
+    // Failures are cached too so a bad TZID is only looked up once
+    cache = realloc(cache, (cache_length + 1) * sizeof(struct cached_zone));
+    cache[cache_length].name = strdup(name);
+    cache[cache_length].zone = zone;
+    cache_length++;
+
+    return zone;
+}
+
+const struct time_zone* get_display_time_zone() {
+    if (display_zone != NULL && display_zone_generation == get_config_generation()) return display_zone;
+
+    const Config* config = get_config();
+    display_zone = config->timezone == NULL ? NULL : get_time_zone(config->timezone);
+    display_zone_generation = get_config_generation();
+
+    char* tz = getenv("TZ");
+    if (display_zone == NULL && tz != NULL && strlen(tz) > 0) {
+        display_zone = get_time_zone(tz[0] == ':' ? tz + 1 : tz);
+    }
+
+    if (display_zone == NULL) display_zone = get_time_zone("localtime");
+    if (display_zone == NULL) display_zone = get_time_zone("UTC");
+
+    return display_zone;
+}
+
+int32_t get_utc_offset(const struct time_zone* zone, int64_t utc) {
+    if (zone->num_transitions == 0 || utc < zone->transitions[0]) return zone->initial_offset;
+
+    return zone->offsets[find_transition(zone, utc)];
+}
+
+int64_t local_to_utc(const struct time_zone* zone, int64_t local) {
+    // Zones never change offset twice within a day, so the only offsets
+    // that can apply are the ones a day either side of the time
+    int32_t before = get_utc_offset(zone, local - SECONDS_PER_DAY);
+    int32_t after = get_utc_offset(zone, local + SECONDS_PER_DAY);
+    if (before == after) return local - before;
+
+    int64_t with_before = local - before;
+    int64_t with_after = local - after;
+    bool before_valid = get_utc_offset(zone, with_before) == before;
+    bool after_valid = get_utc_offset(zone, with_after) == after;
+
+    if (before_valid && after_valid) {
+        return with_before < with_after ? with_before : with_after;
+    }
+    if (after_valid) return with_after;
+
+    // Either the time is valid with the old offset or it falls in a gap,
+    // where the old offset lands the same distance past the gap
+    return with_before;
+}
+
+void utc_to_local_times(const struct time_zone* zone, const int64_t* in, int64_t* out, size_t count) {
+    size_t index = 0;
+    bool has_index = false;
+
+    for (size_t i = 0; i < count; i++) {
+        int64_t utc = in[i];
+
+        if (zone->num_transitions == 0 || utc < zone->transitions[0]) {
+            out[i] = utc + zone->initial_offset;
+            has_index = false;
+            continue;
+        }
+
+        bool in_interval = has_index &&
+            utc >= zone->transitions[index] &&
+            (index + 1 == zone->num_transitions || utc < zone->transitions[index + 1]);
+
+        if (!in_interval) {
+            index = find_transition(zone, utc);
+            has_index = true;
+        }
+
+        out[i] = utc + zone->offsets[index];
+    }
+}
+
+int64_t civil_to_seconds(int year, int month, int day, int hour, int min, int sec) {
+    return (int64_t)days_from_date_key(DATE_KEY(year, month, day)) * SECONDS_PER_DAY + hour * 3600 + min * 60 + sec;
+}
+
+void seconds_to_civil(int64_t seconds, int* date_key, int* hour, int* min) {
+    int64_t days = floor_div(seconds, SECONDS_PER_DAY);
+    int64_t second_of_day = seconds - days * SECONDS_PER_DAY;
+
+    *date_key = date_key_from_days(days);
+    *hour = second_of_day / 3600;
+    *min = second_of_day / 60 % 60;
+}
+
+/*
+ * Returns the index of the last transition at or before utc. The time
+ * must not be before the first transition.
+ */
+size_t find_transition(const struct time_zone* zone, int64_t utc) {
+    // Branchless so random lookups don't pay for mispredicted comparisons
+    const int64_t* base = zone->transitions;
+    size_t length = zone->num_transitions;
+
+    while (length > 1) {
+        size_t half = length / 2;
+        base = base[half] <= utc ? base + half : base;
+        length -= half;
+    }
+
+    return base - zone->transitions;
+}
+
+/*
+ * Reads the whole TZif file for a zone. Returns NULL if it doesn't exist.
+ */
+char* read_zone_file(const char* name, size_t* length) {
+    char path[1024];
+
+    if (strcmp(name, "localtime") == 0) {
+        snprintf(path, sizeof(path), "/etc/localtime");
+    } else if (name[0] == '/') {
+        snprintf(path, sizeof(path), "%s", name);
+    } else {
+        // Zone names come from downloaded files, so keep them in the zoneinfo directory
+        if (strstr(name, "..") != NULL) return NULL;
+
+        char* dir = getenv("TZDIR");
+        if (dir != NULL) {
+            snprintf(path, sizeof(path), "%s/%s", dir, name);
+        } else {
+            snprintf(path, sizeof(path), "%s%s", ZONEINFO_DIR, name);
+        }
+    }
+
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) return NULL;
+
+    struct stat st;
+    if (fstat(fileno(file), &st) != 0 || !S_ISREG(st.st_mode)) {
+        fclose(file);
+        return NULL;
+    }
+
+    char* data = malloc(st.st_size + 1);
+    *length = fread(data, 1, st.st_size, file);
+    data[*length] = '\0';
+    fclose(file);
+
+    return data;
+}
+
+int parse_tzif(struct time_zone* zone, const unsigned char* data, size_t length) {
+    if (length < TZIF_HEADER_SIZE || memcmp(data, "TZif", 4) != 0) return -1;
+
+    int version = data[4] == '\0' ? 1 : data[4] - '0';
+    int time_size = 4;
+
+    const unsigned char* header = data;
+    const unsigned char* end = data + length;
+
+    for (int pass = 0; pass < 2; pass++) {
+        int64_t isutcnt = read_be(header + 20, 4);
+        int64_t isstdcnt = read_be(header + 24, 4);
+        int64_t leapcnt = read_be(header + 28, 4);
+        int64_t timecnt = read_be(header + 32, 4);
+        int64_t typecnt = read_be(header + 36, 4);
+        int64_t charcnt = read_be(header + 40, 4);
+
+        size_t block_size =
+            timecnt * time_size + timecnt + typecnt * 6 + charcnt +
+            leapcnt * (time_size + 4) + isstdcnt + isutcnt;
+
+        const unsigned char* block = header + TZIF_HEADER_SIZE;
+        if (typecnt < 1 || block + block_size > end) return -1;
+
+        // Version 2+ files repeat everything with 64-bit times after the
+        // version 1 block, so skip straight to that
+        if (pass == 0 && version >= 2) {
+            header = block + block_size;
+            time_size = 8;
+            if (header + TZIF_HEADER_SIZE > end || memcmp(header, "TZif", 4) != 0) return -1;
+            continue;
+        }
+
+        const unsigned char* times = block;
+        const unsigned char* indices = times + timecnt * time_size;
+        const unsigned char* types = indices + timecnt;
+
+        size_t size = timecnt + 16;
+        zone->transitions = malloc(size * sizeof(int64_t));
+        zone->offsets = malloc(size * sizeof(int32_t));
+        zone->num_transitions = 0;
+        zone->initial_offset = (int32_t)read_be(types, 4);
+
+        for (int64_t i = 0; i < timecnt; i++) {
+            int type = indices[i];
+            if (type >= typecnt) return -1;
+
+            int64_t time = read_be(times + i * time_size, time_size);
+            add_transition(zone, &size, time, (int32_t)read_be(types + type * 6, 4));
+        }
+
+        // The footer is "\n<POSIX TZ>\n" right after the 64-bit block
+        const unsigned char* footer = block + block_size;
+        if (version >= 2 && footer < end && *footer == '\n') {
+            const unsigned char* footer_end = memchr(footer + 1, '\n', end - footer - 1);
+            if (footer_end != NULL) {
+                char* string = strndup((const char*)footer + 1, footer_end - footer - 1);
+
+                struct posix_tz tz;
+                if (parse_posix_tz(string, &tz) == 0) {
+                    if (zone->num_transitions == 0 && !tz.has_dst) {
+                        zone->initial_offset = tz.std_offset;
+                    }
+                    extend_with_rule(zone, &size, &tz);
+                }
+                free(string);
+            }
+        }
+
+        break;
+    }
+
+    return 0;
+}
+
+void add_transition(struct time_zone* zone, size_t* size, int64_t time, int32_t offset) {
+    if (zone->num_transitions == *size) {
+        *size *= 2;
+        zone->transitions = realloc(zone->transitions, *size * sizeof(int64_t));
+        zone->offsets = realloc(zone->offsets, *size * sizeof(int32_t));
+    }
+
+    zone->transitions[zone->num_transitions] = time;
+    zone->offsets[zone->num_transitions] = offset;
+    zone->num_transitions++;
+}
+
+/*
+ * Adds the transitions described by a POSIX TZ rule from the year of the
+ * last listed transition through TZ_RULE_LAST_YEAR.
+ */
+void extend_with_rule(struct time_zone* zone, size_t* size, const struct posix_tz* tz) {
+    if (!tz->has_dst) return;
+
+    int64_t last = zone->num_transitions > 0 ? zone->transitions[zone->num_transitions - 1] : INT64_MIN;
+    int first_year = 1970;
+    if (zone->num_transitions > 0) {
+        int date_key, hour, min;
+        seconds_to_civil(last, &date_key, &hour, &min);
+        first_year = date_key / 10000;
+    }
+
+    for (int year = first_year; year <= TZ_RULE_LAST_YEAR; year++) {
+        int64_t start = rule_to_local(&tz->start, year) - tz->std_offset;
+        int64_t end = rule_to_local(&tz->end, year) - tz->dst_offset;
+
+        // Southern hemisphere zones end DST before they start it
+        int64_t first = start < end ? start : end;
+        int64_t second = start < end ? end : start;
+        int32_t first_offset = start < end ? tz->dst_offset : tz->std_offset;
+        int32_t second_offset = start < end ? tz->std_offset : tz->dst_offset;
+
+        if (first > last) add_transition(zone, size, first, first_offset);
+        if (second > last) add_transition(zone, size, second, second_offset);
+    }
+}
+
+/*
+ * Parses "std offset [dst [offset] [,start[/time],end[/time]]]".
+ * Offsets are stored the way TZif stores them (seconds east of UTC),
+ * which is the opposite sign of the POSIX string.
+ */
+int parse_posix_tz(const char* string, struct posix_tz* tz) {
+    memset(tz, 0, sizeof(struct posix_tz));
+
+    const char* cursor = parse_tz_name(string);
+    if (cursor == NULL) return -1;
+
+    int32_t offset;
+    cursor = parse_tz_offset(cursor, &offset);
+    if (cursor == NULL) return -1;
+    tz->std_offset = -offset;
+
+    if (*cursor == '\0') return 0;
+
+    cursor = parse_tz_name(cursor);
+    if (cursor == NULL) return -1;
+
+    tz->has_dst = true;
+    tz->dst_offset = tz->std_offset + 3600;
+
+    if (*cursor != ',' && *cursor != '\0') {
+        cursor = parse_tz_offset(cursor, &offset);
+        if (cursor == NULL) return -1;
+        tz->dst_offset = -offset;
+    }
+
+    if (*cursor == '\0') {
+        // No rule given, so POSIX says to use the US rules
+        cursor = ",M3.2.0,M11.1.0";
+    }
+
+    if (*cursor != ',') return -1;
+    cursor = parse_tz_rule(cursor + 1, &tz->start);
+    if (cursor == NULL || *cursor != ',') return -1;
+    cursor = parse_tz_rule(cursor + 1, &tz->end);
+    if (cursor == NULL || *cursor != '\0') return -1;
+
+    return 0;
+}
+
+const char* parse_tz_name(const char* string) {
+    if (*string == '<') {
+        const char* close = strchr(string, '>');
+        return close == NULL ? NULL : close + 1;
+    }
+
+    const char* cursor = string;
+    while ((*cursor >= 'A' && *cursor <= 'Z') || (*cursor >= 'a' && *cursor <= 'z')) cursor++;
+
+    return cursor - string >= 3 ? cursor : NULL;
+}
+
+/*
+ * Parses "[+-]hh[:mm[:ss]]" into seconds.
+ */
+const char* parse_tz_offset(const char* string, int32_t* seconds) {
+    int sign = 1;
+    if (*string == '+' || *string == '-') {
+        sign = *string == '-' ? -1 : 1;
+        string++;
+    }
+
+    if (*string < '0' || *string > '9') return NULL;
+
+    int32_t parts[3] = {0, 0, 0};
+    for (int i = 0; i < 3; i++) {
+        char* end;
+        parts[i] = strtol(string, &end, 10);
+        string = end;
+
+        if (*string != ':') break;
+        string++;
+    }
+
+    *seconds = sign * (parts[0] * 3600 + parts[1] * 60 + parts[2]);
+    return string;
+}
+
+const char* parse_tz_rule(const char* string, struct tz_rule* rule) {
+    char* end;
+    memset(rule, 0, sizeof(struct tz_rule));
+
+    if (*string == 'M') {
+        rule->kind = 'M';
+        rule->month = strtol(string + 1, &end, 10);
+        if (*end != '.') return NULL;
+        rule->week = strtol(end + 1, &end, 10);
+        if (*end != '.') return NULL;
+        rule->wday = strtol(end + 1, &end, 10);
+
+        if (rule->month < 1 || rule->month > 12 || rule->week < 1 || rule->week > 5) return NULL;
+    } else if (*string == 'J') {
+        rule->kind = 'J';
+        rule->day = strtol(string + 1, &end, 10);
+    } else {
+        rule->kind = 'N';
+        rule->day = strtol(string, &end, 10);
+        if (end == string) return NULL;
+    }
+
+    rule->time = 2 * 3600;
+    if (*end == '/') {
+        const char* after = parse_tz_offset(end + 1, &rule->time);
+        if (after == NULL) return NULL;
+        return after;
+    }
+
+    return end;
+}
+
+/*
+ * Returns the wall clock time a rule fires in the given year as seconds
+ * since the epoch.
+ */
+int64_t rule_to_local(const struct tz_rule* rule, int year) {
+    long days = days_from_date_key(DATE_KEY(year, 1, 1));
+
+    if (rule->kind == 'M') {
+        long first = days_from_date_key(DATE_KEY(year, rule->month, 1));
+
+        // Rules count weekdays from Sunday
+        int first_wday = (weekday_from_days(first) + 1) % 7;
+        int day = 1 + (rule->wday - first_wday + 7) % 7 + (rule->week - 1) * 7;
+
+        // Week 5 means the last one in the month
+        while (day > days_in_month(year, rule->month)) day -= 7;
+
+        days = first + day - 1;
+    } else if (rule->kind == 'J') {
+        // Jn counts 1-365 and never includes February 29th
+        days += rule->day - 1;
+        if (is_leap_year(year) && rule->day >= 60) days++;
+    } else {
+        days += rule->day;
+    }
+
+    return (int64_t)days * SECONDS_PER_DAY + rule->time;
+}
+
+int64_t floor_div(int64_t a, int64_t b) {
+    int64_t quotient = a / b;
+    if ((a % b != 0) && ((a < 0) != (b < 0))) quotient--;
+    return quotient;
+}
+
+/*
+ * Reads a big-endian signed integer that is 4 or 8 bytes wide.
+ */
+int64_t read_be(const unsigned char* data, int bytes) {
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; i++) {
+        value = (value << 8) | data[i];
+    }
+
+    if (bytes == 4) return (int32_t)(uint32_t)value;
+    return (int64_t)value;
+}
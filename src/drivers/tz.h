@@ -0,0 +1,67 @@
+#ifndef TZ_H
+#define TZ_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define ZONEINFO_DIR "/usr/share/zoneinfo/"
+
+/*
+ * A time zone loaded from a TZif file. transitions[i] is the UTC time the
+ * offset changes to offsets[i]. Transitions past the end of the file are
+ * generated from its POSIX TZ footer, so lookups never need to evaluate
+ * the rule.
+ */
+struct time_zone {
+    char* name;
+    int64_t* transitions;
+    int32_t* offsets;
+    size_t num_transitions;
+    int32_t initial_offset; // in effect before the first transition
+};
+
+/*
+ * Loads a zone by IANA name ("America/New_York"), absolute path, or
+ * "localtime" for the system zone. Returns 0 on success, -1 on failure.
+ */
+int load_time_zone(struct time_zone* zone, const char* name);
+void free_time_zone(struct time_zone* zone);
+
+/*
+ * Returns a zone loaded by load_time_zone and cached for the rest of the
+ * run, or NULL if it can't be loaded.
+ */
+const struct time_zone* get_time_zone(const char* name);
+
+/*
+ * Returns the zone events are displayed in: `timezone` in the config,
+ * falling back on $TZ and then the system zone. Never NULL.
+ */
+const struct time_zone* get_display_time_zone();
+
+/*
+ * Returns the offset from UTC in seconds at the given UTC time.
+ */
+int32_t get_utc_offset(const struct time_zone* zone, int64_t utc);
+
+/*
+ * Converts a wall clock time in the zone (as seconds since the epoch as if
+ * it were UTC) to UTC. Times skipped by a DST change are moved forward and
+ * repeated times resolve to the first occurrence.
+ */
+int64_t local_to_utc(const struct time_zone* zone, int64_t local);
+
+/*
+ * Converts count UTC times to wall clock times in the zone. in and out may
+ * be the same array. Sorted input is fastest since consecutive times
+ * usually share a transition and skip the binary search.
+ */
+void utc_to_local_times(const struct time_zone* zone, const int64_t* in, int64_t* out, size_t count);
+
+/*
+ * Converts between civil times and seconds since 1970-01-01 00:00.
+ */
+int64_t civil_to_seconds(int year, int month, int day, int hour, int min, int sec);
+void seconds_to_civil(int64_t seconds, int* date_key, int* hour, int* min);
+
+#endif
@@ -0,0 +1,357 @@
+/*
+ * editor.c
+ *
+ * The line editor behind the modal's summary field. The text lives in a
+ * gap buffer: the bytes before the cursor are at the start of the
+ * allocation and the bytes after it at the end, with the unused space in
+ * between. Typing and deleting at the cursor only move the gap's edges,
+ * and moving the cursor carries one character across the gap, so both
+ * are O(1) however long the summary is. The buffer doubles when the gap
+ * runs out.
+ *
+ * The text is wrapped at character cells to the width of its window. The
+ * editor remembers where each row starts and the first byte that changed
+ * since the last draw, so a draw only lays out and repaints the rows from
+ * that point on.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <limits.h>
+#include <ncurses.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include "calenter.h"
+
+#define EDITOR_MIN_GAP 64
+
+size_t get_gap_length(Editor* editor);
+char get_editor_byte(Editor* editor, size_t offset);
+int get_char_at(Editor* editor, size_t offset, int* width);
+bool is_continuation_byte(char byte);
+void move_cursor_left(Editor* editor);
+void move_cursor_right(Editor* editor);
+void mark_changed(Editor* editor, size_t offset);
+void layout_editor_rows(Editor* editor, int first_row, int width);
+int find_editor_row(Editor* editor, size_t offset);
+void draw_editor_row(Editor* editor, WINDOW* win, int row);
+
+void init_editor(Editor* editor, const char* text) {
+    size_t length = text == NULL ? 0 : strlen(text);
+
+    editor->size = length + EDITOR_MIN_GAP;
+    editor->text = malloc(editor->size);
+    if (length > 0) memcpy(editor->text, text, length);
+
+    // The cursor starts at the end
+    editor->gap_start = length;
+    editor->gap_end = editor->size;
+
+    editor->rows_size = 8;
+    editor->row_starts = malloc(sizeof(size_t) * editor->rows_size);
+    editor->row_starts[0] = 0;
+    editor->num_rows = 1;
+    editor->top_row = 0;
+    editor->width = -1;
+    editor->changed = 0;
+}
+
+void free_editor(Editor* editor) {
+    free(editor->text);
+    free(editor->row_starts);
+}
+
+size_t get_editor_length(Editor* editor) {
+    return editor->size - get_gap_length(editor);
+}
+
+char* get_editor_text(Editor* editor) {
+    size_t length = get_editor_length(editor);
+    char* text = malloc(length + 1);
+
+    memcpy(text, editor->text, editor->gap_start);
+    memcpy(text + editor->gap_start, editor->text + editor->gap_end, editor->size - editor->gap_end);
+    text[length] = '\0';
+
+    return text;
+}
+
+void editor_insert(Editor* editor, const char* bytes, size_t length) {
+    if (get_gap_length(editor) < length) {
+        size_t tail = editor->size - editor->gap_end;
+        size_t size = editor->size * 2;
+        if (size < editor->size + length + EDITOR_MIN_GAP) size = editor->size + length + EDITOR_MIN_GAP;
+
+        editor->text = realloc(editor->text, size);
+        memmove(editor->text + size - tail, editor->text + editor->gap_end, tail);
+        editor->gap_end = size - tail;
+        editor->size = size;
+    }
+
+    mark_changed(editor, editor->gap_start);
+    memcpy(editor->text + editor->gap_start, bytes, length);
+    editor->gap_start += length;
+}
+
+void editor_delete_before(Editor* editor) {
+    if (editor->gap_start == 0) return;
+
+    do {
+        editor->gap_start--;
+    } while (editor->gap_start > 0 && is_continuation_byte(editor->text[editor->gap_start]));
+
+    mark_changed(editor, editor->gap_start);
+}
+
+void editor_delete_after(Editor* editor) {
+    if (editor->gap_end == editor->size) return;
+
+    do {
+        editor->gap_end++;
+    } while (editor->gap_end < editor->size && is_continuation_byte(editor->text[editor->gap_end]));
+
+    mark_changed(editor, editor->gap_start);
+}
+
+void editor_move(Editor* editor, enum editor_motion motion) {
+    switch (motion) {
+        case CHAR_LEFT: {
+            move_cursor_left(editor);
+            break;
+        }
+        case CHAR_RIGHT: {
+            move_cursor_right(editor);
+            break;
+        }
+        case WORD_LEFT: {
+            // To the start of this word, or the one before if already there
+            while (editor->gap_start > 0 && editor->text[editor->gap_start - 1] == ' ') {
+                move_cursor_left(editor);
+            }
+            while (editor->gap_start > 0 && editor->text[editor->gap_start - 1] != ' ') {
+                move_cursor_left(editor);
+            }
+            break;
+        }
+        case WORD_RIGHT: {
+            // To the end of this word, or the next one if already there
+            while (editor->gap_end < editor->size && editor->text[editor->gap_end] == ' ') {
+                move_cursor_right(editor);
+            }
+            while (editor->gap_end < editor->size && editor->text[editor->gap_end] != ' ') {
+                move_cursor_right(editor);
+            }
+            break;
+        }
+        case TEXT_START: {
+            while (editor->gap_start > 0) move_cursor_left(editor);
+            break;
+        }
+        case TEXT_END: {
+            while (editor->gap_end < editor->size) move_cursor_right(editor);
+            break;
+        }
+    }
+}
+
+void invalidate_editor(Editor* editor) {
+    editor->width = -1;
+}
+
+void render_editor(Editor* editor, WINDOW* win, bool show_cursor) {
+    int height, width;
+    getmaxyx(win, height, width);
+
+    int first_row = 0;
+    if (width != editor->width) {
+        // Everything has to be wrapped and drawn again at the new width
+        editor->width = width;
+        editor->top_row = -1;
+    } else if (editor->changed == SIZE_MAX) {
+        first_row = editor->num_rows;
+    } else {
+        // A change can pull the start of its row back onto the row above
+        first_row = find_editor_row(editor, editor->changed) - 1;
+        if (first_row < 0) first_row = 0;
+    }
+
+    int old_num_rows = editor->num_rows;
+    if (first_row < editor->num_rows) layout_editor_rows(editor, first_row, width);
+    editor->changed = SIZE_MAX;
+
+    // Keeps the cursor's row on screen
+    int cursor_row = find_editor_row(editor, editor->gap_start);
+    int top_row = editor->top_row < 0 ? 0 : editor->top_row;
+    if (cursor_row < top_row) top_row = cursor_row;
+    if (cursor_row >= top_row + height) top_row = cursor_row - height + 1;
+
+    if (top_row != editor->top_row) {
+        editor->top_row = top_row;
+        first_row = top_row;
+    }
+
+    // Only the rows from the first change down are drawn, along with any
+    // left over from a longer text
+    int last_row = editor->num_rows > old_num_rows ? editor->num_rows : old_num_rows;
+    if (last_row > top_row + height) last_row = top_row + height;
+    if (first_row < top_row) first_row = top_row;
+
+    for (int row = first_row; row < last_row; row++) {
+        draw_editor_row(editor, win, row);
+    }
+
+    if (show_cursor) {
+        int column = 0;
+        for (size_t offset = editor->row_starts[cursor_row]; offset < editor->gap_start;) {
+            int char_width;
+            offset += get_char_at(editor, offset, &char_width);
+            column += char_width;
+        }
+        wmove(win, cursor_row - top_row, column < width ? column : width - 1);
+    }
+}
+
+size_t get_gap_length(Editor* editor) {
+    return editor->gap_end - editor->gap_start;
+}
+
+/*
+ * Returns the byte at an offset into the text, skipping over the gap.
+ */
+char get_editor_byte(Editor* editor, size_t offset) {
+    if (offset >= editor->gap_start) offset += get_gap_length(editor);
+    return editor->text[offset];
+}
+
+/*
+ * Decodes the character at an offset into the text. Returns its length in
+ * bytes and sets width to the columns it takes.
+ */
+int get_char_at(Editor* editor, size_t offset, int* width) {
+    size_t length = get_editor_length(editor);
+
+    // The character may straddle the gap, so it's copied out first
+    char bytes[MB_LEN_MAX];
+    size_t num_bytes = 0;
+    while (num_bytes < MB_CUR_MAX && offset + num_bytes < length) {
+        bytes[num_bytes] = get_editor_byte(editor, offset + num_bytes);
+        num_bytes++;
+    }
+
+    wchar_t c;
+    return measure_char(bytes, num_bytes, &c, width);
+}
+
+/*
+ * Whether a byte continues a UTF-8 sequence, so the cursor should not stop
+ * before it.
+ */
+bool is_continuation_byte(char byte) {
+    return MB_CUR_MAX > 1 && (byte & 0xC0) == 0x80;
+}
+
+void move_cursor_left(Editor* editor) {
+    do {
+        if (editor->gap_start == 0) return;
+
+        editor->gap_start--;
+        editor->gap_end--;
+        editor->text[editor->gap_end] = editor->text[editor->gap_start];
+    } while (is_continuation_byte(editor->text[editor->gap_end]));
+}
+
+void move_cursor_right(Editor* editor) {
+    do {
+        if (editor->gap_end == editor->size) return;
+
+        editor->text[editor->gap_start] = editor->text[editor->gap_end];
+        editor->gap_start++;
+        editor->gap_end++;
+    } while (editor->gap_end < editor->size && is_continuation_byte(editor->text[editor->gap_end]));
+}
+
+void mark_changed(Editor* editor, size_t offset) {
+    if (offset < editor->changed) editor->changed = offset;
+}
+
+/*
+ * Wraps the text into rows of width columns, starting from the given row,
+ * whose start is still right.
+ */
+void layout_editor_rows(Editor* editor, int first_row, int width) {
+    size_t length = get_editor_length(editor);
+    size_t offset = editor->row_starts[first_row];
+    int row = first_row;
+    int column = 0;
+
+    while (offset < length) {
+        int char_width;
+        int char_bytes = get_char_at(editor, offset, &char_width);
+
+        if (column + char_width > width && column > 0) {
+            row++;
+            column = 0;
+
+            if (row >= editor->rows_size) {
+                editor->rows_size *= 2;
+                editor->row_starts = realloc(editor->row_starts, sizeof(size_t) * editor->rows_size);
+            }
+            editor->row_starts[row] = offset;
+        }
+
+        column += char_width;
+        offset += char_bytes;
+    }
+
+    // A full last row leaves the cursor at the start of the next one
+    if (column >= width && length > 0) {
+        row++;
+        if (row >= editor->rows_size) {
+            editor->rows_size *= 2;
+            editor->row_starts = realloc(editor->row_starts, sizeof(size_t) * editor->rows_size);
+        }
+        editor->row_starts[row] = length;
+    }
+
+    editor->num_rows = row + 1;
+}
+
+/*
+ * Returns the row holding the byte at offset, by binary search.
+ */
+int find_editor_row(Editor* editor, size_t offset) {
+    int low = 0;
+    int high = editor->num_rows - 1;
+
+    while (low < high) {
+        int middle = (low + high + 1) / 2;
+        if (editor->row_starts[middle] <= offset) {
+            low = middle;
+        } else {
+            high = middle - 1;
+        }
+    }
+
+    return low;
+}
+
+void draw_editor_row(Editor* editor, WINDOW* win, int row) {
+    wmove(win, row - editor->top_row, 0);
+    wclrtoeol(win);
+    if (row >= editor->num_rows) return;
+
+    size_t start = editor->row_starts[row];
+    size_t end = row + 1 < editor->num_rows ? editor->row_starts[row + 1] : get_editor_length(editor);
+
+    // A row can run into the gap, so it's drawn in up to two pieces
+    if (start < editor->gap_start) {
+        size_t before_gap = end < editor->gap_start ? end : editor->gap_start;
+        waddnstr(win, editor->text + start, before_gap - start);
+        start = before_gap;
+    }
+    if (start < end) {
+        waddnstr(win, editor->text + start + get_gap_length(editor), end - start);
+    }
+}
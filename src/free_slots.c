@@ -0,0 +1,118 @@
+/*
+ * free_slots.c
+ *
+ * The overlay that lists the next gaps in every calendar from the day in
+ * the Daily Schedule, within work_hours. The search itself is in
+ * drivers/freeslots.c and is cheap enough to run again on every key, so
+ * changing the length shows the new gaps straight away.
+ */
+
+#include <ncurses.h>
+#include <stdlib.h>
+#include <time.h>
+#include "calenter.h"
+#include "drivers/freeslots.h"
+
+// Gaps listed at once, how far ahead they're looked for and how much the
+// length changes with + and -
+#define FREE_SLOT_ROWS 10
+#define FREE_SLOT_DAYS 90
+#define FREE_SLOT_DEFAULT_LENGTH 60
+#define FREE_SLOT_STEP 15
+
+void render_free_slots(WINDOW* overlay, struct slot_query* query, struct free_slot* slots, int num_slots, int selected);
+
+int free_slots_overlay(int date_key) {
+    time_t raw_time = time(NULL);
+    struct tm* info = localtime(&raw_time);
+    int today_key = DATE_KEY(info->tm_year + 1900, info->tm_mon + 1, info->tm_mday);
+
+    struct slot_query query;
+    query.start_key = date_key;
+    query.start_minute = date_key == today_key ? info->tm_hour * 60 + info->tm_min : 0;
+    query.num_days = FREE_SLOT_DAYS;
+    query.length = FREE_SLOT_DEFAULT_LENGTH;
+    get_work_hours(&query.window_start, &query.window_end);
+
+    int height = FREE_SLOT_ROWS + 7;
+    int width = 52;
+    if (width > COLS) width = COLS;
+    if (height > LINES) height = LINES;
+
+    WINDOW* overlay = newwin(height, width, (LINES - height) / 2, (COLS - width) / 2);
+    keypad(overlay, true);
+
+    struct free_slot slots[FREE_SLOT_ROWS];
+    int num_slots = find_free_slots(&query, slots, FREE_SLOT_ROWS);
+    int selected = 0;
+    render_free_slots(overlay, &query, slots, num_slots, selected);
+
+    int picked = 0;
+    int ch = wgetch(overlay);
+    while (ch != 10 && ch != 27 && ch != 'q') {
+        int length = query.length;
+
+        if (ch == '+' || ch == '=') length += FREE_SLOT_STEP;
+        if (ch == '-') length -= FREE_SLOT_STEP;
+        if (ch == 'j' || ch == KEY_DOWN) selected++;
+        if (ch == 'k' || ch == KEY_UP) selected--;
+
+        if (length >= FREE_SLOT_STEP && length <= query.window_end - query.window_start && length != query.length) {
+            query.length = length;
+            num_slots = find_free_slots(&query, slots, FREE_SLOT_ROWS);
+        }
+
+        if (selected >= num_slots) selected = num_slots - 1;
+        if (selected < 0) selected = 0;
+
+        render_free_slots(overlay, &query, slots, num_slots, selected);
+        ch = wgetch(overlay);
+    }
+
+    if (ch == 10 && num_slots > 0) picked = slots[selected].date_key;
+
+    werase(overlay);
+    wrefresh(overlay);
+    delwin(overlay);
+
+    return picked;
+}
+
+void render_free_slots(WINDOW* overlay, struct slot_query* query, struct free_slot* slots, int num_slots, int selected) {
+    werase(overlay);
+    box(overlay, 0, 0);
+
+    wattron(overlay, A_BOLD);
+    mvwprintw(overlay, 0, 1, " Free Slots ");
+    wattroff(overlay, A_BOLD);
+
+    mvwprintw(overlay, 2, 2, "%d min between %02d:%02d and %02d:%02d",
+        query->length,
+        query->window_start / 60, query->window_start % 60,
+        query->window_end / 60, query->window_end % 60);
+
+    if (num_slots < 0) {
+        mvwprintw(overlay, 4, 2, "The calendars couldn't be read");
+    } else if (num_slots == 0) {
+        mvwprintw(overlay, 4, 2, "Nothing free in the next %d days", query->num_days);
+    }
+
+    for (int i = 0; i < num_slots; i++) {
+        int year = slots[i].date_key / 10000;
+        int month = slots[i].date_key / 100 % 100;
+        int day = slots[i].date_key % 100;
+
+        char date[100];
+        format_pretty_date(date, year, month, day);
+
+        if (i == selected) wattron(overlay, A_REVERSE);
+        mvwprintw(overlay, 4 + i, 2, "%02d:%02d-%02d:%02d  %s",
+            slots[i].start / 60, slots[i].start % 60, slots[i].end / 60, slots[i].end % 60, date);
+        wattroff(overlay, A_REVERSE);
+    }
+
+    int height = getmaxy(overlay);
+    mvwprintw(overlay, height - 2, 2, "+/-  Length | j,k  Select | ENTER  Go to Day");
+
+    wrefresh(overlay);
+}
@@ -0,0 +1,258 @@
+/*
+ * latency.c
+ *
+ * Measures the time between wgetch returning a key in the main loop
+ * and the resulting frame being flushed to the terminal. Samples are
+ * kept in HDR-style (log-linear) histograms, one per UI action, so the
+ * percentiles stay accurate to a few percent from microseconds up to
+ * multi-second stalls without storing every sample.
+ *
+ * Nothing is recorded or written when trace is off in the config.
+ */
+
+#include <ncurses.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "calenter.h"
+#include "drivers/config.h"
+
+#define LATENCY_FILE "/.calendar/latency.txt"
+
+// Every power of two is split into LATENCY_SUB_BUCKETS linear buckets,
+// which bounds the relative error of a recorded value to 1/32.
+#define LATENCY_SUB_BITS 6
+#define LATENCY_SUB_BUCKETS (1 << LATENCY_SUB_BITS)
+#define LATENCY_HALF_BUCKETS (LATENCY_SUB_BUCKETS / 2)
+#define LATENCY_MAX_SHIFT 32
+#define LATENCY_NUM_BUCKETS ((LATENCY_MAX_SHIFT + 2) * LATENCY_HALF_BUCKETS)
+
+typedef struct _histogram {
+    uint64_t count;
+    uint64_t max;
+    uint32_t buckets[LATENCY_NUM_BUCKETS];
+} Histogram;
+
+static Histogram histograms[NUM_LATENCY_ACTIONS];
+
+static struct timespec pending_start;
+static enum latency_action pending_action;
+static bool pending = false;
+
+static int bucket_index(uint64_t value);
+static uint64_t bucket_upper_bound(int index);
+
+static const char* action_names[NUM_LATENCY_ACTIONS] = {
+    "schedule next day",
+    "schedule prev day",
+    "schedule select",
+    "schedule delete",
+    "undo/redo",
+    "open modal",
+    "calendar move",
+    "calendar go to day",
+    "switch window",
+    "sync",
+    "resize",
+    "other",
+};
+
+const char* get_latency_action_name(enum latency_action action) {
+    return action_names[action];
+}
+
+enum latency_action classify_key(int win_id, int key) {
+    if (key == '\t') return LATENCY_SWITCH_WINDOW;
+    if (key == 's') return LATENCY_SYNC;
+    if (key == KEY_RESIZE) return LATENCY_RESIZE;
+
+    if (win_id == SCHEDULE_WIN) {
+        switch (key) {
+            case 'l': return LATENCY_SCHEDULE_NEXT_DAY;
+            case 'h': return LATENCY_SCHEDULE_PREV_DAY;
+            case 'j':
+            case 'k': return LATENCY_SCHEDULE_SELECT;
+            case 'd':
+            case 'D': return LATENCY_SCHEDULE_DELETE;
+            case 'u':
+            case 'r': return LATENCY_UNDO_REDO;
+            case 10: return LATENCY_OPEN_MODAL;
+        }
+    } else if (win_id == CALENDAR_WIN) {
+        switch (key) {
+            case 'h':
+            case 'H':
+            case 'j':
+            case 'k':
+            case 'l':
+            case 'L': return LATENCY_CALENDAR_MOVE;
+            case 10: return LATENCY_CALENDAR_GOTO;
+        }
+    }
+
+    return LATENCY_OTHER;
+}
+
+void latency_begin(enum latency_action action) {
+    if (!get_config()->trace) return;
+
+    clock_gettime(CLOCK_MONOTONIC, &pending_start);
+    pending_action = action;
+    pending = true;
+}
+
+void latency_end() {
+    if (!pending) return;
+    pending = false;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    int64_t elapsed_us = (now.tv_sec - pending_start.tv_sec) * 1000000
+        + (now.tv_nsec - pending_start.tv_nsec) / 1000;
+    if (elapsed_us < 0) elapsed_us = 0;
+
+    Histogram* hist = &histograms[pending_action];
+    hist->buckets[bucket_index(elapsed_us)]++;
+    hist->count++;
+    if (elapsed_us > hist->max) hist->max = elapsed_us;
+}
+
+void latency_cancel() {
+    pending = false;
+}
+
+uint64_t latency_percentile(enum latency_action action, double percentile) {
+    Histogram* hist = &histograms[action];
+    if (hist->count == 0) return 0;
+
+    uint64_t target = (uint64_t)(percentile / 100.0 * hist->count + 0.5);
+    if (target == 0) target = 1;
+
+    uint64_t seen = 0;
+    for (int i = 0; i < LATENCY_NUM_BUCKETS; i++) {
+        seen += hist->buckets[i];
+        if (seen >= target) {
+            uint64_t upper = bucket_upper_bound(i);
+            return upper < hist->max ? upper : hist->max;
+        }
+    }
+
+    return hist->max;
+}
+
+uint64_t latency_max(enum latency_action action) {
+    return histograms[action].max;
+}
+
+uint64_t latency_count(enum latency_action action) {
+    return histograms[action].count;
+}
+
+void render_latency_overlay() {
+    int height = NUM_LATENCY_ACTIONS + 7;
+    int width = 66;
+    if (width > COLS) width = COLS;
+    if (height > LINES) height = LINES;
+
+    WINDOW* overlay = newwin(height, width, (LINES - height) / 2, (COLS - width) / 2);
+    keypad(overlay, true);
+    box(overlay, 0, 0);
+    wattron(overlay, A_BOLD);
+    mvwprintw(overlay, 0, 1, " Key to Frame Latency (us) ");
+    mvwprintw(overlay, 2, 2, "%-20s %8s %10s %10s %10s", "action", "n", "p50", "p99", "max");
+    wattroff(overlay, A_BOLD);
+
+    for (int i = 0; i < NUM_LATENCY_ACTIONS; i++) {
+        mvwprintw(overlay, 3 + i, 2, "%-20s %8lu %10lu %10lu %10lu",
+            action_names[i],
+            (unsigned long)latency_count(i),
+            (unsigned long)latency_percentile(i, 50),
+            (unsigned long)latency_percentile(i, 99),
+            (unsigned long)latency_max(i));
+    }
+
+    // Waiting for the lock while a sync writes shows up here
+    struct calendar_lock_stats locks;
+    get_calendar_lock_stats(&locks);
+    mvwprintw(overlay, 4 + NUM_LATENCY_ACTIONS, 2, "calendar lock: %ld taken, max wait %.2f ms, max held %.2f ms",
+        locks.locks, locks.max_wait_ms, locks.max_held_ms);
+
+    wrefresh(overlay);
+    wgetch(overlay);
+
+    werase(overlay);
+    wrefresh(overlay);
+    delwin(overlay);
+}
+
+int write_latency_histograms() {
+    if (!get_config()->trace) return 0;
+
+    char* home = getenv("HOME");
+    if (home == NULL) return -1;
+
+    char path[4096];
+    snprintf(path, sizeof(path), "%s%s", home, LATENCY_FILE);
+
+    FILE* out = fopen(path, "w");
+    if (out == NULL) return -1;
+
+    fprintf(out, "# action, count, p50_us, p90_us, p99_us, max_us\n");
+    for (int i = 0; i < NUM_LATENCY_ACTIONS; i++) {
+        fprintf(out, "%s, %lu, %lu, %lu, %lu, %lu\n",
+            action_names[i],
+            (unsigned long)latency_count(i),
+            (unsigned long)latency_percentile(i, 50),
+            (unsigned long)latency_percentile(i, 90),
+            (unsigned long)latency_percentile(i, 99),
+            (unsigned long)latency_max(i));
+    }
+
+    struct calendar_lock_stats locks;
+    get_calendar_lock_stats(&locks);
+    fprintf(out, "\n# calendar lock: count, total_wait_ms, max_wait_ms, total_held_ms, max_held_ms, merged_days\n");
+    fprintf(out, "calendar lock, %ld, %.3f, %.3f, %.3f, %.3f, %ld\n",
+        locks.locks, locks.wait_ms, locks.max_wait_ms, locks.held_ms, locks.max_held_ms, locks.merged_days);
+
+    fprintf(out, "\n# action, bucket_upper_bound_us, count\n");
+    for (int i = 0; i < NUM_LATENCY_ACTIONS; i++) {
+        for (int j = 0; j < LATENCY_NUM_BUCKETS; j++) {
+            if (histograms[i].buckets[j] == 0) continue;
+
+            fprintf(out, "%s, %lu, %u\n",
+                action_names[i],
+                (unsigned long)bucket_upper_bound(j),
+                histograms[i].buckets[j]);
+        }
+    }
+
+    fclose(out);
+    return 0;
+}
+
+/*
+ * Values below LATENCY_SUB_BUCKETS get a bucket each. Above that, the value
+ * is shifted right until it fits in the top half of the sub bucket range
+ * and the shift selects which group of LATENCY_HALF_BUCKETS it lands in.
+ */
+static int bucket_index(uint64_t value) {
+    if (value < LATENCY_SUB_BUCKETS) return value;
+
+    int msb = 63 - __builtin_clzll(value);
+    int shift = msb - (LATENCY_SUB_BITS - 1);
+    if (shift > LATENCY_MAX_SHIFT) return LATENCY_NUM_BUCKETS - 1;
+
+    return shift * LATENCY_HALF_BUCKETS + (int)(value >> shift);
+}
+
+static uint64_t bucket_upper_bound(int index) {
+    if (index < LATENCY_SUB_BUCKETS) return index;
+
+    int shift = index / LATENCY_HALF_BUCKETS - 1;
+    uint64_t sub = index - shift * LATENCY_HALF_BUCKETS;
+
+    return ((sub + 1) << shift) - 1;
+}
@@ -0,0 +1,220 @@
+/*
+ * loader.c
+ *
+ * Reads days from the calendars on a thread of their own, so the UI can
+ * draw before the disk has been touched and a key press never waits for
+ * it. The UI posts a request with request_day and polls the file
+ * descriptor returned by start_loader, which becomes readable once the
+ * day can be taken with take_loaded_day.
+ *
+ * There is only ever one request waiting: a new one replaces it, so a
+ * burst of key presses only reads the day they end on. A day that's
+ * already being read when it's replaced is dropped without reading its
+ * neighbours or being posted.
+ *
+ * The sources (and the config they read) aren't thread safe, so the UI
+ * must call wait_for_loader before it reads or writes a calendar or
+ * reloads the config itself.
+ */
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+#include "calenter.h"
+#include "drivers/skeleton.h"
+
+void* run_loader(void* data);
+void load_day(int date_key);
+bool is_superseded();
+void notify_ui();
+
+static pthread_t thread;
+static bool running = false;
+static bool stopping = false;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake = PTHREAD_COND_INITIALIZER; // a request was posted or stop_loader was called
+static pthread_cond_t idle = PTHREAD_COND_INITIALIZER; // a request was finished
+
+static bool has_request = false;
+static int request_key;
+static bool busy = false; // a request is being read
+
+static bool has_result = false;
+static struct loaded_day result;
+
+// Written to whenever a result is ready, read by the UI's poll
+static int notify_fds[2] = {-1, -1};
+
+int start_loader() {
+    if (pipe(notify_fds) != 0) return -1;
+    fcntl(notify_fds[0], F_SETFL, O_NONBLOCK);
+    fcntl(notify_fds[1], F_SETFL, O_NONBLOCK);
+
+    // Signals like SIGWINCH have to interrupt the UI's poll, so the
+    // thread starts with all of them blocked
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    running = pthread_create(&thread, NULL, run_loader, NULL) == 0;
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    return notify_fds[0];
+}
+
+void stop_loader() {
+    if (running) {
+        pthread_mutex_lock(&lock);
+        stopping = true;
+        pthread_cond_signal(&wake);
+        pthread_mutex_unlock(&lock);
+
+        pthread_join(thread, NULL);
+        running = false;
+    }
+
+    if (has_result) free_loaded_day(&result);
+    has_result = false;
+
+    for (int i = 0; i < 2; i++) {
+        if (notify_fds[i] >= 0) close(notify_fds[i]);
+        notify_fds[i] = -1;
+    }
+}
+
+void request_day(int year, int month, int day) {
+    // Without the thread the day is read straight away
+    if (!running) {
+        load_day(DATE_KEY(year, month, day));
+        return;
+    }
+
+    pthread_mutex_lock(&lock);
+    has_request = true;
+    request_key = DATE_KEY(year, month, day);
+    pthread_cond_signal(&wake);
+    pthread_mutex_unlock(&lock);
+}
+
+bool take_loaded_day(struct loaded_day* day) {
+    pthread_mutex_lock(&lock);
+
+    bool taken = has_result;
+    if (taken) {
+        *day = result;
+        has_result = false;
+    }
+
+    // Nothing else is waiting, so the notifications can all go
+    char buffer[16];
+    while (read(notify_fds[0], buffer, sizeof(buffer)) > 0);
+
+    pthread_mutex_unlock(&lock);
+
+    return taken;
+}
+
+void wait_for_loader() {
+    if (!running) return;
+
+    pthread_mutex_lock(&lock);
+    while (has_request || busy) pthread_cond_wait(&idle, &lock);
+    pthread_mutex_unlock(&lock);
+}
+
+void* run_loader(void* data) {
+    pthread_mutex_lock(&lock);
+
+    while (true) {
+        while (!has_request && !stopping) pthread_cond_wait(&wake, &lock);
+        if (stopping) break;
+
+        int date_key = request_key;
+        has_request = false;
+        busy = true;
+        pthread_mutex_unlock(&lock);
+
+        load_day(date_key);
+
+        pthread_mutex_lock(&lock);
+        busy = false;
+        pthread_cond_broadcast(&idle);
+    }
+
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+
+/*
+ * Reads a day with the days either side of it and posts them for the UI,
+ * replacing a day it hasn't taken. Nothing is posted if another day was
+ * asked for in the meantime, since the UI has moved on.
+ */
+void load_day(int date_key) {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    struct loaded_day day;
+    day.year = date_key / 10000;
+    day.month = date_key / 100 % 100;
+    day.day = date_key % 100;
+    day.events = get_events(day.year, day.month, day.day);
+
+    // The neighbours are only needed for conflicts and are usually in the
+    // day cache from the read above
+    if (is_superseded()) {
+        free_events(day.events);
+        return;
+    }
+
+    int previous_key = prev_date_key(date_key);
+    int next_key = next_date_key(date_key);
+    day.previous = get_events(previous_key / 10000, previous_key / 100 % 100, previous_key % 100);
+    day.next = get_events(next_key / 10000, next_key / 100 % 100, next_key % 100);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    day.read_ms = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+
+    pthread_mutex_lock(&lock);
+    if (has_request) {
+        pthread_mutex_unlock(&lock);
+        free_loaded_day(&day);
+        return;
+    }
+
+    if (has_result) free_loaded_day(&result);
+    result = day;
+    has_result = true;
+
+    notify_ui();
+    pthread_mutex_unlock(&lock);
+}
+
+/*
+ * Returns true if a newer request is waiting, which makes the one being
+ * read pointless.
+ */
+bool is_superseded() {
+    pthread_mutex_lock(&lock);
+    bool superseded = has_request;
+    pthread_mutex_unlock(&lock);
+
+    return superseded;
+}
+
+void free_loaded_day(struct loaded_day* day) {
+    free_events(day->events);
+    free_events(day->previous);
+    free_events(day->next);
+}
+
+void notify_ui() {
+    if (notify_fds[1] < 0) return;
+
+    // A full pipe already has a notification waiting
+    char byte = 1;
+    if (write(notify_fds[1], &byte, 1) < 0) return;
+}
@@ -5,78 +5,155 @@
 #include <stdlib.h>
 #include "calenter.h"
 #include "drivers/calendartxt.h"
+#include "drivers/sources.h"
 
+// The time fields come first so they can index times
 enum active_input {
     HOUR,
     MIN,
+    END_HOUR,
+    END_MIN,
     SUMMARY,
+    REPEAT,
+    SOURCE,
 };
 
+#define NUM_TIME_FIELDS 4
+
 typedef struct _input_fields {
     enum active_input active_input;
+    int num_inputs;
+    int source;
+    enum repeat_freq repeat;
     WINDOW* summary_win;
-    int hour_index;
-    int min_index;
-    int summary_index;
-    char hour[5];
-    char min[5];
-    char summary[2000];
+    int time_indexes[NUM_TIME_FIELDS];
+    char times[NUM_TIME_FIELDS][5]; // two digits or spaces each
+    Editor summary;
 } Inputs;
 
 
-void set_byte(Inputs* inputs, char ch);
+void set_byte(Inputs* inputs, int ch);
+void insert_pending_text(WINDOW* modal, Inputs* inputs, char first);
+bool is_text_key(int ch);
+bool edit_summary(Inputs* inputs, int ch);
+void cycle_source(Inputs* inputs, int direction);
+void cycle_repeat(Inputs* inputs, int direction);
 void delete_byte(Inputs* inputs);
 void render_input_fields(WINDOW* win, Inputs* inputs);
+WINDOW* open_modal(Inputs* inputs);
+void set_time_field(Inputs* inputs, enum active_input field, int value);
+int get_duration(Inputs* inputs);
 
-struct event add_event_modal(Window** windows, struct event* event) {
-    int height = 3 * LINES / 4;
-    int width = COLS / 2;
-
-    WINDOW* modal = newwin(height, width, (LINES - height) / 2, (COLS - width) / 2);
-    keypad(modal, true);
-    box(modal, 0, 0);
-    mvwprintw(modal, 0, 1, " Add Event ");
-
+struct event add_event_modal(Window** windows, struct event* event, enum repeat_freq* repeat) {
     Inputs inputs = {0};
     inputs.active_input = HOUR;
-    inputs.summary_win = derwin(modal, 10, width - 6, 7, 3);
+    inputs.repeat = REPEAT_NONE;
+
+    // Repeats and the calendar can only be picked for new events, and the
+    // calendar only when there is more than one
+    if (event != NULL) {
+        inputs.num_inputs = SUMMARY + 1;
+    } else {
+        inputs.num_inputs = get_num_sources() > 1 ? SOURCE + 1 : REPEAT + 1;
+    }
+    inputs.source = event == NULL ? get_default_source() : event->source;
 
     if (event != NULL) {
         assert(event->hour < 24);
         assert(event->min < 60);
-        assert(strlen(event->summary) < 2000);
 
-        char* hour_fmt_str = (event->hour < 10) ? "0%d" : "%d";
-        char* min_fmt_str = (event->min < 10) ? "0%d" : "%d";
+        for (int i = 0; i < NUM_TIME_FIELDS; i++) {
+            strcpy(inputs.times[i], "  ");
+        }
 
-        sprintf(inputs.hour, hour_fmt_str, event->hour);
-        sprintf(inputs.min, min_fmt_str, event->min);
-        sprintf(inputs.summary, "%s", event->summary);
+        set_time_field(&inputs, HOUR, event->hour);
+        set_time_field(&inputs, MIN, event->min);
+        if (event->duration > 0) {
+            int end = (event->hour * 60 + event->min + event->duration) % (24 * 60);
+            set_time_field(&inputs, END_HOUR, end / 60);
+            set_time_field(&inputs, END_MIN, end % 60);
+        }
 
-        inputs.hour_index = strlen(inputs.hour);
-        inputs.min_index = strlen(inputs.min);
-        inputs.summary_index = strlen(inputs.summary);
+        init_editor(&inputs.summary, event->summary);
     } else {
-        strcpy(inputs.hour, "  ");
-        strcpy(inputs.min, "  ");
+        for (int i = 0; i < NUM_TIME_FIELDS; i++) {
+            strcpy(inputs.times[i], "  ");
+        }
+        init_editor(&inputs.summary, NULL);
     }
 
+    WINDOW* modal = open_modal(&inputs);
     render_input_fields(modal, &inputs);
     wrefresh(modal);
 
+    // The first frame of the modal is what the user waits on when opening it.
+    latency_end();
+
     int ch = wgetch(modal);
     while (ch != 10 && ch != 27) {
         switch (ch) {
-            case KEY_BACKSPACE: {
+            case KEY_BACKSPACE:
+            case 127: {
                 delete_byte(&inputs);
                 render_input_fields(modal, &inputs);
                 break;
             }
             case '\t': {
-                inputs.active_input = (inputs.active_input + 1) % 3;
+                inputs.active_input = (inputs.active_input + 1) % inputs.num_inputs;
+                render_input_fields(modal, &inputs);
+                break;
+            }
+            case KEY_RESIZE: {
+                // The windows behind the modal are laid out again first so
+                // the modal ends up on top
+                wait_for_resize_to_settle(modal);
+                delwin(inputs.summary_win);
+                delwin(modal);
+
+                resize_windows(windows[SCHEDULE_WIN]);
+
+                modal = open_modal(&inputs);
+                invalidate_editor(&inputs.summary);
+                render_input_fields(modal, &inputs);
+                break;
+            }
+            case KEY_LEFT:
+            case KEY_RIGHT: {
+                if (inputs.active_input == SOURCE) {
+                    cycle_source(&inputs, ch == KEY_LEFT ? -1 : 1);
+                    render_input_fields(modal, &inputs);
+                } else if (inputs.active_input == REPEAT) {
+                    cycle_repeat(&inputs, ch == KEY_LEFT ? -1 : 1);
+                    render_input_fields(modal, &inputs);
+                } else if (inputs.active_input == SUMMARY) {
+                    edit_summary(&inputs, ch);
+                    render_input_fields(modal, &inputs);
+                }
                 break;
             }
             default: {
+                if (inputs.active_input == SUMMARY) {
+                    if (is_text_key(ch)) {
+                        insert_pending_text(modal, &inputs, ch);
+                        render_input_fields(modal, &inputs);
+                    } else if (edit_summary(&inputs, ch)) {
+                        render_input_fields(modal, &inputs);
+                    }
+                    break;
+                }
+
+                if (inputs.active_input == SOURCE || inputs.active_input == REPEAT) {
+                    if (ch == 'h' || ch == 'l' || ch == ' ') {
+                        if (inputs.active_input == SOURCE) {
+                            cycle_source(&inputs, ch == 'h' ? -1 : 1);
+                        } else {
+                            cycle_repeat(&inputs, ch == 'h' ? -1 : 1);
+                        }
+                        render_input_fields(modal, &inputs);
+                    }
+                    break;
+                }
+
                 set_byte(&inputs, ch);
                 render_input_fields(modal, &inputs);
             }
@@ -88,14 +165,20 @@ struct event add_event_modal(Window** windows, struct event* event) {
     struct event new_event = {0};
 
     if (ch == 10) {
-        new_event.hour = atoi(inputs.hour);
-        new_event.min = atoi(inputs.min);
-        new_event.summary = strdup(inputs.summary);
+        new_event.hour = atoi(inputs.times[HOUR]);
+        new_event.min = atoi(inputs.times[MIN]);
+        new_event.duration = get_duration(&inputs);
+        new_event.summary = get_editor_text(&inputs.summary);
+        new_event.source = inputs.source;
     }
+    *repeat = inputs.repeat;
 
     werase(modal);
     wrefresh(modal);
+    delwin(inputs.summary_win);
     delwin(modal);
+    free_editor(&inputs.summary);
+    curs_set(0);
 
     for (int i = 0; i < NUM_WINDOWS; i++) {
         if (i == SCHEDULE_WIN) {
@@ -109,61 +192,194 @@ struct event add_event_modal(Window** windows, struct event* event) {
     return new_event;
 }
 
-void set_byte(Inputs* inputs, char ch) {
-    if (inputs->active_input == HOUR) {
-        if (inputs->hour_index >= 2 || ch < 48 || ch > 57) return;
+/*
+ * Creates the modal's window, sized for the current terminal, along with
+ * the summary field inside it.
+ */
+WINDOW* open_modal(Inputs* inputs) {
+    int height = 3 * LINES / 4;
+    int width = COLS / 2;
+    if (height < 1) height = 1;
+    if (width < 7) width = 7;
 
-        inputs->hour[inputs->hour_index] = ch;
-        inputs->hour_index++;
+    WINDOW* modal = newwin(height, width, (LINES - height) / 2, (COLS - width) / 2);
+    keypad(modal, true);
+    box(modal, 0, 0);
+    mvwprintw(modal, 0, 1, " Add Event ");
 
-    } else if (inputs->active_input == MIN) {
-        if (inputs->min_index >= 2 || ch < 48 || ch > 57) return;
+    inputs->summary_win = derwin(modal, 10, width - 6, 7, 3);
+    wbkgd(inputs->summary_win, COLOR_PAIR(INPUT_FIELD_PAIR));
 
-        inputs->min[inputs->min_index] = ch;
-        inputs->min_index++;
-    } else {
-        if (inputs->summary_index >= 1999) return;
+    return modal;
+}
+
+void set_byte(Inputs* inputs, int ch) {
+    if (inputs->active_input >= NUM_TIME_FIELDS) return;
+
+    int* index = &inputs->time_indexes[inputs->active_input];
+    if (*index >= 2 || ch < 48 || ch > 57) return;
 
-        inputs->summary[inputs->summary_index] = ch;
-        inputs->summary_index++;
+    inputs->times[inputs->active_input][*index] = ch;
+    (*index)++;
+}
+
+void set_time_field(Inputs* inputs, enum active_input field, int value) {
+    snprintf(inputs->times[field], sizeof(inputs->times[field]), "%02d", value);
+    inputs->time_indexes[field] = 2;
+}
+
+/*
+ * Returns the minutes from the start to the end time, or 0 if the end
+ * time was left empty. An end before the start is on the next day.
+ */
+int get_duration(Inputs* inputs) {
+    if (inputs->time_indexes[END_HOUR] == 0 && inputs->time_indexes[END_MIN] == 0) return 0;
+
+    int start = atoi(inputs->times[HOUR]) * 60 + atoi(inputs->times[MIN]);
+    int end = atoi(inputs->times[END_HOUR]) * 60 + atoi(inputs->times[END_MIN]);
+
+    int duration = end - start;
+    if (duration < 0) duration += 24 * 60;
+
+    return duration <= MAX_EVENT_DURATION ? duration : 0;
+}
+
+/*
+ * Inserts a typed byte into the summary along with any text that's
+ * already waiting, so a paste is drawn once rather than a byte at a time.
+ * Line breaks and tabs in pasted text become spaces since a summary is a
+ * single line.
+ */
+void insert_pending_text(WINDOW* modal, Inputs* inputs, char first) {
+    char text[512];
+    size_t length = 0;
+    text[length++] = first;
+
+    wtimeout(modal, 0);
+
+    int ch;
+    while ((ch = wgetch(modal)) != ERR) {
+        if (ch == '\n' || ch == '\t') ch = ' ';
+        if (!is_text_key(ch)) {
+            ungetch(ch);
+            break;
+        }
+
+        text[length++] = ch;
+        if (length == sizeof(text)) {
+            editor_insert(&inputs->summary, text, length);
+            length = 0;
+        }
     }
+
+    wtimeout(modal, -1);
+    editor_insert(&inputs->summary, text, length);
+}
+
+/*
+ * Whether a key is a byte of text: printable ASCII or part of a UTF-8
+ * character.
+ */
+bool is_text_key(int ch) {
+    return ch >= ' ' && ch <= 0xFF && ch != 127;
+}
+
+/*
+ * Applies a cursor movement or delete key to the summary. Returns false
+ * for keys the summary doesn't use.
+ */
+bool edit_summary(Inputs* inputs, int ch) {
+    Editor* summary = &inputs->summary;
+    const char* name = keyname(ch);
+
+    if (ch == KEY_LEFT) {
+        editor_move(summary, CHAR_LEFT);
+    } else if (ch == KEY_RIGHT) {
+        editor_move(summary, CHAR_RIGHT);
+    } else if (ch == KEY_HOME || ch == ('a' & 0x1f)) {
+        editor_move(summary, TEXT_START);
+    } else if (ch == KEY_END || ch == ('e' & 0x1f)) {
+        editor_move(summary, TEXT_END);
+    } else if (ch == KEY_DC) {
+        editor_delete_after(summary);
+    } else if (name != NULL && strcmp(name, "kLFT5") == 0) {
+        // Ctrl+Left and Ctrl+Right, when the terminal reports them
+        editor_move(summary, WORD_LEFT);
+    } else if (name != NULL && strcmp(name, "kRIT5") == 0) {
+        editor_move(summary, WORD_RIGHT);
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+void cycle_source(Inputs* inputs, int direction) {
+    int num_sources = get_num_sources();
+    inputs->source = (inputs->source + direction + num_sources) % num_sources;
+}
+
+void cycle_repeat(Inputs* inputs, int direction) {
+    int num_options = REPEAT_MONTHLY + 1;
+    inputs->repeat = (inputs->repeat + direction + num_options) % num_options;
 }
 
 void delete_byte(Inputs* inputs) {
     switch (inputs->active_input) {
-        case HOUR: {
-            if (inputs->hour_index > 0) inputs->hour_index--;
-            inputs->hour[inputs->hour_index] = ' ';
-            break;
-        }
-        case MIN: {
-            if (inputs->min_index > 0) inputs->min_index--;
-            inputs->min[inputs->min_index] = ' ';
+        case HOUR:
+        case MIN:
+        case END_HOUR:
+        case END_MIN: {
+            int* index = &inputs->time_indexes[inputs->active_input];
+            if (*index > 0) (*index)--;
+            inputs->times[inputs->active_input][*index] = ' ';
             break;
         }
         case SUMMARY: {
-            if (inputs->summary_index > 0) inputs->summary_index--;
-            inputs->summary[inputs->summary_index] = ' ';
+            editor_delete_before(&inputs->summary);
             break;
         }
+        case REPEAT:
+        case SOURCE: break;
     };
 }
 
 void render_input_fields(WINDOW* win, Inputs* inputs) {
     mvwprintw(win, 2, 3, "Time (24 hour):");
-    wattron(win, COLOR_PAIR(INPUT_FIELD_PAIR));
-    mvwprintw(win, 3, 3, "%s", inputs->hour);
-    wattroff(win, COLOR_PAIR(INPUT_FIELD_PAIR));
 
+    // HH:MM - HH:MM
+    int columns[] = {3, 6, 11, 14};
+    for (int i = 0; i < NUM_TIME_FIELDS; i++) {
+        wattron(win, COLOR_PAIR(INPUT_FIELD_PAIR));
+        mvwprintw(win, 3, columns[i], "%s", inputs->times[i]);
+        wattroff(win, COLOR_PAIR(INPUT_FIELD_PAIR));
+    }
     mvwprintw(win, 3, 5, ":");
+    mvwprintw(win, 3, 8, " - ");
+    mvwprintw(win, 3, 13, ":");
 
-    wattron(win, COLOR_PAIR(INPUT_FIELD_PAIR));
-    mvwprintw(win, 3, 6, "%s", inputs->min);
-    wattroff(win, COLOR_PAIR(INPUT_FIELD_PAIR));
+    if (inputs->num_inputs > REPEAT) {
+        const char* repeat_name = inputs->repeat == REPEAT_NONE ? "never" : get_repeat_name(inputs->repeat);
 
-    mvwprintw(win, 6, 3, "Summary (2000 character limit):");
-    mvwprintw(inputs->summary_win, 0, 0, "%s", inputs->summary);
-    wbkgd(inputs->summary_win, COLOR_PAIR(INPUT_FIELD_PAIR));
+        mvwprintw(win, 2, 22, "Repeat (h/l):");
+        wattron(win, COLOR_PAIR(INPUT_FIELD_PAIR));
+        mvwprintw(win, 3, 22, " %-8s ", repeat_name);
+        wattroff(win, COLOR_PAIR(INPUT_FIELD_PAIR));
+    }
+
+    if (inputs->num_inputs > SOURCE) {
+        mvwprintw(win, 2, 38, "Calendar (h/l):");
+        wattron(win, COLOR_PAIR(INPUT_FIELD_PAIR));
+        mvwprintw(win, 3, 38, " %-20.20s ", get_source_name(inputs->source));
+        wattroff(win, COLOR_PAIR(INPUT_FIELD_PAIR));
+    }
+
+    mvwprintw(win, 6, 3, "Summary:");
+
+    // The summary's own cursor is shown while it's being edited
+    bool editing = inputs->active_input == SUMMARY;
+    render_editor(&inputs->summary, inputs->summary_win, editing);
+    curs_set(editing ? 1 : 0);
 
     wrefresh(win);
     wrefresh(inputs->summary_win);
@@ -1,6 +1,9 @@
+#define _XOPEN_SOURCE 700
+
 #include <stdio.h>
 #include <time.h>
 #include <string.h>
+#include <wchar.h>
 #include "calenter.h"
 
 // TODO: Handle leap years.
@@ -75,3 +78,22 @@ struct tm get_day_info(int year, int month, int day) {
 
     return my_time;
 }
+
+int measure_char(const char* bytes, size_t length, wchar_t* c, int* width) {
+    mbstate_t state;
+    memset(&state, 0, sizeof(mbstate_t));
+    size_t char_bytes = mbrtowc(c, bytes, length, &state);
+
+    if (char_bytes == (size_t)-1 || char_bytes == (size_t)-2 || char_bytes == 0) {
+        // Bytes that aren't valid in the locale are shown one by one
+        *c = (unsigned char)bytes[0];
+        *width = 1;
+        return 1;
+    }
+
+    // Control characters are drawn as ^X
+    *width = wcwidth(*c);
+    if (*width < 0) *width = 2;
+
+    return char_bytes;
+}
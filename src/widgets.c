@@ -1,9 +1,32 @@
+#define _XOPEN_SOURCE 700
+
 #include <stdlib.h>
 #include <assert.h>
 #include <time.h>
 #include <string.h>
+#include <limits.h>
+#include <wchar.h>
 #include "calenter.h"
-
+#include "drivers/conflicts.h"
+#include "drivers/skeleton.h"
+
+/*
+ * The start of a string measured by measure_text.
+ */
+struct text_span {
+    int bytes;
+    int width; // in columns
+    int break_bytes; // offset of the last space, 0 if there isn't one
+    int break_width;
+};
+
+int get_visible_items(Window* win);
+void scroll_to_selection(Window* win, Schedule* schedule);
+void render_schedule_item(Window* win, Schedule* schedule, int index);
+void render_scroll_indicator(Window* win, Schedule* schedule);
+void layout_event(struct event* event, int width, struct event_layout* layout);
+void measure_text(const char* text, int max_width, struct text_span* span);
+void mark_conflicts(Schedule* schedule);
 
 void add_widget(Window* window, Widget widget) {
     if (window->widgets == NULL) {
@@ -42,13 +65,115 @@ void init_schedule(Widget* schedule) {
     sched.month = info->tm_mon + 1;
     sched.year = info->tm_year + 1900;
     sched.selected_event = 0;
+    sched.scroll_offset = 0;
 
-    sched.events = get_events(info->tm_year + 1900, info->tm_mon + 1, info->tm_mday);
+    // The events are read by the loader so the first frame doesn't wait
+    // for the disk
+    init_events(&sched.events);
+    init_events(&sched.previous_day);
+    init_events(&sched.next_day);
+    sched.layouts = malloc(sizeof(struct event_layout));
+    sched.time_width = 0;
+    sched.loading = true;
 
     schedule->tag = SCHEDULE;
     schedule->widget.schedule = sched;
 }
 
+void load_schedule_events(Schedule* schedule) {
+    int key = DATE_KEY(schedule->year, schedule->month, schedule->day);
+    int previous_key = prev_date_key(key);
+    int next_key = next_date_key(key);
+
+    free_events(schedule->events);
+    free_events(schedule->previous_day);
+    free_events(schedule->next_day);
+    schedule->events = get_events(schedule->year, schedule->month, schedule->day);
+    schedule->previous_day = get_events(previous_key / 10000, previous_key / 100 % 100, previous_key % 100);
+    schedule->next_day = get_events(next_key / 10000, next_key / 100 % 100, next_key % 100);
+    schedule->loading = false;
+    reset_schedule_layouts(schedule);
+}
+
+void start_schedule_load(Schedule* schedule) {
+    free_events(schedule->events);
+    free_events(schedule->previous_day);
+    free_events(schedule->next_day);
+    init_events(&schedule->events);
+    init_events(&schedule->previous_day);
+    init_events(&schedule->next_day);
+
+    schedule->loading = true;
+    schedule->selected_event = 0;
+    schedule->scroll_offset = 0;
+    request_day(schedule->year, schedule->month, schedule->day);
+}
+
+void finish_schedule_load(Schedule* schedule, struct loaded_day* day) {
+    free_events(schedule->events);
+    free_events(schedule->previous_day);
+    free_events(schedule->next_day);
+    schedule->events = day->events;
+    schedule->previous_day = day->previous;
+    schedule->next_day = day->next;
+
+    schedule->loading = false;
+    reset_schedule_layouts(schedule);
+}
+
+void reset_schedule_layouts(Schedule* schedule) {
+    // Events are laid out the first time they're drawn, once the width
+    // is known
+    free(schedule->layouts);
+    schedule->layouts = malloc(sizeof(struct event_layout) * (schedule->events.length + 1));
+    schedule->time_width = 0;
+
+    for (size_t i = 0; i < schedule->events.length; i++) {
+        schedule->layouts[i].width = -1;
+        schedule->layouts[i].conflicting = false;
+
+        char time_str[12];
+        format_time_range(time_str, schedule->events.events[i]);
+        if ((int)strlen(time_str) > schedule->time_width) schedule->time_width = strlen(time_str);
+    }
+
+    mark_conflicts(schedule);
+}
+
+/*
+ * Flags the events that overlap another. Events can run into the day from
+ * the one before, or out of it into the next one, so those are searched
+ * too.
+ */
+void mark_conflicts(Schedule* schedule) {
+    struct events previous = schedule->previous_day;
+    struct events next = schedule->next_day;
+
+    // The events are only looked at, so the list shares their summaries
+    struct events all;
+    all.length = previous.length + schedule->events.length + next.length;
+    all.size = all.length;
+    all.events = malloc((all.length + 1) * sizeof(struct event));
+    memcpy(all.events, previous.events, previous.length * sizeof(struct event));
+    memcpy(all.events + previous.length, schedule->events.events, schedule->events.length * sizeof(struct event));
+    memcpy(all.events + previous.length + schedule->events.length, next.events, next.length * sizeof(struct event));
+
+    struct conflict* conflicts;
+    size_t num_conflicts = find_conflicts(&all, &conflicts);
+
+    for (size_t i = 0; i < num_conflicts; i++) {
+        size_t events[] = {conflicts[i].first, conflicts[i].second};
+
+        for (int j = 0; j < 2; j++) {
+            size_t index = events[j] - previous.length;
+            if (events[j] >= previous.length && index < schedule->events.length) schedule->layouts[index].conflicting = true;
+        }
+    }
+
+    free(conflicts);
+    free(all.events);
+}
+
 void init_calendar(Widget* calendar) {
     time_t raw_time = time(NULL);
     struct tm* info = localtime(&raw_time);
@@ -67,37 +192,268 @@ void render_schedule(Window* win, bool active) {
     werase(win->win);
 
     int sched_index = get_widget_index(win, SCHEDULE);
-    Schedule schedule = win->widgets[sched_index].widget.schedule;
+    Schedule* schedule = &win->widgets[sched_index].widget.schedule;
 
     char header[100] = "\0";
-    format_pretty_date(header, schedule.year, schedule.month, schedule.day);
+    format_pretty_date(header, schedule->year, schedule->month, schedule->day);
     int header_length = strlen(header);
 
     mvwprintw(win->win, 1, (win->width - header_length) / 2, "%s", header);
 
-    for (int i = 0; i < schedule.events.length; i++) {
-        struct event event = schedule.events.events[i];
-        char time_str[10];
-        format_time(time_str, event.hour, event.min);
+    if (schedule->loading) {
+        mvwprintw(win->win, SCHEDULE_FIRST_ROW, 3, "Loading...");
+        refresh_win(win, active);
+        return;
+    }
 
-        if (i == schedule.selected_event) {
-            wattron(win->win, A_REVERSE);
-            mvwprintw(win->win, 3 + i * 2, 3, "%s - %s", time_str, event.summary);
-            wattroff(win->win, A_REVERSE);
-        } else {
-            mvwprintw(win->win, 3 + i * 2, 3, "%s - %s", time_str, event.summary);
+    scroll_to_selection(win, schedule);
+
+    // Only the items on screen are drawn, so a render costs the same
+    // however many events the day has
+    int last = schedule->scroll_offset + get_visible_items(win);
+    if (last > (int)schedule->events.length + 1) last = schedule->events.length + 1;
+
+    for (int i = schedule->scroll_offset; i < last; i++) {
+        render_schedule_item(win, schedule, i);
+    }
+    render_scroll_indicator(win, schedule);
+
+    refresh_win(win, active);
+}
+
+void move_schedule_selection(Window* win, int delta, bool active) {
+    int sched_index = get_widget_index(win, SCHEDULE);
+    Schedule* schedule = &win->widgets[sched_index].widget.schedule;
+
+    int selected = schedule->selected_event + delta;
+    if (selected < 0 || selected > (int)schedule->events.length) return;
+
+    int old_selected = schedule->selected_event;
+    int old_offset = schedule->scroll_offset;
+    schedule->selected_event = selected;
+    scroll_to_selection(win, schedule);
+
+    int shift = schedule->scroll_offset - old_offset;
+    int visible = get_visible_items(win);
+
+    if (shift != 0 && abs(shift) < visible) {
+        // Let the terminal move the rows that are still on screen and
+        // only draw the items that scrolled in
+        int top = SCHEDULE_FIRST_ROW;
+        int bottom = SCHEDULE_FIRST_ROW + visible * SCHEDULE_ITEM_ROWS - 1;
+        if (bottom > win->height - 2) bottom = win->height - 2;
+
+        idlok(win->win, true);
+        scrollok(win->win, true);
+        wsetscrreg(win->win, top, bottom);
+        wscrl(win->win, shift * SCHEDULE_ITEM_ROWS);
+        wsetscrreg(win->win, 0, win->height - 1);
+        scrollok(win->win, false);
+
+        int first_new = shift > 0 ? schedule->scroll_offset + visible - shift : schedule->scroll_offset;
+        for (int i = first_new; i < first_new + abs(shift); i++) {
+            render_schedule_item(win, schedule, i);
         }
+    } else if (shift != 0) {
+        render_schedule(win, active);
+        return;
+    }
+
+    render_schedule_item(win, schedule, old_selected);
+    render_schedule_item(win, schedule, selected);
+    render_scroll_indicator(win, schedule);
+
+    refresh_win(win, active);
+}
+
+/*
+ * Returns how many items fit in the window. Each takes a slot of
+ * SCHEDULE_ITEM_ROWS rows, which a long summary wraps onto (see
+ * layout_event).
+ */
+int get_visible_items(Window* win) {
+    int rows = win->height - 1 - SCHEDULE_FIRST_ROW;
+    return rows < SCHEDULE_ITEM_ROWS ? 1 : rows / SCHEDULE_ITEM_ROWS;
+}
+
+/*
+ * Moves the scroll offset as little as possible to bring the selection on
+ * screen, and back up if the day has fewer items than before.
+ */
+void scroll_to_selection(Window* win, Schedule* schedule) {
+    int visible = get_visible_items(win);
+    int num_items = schedule->events.length + 1;
+
+    if (schedule->selected_event < schedule->scroll_offset) {
+        schedule->scroll_offset = schedule->selected_event;
+    } else if (schedule->selected_event >= schedule->scroll_offset + visible) {
+        schedule->scroll_offset = schedule->selected_event - visible + 1;
+    }
+
+    if (schedule->scroll_offset > num_items - visible) schedule->scroll_offset = num_items - visible;
+    if (schedule->scroll_offset < 0) schedule->scroll_offset = 0;
+}
+
+/*
+ * Draws one item on its rows, if it's on screen. The rows are cleared
+ * first, including the border, which refresh_win draws again.
+ */
+void render_schedule_item(Window* win, Schedule* schedule, int index) {
+    int slot = index - schedule->scroll_offset;
+    if (slot < 0 || slot >= get_visible_items(win) || index > (int)schedule->events.length) return;
+
+    int row = SCHEDULE_FIRST_ROW + slot * SCHEDULE_ITEM_ROWS;
+    for (int i = 0; i < SCHEDULE_ITEM_ROWS; i++) {
+        wmove(win->win, row + i, 0);
+        wclrtoeol(win->win);
     }
 
-    if (schedule.events.length == schedule.selected_event) {
-        wattron(win->win, A_REVERSE);
-        mvwprintw(win->win, 3 + schedule.events.length * 2, 3, "Add event");
+    if (index == schedule->selected_event) wattron(win->win, A_REVERSE);
+
+    if (index == (int)schedule->events.length) {
+        mvwprintw(win->win, row, 3, "Add event");
         wattroff(win->win, A_REVERSE);
-    } else {
-        mvwprintw(win->win, 3 + schedule.events.length * 2, 3, "Add event");
+        return;
     }
 
-    refresh_win(win, active);
+    struct event* event = &schedule->events.events[index];
+    char time_str[12];
+    format_time_range(time_str, *event);
+
+    // Summaries are lined up after the longest time on every row
+    int indent = schedule->time_width + 3;
+    int width = win->width - 6 - indent;
+    if (width < 0) width = 0;
+
+    struct event_layout* layout = &schedule->layouts[index];
+    if (layout->width != width) layout_event(event, width, layout);
+
+    // The times of overlapping events are picked out
+    if (layout->conflicting) wattron(win->win, COLOR_PAIR(CONFLICT_COLOR_PAIR) | A_BOLD);
+    mvwprintw(win->win, row, 3, "%-*s", schedule->time_width, time_str);
+    if (layout->conflicting) wattroff(win->win, COLOR_PAIR(CONFLICT_COLOR_PAIR) | A_BOLD);
+    wprintw(win->win, " - ");
+    for (int i = 0; i < layout->num_rows; i++) {
+        wmove(win->win, row + i, 3 + indent);
+        waddnstr(win->win, event->summary + layout->row_start[i], layout->row_end[i] - layout->row_start[i]);
+    }
+    if (layout->truncated) waddstr(win->win, MB_CUR_MAX > 1 ? "\u2026" : "~");
+    wattroff(win->win, A_REVERSE);
+
+    if (layout->show_source) {
+        wattron(win->win, COLOR_PAIR(CONTROLS_COLOR_PAIR));
+        wprintw(win->win, " [%s]", get_source_name(event->source));
+        wattroff(win->win, COLOR_PAIR(CONTROLS_COLOR_PAIR));
+    }
+}
+
+/*
+ * Cuts an event's summary into rows of at most width columns, breaking
+ * at spaces where it can. The calendar's name, when there are several,
+ * goes at the end of the last row, and whatever doesn't fit in the
+ * item is replaced with an ellipsis.
+ */
+void layout_event(struct event* event, int width, struct event_layout* layout) {
+    const char* summary = event->summary;
+    int length = strlen(summary);
+    struct text_span span;
+
+    measure_text(summary, INT_MAX, &span);
+    layout->width = width;
+    layout->display_width = span.width;
+    layout->num_rows = 0;
+    layout->truncated = false;
+
+    int source_width = 0;
+    layout->show_source = false;
+    if (get_num_sources() > 1) {
+        measure_text(get_source_name(event->source), INT_MAX, &span);
+        source_width = span.width + 3;
+        layout->show_source = source_width <= width / 2;
+        if (!layout->show_source) source_width = 0;
+    }
+
+    int start = 0;
+    int rest_width = layout->display_width;
+
+    for (int i = 0; i < SCHEDULE_ITEM_ROWS; i++) {
+        layout->row_start[i] = start;
+        layout->num_rows++;
+
+        if (rest_width + source_width <= width) {
+            layout->row_end[i] = length;
+            return;
+        }
+
+        if (i == SCHEDULE_ITEM_ROWS - 1) {
+            int room = width - source_width - 1;
+            measure_text(summary + start, room < 0 ? 0 : room, &span);
+            layout->row_end[i] = start + span.bytes;
+            layout->truncated = width > 0;
+            return;
+        }
+
+        // Words longer than a whole row are cut where the row ends
+        measure_text(summary + start, width, &span);
+        if (span.break_bytes > 0) {
+            span.bytes = span.break_bytes;
+            span.width = span.break_width;
+        }
+        layout->row_end[i] = start + span.bytes;
+
+        start += span.bytes;
+        rest_width -= span.width;
+        while (summary[start] == ' ') {
+            start++;
+            rest_width--;
+        }
+    }
+}
+
+/*
+ * Measures the longest start of text that fits in max_width columns, and
+ * where it could last be broken at a space.
+ */
+void measure_text(const char* text, int max_width, struct text_span* span) {
+    memset(span, 0, sizeof(struct text_span));
+
+    while (text[span->bytes] != '\0') {
+        wchar_t c;
+        int char_width;
+        int char_bytes = measure_char(text + span->bytes, MB_CUR_MAX, &c, &char_width);
+
+        if (span->width + char_width > max_width) break;
+
+        if (c == L' ' && span->bytes > 0) {
+            span->break_bytes = span->bytes;
+            span->break_width = span->width;
+        }
+
+        span->bytes += char_bytes;
+        span->width += char_width;
+    }
+}
+
+/*
+ * Shows which items are on screen when they don't all fit.
+ */
+void render_scroll_indicator(Window* win, Schedule* schedule) {
+    int num_items = schedule->events.length + 1;
+    int visible = get_visible_items(win);
+
+    wmove(win->win, SCHEDULE_FIRST_ROW - 1, 0);
+    wclrtoeol(win->win);
+    if (num_items <= visible) return;
+
+    int last = schedule->scroll_offset + visible;
+    if (last > num_items) last = num_items;
+
+    char indicator[64];
+    int length = snprintf(indicator, sizeof(indicator), "%d-%d of %d", schedule->scroll_offset + 1, last, num_items);
+
+    wattron(win->win, COLOR_PAIR(CONTROLS_COLOR_PAIR));
+    mvwprintw(win->win, SCHEDULE_FIRST_ROW - 1, win->width - length - 3, "%s", indicator);
+    wattroff(win->win, COLOR_PAIR(CONTROLS_COLOR_PAIR));
 }
 
 void render_calendar(Window* win, bool active) {
@@ -2,10 +2,15 @@
 #include <stdlib.h>
 #include <string.h>
 #include "calenter.h"
+#include "drivers/config.h"
 
 extern Window* windows[NUM_WINDOWS];
 
+// Set between begin_frame and end_frame
+static bool batching = false;
+
 void refresh_controls(int win_id);
+void flush_win(WINDOW* win);
 
 Window* create_win(int id, char* title, int height, int width, int startx, int starty) {
     Window* window = malloc(sizeof(Window));
@@ -14,6 +19,7 @@ Window* create_win(int id, char* title, int height, int width, int startx, int s
     window->title = title == NULL ? NULL : strdup(title);
     window->width = width;
     window->height = height;
+    window->num_widgets = 0;
     window->widgets = NULL;
     window->win = newwin(height, width, starty, startx);
 
@@ -25,6 +31,15 @@ Window* create_win(int id, char* title, int height, int width, int startx, int s
 }
 
 void free_win(Window* window) {
+    for (int i = 0; i < window->num_widgets; i++) {
+        if (window->widgets[i].tag != SCHEDULE) continue;
+
+        free_events(window->widgets[i].widget.schedule.events);
+        free_events(window->widgets[i].widget.schedule.previous_day);
+        free_events(window->widgets[i].widget.schedule.next_day);
+        free(window->widgets[i].widget.schedule.layouts);
+    }
+
     delwin(window->win);
     free(window->title);
     free(window->widgets);
@@ -35,7 +50,7 @@ void free_win(Window* window) {
 
 void refresh_win(Window* window, bool active) {
     if (window->title == NULL) {
-        wrefresh(window->win);
+        flush_win(window->win);
         return;
     }
 
@@ -50,7 +65,85 @@ void refresh_win(Window* window, bool active) {
         mvwprintw(window->win, 0, 1, " %s ", window->title);
     }
     wattroff(window->win, A_BOLD);
-    wrefresh(window->win);
+    flush_win(window->win);
+}
+
+void begin_frame() {
+    batching = true;
+}
+
+void end_frame() {
+    batching = false;
+    doupdate();
+}
+
+/*
+ * Puts the window on the terminal, or only stages it during a frame.
+ */
+void flush_win(WINDOW* win) {
+    if (batching) {
+        wnoutrefresh(win);
+    } else {
+        wrefresh(win);
+    }
+}
+
+void get_window_geometry(int id, int* height, int* width, int* startx, int* starty) {
+    switch (id) {
+        case SCHEDULE_WIN:
+            *height = LINES - 4;
+            *width = 2 * COLS / 3 - 1;
+            *startx = 1;
+            *starty = 0;
+            break;
+        case CALENDAR_WIN:
+            *height = LINES - 4;
+            *width = COLS / 3;
+            *startx = 2 * COLS / 3;
+            *starty = 0;
+            break;
+        default:
+            *height = 4;
+            *width = COLS;
+            *startx = 0;
+            *starty = LINES - 4;
+    }
+
+    // newwin fails on an empty window, which a tiny terminal would give
+    if (*height < 1) *height = 1;
+    if (*width < 1) *width = 1;
+    if (*starty < 0) *starty = 0;
+}
+
+void wait_for_resize_to_settle(WINDOW* win) {
+    wtimeout(win, RESIZE_SETTLE_MS);
+
+    int ch;
+    while ((ch = wgetch(win)) == KEY_RESIZE);
+    if (ch != ERR) ungetch(ch);
+
+    wtimeout(win, -1);
+}
+
+void resize_windows(Window* active_win) {
+    // Anything left outside the new windows would stay on screen otherwise
+    clear();
+    refresh();
+
+    for (int i = 0; i < NUM_WINDOWS; i++) {
+        int height, width, startx, starty;
+        get_window_geometry(i, &height, &width, &startx, &starty);
+
+        delwin(windows[i]->win);
+        windows[i]->win = newwin(height, width, starty, startx);
+        windows[i]->height = height;
+        windows[i]->width = width;
+        keypad(windows[i]->win, true);
+    }
+
+    render_schedule(windows[SCHEDULE_WIN], active_win == windows[SCHEDULE_WIN]);
+    render_calendar(windows[CALENDAR_WIN], active_win == windows[CALENDAR_WIN]);
+    refresh_controls(active_win->id);
 }
 
 void set_active_window(Window** active_win, Window* window) {
@@ -67,26 +160,44 @@ void set_active_window(Window** active_win, Window* window) {
 }
 
 void refresh_controls(int win_id) {
-    char common_ctrls[256] = "hH,j,k,lL  Nav | q  Quit | s  Sync";
+    char common_ctrls[256] = "hH,j,k,lL Nav | q Quit | s Sync";
 
     char controls_str[4096] = "\0";
     strcpy(controls_str, common_ctrls);
 
     switch (win_id) {
         case SCHEDULE_WIN:
-            strcpy(controls_str + strlen(common_ctrls), " | d  Delete | ENTER  Add/Edit");
+            strcpy(controls_str + strlen(common_ctrls), " | d,D Del | u,r Undo/Redo | f Free | ENTER Edit");
             break;
 
         case CALENDAR_WIN:
-            strcpy(controls_str + strlen(common_ctrls), " | ENTER  Go to Day");
+            strcpy(controls_str + strlen(common_ctrls), " | ENTER Go to Day");
             break;
     }
 
-    int x = (windows[CONTROLS_WIN]->width - strlen(controls_str)) / 2;
+    // Fits an 80 column terminal, and is cut short on a narrower one
+    int width = windows[CONTROLS_WIN]->width;
+    int length = strlen(controls_str);
+    int x = length < width ? (width - length) / 2 : 0;
 
     werase(windows[CONTROLS_WIN]->win);
     wattron(windows[CONTROLS_WIN]->win, COLOR_PAIR(CONTROLS_COLOR_PAIR));
-    mvwprintw(windows[CONTROLS_WIN]->win, 1, x, "%s", controls_str);
+    mvwprintw(windows[CONTROLS_WIN]->win, 1, x, "%.*s", width, controls_str);
     wattroff(windows[CONTROLS_WIN]->win, COLOR_PAIR(CONTROLS_COLOR_PAIR));
+
+    // Problems in the config are shown under the controls until fixed
+    const Config* config = get_config();
+    if (config->num_warnings > 0) {
+        char warning[4096];
+        if (config->num_warnings == 1) {
+            snprintf(warning, sizeof(warning), "%s", config->warnings[0]);
+        } else {
+            snprintf(warning, sizeof(warning), "%s (+%d more)", config->warnings[0], config->num_warnings - 1);
+        }
+
+        length = strlen(warning);
+        mvwprintw(windows[CONTROLS_WIN]->win, 2, length < width ? (width - length) / 2 : 0, "%.*s", width, warning);
+    }
+
     refresh_win(windows[CONTROLS_WIN], false);
 }